@@ -52,19 +52,6 @@
 
 int pmemfile_flock(PMEMfilepool *, PMEMfile *file, int operation);
 
-void *pmemfile_mmap(PMEMfilepool *, void *addr, size_t len,
-		int prot, int flags, PMEMfile *file, pmemfile_off_t off);
-int pmemfile_munmap(PMEMfilepool *, void *addr, size_t len);
-void *pmemfile_mremap(PMEMfilepool *, void *old_addr, size_t old_size,
-			size_t new_size, int flags, void *new_addr);
-int pmemfile_msync(PMEMfilepool *, void *addr, size_t len, int flags);
-int pmemfile_mprotect(PMEMfilepool *, void *addr, size_t len, int prot);
-
-pmemfile_ssize_t pmemfile_copy_file_range(PMEMfilepool *,
-		PMEMfile *file_in, pmemfile_off_t *off_in,
-		PMEMfile *file_out, pmemfile_off_t *off_out,
-		size_t len, unsigned flags);
-
 int pmemfile_mknodat(PMEMfilepool *, PMEMfile *dir, const char *path,
 		pmemfile_mode_t mode, pmemfile_dev_t dev);
 
@@ -40,6 +40,7 @@
 #ifndef LIBPMEMFILE_POSIX_H
 #define LIBPMEMFILE_POSIX_H 1
 
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -172,6 +173,22 @@
 
 #define PMEMFILE_MAP_FAILED	((void *) -1)
 
+#define PMEMFILE_PROT_NONE	0x0
+#define PMEMFILE_PROT_READ	0x1
+#define PMEMFILE_PROT_WRITE	0x2
+#define PMEMFILE_PROT_EXEC	0x4
+
+#define PMEMFILE_MAP_SHARED	0x01
+#define PMEMFILE_MAP_PRIVATE	0x02
+#define PMEMFILE_MAP_FIXED	0x10
+
+#define PMEMFILE_MS_ASYNC	1
+#define PMEMFILE_MS_INVALIDATE	2
+#define PMEMFILE_MS_SYNC	4
+
+#define PMEMFILE_MREMAP_MAYMOVE	1
+#define PMEMFILE_MREMAP_FIXED	2
+
 #define PMEMFILE_ST_RDONLY	1
 #define PMEMFILE_ST_NOSUID	2
 #define PMEMFILE_ST_NODEV	4
@@ -194,6 +211,7 @@ extern "C" {
  */
 typedef struct pmemfilepool PMEMfilepool;
 typedef struct pmemfile_file PMEMfile;
+typedef struct pmemfile_lease PMEMfilelease;
 
 typedef mode_t pmemfile_mode_t;
 typedef uid_t pmemfile_uid_t;
@@ -225,6 +243,17 @@ unsigned pmemfile_pool_root_count(PMEMfilepool *);
 PMEMfilepool *pmemfile_pool_create(const char *pathname, size_t poolsize,
 		pmemfile_mode_t mode);
 
+#define PMEMFILE_INODE_SIZE_DEFAULT 4096
+#define PMEMFILE_INODE_SIZE_COMPACT 512
+
+/*
+ * Not in POSIX:
+ * Same as pmemfile_pool_create, but inodes of all files except directories
+ * take inode_size bytes - one of PMEMFILE_INODE_SIZE_* values.
+ */
+PMEMfilepool *pmemfile_pool_create_ex(const char *pathname, size_t poolsize,
+		pmemfile_mode_t mode, size_t inode_size);
+
 PMEMfilepool *pmemfile_pool_open(const char *pathname);
 void pmemfile_pool_close(PMEMfilepool *pfp);
 void pmemfile_pool_set_device(PMEMfilepool *pfp, pmemfile_dev_t dev);
@@ -237,6 +266,10 @@ PMEMfile *pmemfile_open_root(PMEMfilepool *pfp, unsigned index, int flags);
 
 PMEMfile *pmemfile_create(PMEMfilepool *pfp, const char *pathname,
 		pmemfile_mode_t mode);
+/* Not in POSIX. */
+int pmemfile_create_batch(PMEMfilepool *pfp, PMEMfile *dir,
+		const char *const names[], const pmemfile_mode_t modes[],
+		PMEMfile *out[], size_t count);
 /* XXX Should we get rid of PMEMfilepool pointer? */
 void pmemfile_close(PMEMfilepool *pfp, PMEMfile *file);
 
@@ -247,6 +280,9 @@ int pmemfile_linkat(PMEMfilepool *pfp, PMEMfile *olddir, const char *oldpath,
 int pmemfile_unlink(PMEMfilepool *pfp, const char *pathname);
 int pmemfile_unlinkat(PMEMfilepool *pfp, PMEMfile *dir, const char *pathname,
 		int flags);
+/* Not in POSIX. */
+int pmemfile_unlink_batch(PMEMfilepool *pfp, PMEMfile *dir,
+		const char *const names[], size_t count);
 int pmemfile_rename(PMEMfilepool *, const char *old_path, const char *new_path);
 int pmemfile_renameat(PMEMfilepool *, PMEMfile *old_at, const char *old_path,
 				PMEMfile *new_at, const char *new_path);
@@ -262,6 +298,16 @@ pmemfile_ssize_t pmemfile_readv(PMEMfilepool *, PMEMfile *file,
 pmemfile_ssize_t pmemfile_preadv(PMEMfilepool *, PMEMfile *file,
 	const pmemfile_iovec_t *iov, int iovcnt, pmemfile_off_t offset);
 
+/*
+ * Not in POSIX:
+ * Zero-copy read. Fills iov with read-only pointers to file data, which stay
+ * valid until the lease is released.
+ */
+pmemfile_ssize_t pmemfile_pread_borrow(PMEMfilepool *pfp, PMEMfile *file,
+		size_t count, pmemfile_off_t offset, pmemfile_iovec_t *iov,
+		int *iovcnt, PMEMfilelease **lease);
+void pmemfile_pread_release(PMEMfilepool *pfp, PMEMfilelease *lease);
+
 pmemfile_ssize_t pmemfile_write(PMEMfilepool *pfp, PMEMfile *file,
 		const void *buf, size_t count);
 pmemfile_ssize_t pmemfile_pwrite(PMEMfilepool *pfp, PMEMfile *file,
@@ -372,6 +418,13 @@ struct pmemfile_stats {
 	unsigned block_arrays;
 	unsigned inode_arrays;
 	unsigned blocks;
+	unsigned block_refs;
+	unsigned block_index;
+
+	/* path component lookup cache */
+	uint64_t dcache_hits;
+	uint64_t dcache_negative_hits;
+	uint64_t dcache_misses;
 };
 void pmemfile_stats(PMEMfilepool *pfp, struct pmemfile_stats *stats);
 int pmemfile_statfs(PMEMfilepool *pfp, pmemfile_statfs_t *buf);
@@ -382,7 +435,8 @@ int pmemfile_ftruncate(PMEMfilepool *, PMEMfile *file, pmemfile_off_t length);
 /*
  * Not in POSIX:
  * The fallocate glibc routine/syscall is Linux/glibc specific,
- * The pmemfile_fallocate supports allocating, and punching holes.
+ * The pmemfile_fallocate supports allocating, punching holes, zeroing,
+ * collapsing and inserting ranges.
  */
 int pmemfile_fallocate(PMEMfilepool *, PMEMfile *file, int mode,
 		pmemfile_off_t offset, pmemfile_off_t length);
@@ -390,6 +444,52 @@ int pmemfile_fallocate(PMEMfilepool *, PMEMfile *file, int mode,
 int pmemfile_posix_fallocate(PMEMfilepool *pfp, PMEMfile *file,
 		pmemfile_off_t offset, pmemfile_off_t length);
 
+void *pmemfile_mmap(PMEMfilepool *, void *addr, size_t len,
+		int prot, int flags, PMEMfile *file, pmemfile_off_t off);
+int pmemfile_munmap(PMEMfilepool *, void *addr, size_t len);
+void *pmemfile_mremap(PMEMfilepool *, void *old_addr, size_t old_size,
+			size_t new_size, int flags, void *new_addr);
+int pmemfile_msync(PMEMfilepool *, void *addr, size_t len, int flags);
+int pmemfile_mprotect(PMEMfilepool *, void *addr, size_t len, int prot);
+
+/*
+ * Not in POSIX:
+ * copy_file_range is Linux specific. Whole blocks are shared between
+ * files copy-on-write when possible.
+ */
+pmemfile_ssize_t pmemfile_copy_file_range(PMEMfilepool *,
+		PMEMfile *file_in, pmemfile_off_t *off_in,
+		PMEMfile *file_out, pmemfile_off_t *off_out,
+		size_t len, unsigned flags);
+
+/*
+ * Not in POSIX:
+ * Replaces runs of small adjacent blocks in the range by bigger blocks.
+ */
+int pmemfile_defrag(PMEMfilepool *, PMEMfile *file, pmemfile_off_t offset,
+		pmemfile_off_t length);
+
+/* same as FIEMAP_EXTENT_* */
+#define PMEMFILE_FIEMAP_EXTENT_LAST		0x00000001
+#define PMEMFILE_FIEMAP_EXTENT_NOT_ALIGNED	0x00000100
+#define PMEMFILE_FIEMAP_EXTENT_DATA_INLINE	0x00000200
+#define PMEMFILE_FIEMAP_EXTENT_UNWRITTEN	0x00000800
+#define PMEMFILE_FIEMAP_EXTENT_SHARED		0x00002000
+
+struct pmemfile_extent {
+	uint64_t offset;
+	uint64_t length;
+	uint32_t flags;
+};
+
+/*
+ * Not in POSIX:
+ * Reports allocated extents of the file, like the FS_IOC_FIEMAP ioctl.
+ */
+pmemfile_ssize_t pmemfile_fiemap(PMEMfilepool *, PMEMfile *file,
+		pmemfile_off_t offset, pmemfile_off_t length,
+		struct pmemfile_extent *extents, size_t count);
+
 char *pmemfile_get_dir_path(PMEMfilepool *pfp, PMEMfile *dir, char *buf,
 		size_t size);
 
@@ -409,6 +509,9 @@ const char *pmemfile_errormsg(void);
 int pmemfile_pool_resume(PMEMfilepool *pfp, const char *pathname);
 int pmemfile_pool_suspend(PMEMfilepool *pfp);
 
+/* Not in POSIX. */
+int pmemfile_pool_reclaim(PMEMfilepool *pfp);
+
 #include "libpmemfile-posix-stubs.h"
 
 #ifdef __cplusplus
@@ -30,6 +30,8 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "block_index.h"
+#include "block_ref.h"
 #include "blocks.h"
 #include "layout.h"
 #include "inode.h"
@@ -73,7 +75,7 @@ update_first_block_info(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 	 * slot. This is either the block_array stored right in the
 	 * inode, ...
 	 */
-	binfo->arr = &vinode->inode->file_data.blocks;
+	binfo->arr = &inode_file_data(vinode->inode)->blocks;
 	/*
 	 * ... or if there is more than one block_array, it is
 	 * the one linked to it with the next field.
@@ -174,8 +176,8 @@ allocate_new_block_array(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 
 	PF_RW(pfp, new)->version = PMEMFILE_BLOCK_ARRAY_VERSION(1);
 
-	PF_RW(pfp, new)->next = vinode->inode->file_data.blocks.next;
-	TX_SET_DIRECT(&vinode->inode->file_data.blocks, next, new);
+	PF_RW(pfp, new)->next = inode_file_data(vinode->inode)->blocks.next;
+	TX_SET_DIRECT(&inode_file_data(vinode->inode)->blocks, next, new);
 	vinode->first_free_block.arr = PF_RW(pfp, new);
 	vinode->first_free_block.idx = 0;
 }
@@ -352,7 +354,7 @@ is_first_block_array_empty(struct pmemfile_vinode *vinode)
 	 * If yes then in a sense it is the zeroth block array, not the first.
 	 */
 	return vinode->first_free_block.arr !=
-	    &vinode->inode->file_data.blocks;
+	    &inode_file_data(vinode->inode)->blocks;
 }
 
 /*
@@ -372,12 +374,12 @@ remove_first_block_array(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 
 	binfo = &vinode->first_free_block;
 
-	to_remove = vinode->inode->file_data.blocks.next;
+	to_remove = inode_file_data(vinode->inode)->blocks.next;
 
 	new_next = PF_RW(pfp, to_remove)->next;
-	TX_SET_DIRECT(&vinode->inode->file_data.blocks, next, new_next);
+	TX_SET_DIRECT(&inode_file_data(vinode->inode)->blocks, next, new_next);
 	if (TOID_IS_NULL(new_next))
-		binfo->arr = &vinode->inode->file_data.blocks;
+		binfo->arr = &inode_file_data(vinode->inode)->blocks;
 	else
 		binfo->arr = PF_RW(pfp, new_next);
 
@@ -466,16 +468,21 @@ block_list_remove(PMEMfilepool *pfp,
 	if (vinode->first_block == block)
 		vinode->first_block = PF_RW(pfp, block->next);
 
-	if (!TOID_IS_NULL(block->data))
-		TX_FREE(block->data);
+	block_data_free(pfp, block);
 
 	if (moving_block != block) {
 		if (vinode->first_block == moving_block)
 			vinode->first_block = block;
-		remove_block(vinode->blocks, moving_block);
-		relocate_block(pfp, block, moving_block);
-		if (insert_block(vinode->blocks, block))
-			pmemfile_tx_abort(errno);
+		if (vinode->index) {
+			relocate_block(pfp, block, moving_block);
+			block_index_relocate(vinode->index, block,
+					moving_block);
+		} else {
+			remove_block(vinode->blocks, moving_block);
+			relocate_block(pfp, block, moving_block);
+			if (insert_block(vinode->blocks, block))
+				pmemfile_tx_abort(errno);
+		}
 	}
 
 	TX_MEMSET(moving_block, 0, sizeof(*moving_block));
@@ -52,7 +52,8 @@ block_list_insert_after(PMEMfilepool *pfp,
 
 /*
  * Removes the block from the linked list of blocks. Deallocates
- * block->data if set, and deallocates the block metadata.
+ * block->data if set and not shared with other blocks (see block_data_free),
+ * and deallocates the block metadata.
  *
  * Returns a pointer to the preceding block metadata - the one that
  * was the previous block before deallocating.
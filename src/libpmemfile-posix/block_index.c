@@ -0,0 +1,489 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * block_index.c -- persistent offset-ordered index of blocks of a file
+ *
+ * Blocks of a file are linked in offset order, but the list can only be
+ * walked, so without an index the whole list has to be inserted into the
+ * runtime tree (see offset_mapping.c) before the first lookup after open.
+ * Files with many blocks have an index instead: a chain of
+ * pmemfile_block_index pages with (offset, block) pairs sorted by offset,
+ * hanging off the inode. It's modified in the same transactions which insert
+ * and remove blocks, so it's valid as soon as the file is opened.
+ *
+ * The only runtime state is an array of pointers to the pages. A lookup is
+ * a binary search over the first offsets of pages, followed by a binary
+ * search in one page.
+ *
+ * A full page is split in half, except when an entry is appended at the end
+ * of the last page - then it goes to a new page, so files written
+ * sequentially get fully packed pages. A page which becomes empty is freed,
+ * unless it's the only one.
+ *
+ * All modifying functions must be called in a transaction.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "block_index.h"
+#include "blocks.h"
+#include "layout.h"
+#include "out.h"
+#include "pool.h"
+#include "utils.h"
+
+struct block_index {
+	PMEMfilepool *pfp;
+
+	struct pmemfile_inode *inode;
+
+	/* index pages, in offset order, never empty if there is more than 1 */
+	struct pmemfile_block_index **pages;
+	unsigned count;
+	unsigned capacity;
+};
+
+static TOID(struct pmemfile_block_index)
+page_oid(struct pmemfile_block_index *page)
+{
+	return (TOID(struct pmemfile_block_index))pmemobj_oid(page);
+}
+
+static struct pmemfile_block_desc *
+entry_block(struct block_index *idx,
+		const struct pmemfile_block_index_entry *entry)
+{
+	return (void *)((uintptr_t)idx->pfp->pop + entry->block);
+}
+
+/*
+ * pages_reserve -- makes sure the array of pages can hold count pages
+ */
+static int
+pages_reserve(struct block_index *idx, unsigned count)
+{
+	if (count <= idx->capacity)
+		return 0;
+
+	unsigned capacity = idx->capacity ? idx->capacity * 2 : 16;
+	while (capacity < count)
+		capacity *= 2;
+
+	struct pmemfile_block_index **pages =
+			pf_realloc(idx->pages, capacity * sizeof(*pages));
+	if (!pages) {
+		errno = ENOMEM;
+		return ENOMEM;
+	}
+
+	idx->pages = pages;
+	idx->capacity = capacity;
+
+	return 0;
+}
+
+/*
+ * page_find -- returns number of the last page with first offset lower than
+ * or equal to offset, 0 if there is no such page
+ */
+static unsigned
+page_find(struct block_index *idx, uint64_t offset)
+{
+	unsigned lo = 0;
+	unsigned hi = idx->count;
+
+	while (hi - lo > 1) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (idx->pages[mid]->entries[0].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * entry_find -- returns index of the last entry with offset lower than
+ * or equal to offset, -1 if there is no such entry
+ */
+static int
+entry_find(const struct pmemfile_block_index *page, uint64_t offset)
+{
+	unsigned lo = 0;
+	unsigned hi = page->length;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (page->entries[mid].offset <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (int)lo - 1;
+}
+
+/*
+ * block_index_open -- loads index of the inode
+ */
+struct block_index *
+block_index_open(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	ASSERT(!TOID_IS_NULL(inode->block_index));
+
+	struct block_index *idx = pf_calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	idx->pfp = pfp;
+	idx->inode = inode;
+
+	struct pmemfile_block_index *page = PF_RW(pfp, inode->block_index);
+
+	while (page != NULL) {
+		if (pages_reserve(idx, idx->count + 1)) {
+			block_index_close(idx);
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		idx->pages[idx->count++] = page;
+		page = PF_RW(pfp, page->next);
+	}
+
+	return idx;
+}
+
+/*
+ * page_alloc -- allocates new, empty index page
+ */
+static struct pmemfile_block_index *
+page_alloc(PMEMfilepool *pfp)
+{
+	const struct pmem_block_info *info = metadata_block_info();
+
+	TOID(struct pmemfile_block_index) page =
+		TX_XALLOC(struct pmemfile_block_index, info->size,
+			POBJ_XALLOC_ZERO | info->class_id);
+
+	PF_RW(pfp, page)->version = PMEMFILE_BLOCK_INDEX_VERSION(1);
+
+	return PF_RW(pfp, page);
+}
+
+/*
+ * block_index_create -- creates an empty index and attaches it to the inode
+ *
+ * Bumps inode version, so the inode can't be opened by versions of the
+ * library which wouldn't keep the index up to date.
+ */
+struct block_index *
+block_index_create(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	ASSERT_IN_TX();
+	ASSERT(TOID_IS_NULL(inode->block_index));
+
+	struct block_index *idx = pf_calloc(1, sizeof(*idx));
+	if (!idx)
+		pmemfile_tx_abort(ENOMEM);
+
+	idx->pfp = pfp;
+	idx->inode = inode;
+
+	if (pages_reserve(idx, 1)) {
+		pf_free(idx);
+		pmemfile_tx_abort(ENOMEM);
+	}
+
+	struct pmemfile_block_index *page = page_alloc(pfp);
+	idx->pages[idx->count++] = page;
+
+	TX_SET_DIRECT(inode, block_index, page_oid(page));
+	if (inode->version < PMEMFILE_INODE_VERSION(3))
+		TX_SET_DIRECT(inode, version, PMEMFILE_INODE_VERSION(3));
+
+	return idx;
+}
+
+/*
+ * block_index_close -- frees runtime state of the index
+ */
+void
+block_index_close(struct block_index *idx)
+{
+	pf_free(idx->pages);
+	pf_free(idx);
+}
+
+/*
+ * block_index_first -- returns block with the lowest offset
+ */
+struct pmemfile_block_desc *
+block_index_first(struct block_index *idx)
+{
+	struct pmemfile_block_index *page = idx->pages[0];
+
+	if (page->length == 0)
+		return NULL;
+
+	return entry_block(idx, &page->entries[0]);
+}
+
+/*
+ * block_index_find_closest -- returns block with the highest offset lower
+ * than or equal to offset, NULL if there is no such block
+ */
+struct pmemfile_block_desc *
+block_index_find_closest(struct block_index *idx, uint64_t offset)
+{
+	struct pmemfile_block_index *page = idx->pages[page_find(idx, offset)];
+
+	int i = entry_find(page, offset);
+	if (i < 0)
+		return NULL;
+
+	return entry_block(idx, &page->entries[i]);
+}
+
+/*
+ * page_add_after -- allocates new page and links it after page number p
+ */
+static struct pmemfile_block_index *
+page_add_after(struct block_index *idx, unsigned p)
+{
+	ASSERT(idx->count < idx->capacity);
+
+	PMEMfilepool *pfp = idx->pfp;
+	struct pmemfile_block_index *page = idx->pages[p];
+	struct pmemfile_block_index *new = page_alloc(pfp);
+
+	new->prev = page_oid(page);
+	new->next = page->next;
+
+	struct pmemfile_block_index *next = PF_RW(pfp, page->next);
+	if (next != NULL)
+		TX_SET_DIRECT(next, prev, page_oid(new));
+	TX_SET_DIRECT(page, next, page_oid(new));
+
+	memmove(&idx->pages[p + 2], &idx->pages[p + 1],
+			(idx->count - p - 1) * sizeof(idx->pages[0]));
+	idx->pages[p + 1] = new;
+	idx->count++;
+
+	return new;
+}
+
+/*
+ * page_remove -- unlinks and frees page number p
+ */
+static void
+page_remove(struct block_index *idx, unsigned p)
+{
+	ASSERT(idx->count > 1);
+
+	PMEMfilepool *pfp = idx->pfp;
+	struct pmemfile_block_index *page = idx->pages[p];
+
+	struct pmemfile_block_index *prev = PF_RW(pfp, page->prev);
+	struct pmemfile_block_index *next = PF_RW(pfp, page->next);
+
+	if (prev != NULL)
+		TX_SET_DIRECT(prev, next, page->next);
+	else
+		TX_SET_DIRECT(idx->inode, block_index, page->next);
+
+	if (next != NULL)
+		TX_SET_DIRECT(next, prev, page->prev);
+
+	TX_FREE(page_oid(page));
+
+	memmove(&idx->pages[p], &idx->pages[p + 1],
+			(idx->count - p - 1) * sizeof(idx->pages[0]));
+	idx->count--;
+}
+
+/*
+ * block_index_insert -- inserts block into the index
+ */
+void
+block_index_insert(struct block_index *idx, struct pmemfile_block_desc *block)
+{
+	ASSERT_IN_TX();
+
+	/* page can be split, and that can't fail half way */
+	if (pages_reserve(idx, idx->count + 1))
+		pmemfile_tx_abort(ENOMEM);
+
+	unsigned p = page_find(idx, block->offset);
+	struct pmemfile_block_index *page = idx->pages[p];
+	unsigned i = (unsigned)(entry_find(page, block->offset) + 1);
+
+	ASSERT(i == 0 || page->entries[i - 1].offset != block->offset);
+
+	if (page->length == NUMEXTENTS_PER_INDEX) {
+		bool append = p == idx->count - 1 && i == page->length;
+		struct pmemfile_block_index *new = page_add_after(idx, p);
+
+		if (append) {
+			page = new;
+			i = 0;
+		} else {
+			unsigned half = NUMEXTENTS_PER_INDEX / 2;
+
+			/* new page was allocated in this transaction */
+			memcpy(new->entries, &page->entries[half],
+				(page->length - half) *
+				sizeof(page->entries[0]));
+			new->length = page->length - half;
+
+			TX_SET_DIRECT(page, length, half);
+
+			if (i > half) {
+				page = new;
+				i -= half;
+			}
+		}
+	}
+
+	pmemobj_tx_add_range_direct(&page->entries[i],
+			(page->length - i + 1) * sizeof(page->entries[0]));
+	TX_ADD_FIELD_DIRECT(page, length);
+
+	memmove(&page->entries[i + 1], &page->entries[i],
+			(page->length - i) * sizeof(page->entries[0]));
+	page->entries[i].offset = block->offset;
+	page->entries[i].block = pmemobj_oid(block).off;
+	page->length++;
+}
+
+/*
+ * block_index_remove -- removes block from the index
+ */
+void
+block_index_remove(struct block_index *idx, struct pmemfile_block_desc *block)
+{
+	ASSERT_IN_TX();
+
+	unsigned p = page_find(idx, block->offset);
+	struct pmemfile_block_index *page = idx->pages[p];
+	int i = entry_find(page, block->offset);
+
+	ASSERT(i >= 0);
+	ASSERTeq(page->entries[i].offset, block->offset);
+	ASSERTeq(entry_block(idx, &page->entries[i]), block);
+
+	unsigned len = page->length - (unsigned)i - 1;
+
+	pmemobj_tx_add_range_direct(&page->entries[i],
+			(len + 1) * sizeof(page->entries[0]));
+	TX_ADD_FIELD_DIRECT(page, length);
+
+	memmove(&page->entries[i], &page->entries[i + 1],
+			len * sizeof(page->entries[0]));
+	page->length--;
+
+	if (page->length == 0 && idx->count > 1)
+		page_remove(idx, p);
+}
+
+/*
+ * block_index_relocate -- points the entry of src to dst, which is a copy
+ * of src in a different place
+ */
+void
+block_index_relocate(struct block_index *idx, struct pmemfile_block_desc *dst,
+		const struct pmemfile_block_desc *src)
+{
+	ASSERT_IN_TX();
+	ASSERTeq(dst->offset, src->offset);
+
+	struct pmemfile_block_index *page =
+			idx->pages[page_find(idx, src->offset)];
+	int i = entry_find(page, src->offset);
+
+	ASSERT(i >= 0);
+	ASSERTeq(entry_block(idx, &page->entries[i]), src);
+
+	TX_SET_DIRECT(&page->entries[i], block, pmemobj_oid(dst).off);
+}
+
+/*
+ * block_index_shift -- adds delta to offsets of all entries with offsets
+ * higher than or equal to from
+ *
+ * Order of the entries can't change.
+ */
+void
+block_index_shift(struct block_index *idx, uint64_t from, uint64_t delta)
+{
+	ASSERT_IN_TX();
+
+	unsigned p = page_find(idx, from);
+	int first = from > 0 ? entry_find(idx->pages[p], from - 1) + 1 : 0;
+
+	for (; p < idx->count; ++p) {
+		struct pmemfile_block_index *page = idx->pages[p];
+		unsigned i = (unsigned)first;
+
+		if (i < page->length)
+			pmemobj_tx_add_range_direct(&page->entries[i],
+				(page->length - i) * sizeof(page->entries[0]));
+
+		for (; i < page->length; ++i)
+			page->entries[i].offset += delta;
+
+		first = 0;
+	}
+}
+
+/*
+ * block_index_free -- frees all pages of the index of the inode
+ */
+void
+block_index_free(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	ASSERT_IN_TX();
+
+	TOID(struct pmemfile_block_index) page = inode->block_index;
+
+	while (!TOID_IS_NULL(page)) {
+		TOID(struct pmemfile_block_index) next = PF_RO(pfp, page)->next;
+		TX_FREE(page);
+		page = next;
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * block_index.h -- persistent offset-ordered index of blocks of a file
+ */
+
+#ifndef PMEMFILE_BLOCK_INDEX_H
+#define PMEMFILE_BLOCK_INDEX_H
+
+#include <stdint.h>
+
+#include "libpmemfile-posix.h"
+
+struct pmemfile_block_desc;
+struct pmemfile_inode;
+struct block_index;
+
+struct block_index *block_index_open(PMEMfilepool *pfp,
+		struct pmemfile_inode *inode);
+struct block_index *block_index_create(PMEMfilepool *pfp,
+		struct pmemfile_inode *inode);
+void block_index_close(struct block_index *idx);
+
+struct pmemfile_block_desc *block_index_first(struct block_index *idx);
+struct pmemfile_block_desc *block_index_find_closest(struct block_index *idx,
+		uint64_t offset);
+
+void block_index_insert(struct block_index *idx,
+		struct pmemfile_block_desc *block);
+void block_index_remove(struct block_index *idx,
+		struct pmemfile_block_desc *block);
+void block_index_relocate(struct block_index *idx,
+		struct pmemfile_block_desc *dst,
+		const struct pmemfile_block_desc *src);
+void block_index_shift(struct block_index *idx, uint64_t from,
+		uint64_t delta);
+
+void block_index_free(PMEMfilepool *pfp, struct pmemfile_inode *inode);
+
+#endif
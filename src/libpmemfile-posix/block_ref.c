@@ -0,0 +1,328 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * block_ref.c -- reference counting of block data shared between files
+ *
+ * Data of a block can be pointed to by many block descriptors (e.g. after
+ * pmemfile_copy_file_range). Such blocks have the BLOCK_SHARED flag set and
+ * the number of descriptors pointing to their data is kept in a hash table
+ * of pages of counters, indexed by pool offset of the data.
+ *
+ * All functions here must be called in a transaction. The table is protected
+ * by the pool block_refs_mutex, which is taken on first use and held until
+ * the end of the transaction, because modified counters can't be seen by
+ * other transactions before commit.
+ */
+
+#include "block_ref.h"
+#include "blocks.h"
+#include "callbacks.h"
+#include "layout.h"
+#include "os_thread.h"
+#include "out.h"
+#include "pool.h"
+#include "utils.h"
+
+/* block_refs_mutex of the pool is held by the current transaction */
+static __thread bool block_refs_locked;
+
+/*
+ * block_refs_unlock_cb -- releases block_refs_mutex at the end of transaction
+ */
+static void
+block_refs_unlock_cb(PMEMfilepool *pfp, void *arg)
+{
+	(void) arg;
+
+	block_refs_locked = false;
+	os_mutex_unlock(&pfp->block_refs_mutex);
+}
+
+/*
+ * block_refs_tx_lock -- takes block_refs_mutex until the end of transaction
+ */
+static void
+block_refs_tx_lock(PMEMfilepool *pfp)
+{
+	ASSERT_IN_TX();
+
+	if (block_refs_locked)
+		return;
+
+	cb_push_front(TX_STAGE_ONABORT, (cb_basic)block_refs_unlock_cb, NULL);
+	cb_push_back(TX_STAGE_ONCOMMIT, (cb_basic)block_refs_unlock_cb, NULL);
+
+	os_mutex_lock(&pfp->block_refs_mutex);
+	block_refs_locked = true;
+}
+
+/*
+ * block_ref_bucket -- returns bucket of data at pool offset data
+ */
+static TOID(struct pmemfile_block_ref_page) *
+block_ref_bucket(PMEMfilepool *pfp, uint64_t data)
+{
+	struct pmemfile_block_refs *refs = PF_RW(pfp, pfp->super->block_refs);
+
+	return &refs->buckets[(data / block_alignment) % NUMREF_BUCKETS];
+}
+
+/*
+ * block_ref_find -- returns reference counter of data at pool offset data
+ */
+static struct pmemfile_block_ref *
+block_ref_find(PMEMfilepool *pfp, uint64_t data)
+{
+	if (TOID_IS_NULL(pfp->super->block_refs))
+		return NULL;
+
+	struct pmemfile_block_ref_page *page =
+			PF_RW(pfp, *block_ref_bucket(pfp, data));
+
+	while (page) {
+		for (uint32_t i = 0; i < page->used; ++i)
+			if (page->refs[i].data == data)
+				return &page->refs[i];
+
+		page = PF_RW(pfp, page->next);
+	}
+
+	return NULL;
+}
+
+/*
+ * block_ref_page_alloc -- allocates new page of reference counters
+ */
+static TOID(struct pmemfile_block_ref_page)
+block_ref_page_alloc(PMEMfilepool *pfp)
+{
+	const struct pmem_block_info *info = metadata_block_info();
+
+	TOID(struct pmemfile_block_ref_page) page =
+		TX_XALLOC(struct pmemfile_block_ref_page, info->size,
+			POBJ_XALLOC_ZERO | info->class_id);
+
+	PF_RW(pfp, page)->version = PMEMFILE_BLOCK_REFS_VERSION(1);
+
+	return page;
+}
+
+/*
+ * block_ref_insert -- creates new reference counter of data at pool offset
+ * data
+ */
+static struct pmemfile_block_ref *
+block_ref_insert(PMEMfilepool *pfp, uint64_t data)
+{
+	struct pmemfile_super *super = pfp->super;
+
+	if (TOID_IS_NULL(super->block_refs)) {
+		const struct pmem_block_info *info = metadata_block_info();
+
+		TX_ADD_FIELD_DIRECT(super, block_refs);
+		super->block_refs = TX_XALLOC(struct pmemfile_block_refs,
+				info->size, POBJ_XALLOC_ZERO | info->class_id);
+		PF_RW(pfp, super->block_refs)->version =
+				PMEMFILE_BLOCK_REFS_VERSION(1);
+	}
+
+	TOID(struct pmemfile_block_ref_page) *bucket =
+			block_ref_bucket(pfp, data);
+	struct pmemfile_block_ref_page *page = PF_RW(pfp, *bucket);
+	struct pmemfile_block_ref *ref = NULL;
+
+	/* reuse an unused entry or append to the first page with space */
+	for (; page && !ref; page = PF_RW(pfp, page->next)) {
+		for (uint32_t i = 0; i < page->used; ++i) {
+			if (page->refs[i].data == 0) {
+				ref = &page->refs[i];
+				break;
+			}
+		}
+
+		if (!ref && page->used < NUMREFS_PER_PAGE) {
+			TX_ADD_FIELD_DIRECT(page, used);
+			ref = &page->refs[page->used++];
+		}
+	}
+
+	if (!ref) {
+		TOID(struct pmemfile_block_ref_page) new =
+				block_ref_page_alloc(pfp);
+		page = PF_RW(pfp, new);
+
+		page->next = *bucket;
+		page->used = 1;
+		ref = &page->refs[0];
+
+		TX_ADD_DIRECT(bucket);
+		*bucket = new;
+	} else {
+		TX_ADD_DIRECT(ref);
+	}
+
+	ref->data = data;
+	ref->refcount = 0;
+
+	return ref;
+}
+
+/*
+ * block_ref_get -- returns reference counter of shared block
+ */
+static struct pmemfile_block_ref *
+block_ref_get(PMEMfilepool *pfp, struct pmemfile_block_desc *block)
+{
+	ASSERT(block->flags & BLOCK_SHARED);
+
+	struct pmemfile_block_ref *ref =
+			block_ref_find(pfp, block->data.oid.off);
+	if (!ref)
+		FATAL("no reference counter of shared block data 0x%lx",
+				block->data.oid.off);
+
+	ASSERT(ref->refcount > 0);
+
+	return ref;
+}
+
+/*
+ * block_ref_remove -- releases reference counter entry
+ */
+static void
+block_ref_remove(struct pmemfile_block_ref *ref)
+{
+	TX_ADD_DIRECT(ref);
+	ref->data = 0;
+	ref->refcount = 0;
+}
+
+/*
+ * block_data_share -- adds a reference to data of block, which is going to
+ * be pointed to by another block descriptor
+ *
+ * Marks block as shared. The new descriptor must have BLOCK_SHARED flag set
+ * too.
+ */
+void
+block_data_share(PMEMfilepool *pfp, struct pmemfile_block_desc *block)
+{
+	ASSERT_IN_TX();
+	ASSERT(block->flags & BLOCK_INITIALIZED);
+
+	block_refs_tx_lock(pfp);
+
+	struct pmemfile_block_ref *ref;
+
+	if (block->flags & BLOCK_SHARED) {
+		ref = block_ref_get(pfp, block);
+		TX_ADD_DIRECT(&ref->refcount);
+		ref->refcount++;
+	} else {
+		ref = block_ref_insert(pfp, block->data.oid.off);
+		ref->refcount = 2;
+		TX_SET_DIRECT(block, flags, block->flags | BLOCK_SHARED);
+	}
+}
+
+/*
+ * block_data_unshare -- makes block the only owner of its data, copying it
+ * if other blocks still point to it
+ *
+ * Caller must make sure nobody uses pointers to the old data of block.
+ */
+void
+block_data_unshare(PMEMfilepool *pfp, struct pmemfile_block_desc *block)
+{
+	ASSERT_IN_TX();
+
+	if (!(block->flags & BLOCK_SHARED))
+		return;
+
+	block_refs_tx_lock(pfp);
+
+	struct pmemfile_block_ref *ref = block_ref_get(pfp, block);
+
+	TX_ADD_DIRECT(block);
+
+	if (ref->refcount == 1) {
+		block_ref_remove(ref);
+	} else {
+		TX_ADD_DIRECT(&ref->refcount);
+		ref->refcount--;
+
+		const struct pmem_block_info *info =
+				data_block_info(block->size, block->size);
+		ASSERTeq(info->size, block->size);
+
+		TOID(char) data = TX_XALLOC(char, block->size,
+				POBJ_XALLOC_NO_FLUSH | info->class_id);
+
+		/* new object doesn't need undo log, commit drains the copy */
+		pmemfile_memcpy_nodrain(pfp, PF_RW(pfp, data),
+				PF_RO(pfp, block->data), block->size);
+
+		block->data = data;
+	}
+
+	block->flags &= ~(uint32_t)BLOCK_SHARED;
+}
+
+/*
+ * block_data_free -- drops reference to data of block, freeing it if it was
+ * the last one
+ */
+void
+block_data_free(PMEMfilepool *pfp, struct pmemfile_block_desc *block)
+{
+	ASSERT_IN_TX();
+
+	if (TOID_IS_NULL(block->data))
+		return;
+
+	if (block->flags & BLOCK_SHARED) {
+		block_refs_tx_lock(pfp);
+
+		struct pmemfile_block_ref *ref = block_ref_get(pfp, block);
+
+		if (ref->refcount > 1) {
+			TX_ADD_DIRECT(&ref->refcount);
+			ref->refcount--;
+			return;
+		}
+
+		block_ref_remove(ref);
+	}
+
+	TX_FREE(block->data);
+}
@@ -38,6 +38,7 @@
 #include "blocks.h"
 #include "out.h"
 
+#define COMPACT_INODE_ID 127
 #define METADATA_ID 128
 #define FIRST_BLOCK_ID 129
 
@@ -46,6 +47,9 @@
 static struct pmem_block_info metadata_block =
 	{ METADATA_BLOCK_SIZE, 128 };
 
+static struct pmem_block_info compact_inode_block =
+	{ PMEMFILE_COMPACT_INODE_SIZE, 1024 };
+
 static struct pmem_block_info data_blocks[] = {
 	{ MIN_BLOCK_SIZE,	128 },
 	{ 256 * 1024,		16 },
@@ -75,6 +79,12 @@ metadata_block_info(void)
 	return &metadata_block;
 }
 
+const struct pmem_block_info *
+compact_inode_block_info(void)
+{
+	return &compact_inode_block;
+}
+
 /*
  * returns block which is smaller or equal to 'limit'
  * if it's possible (limit value is large enough) returned block
@@ -140,6 +150,10 @@ initialize_alloc_classes(PMEMobjpool *pop)
 	if (ret)
 		return ret;
 
+	ret = set_alloc_class(pop, &compact_inode_block, COMPACT_INODE_ID);
+	if (ret)
+		return ret;
+
 	struct pmem_block_info *block;
 
 	for (block = data_blocks; block->size != 0; ++block) {
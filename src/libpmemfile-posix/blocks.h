@@ -72,6 +72,8 @@ void expand_to_full_pages(uint64_t *offset, uint64_t *length);
 
 const struct pmem_block_info *metadata_block_info(void);
 
+const struct pmem_block_info *compact_inode_block_info(void);
+
 const struct pmem_block_info *data_block_info(size_t size, size_t limit);
 
 int initialize_alloc_classes(PMEMobjpool *pop);
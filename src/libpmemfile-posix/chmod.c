@@ -58,6 +58,7 @@ vinode_chmod(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 	ASSERT_NOT_IN_TX();
 
 	os_rwlock_wrlock(&vinode->rwlock);
+	vinode_seq_write_begin(vinode);
 
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
 		if (vinode->inode->uid != cred->fsuid &&
@@ -82,6 +83,7 @@ vinode_chmod(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 		error = errno;
 	} TX_END
 
+	vinode_seq_write_end(vinode);
 	os_rwlock_unlock(&vinode->rwlock);
 
 	return error;
@@ -81,6 +81,8 @@ vinode_chown(PMEMfilepool *pfp, const struct pmemfile_cred *cred,
 		}
 	}
 
+	vinode_seq_write_begin(vinode);
+
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
 		COMPILE_ERROR_ON(offsetof(struct pmemfile_inode, gid) !=
 				offsetof(struct pmemfile_inode, uid) +
@@ -102,6 +104,8 @@ vinode_chown(PMEMfilepool *pfp, const struct pmemfile_cred *cred,
 		error = errno;
 	} TX_END
 
+	vinode_seq_write_end(vinode);
+
 end:
 	os_rwlock_unlock(&vinode->rwlock);
 
@@ -30,27 +30,445 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 /*
  * copy_file_range.c -- pmemfile_copy_file_range implementation
+ *
+ * Whole, initialized blocks of the source range are not copied, but shared
+ * by both files (see block_ref.c) and copied on first write. This requires
+ * the source and destination offsets to be equally aligned to the block
+ * size and no block of the destination file crossing the edges of the range
+ * replaced by a shared block. Everything else is copied from pool to pool
+ * memory, without intermediate buffers if files differ.
  */
 
 #include <errno.h>
+#include <limits.h>
+
+#include "alloc.h"
+#include "blocks.h"
+#include "callbacks.h"
+#include "data.h"
+#include "file.h"
+#include "inode.h"
 #include "libpmemfile-posix.h"
+#include "mmap.h"
 #include "out.h"
+#include "pool.h"
+#include "utils.h"
+
+/* maximum number of bytes copied by one write */
+#define COPY_CHUNK_SIZE ((uint64_t)64 << 20)
+
+#define COPY_IOV_COUNT 64
+
+/*
+ * copy_range -- copies [src_off, src_off + len) range of src to dst at dst_off
+ *
+ * Returns number of copied bytes or -1 if nothing could be copied.
+ */
+static pmemfile_ssize_t
+copy_range(PMEMfilepool *pfp, struct pmemfile_vinode *src, uint64_t src_off,
+		struct pmemfile_vinode *dst, uint64_t dst_off, uint64_t len)
+{
+	pmemfile_iovec_t iov[COPY_IOV_COUNT];
+	char *buf = NULL;
+	uint64_t done = 0;
+
+	/*
+	 * Writing to the same file can unshare blocks we would read from, so
+	 * data is copied through a buffer.
+	 */
+	if (src == dst) {
+		buf = pf_malloc(len < COPY_CHUNK_SIZE ? len : COPY_CHUNK_SIZE);
+		if (!buf)
+			return -1;
+	}
+
+	while (done < len) {
+		uint64_t n = len - done;
+		if (n > COPY_CHUNK_SIZE)
+			n = COPY_CHUNK_SIZE;
+
+		struct pmemfile_block_desc *block =
+				find_closest_block(src, src_off + done);
+		int iovcnt;
+
+		if (buf) {
+			iterate_on_file_range(pfp, src, block, src_off + done,
+					n, buf, read_from_blocks);
+			iov[0].iov_base = buf;
+			iov[0].iov_len = n;
+			iovcnt = 1;
+		} else {
+			iovcnt = borrow_file_range(pfp, src, block,
+					src_off + done, &n, iov,
+					COPY_IOV_COUNT);
+		}
+
+		pmemfile_ssize_t ret = vinode_pwritev_locked(pfp, dst,
+				dst_off + done, iov, iovcnt);
+		if (ret < 0)
+			break;
+
+		done += (uint64_t)ret;
+	}
+
+	pf_free(buf);
+
+	if (done == 0 && len > 0)
+		return -1;
+
+	return (pmemfile_ssize_t)done;
+}
+
+/*
+ * has_blocks_in_interval -- returns true if any block of vinode intersects
+ * [offset, offset + len)
+ */
+static bool
+has_blocks_in_interval(struct pmemfile_vinode *vinode, uint64_t offset,
+		uint64_t len)
+{
+	struct pmemfile_block_desc *block =
+			find_closest_block(vinode, offset + len - 1);
+
+	return block != NULL && block->offset + block->size > offset;
+}
+
+/*
+ * share_block -- makes dst at dst_off point to data of block of src
+ */
+static int
+share_block(PMEMfilepool *pfp, struct pmemfile_vinode *src,
+		struct pmemfile_block_desc *block, struct pmemfile_vinode *dst,
+		uint64_t dst_off)
+{
+	int error = 0;
+
+	src->has_shared_blocks = true;
+
+	vinode_snapshot(dst);
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		inode_tx_set_shared_blocks(src->inode);
+		vinode_share_block(pfp, dst, dst_off, block);
+	} TX_ONABORT {
+		error = errno;
+		if (error == ENOMEM)
+			error = ENOSPC;
+		vinode_restore_on_abort(dst);
+	} TX_END
+
+	return error;
+}
+
+/*
+ * update_dst_inode -- updates size and times of destination file after copy
+ * of data ending at end
+ */
+static int
+update_dst_inode(PMEMfilepool *pfp, struct pmemfile_vinode *dst, uint64_t end)
+{
+	struct pmemfile_inode *inode = dst->inode;
+	int error = 0;
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		if (inode_get_size(inode) < end)
+			inode_tx_set_size(inode, end);
+
+		struct pmemfile_time tm;
+		get_current_time(&tm);
+		inode_tx_set_mtime(inode, tm);
+		inode_tx_set_ctime(inode, tm);
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	return error;
+}
+
+/*
+ * vinode_copy_file_range -- copies up to len bytes of src starting at src_off
+ * to dst at dst_off
+ *
+ * Both vinodes must be locked in write mode and nobody can borrow
+ * [dst_off, dst_off + len) range of dst. Returns number of copied bytes
+ * or -1.
+ */
+static pmemfile_ssize_t
+vinode_copy_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *src,
+		uint64_t src_off, struct pmemfile_vinode *dst, uint64_t dst_off,
+		uint64_t len)
+{
+	int error;
+
+	if (!src->blocks) {
+		error = vinode_rebuild_block_tree(pfp, src);
+		if (error) {
+			errno = -error;
+			return -1;
+		}
+	}
+
+	if (!dst->blocks) {
+		error = vinode_rebuild_block_tree(pfp, dst);
+		if (error) {
+			errno = -error;
+			return -1;
+		}
+	}
+
+	uint64_t size = inode_get_size(src->inode);
+	if (src_off >= size || len == 0)
+		return 0;
+
+	if (len > size - src_off)
+		len = size - src_off;
+
+	bool can_share = (dst_off - src_off) % block_alignment == 0;
+
+	/* blocks of mapped ranges can't be freed or shared */
+	ASSERT(!range_lock_is_locked(&dst->leases, dst_off, len));
+	vinode_detach_mappings(pfp, dst, dst_off, len);
+	if (can_share)
+		vinode_detach_mappings(pfp, src, src_off, len);
 
+	uint64_t done = 0;
+	error = 0;
+
+	while (done < len && !error) {
+		uint64_t off = src_off + done;
+		uint64_t n = len - done;
+		bool share = false;
+		bool skip = false;
+
+		struct pmemfile_block_desc *block =
+				find_closest_block(src, off);
+
+		if (is_offset_in_block(block, off)) {
+			uint64_t avail = block->offset + block->size - off;
+			if (avail < n)
+				n = avail;
+
+			share = can_share && !vinode_has_inline_data(dst) &&
+				block->offset == off &&
+				n == block->size &&
+				(block->flags & BLOCK_INITIALIZED) &&
+				vinode_is_interval_splittable(dst,
+						dst_off + done, n);
+		} else {
+			struct pmemfile_block_desc *next = block ?
+				PF_RW(pfp, block->next) : src->first_block;
+
+			if (next && next->offset - off < n)
+				n = next->offset - off;
+
+			/* hole over a hole, data stored inline has no holes */
+			skip = !vinode_has_inline_data(src) &&
+				!vinode_has_inline_data(dst) &&
+				!has_blocks_in_interval(dst, dst_off + done, n);
+		}
+
+		if (share) {
+			error = share_block(pfp, src, block, dst,
+					dst_off + done);
+		} else if (!skip) {
+			pmemfile_ssize_t ret = copy_range(pfp, src, off, dst,
+					dst_off + done, n);
+			if (ret < 0) {
+				error = errno;
+				break;
+			}
+
+			n = (uint64_t)ret;
+		}
+
+		if (!error)
+			done += n;
+	}
+
+	if (done > 0) {
+		int err = update_dst_inode(pfp, dst, dst_off + done);
+		if (err && !error)
+			error = err;
+	}
+
+	if (done == 0 && error) {
+		errno = error;
+		return -1;
+	}
+
+	return (pmemfile_ssize_t)done;
+}
+
+/*
+ * lock_files -- locks mutexes of two files in a fixed order
+ */
+static void
+lock_files(PMEMfile *f1, PMEMfile *f2)
+{
+	if (f1 == f2) {
+		os_mutex_lock(&f1->mutex);
+	} else if (f1 < f2) {
+		os_mutex_lock(&f1->mutex);
+		os_mutex_lock(&f2->mutex);
+	} else {
+		os_mutex_lock(&f2->mutex);
+		os_mutex_lock(&f1->mutex);
+	}
+}
+
+static void
+unlock_files(PMEMfile *f1, PMEMfile *f2)
+{
+	os_mutex_unlock(&f1->mutex);
+	if (f1 != f2)
+		os_mutex_unlock(&f2->mutex);
+}
+
+/*
+ * copy_file_range_args_check -- checks arguments of copy_file_range, both
+ * files must be locked
+ */
+static int
+copy_file_range_args_check(PMEMfile *file_in, uint64_t off_in,
+		PMEMfile *file_out, uint64_t off_out, size_t len)
+{
+	if (!(file_in->flags & PFILE_READ))
+		return EBADF;
+
+	if (!(file_out->flags & PFILE_WRITE) ||
+			(file_out->flags & PFILE_APPEND))
+		return EBADF;
+
+	if (vinode_is_dir(file_in->vinode) || vinode_is_dir(file_out->vinode))
+		return EISDIR;
+
+	if (!vinode_is_regular_file(file_in->vinode) ||
+			!vinode_is_regular_file(file_out->vinode))
+		return EINVAL;
+
+	if (off_in + len < off_in || off_out + len < off_out ||
+			off_in + len > INT64_MAX || off_out + len > INT64_MAX)
+		return EOVERFLOW;
+
+	/* overlapping ranges of the same file */
+	if (file_in->vinode == file_out->vinode &&
+			off_in < off_out + len && off_out < off_in + len)
+		return EINVAL;
+
+	return 0;
+}
+
+/*
+ * pmemfile_copy_file_range -- copies len bytes from file_in to file_out
+ *
+ * If off_in (off_out) is NULL, the file offset of file_in (file_out) is used
+ * and updated, otherwise *off_in (*off_out) is used and updated.
+ */
 pmemfile_ssize_t
 pmemfile_copy_file_range(PMEMfilepool *pfp,
 		PMEMfile *file_in, pmemfile_off_t *off_in,
 		PMEMfile *file_out, pmemfile_off_t *off_out,
 		size_t len, unsigned flags)
 {
-	(void) file_in;
-	(void) off_in;
-	(void) file_out;
-	(void) off_out;
-	(void) len;
-	(void) flags;
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!file_in || !file_out) {
+		LOG(LUSR, "NULL file");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (flags != 0 || (off_in && *off_in < 0) ||
+			(off_out && *off_out < 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (len > SSIZE_MAX)
+		len = SSIZE_MAX;
+
+retry:
+	lock_files(file_in, file_out);
+
+	uint64_t in = off_in ? (uint64_t)*off_in : file_in->offset;
+	uint64_t out = off_out ? (uint64_t)*off_out : file_out->offset;
+
+	int error = copy_file_range_args_check(file_in, in, file_out, out,
+			len);
+	if (error) {
+		unlock_files(file_in, file_out);
+		errno = error;
+		return -1;
+	}
+
+	struct pmemfile_vinode *src = file_in->vinode;
+	struct pmemfile_vinode *dst = file_out->vinode;
+
+	if (src == dst) {
+		os_rwlock_wrlock(&src->rwlock);
+	} else if (src < dst) {
+		os_rwlock_wrlock(&src->rwlock);
+		os_rwlock_wrlock(&dst->rwlock);
+	} else {
+		os_rwlock_wrlock(&dst->rwlock);
+		os_rwlock_wrlock(&src->rwlock);
+	}
+
+	/*
+	 * Blocks of borrowed ranges can't be freed. Lease holders may need
+	 * the locks taken above (and the file mutexes) to release them.
+	 */
+	if (len > 0 && range_lock_is_locked(&dst->leases, out, len)) {
+		os_rwlock_unlock(&src->rwlock);
+		if (src != dst)
+			os_rwlock_unlock(&dst->rwlock);
+		unlock_files(file_in, file_out);
+
+		range_lock_wait(&dst->leases, out, len);
+		goto retry;
+	}
+
+	pmemfile_ssize_t ret = vinode_copy_file_range(pfp, src, in, dst, out,
+			len);
+
+	/* block of dst which has to be unshared is borrowed */
+	if (ret < 0 && errno == EBUSY) {
+		uint64_t busy_offset = dst->busy_offset;
+		uint64_t busy_len = dst->busy_len;
+
+		os_rwlock_unlock(&src->rwlock);
+		if (src != dst)
+			os_rwlock_unlock(&dst->rwlock);
+		unlock_files(file_in, file_out);
+
+		range_lock_wait(&dst->leases, busy_offset, busy_len);
+		goto retry;
+	}
+
+	os_rwlock_unlock(&src->rwlock);
+	if (src != dst)
+		os_rwlock_unlock(&dst->rwlock);
+
+	if (ret > 0) {
+		if (off_in)
+			*off_in += ret;
+		else
+			file_in->offset += (size_t)ret;
+
+		if (off_out)
+			*off_out += ret;
+		else
+			file_out->offset += (size_t)ret;
+	}
+
+	unlock_files(file_in, file_out);
 
-	errno = ENOTSUP;
-	return -1;
+	return ret;
 }
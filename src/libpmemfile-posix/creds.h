@@ -92,6 +92,30 @@ _vinode_get_perms(struct pmemfile_vinode *vinode)
 	return perms;
 }
 
+/*
+ * vinode_get_perms_rcu -- reads permissions without taking vinode lock
+ *
+ * Returns false if they were concurrently modified or vinode is being
+ * released. Must be called in rcu read-side section.
+ */
+static inline bool
+vinode_get_perms_rcu(struct pmemfile_vinode *vinode,
+		struct inode_perms *perms)
+{
+	uint32_t seq = vinode_seq_read_begin(vinode);
+	struct pmemfile_inode *inode =
+			__atomic_load_n(&vinode->inode, __ATOMIC_RELAXED);
+
+	if ((seq & 1) || !inode)
+		return false;
+
+	perms->flags = inode_get_flags(inode);
+	perms->uid = inode->uid;
+	perms->gid = inode->gid;
+
+	return !vinode_seq_read_retry(vinode, seq);
+}
+
 static inline struct inode_perms
 vinode_get_perms(struct pmemfile_vinode *vinode)
 {
@@ -30,8 +30,13 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
+
 #include "block_array.h"
+#include "block_index.h"
+#include "block_ref.h"
 #include "blocks.h"
+#include "callbacks.h"
 #include "data.h"
 #include "offset_mapping.h"
 #include "out.h"
@@ -49,26 +54,88 @@ block_cache_insert_block(struct offset_map *c,
 	return insert_block(c, block);
 }
 
+/*
+ * vinode_create_block_index -- moves blocks of the file from the runtime tree
+ * to a new persistent index
+ */
 static void
-block_cache_insert_block_in_tx(struct offset_map *c,
+vinode_create_block_index(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	ASSERT_IN_TX();
+
+	vinode->index = block_index_create(pfp, vinode->inode);
+
+	for (struct pmemfile_block_desc *block = vinode->first_block;
+			block != NULL; block = PF_RW(pfp, block->next))
+		block_index_insert(vinode->index, block);
+
+	struct offset_map *empty = offset_map_new(pfp);
+	if (!empty)
+		pmemfile_tx_abort(errno);
+
+	offset_map_delete(vinode->blocks);
+	vinode->blocks = empty;
+}
+
+/*
+ * block_cache_insert_block_in_tx -- inserts block into the index or the tree
+ *
+ * The index is created once the file outgrows block array embedded in the
+ * inode. Smaller files live with just the runtime tree.
+ */
+static void
+block_cache_insert_block_in_tx(PMEMfilepool *pfp,
+		struct pmemfile_vinode *vinode,
 		struct pmemfile_block_desc *block)
 {
 	ASSERT_IN_TX();
-	int err = block_cache_insert_block(c, block);
+
+	if (vinode->index) {
+		block_index_insert(vinode->index, block);
+		return;
+	}
+
+	int err = block_cache_insert_block(vinode->blocks, block);
 	if (err)
 		pmemfile_tx_abort(err);
+
+	struct pmemfile_block_array *first =
+			&inode_file_data(vinode->inode)->blocks;
+	if (vinode->first_free_block.arr != first)
+		vinode_create_block_index(pfp, vinode);
+}
+
+/*
+ * block_cache_remove_block_in_tx -- removes block from the index or the tree
+ */
+static void
+block_cache_remove_block_in_tx(struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc *block)
+{
+	ASSERT_IN_TX();
+
+	if (vinode->index)
+		block_index_remove(vinode->index, block);
+	else
+		remove_block(vinode->blocks, block);
 }
+
 /*
  * find_last_block - find the block with the highest offset in the file
  */
 static struct pmemfile_block_desc *
-find_last_block(const struct pmemfile_vinode *vinode)
+find_last_block(struct pmemfile_vinode *vinode)
 {
-	return block_find_closest(vinode->blocks, UINT64_MAX);
+	return find_closest_block(vinode, UINT64_MAX);
 }
 
 /*
  * vinode_rebuild_block_tree -- rebuilds runtime tree of blocks
+ *
+ * If the file has a block index, only the index is loaded and the tree is
+ * left empty. Otherwise blocks are inserted in offset order (following the
+ * list of blocks, not the block arrays), so every insert is an append to the
+ * tree and its nodes end up fully packed.
  */
 int
 vinode_rebuild_block_tree(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
@@ -78,9 +145,33 @@ vinode_rebuild_block_tree(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 	struct offset_map *c = offset_map_new(pfp);
 	if (!c)
 		return -errno;
+
+	if (!TOID_IS_NULL(vinode->inode->block_index)) {
+		struct block_index *idx =
+				block_index_open(pfp, vinode->inode);
+		if (!idx) {
+			int err = errno;
+			offset_map_delete(c);
+			return -err;
+		}
+
+		vinode->first_block = block_index_first(idx);
+		vinode->blocks = c;
+		vinode->index = idx;
+		/*
+		 * Blocks aren't scanned here, but the inode is marked when
+		 * any of them starts to share data.
+		 */
+		vinode->has_shared_blocks =
+				inode_has_shared_blocks(vinode->inode);
+
+		return 0;
+	}
+
 	struct pmemfile_block_array *block_array =
-			&vinode->inode->file_data.blocks;
+			&inode_file_data(vinode->inode)->blocks;
 	struct pmemfile_block_desc *first = NULL;
+	bool shared = false;
 
 	while (block_array != NULL) {
 		for (unsigned i = 0; i < block_array->length; ++i) {
@@ -90,20 +181,27 @@ vinode_rebuild_block_tree(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 			if (block->size == 0)
 				break;
 
-			int err = block_cache_insert_block(c, block);
-			if (err) {
-				offset_map_delete(c);
-				return err;
-			}
 			if (first == NULL || block->offset < first->offset)
 				first = block;
+			if (block->flags & BLOCK_SHARED)
+				shared = true;
 		}
 
 		block_array = PF_RW(pfp, block_array->next);
 	}
 
+	for (struct pmemfile_block_desc *block = first; block != NULL;
+			block = PF_RW(pfp, block->next)) {
+		int err = block_cache_insert_block(c, block);
+		if (err) {
+			offset_map_delete(c);
+			return -err;
+		}
+	}
+
 	vinode->first_block = first;
 	vinode->blocks = c;
+	vinode->has_shared_blocks = shared;
 
 	return 0;
 }
@@ -143,6 +241,9 @@ is_block_data_initialized(const struct pmemfile_block_desc *block)
 struct pmemfile_block_desc *
 find_closest_block(struct pmemfile_vinode *vinode, uint64_t off)
 {
+	if (vinode->index)
+		return block_index_find_closest(vinode->index, off);
+
 	return block_find_closest(vinode->blocks, off);
 }
 
@@ -515,7 +616,7 @@ vinode_allocate_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			block = block_list_insert_after(pfp, vinode, NULL);
 			block->offset = offset;
 			file_allocate_block_data(pfp, block, info);
-			block_cache_insert_block_in_tx(vinode->blocks, block);
+			block_cache_insert_block_in_tx(pfp, vinode, block);
 			allocated_space += block->size;
 		} else if (block == NULL && vinode->first_block != NULL) {
 			/* case 4) */
@@ -533,7 +634,7 @@ vinode_allocate_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			block = block_list_insert_after(pfp, vinode, NULL);
 			block->offset = offset;
 			file_allocate_block_data(pfp, block, info);
-			block_cache_insert_block_in_tx(vinode->blocks, block);
+			block_cache_insert_block_in_tx(pfp, vinode, block);
 			allocated_space += block->size;
 		} else if (TOID_IS_NULL(block->next)) {
 			/* case 2) */
@@ -545,7 +646,7 @@ vinode_allocate_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			block = block_list_insert_after(pfp, vinode, block);
 			block->offset = offset;
 			file_allocate_block_data(pfp, block, info);
-			block_cache_insert_block_in_tx(vinode->blocks, block);
+			block_cache_insert_block_in_tx(pfp, vinode, block);
 			allocated_space += block->size;
 		} else {
 			/* case 2) */
@@ -566,7 +667,7 @@ vinode_allocate_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 						block);
 				block->offset = offset;
 				file_allocate_block_data(pfp, block, info);
-				block_cache_insert_block_in_tx(vinode->blocks,
+				block_cache_insert_block_in_tx(pfp, vinode,
 						block);
 				allocated_space += block->size;
 			} else {
@@ -579,13 +680,14 @@ vinode_allocate_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 }
 
 /*
- * vinode_is_interval_allocated -- return true if [offset, offset + size)
- * interval is allocated
+ * interval_check -- return true if [offset, offset + size) interval is
+ * allocated and, if require_initialized is set, all blocks covering it
+ * are initialized and don't share data with other blocks
  */
-bool
-vinode_is_interval_allocated(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+static bool
+interval_check(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 	uint64_t offset, uint64_t size,
-	const struct pmemfile_block_desc *block)
+	const struct pmemfile_block_desc *block, bool require_initialized)
 {
 	ASSERT(size > 0);
 	ASSERT(offset + size > offset);
@@ -598,6 +700,9 @@ vinode_is_interval_allocated(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 
 	uint64_t iterator;
 	do {
+		if (require_initialized && (!is_block_data_initialized(block) ||
+				(block->flags & BLOCK_SHARED)))
+			return false;
 		iterator = block->offset + block->size;
 		block = PF_RO(pfp, block->next);
 	} while (iterator < offset + size &&
@@ -606,6 +711,32 @@ vinode_is_interval_allocated(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 	return iterator >= offset + size;
 }
 
+/*
+ * vinode_is_interval_allocated -- return true if [offset, offset + size)
+ * interval is allocated
+ */
+bool
+vinode_is_interval_allocated(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+	uint64_t offset, uint64_t size,
+	const struct pmemfile_block_desc *block)
+{
+	return interval_check(pfp, vinode, offset, size, block, false);
+}
+
+/*
+ * vinode_is_interval_initialized -- return true if [offset, offset + size)
+ * interval is allocated and all blocks covering it are initialized and not
+ * shared, which means writing to this interval won't touch any data outside
+ * of it
+ */
+bool
+vinode_is_interval_initialized(PMEMfilepool *pfp,
+	struct pmemfile_vinode *vinode, uint64_t offset, uint64_t size,
+	const struct pmemfile_block_desc *block)
+{
+	return interval_check(pfp, vinode, offset, size, block, true);
+}
+
 /*
  * find_following_block
  * Returns the block following the one supplied as argument, according
@@ -653,6 +784,8 @@ read_block_range(PMEMfilepool *pfp, const struct pmemfile_block_desc *block,
  * write_block_range - copy data from user supplied buffer
  *
  * A corresponding block is expected to be already allocated.
+ * Data is flushed, but not drained. Caller is responsible for setting
+ * BLOCK_INITIALIZED flag after draining (see mark_blocks_initialized).
  */
 static void
 write_block_range(PMEMfilepool *pfp, struct pmemfile_block_desc *block,
@@ -669,19 +802,41 @@ write_block_range(PMEMfilepool *pfp, struct pmemfile_block_desc *block,
 		char *start_zero = data;
 		size_t count = offset;
 		if (count != 0)
-			pmemobj_memset_persist(pfp->pop, start_zero, 0, count);
+			pmemfile_memset_nodrain(pfp, start_zero, 0, count);
 
 		start_zero = data + offset + len;
 		count = block->size - (offset + len);
 		if (count != 0)
-			pmemobj_memset_persist(pfp->pop, start_zero, 0, count);
+			pmemfile_memset_nodrain(pfp, start_zero, 0, count);
 	}
 
-	pmemobj_memcpy_persist(pfp->pop, data + offset, buf, len);
+	pmemfile_memcpy_nodrain(pfp, data + offset, buf, len);
+}
 
-	if (!is_block_data_initialized(block)) {
-		block->flags |= BLOCK_INITIALIZED;
-		pmemfile_persist(pfp, &block->flags);
+/*
+ * mark_blocks_initialized -- sets BLOCK_INITIALIZED flag on all blocks
+ * between first and last (inclusive)
+ *
+ * Flags can hit the medium only after the data written to these blocks,
+ * so it issues a fence first. Flags are flushed, but not drained.
+ */
+static void
+mark_blocks_initialized(PMEMfilepool *pfp, struct pmemfile_block_desc *first,
+	struct pmemfile_block_desc *last)
+{
+	pmemfile_drain(pfp);
+
+	struct pmemfile_block_desc *block = first;
+	while (true) {
+		if (!is_block_data_initialized(block)) {
+			block->flags |= BLOCK_INITIALIZED;
+			pmemfile_flush(pfp, &block->flags);
+		}
+
+		if (block == last)
+			break;
+
+		block = PF_RW(pfp, block->next);
 	}
 }
 
@@ -691,6 +846,9 @@ write_block_range(PMEMfilepool *pfp, struct pmemfile_block_desc *block,
  * When cpy_direction specifies writing, this routine expects the corresponding
  * blocks to be already allocated. In case of reading, it is ok to skip holes
  * between blocks.
+ *
+ * Written data is flushed, but not drained - caller has to call pmemfile_drain
+ * before making it visible (e.g. by updating file size) or returning to user.
  */
 struct pmemfile_block_desc *
 iterate_on_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
@@ -700,6 +858,23 @@ iterate_on_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 	struct pmemfile_block_desc *block = starting_block;
 	struct pmemfile_block_desc *last_block = starting_block;
 
+	if (vinode_has_inline_data(vinode)) {
+		char *data = vinode->inode->inline_data + offset;
+
+		ASSERT(offset + len <= PMEMFILE_INODE_INLINE_DATA_SIZE);
+
+		if (dir == read_from_blocks)
+			memcpy(buf, data, len);
+		else
+			pmemfile_memcpy_nodrain(pfp, data, buf, len);
+
+		return starting_block;
+	}
+
+	/* range of written blocks, which were not initialized */
+	struct pmemfile_block_desc *first_uninit = NULL;
+	struct pmemfile_block_desc *last_uninit = NULL;
+
 	while (len > 0) {
 		/* Remember the pointer to block used last time */
 		if (block == NULL)
@@ -790,9 +965,16 @@ iterate_on_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 		if (dir == read_from_blocks)
 			read_block_range(pfp, block,
 				in_block_start, in_block_len, buf);
-		else
+		else {
+			if (!is_block_data_initialized(block)) {
+				if (!first_uninit)
+					first_uninit = block;
+				last_uninit = block;
+			}
+
 			write_block_range(pfp, block,
 				in_block_start, in_block_len, buf);
+		}
 
 		offset += in_block_len;
 		len -= in_block_len;
@@ -801,10 +983,174 @@ iterate_on_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 		block = PF_RW(pfp, block->next);
 	}
 
+	if (first_uninit)
+		mark_blocks_initialized(pfp, first_uninit, last_uninit);
+
 	return last_block;
 }
 
 
+/*
+ * Zeroes shared by all borrowed holes and uninitialized blocks. It's mapped
+ * read-only, so it costs only virtual address space and borrowers can't
+ * modify it for others.
+ */
+#define ZERO_REGION_SIZE (1 << 20)
+static const char *zero_region;
+
+/*
+ * data_init -- initializes data module
+ */
+void
+data_init(void)
+{
+	void *addr = mmap(NULL, ZERO_REGION_SIZE, PROT_READ,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		FATAL("!mmap zero region");
+
+	zero_region = addr;
+}
+
+/*
+ * borrow_file_range -- fills iov with pointers to file data in range
+ * [offset, offset + *len)
+ *
+ * Holes and uninitialized blocks are represented by pointers to a shared,
+ * zeroed region. Data stored inline is borrowed straight from the inode.
+ * Returns number of used iov entries and sets *len to number of bytes they
+ * cover, which can be less than requested if iovcnt entries were not enough.
+ */
+int
+borrow_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc *block, uint64_t offset,
+		uint64_t *len, pmemfile_iovec_t *iov, int iovcnt)
+{
+	uint64_t left = *len;
+	int used = 0;
+
+	if (vinode_has_inline_data(vinode)) {
+		iov[0].iov_base = vinode->inode->inline_data + offset;
+		iov[0].iov_len = *len;
+		return 1;
+	}
+
+	/* block is the one with the highest offset <= offset, or NULL */
+	while (left > 0) {
+		char *ptr = NULL;
+		uint64_t seg;
+
+		if (is_offset_in_block(block, offset)) {
+			uint64_t in_block_start = offset - block->offset;
+
+			seg = block->size - in_block_start;
+			if (left < seg)
+				seg = left;
+
+			if (is_block_data_initialized(block))
+				ptr = PF_RW(pfp, block->data) + in_block_start;
+		} else {
+			struct pmemfile_block_desc *next =
+				find_following_block(pfp, vinode, block);
+
+			if (next != NULL && next->offset <= offset) {
+				block = next;
+				continue;
+			}
+
+			/* hole till the next block or till the end of range */
+			seg = left;
+			if (next != NULL && next->offset - offset < seg)
+				seg = next->offset - offset;
+		}
+
+		if (ptr == NULL) {
+			/* iovec can't point to const memory */
+			ptr = (char *)zero_region;
+			if (seg > ZERO_REGION_SIZE)
+				seg = ZERO_REGION_SIZE;
+		}
+
+		if (used > 0 && ptr != zero_region &&
+				(char *)iov[used - 1].iov_base +
+				iov[used - 1].iov_len == ptr) {
+			iov[used - 1].iov_len += seg;
+		} else {
+			if (used == iovcnt)
+				break;
+
+			iov[used].iov_base = ptr;
+			iov[used].iov_len = seg;
+			used++;
+		}
+
+		offset += seg;
+		left -= seg;
+	}
+
+	*len -= left;
+
+	return used;
+}
+
+/*
+ * vinode_inline_to_blocks -- moves data stored in the inode to blocks, so
+ * the file can grow past the inline data size or be handled by code which
+ * works on blocks
+ *
+ * Does nothing if the data is not stored inline. Vinode must be locked in
+ * write mode.
+ */
+int
+vinode_inline_to_blocks(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+
+	ASSERT_NOT_IN_TX();
+
+	if (!inode_has_inline_data(inode))
+		return 0;
+
+	if (vinode->blocks == NULL) {
+		int err = vinode_rebuild_block_tree(pfp, vinode);
+		if (err)
+			return -err;
+	}
+
+	uint64_t size = inode_get_size(inode);
+	int error = 0;
+
+	vinode_snapshot(vinode);
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		inode_tx_set_flags(inode, inode_get_flags(inode) &
+				~(uint64_t)PMEMFILE_S_INLINE_DATA);
+
+		if (size > 0) {
+			size_t allocated_space =
+				inode_get_allocated_space(inode) +
+				vinode_allocate_interval(pfp, vinode, 0, size);
+
+			/*
+			 * Blocks are freshly allocated in this transaction,
+			 * so their data doesn't have to be added to it.
+			 */
+			iterate_on_file_range(pfp, vinode,
+					find_closest_block(vinode, 0), 0, size,
+					inode->inline_data, write_to_blocks);
+
+			inode_tx_set_allocated_space(inode, allocated_space);
+		}
+	} TX_ONABORT {
+		error = errno;
+		if (error == ENOMEM)
+			error = ENOSPC;
+		vinode_restore_on_abort(vinode);
+	} TX_END
+
+	return error;
+}
+
 /*
  * is_block_contained_by_interval -- see vinode_remove_interval
  * for explanation.
@@ -882,6 +1228,8 @@ is_block_at_right_edge(struct pmemfile_block_desc *block,
  *
  * At this point, the file size is not changed, but the corresponding file
  * contents would remain zero bytes, if they were not snapshotted.
+ *
+ * Blocks zeroed partially must not be shared, see vinode_unshare_edges.
  */
 size_t
 vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
@@ -909,7 +1257,7 @@ vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			 *           | block |
 			 */
 			deallocated_space += block->size;
-			remove_block(vinode->blocks, block);
+			block_cache_remove_block_in_tx(vinode, block);
 			block = block_list_remove(pfp, vinode, block);
 
 		} else if (is_interval_contained_by_block(block, offset, len)) {
@@ -922,6 +1270,8 @@ vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			 * -----+---+---------+--+-----
 			 *      |    block       |
 			 */
+			ASSERT(!(block->flags & BLOCK_SHARED));
+
 			if (is_block_data_initialized(block)) {
 				uint64_t block_offset = offset - block->offset;
 
@@ -946,6 +1296,8 @@ vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			 *                                 intersection
 			 */
 
+			ASSERT(!(block->flags & BLOCK_SHARED));
+
 			if (is_block_data_initialized(block))
 				TX_MEMSET(PF_RW(pfp, block->data), 0,
 					offset + len - block->offset);
@@ -963,6 +1315,8 @@ vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 			 *      intersection
 			 */
 
+			ASSERT(!(block->flags & BLOCK_SHARED));
+
 			if (is_block_data_initialized(block)) {
 				uint64_t block_offset = offset - block->offset;
 				uint64_t zero_len = block->size - block_offset;
@@ -979,3 +1333,403 @@ vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 
 	return deallocated_space;
 }
+
+/*
+ * vinode_zero_interval -- zeroes [offset, offset + len) range of a file
+ * without writing zeroes over whole blocks
+ *
+ * Whole blocks in the range are marked as uninitialized (which makes them
+ * read as zeroes), only parts of blocks at the edges of the range are zeroed.
+ * Whole shared blocks are removed instead, because data of an uninitialized
+ * block can be overwritten in place. Holes are not allocated, returns
+ * the amount of space deallocated by removing shared blocks.
+ *
+ * Blocks zeroed partially must not be shared, see vinode_unshare_edges.
+ * Must be called in a transaction.
+ */
+size_t
+vinode_zero_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	ASSERT_IN_TX();
+	ASSERT(len > 0);
+
+	vinode->block_pointer_invalidation_counter++;
+
+	size_t deallocated_space = 0;
+
+	struct pmemfile_block_desc *block =
+			find_closest_block(vinode, offset + len - 1);
+
+	while (block != NULL && block->offset + block->size > offset) {
+		if (!is_block_contained_by_interval(block, offset, len)) {
+			ASSERT(!(block->flags & BLOCK_SHARED));
+
+			if (is_block_data_initialized(block)) {
+				uint64_t start = block->offset < offset ?
+					offset - block->offset : 0;
+				uint64_t end = offset + len - block->offset;
+				if (end > block->size)
+					end = block->size;
+
+				pmemobj_tx_add_range(block->data.oid, start,
+					end - start);
+				memset(PF_RW(pfp, block->data) + start, 0,
+					end - start);
+			}
+		} else if (block->flags & BLOCK_SHARED) {
+			deallocated_space += block->size;
+			block_cache_remove_block_in_tx(vinode, block);
+			block = block_list_remove(pfp, vinode, block);
+			continue;
+		} else if (is_block_data_initialized(block)) {
+			TX_ADD_FIELD_DIRECT(block, flags);
+			block->flags &= ~(uint32_t)BLOCK_INITIALIZED;
+		}
+
+		block = PF_RW(pfp, block->prev);
+	}
+
+	return deallocated_space;
+}
+
+/*
+ * unshare_block -- gives block its own copy of shared data
+ *
+ * Old data can still be freed by other owners, so it fails with EBUSY when
+ * somebody borrows it from this file (see vinode_check_leases).
+ */
+static int
+unshare_block(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc *block)
+{
+	ASSERT_NOT_IN_TX();
+
+	int error = vinode_check_leases(vinode, block->offset, block->size);
+	if (error)
+		return error;
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		block_data_unshare(pfp, block);
+	} TX_ONABORT {
+		error = errno;
+		if (error == ENOMEM)
+			error = ENOSPC;
+	} TX_END
+
+	return error;
+}
+
+/*
+ * vinode_unshare_interval -- makes sure no block intersecting
+ * [offset, offset + len) shares data with other blocks, so it can be modified
+ * in place
+ *
+ * Vinode must be locked in write mode.
+ */
+int
+vinode_unshare_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	ASSERT(len > 0);
+
+	uint64_t end = offset + len < offset ? UINT64_MAX : offset + len;
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, offset);
+	if (!is_offset_in_block(block, offset))
+		block = find_following_block(pfp, vinode, block);
+
+	while (block != NULL && block->offset < end) {
+		if (block->flags & BLOCK_SHARED) {
+			int error = unshare_block(pfp, vinode, block);
+			if (error)
+				return error;
+		}
+
+		block = PF_RW(pfp, block->next);
+	}
+
+	return 0;
+}
+
+/*
+ * vinode_unshare_edges -- unshares blocks which are going to be zeroed
+ * partially by vinode_remove_interval(offset, len)
+ *
+ * Vinode must be locked in write mode.
+ */
+int
+vinode_unshare_edges(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	ASSERT(len > 0);
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, offset);
+	if (is_offset_in_block(block, offset) && block->offset < offset &&
+			(block->flags & BLOCK_SHARED)) {
+		int error = unshare_block(pfp, vinode, block);
+		if (error)
+			return error;
+	}
+
+	if (offset + len <= offset)
+		return 0;
+
+	uint64_t end = offset + len;
+
+	block = find_closest_block(vinode, end - 1);
+	if (is_offset_in_block(block, end - 1) &&
+			is_offset_in_block(block, end) &&
+			(block->flags & BLOCK_SHARED))
+		return unshare_block(pfp, vinode, block);
+
+	return 0;
+}
+
+/*
+ * vinode_is_interval_splittable -- returns true if no block of vinode
+ * crosses boundaries of [offset, offset + len) interval
+ */
+bool
+vinode_is_interval_splittable(struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	ASSERT(len > 0);
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, offset);
+	if (is_offset_in_block(block, offset) && block->offset < offset)
+		return false;
+
+	block = find_closest_block(vinode, offset + len - 1);
+	if (is_offset_in_block(block, offset + len - 1) &&
+			is_offset_in_block(block, offset + len))
+		return false;
+
+	return true;
+}
+
+/*
+ * vinode_share_block -- replaces [offset, offset + src->size) range of
+ * vinode by a block pointing to data of src, which can belong to any file
+ *
+ * No block of vinode can cross boundaries of the range (see
+ * vinode_is_interval_splittable). Must be called in a transaction.
+ */
+void
+vinode_share_block(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, struct pmemfile_block_desc *src)
+{
+	ASSERT_IN_TX();
+	ASSERT(offset % block_alignment == 0);
+	ASSERT(is_block_data_initialized(src));
+
+	struct pmemfile_inode *inode = vinode->inode;
+
+	block_data_share(pfp, src);
+
+	/* src can be moved by vinode_remove_interval if it's in vinode */
+	TOID(char) data = src->data;
+	uint32_t size = src->size;
+
+	size_t allocated_space = inode_get_allocated_space(inode) -
+			vinode_remove_interval(pfp, vinode, offset, size);
+
+	struct pmemfile_block_desc *prev = find_closest_block(vinode, offset);
+	ASSERT(prev == NULL || prev->offset + prev->size <= offset);
+
+	struct pmemfile_block_desc *block =
+			block_list_insert_after(pfp, vinode, prev);
+	block->offset = offset;
+	block->data = data;
+	block->size = size;
+	block->flags = BLOCK_INITIALIZED | BLOCK_SHARED;
+	block_cache_insert_block_in_tx(pfp, vinode, block);
+
+	inode_tx_set_shared_blocks(inode);
+	vinode->has_shared_blocks = true;
+
+	inode_tx_set_allocated_space(inode, allocated_space + size);
+}
+
+/*
+ * vinode_merge_blocks -- replaces the blocks covering exactly
+ * [offset, offset + len) range of vinode by one block
+ *
+ * Blocks must be adjacent and not shared, and len must be the size of a data
+ * allocation class. Data of uninitialized blocks is zeroed in the new block,
+ * unless none of the blocks was initialized. Must be called in a transaction.
+ */
+void
+vinode_merge_blocks(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	ASSERT_IN_TX();
+
+	const struct pmem_block_info *info = data_block_info(len, len);
+	ASSERTeq(info->size, len);
+
+	struct pmemfile_block_desc *first = find_closest_block(vinode, offset);
+	ASSERTne(first, NULL);
+	ASSERTeq(first->offset, offset);
+
+	bool initialized = false;
+	for (struct pmemfile_block_desc *block = first;
+			block != NULL && block->offset < offset + len;
+			block = PF_RW(pfp, block->next)) {
+		ASSERT(!(block->flags & BLOCK_SHARED));
+		ASSERT(block->offset + block->size <= offset + len);
+		if (is_block_data_initialized(block))
+			initialized = true;
+	}
+
+	TOID(char) data = TX_XALLOC(char, len,
+			POBJ_XALLOC_NO_FLUSH | info->class_id);
+
+	/* new object doesn't need undo log, commit drains the copy */
+	if (initialized) {
+		char *dst = PF_RW(pfp, data);
+
+		for (struct pmemfile_block_desc *block = first;
+				block != NULL && block->offset < offset + len;
+				block = PF_RW(pfp, block->next)) {
+			char *b = dst + (block->offset - offset);
+
+			if (is_block_data_initialized(block))
+				pmemfile_memcpy_nodrain(pfp, b,
+					PF_RO(pfp, block->data), block->size);
+			else
+				pmemfile_memset_nodrain(pfp, b, 0, block->size);
+		}
+	}
+
+	/* the removed blocks take exactly as much space as the new one */
+	size_t removed = vinode_remove_interval(pfp, vinode, offset, len);
+	ASSERTeq(removed, len);
+
+	struct pmemfile_block_desc *prev = find_closest_block(vinode, offset);
+	ASSERT(prev == NULL || prev->offset + prev->size <= offset);
+
+	struct pmemfile_block_desc *block =
+			block_list_insert_after(pfp, vinode, prev);
+	block->offset = offset;
+	block->data = data;
+	block->size = (uint32_t)len;
+	block->flags = initialized ? BLOCK_INITIALIZED : 0;
+	block_cache_insert_block_in_tx(pfp, vinode, block);
+}
+
+/*
+ * allocate_copies -- covers [offset, end) range of a file by new blocks of
+ * the largest sizes which fit, with contents copied from src (if it's not
+ * NULL)
+ *
+ * The range must be a hole, with prev being the last block before it.
+ */
+static void
+allocate_copies(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc *prev, uint64_t offset, uint64_t end,
+		const char *src)
+{
+	while (offset < end) {
+		const struct pmem_block_info *info =
+				data_block_info(end - offset, end - offset);
+
+		struct pmemfile_block_desc *block =
+				block_list_insert_after(pfp, vinode, prev);
+		block->offset = offset;
+		file_allocate_block_data(pfp, block, info);
+
+		/* new object doesn't need undo log, commit drains the copy */
+		if (src) {
+			pmemfile_memcpy_nodrain(pfp, PF_RW(pfp, block->data),
+					src, info->size);
+			block->flags = BLOCK_INITIALIZED;
+			src += info->size;
+		}
+
+		block_cache_insert_block_in_tx(pfp, vinode, block);
+
+		offset += info->size;
+		prev = block;
+	}
+}
+
+/*
+ * vinode_split_block_at -- replaces block crossing offset (if there's one)
+ * by blocks covering the same range, with none of them crossing offset
+ *
+ * Copies at most one block of data. Offset must be aligned to block_alignment.
+ * Must be called in a transaction.
+ */
+void
+vinode_split_block_at(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset)
+{
+	ASSERT_IN_TX();
+	ASSERT(offset % block_alignment == 0);
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, offset);
+	if (!is_offset_in_block(block, offset) || block->offset == offset)
+		return;
+
+	vinode->block_pointer_invalidation_counter++;
+
+	uint64_t start = block->offset;
+	uint64_t end = block->offset + block->size;
+	const char *src = NULL;
+
+	/* freed data stays readable until the end of the transaction */
+	if (is_block_data_initialized(block))
+		src = PF_RO(pfp, block->data);
+
+	block_cache_remove_block_in_tx(vinode, block);
+	block_list_remove(pfp, vinode, block);
+
+	struct pmemfile_block_desc *prev = find_closest_block(vinode, start);
+	ASSERT(prev == NULL || prev->offset + prev->size <= start);
+
+	allocate_copies(pfp, vinode, prev, start, offset, src);
+
+	prev = find_closest_block(vinode, offset - 1);
+	allocate_copies(pfp, vinode, prev, offset, end,
+			src ? src + (offset - start) : NULL);
+}
+
+/*
+ * vinode_shift_blocks -- moves all blocks at offsets higher than or equal to
+ * from to offsets starting at to
+ *
+ * Blocks can't cross from and blocks can't be moved over other blocks,
+ * so their order doesn't change. Must be called in a transaction.
+ */
+void
+vinode_shift_blocks(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t from, uint64_t to)
+{
+	ASSERT_IN_TX();
+
+	/* unsigned arithmetic - adding delta can move blocks down */
+	uint64_t delta = to - from;
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, from);
+	ASSERT(block == NULL || block->offset >= from ||
+			block->offset + block->size <= from);
+
+	if (block == NULL || block->offset < from)
+		block = find_following_block(pfp, vinode, block);
+
+	if (block == NULL)
+		return;
+
+	vinode->block_pointer_invalidation_counter++;
+
+	for (; block != NULL; block = PF_RW(pfp, block->next)) {
+		TX_ADD_FIELD_DIRECT(block, offset);
+		block->offset += delta;
+	}
+
+	if (vinode->index)
+		block_index_shift(vinode->index, from, delta);
+	else
+		offset_map_shift(vinode->blocks, from, delta);
+}
@@ -35,16 +35,39 @@
 #include "inode.h"
 
 extern bool pmemfile_overallocate_on_append;
+extern size_t pmemfile_inline_data_size;
+
+void data_init(void);
 
 int vinode_rebuild_block_tree(PMEMfilepool *pfp,
 			struct pmemfile_vinode *vinode);
 size_t vinode_remove_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 		uint64_t offset, uint64_t len);
+size_t vinode_zero_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len);
 size_t vinode_allocate_interval(PMEMfilepool *pfp,
 		struct pmemfile_vinode *vinode, uint64_t offset, uint64_t size);
 bool vinode_is_interval_allocated(PMEMfilepool *pfp,
 		struct pmemfile_vinode *vinode, uint64_t offset, uint64_t size,
 		const struct pmemfile_block_desc *last_block);
+bool vinode_is_interval_initialized(PMEMfilepool *pfp,
+		struct pmemfile_vinode *vinode, uint64_t offset, uint64_t size,
+		const struct pmemfile_block_desc *last_block);
+
+int vinode_unshare_interval(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len);
+int vinode_unshare_edges(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len);
+bool vinode_is_interval_splittable(struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len);
+void vinode_share_block(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, struct pmemfile_block_desc *src);
+void vinode_merge_blocks(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len);
+void vinode_split_block_at(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset);
+void vinode_shift_blocks(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t from, uint64_t to);
 
 struct pmemfile_block_desc *find_closest_block(struct pmemfile_vinode *vinode,
 		uint64_t off);
@@ -62,4 +85,17 @@ struct pmemfile_block_desc *iterate_on_file_range(PMEMfilepool *pfp,
 		struct pmemfile_block_desc *starting_block, uint64_t offset,
 		uint64_t len, char *buf, enum cpy_direction dir);
 
+pmemfile_ssize_t vinode_pwritev_locked(PMEMfilepool *pfp,
+		struct pmemfile_vinode *vinode, size_t offset,
+		const pmemfile_iovec_t *iov, int iovcnt);
+pmemfile_ssize_t vinode_pwrite_locked(PMEMfilepool *pfp,
+		struct pmemfile_vinode *vinode, size_t offset, const void *buf,
+		size_t count);
+
+int borrow_file_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc *block, uint64_t offset,
+		uint64_t *len, pmemfile_iovec_t *iov, int iovcnt);
+
+int vinode_inline_to_blocks(PMEMfilepool *pfp, struct pmemfile_vinode *vinode);
+
 #endif
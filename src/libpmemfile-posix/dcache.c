@@ -0,0 +1,489 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * dcache.c -- pool-wide cache of path component lookups
+ *
+ * Path resolution looks up every component in its parent directory, which
+ * means taking the parent's lock and searching its entries. The cache maps
+ * (parent vinode, name) pairs to child vinodes, or to nothing when the name
+ * doesn't exist (negative entry), so repeated lookups of the same paths
+ * (including missing ones) don't have to touch directories at all.
+ *
+ * The cache is a direct mapped table, so a new entry simply replaces
+ * whatever was in its slot. Positive entries hold a reference to the child
+ * vinode.
+ *
+ * Every directory vinode has a generation number, drawn from a pool-wide
+ * counter when the vinode is created and every time an entry is added to
+ * or removed from the directory. Cache entries remember the generation of
+ * their parent and are valid only as long as it doesn't change. Because
+ * generations are never reused, entries keyed by a freed vinode can't match
+ * a new vinode allocated at the same address.
+ *
+ * A stale positive entry would keep its child alive until it's replaced,
+ * so code removing a name from a directory also drops the entry of this
+ * name (dcache_forget), once the transaction is over.
+ *
+ * Readers don't take any locks. Each entry has a sequence counter, which
+ * is odd while the entry is being modified, and readers retry (or rather
+ * report a miss) when it changed while they were copying the entry. Names
+ * and vinodes are freed with rcu_free, so readers can safely dereference
+ * them even if the entry was replaced in the meantime. Writers serialize
+ * on striped mutexes.
+ */
+
+#include <string.h>
+
+#include "alloc.h"
+#include "dcache.h"
+#include "inode.h"
+#include "os_thread.h"
+#include "out.h"
+#include "pool.h"
+#include "rcu.h"
+#include "utils.h"
+
+#define DCACHE_LOCKS 64
+#define DCACHE_COUNTERS 16
+
+size_t pmemfile_dcache_size = 4096;
+
+struct dcache_name {
+	struct rcu_head rcu;
+	char name[];
+};
+
+struct dcache_entry {
+	/* odd while the entry is being modified */
+	uint32_t seq;
+
+	/* parent directory, used only as a key - may be already freed */
+	struct pmemfile_vinode *parent;
+	uint64_t gen;
+
+	uint64_t hash;
+	struct dcache_name *name;
+	size_t namelen;
+
+	/* referenced vinode of the child, NULL for a negative entry */
+	struct pmemfile_vinode *child;
+};
+
+struct dcache {
+	/* number of entries, power of 2 or 0 */
+	size_t nslots;
+	struct dcache_entry *slots;
+
+	/* modifications of entry i are serialized by locks[i % DCACHE_LOCKS] */
+	os_mutex_t locks[DCACHE_LOCKS];
+
+	/* source of directory generations */
+	uint64_t gen;
+
+	/* statistics, spread over cache lines to not bounce them on lookups */
+	struct dcache_counters {
+		uint64_t hits;
+		uint64_t negative_hits;
+		uint64_t misses;
+		char padding[64 - 3 * sizeof(uint64_t)];
+	} counters[DCACHE_COUNTERS];
+};
+
+/* only address is used, to pick counters of the current thread */
+static __thread char dcache_thread;
+
+/*
+ * dcache_alloc -- allocates a cache with space for at least size entries
+ */
+struct dcache *
+dcache_alloc(size_t size)
+{
+	struct dcache *dc = pf_calloc(1, sizeof(*dc));
+	if (!dc)
+		return NULL;
+
+	if (size) {
+		dc->nslots = 1;
+		while (dc->nslots < size)
+			dc->nslots <<= 1;
+
+		dc->slots = pf_calloc(dc->nslots, sizeof(dc->slots[0]));
+		if (!dc->slots) {
+			pf_free(dc);
+			return NULL;
+		}
+	}
+
+	for (unsigned i = 0; i < DCACHE_LOCKS; ++i)
+		os_mutex_init(&dc->locks[i]);
+
+	return dc;
+}
+
+/*
+ * dcache_free -- drops all entries and frees the cache
+ *
+ * Can't be called in a transaction.
+ */
+void
+dcache_free(PMEMfilepool *pfp)
+{
+	struct dcache *dc = pfp->dcache;
+
+	dcache_flush(pfp);
+
+	for (unsigned i = 0; i < DCACHE_LOCKS; ++i)
+		os_mutex_destroy(&dc->locks[i]);
+
+	pf_free(dc->slots);
+	pf_free(dc);
+	pfp->dcache = NULL;
+}
+
+/*
+ * dcache_write_begin -- locks entry i for modification
+ */
+static struct dcache_entry *
+dcache_write_begin(struct dcache *dc, size_t i)
+{
+	struct dcache_entry *e = &dc->slots[i];
+
+	os_mutex_lock(&dc->locks[i % DCACHE_LOCKS]);
+
+	__atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	return e;
+}
+
+/*
+ * dcache_write_end -- publishes modification of entry i
+ */
+static void
+dcache_write_end(struct dcache *dc, size_t i)
+{
+	struct dcache_entry *e = &dc->slots[i];
+
+	__atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+
+	os_mutex_unlock(&dc->locks[i % DCACHE_LOCKS]);
+}
+
+/*
+ * dcache_entry_drop -- releases name and child of an entry taken out of
+ * the cache
+ *
+ * Can't be called in a transaction.
+ */
+static void
+dcache_entry_drop(PMEMfilepool *pfp, struct dcache_entry *old)
+{
+	if (old->name)
+		rcu_free(&old->name->rcu, old->name);
+	if (old->child)
+		vinode_unref(pfp, old->child);
+}
+
+/*
+ * dcache_flush -- drops all entries and their references
+ *
+ * Can't be called in a transaction.
+ */
+void
+dcache_flush(PMEMfilepool *pfp)
+{
+	struct dcache *dc = pfp->dcache;
+
+	ASSERT_NOT_IN_TX();
+
+	for (size_t i = 0; i < dc->nslots; ++i) {
+		struct dcache_entry *e = dcache_write_begin(dc, i);
+		struct dcache_entry old = *e;
+
+		e->name = NULL;
+		e->child = NULL;
+		dcache_write_end(dc, i);
+
+		dcache_entry_drop(pfp, &old);
+	}
+}
+
+/*
+ * dcache_invalidate -- gives directory a new generation, which makes all
+ * cached lookups in it stale
+ *
+ * Called for new vinodes and by code adding or removing directory entries.
+ * Caller must have exclusive access to dir or it must not be visible to
+ * other threads yet.
+ */
+void
+dcache_invalidate(PMEMfilepool *pfp, struct pmemfile_vinode *dir)
+{
+	__atomic_store_n(&dir->dcache_gen,
+			__sync_add_and_fetch(&pfp->dcache->gen, 1),
+			__ATOMIC_RELEASE);
+}
+
+static size_t
+dcache_slot(struct dcache *dc, uint64_t hash)
+{
+	return (hash ^ (hash >> 32)) & (dc->nslots - 1);
+}
+
+static uint64_t
+dcache_hash(struct pmemfile_vinode *parent, const char *name, size_t namelen)
+{
+	return str_hash(name, namelen) ^
+			((uint64_t)(uintptr_t)parent * 0x9E3779B97F4A7C15ULL);
+}
+
+static bool
+dcache_entry_matches(struct dcache_entry *e, struct pmemfile_vinode *parent,
+		uint64_t hash, const char *name, size_t namelen)
+{
+	return e->name && e->parent == parent && e->hash == hash &&
+			e->namelen == namelen &&
+			memcmp(e->name->name, name, namelen) == 0;
+}
+
+/*
+ * dcache_peek -- looks up name in parent directory without taking any
+ * locks or references
+ *
+ * On DCACHE_HIT stores the child in *child. It stays valid (but not
+ * necessarily alive - check its reference counter or sequence counter)
+ * until the end of the read-side section.
+ *
+ * Must be called in rcu read-side section.
+ */
+enum dcache_result
+dcache_peek(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *name, size_t namelen,
+		struct pmemfile_vinode **child)
+{
+	struct dcache *dc = pfp->dcache;
+
+	if (dc->nslots == 0)
+		return DCACHE_MISS;
+
+	uint64_t hash = dcache_hash(parent, name, namelen);
+	struct dcache_entry *e = &dc->slots[dcache_slot(dc, hash)];
+
+	uint32_t seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return DCACHE_MISS;
+
+	struct dcache_entry copy;
+	copy.parent = __atomic_load_n(&e->parent, __ATOMIC_RELAXED);
+	copy.gen = __atomic_load_n(&e->gen, __ATOMIC_RELAXED);
+	copy.hash = __atomic_load_n(&e->hash, __ATOMIC_RELAXED);
+	copy.name = __atomic_load_n(&e->name, __ATOMIC_RELAXED);
+	copy.namelen = __atomic_load_n(&e->namelen, __ATOMIC_RELAXED);
+	copy.child = __atomic_load_n(&e->child, __ATOMIC_RELAXED);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+		return DCACHE_MISS;
+
+	if (!dcache_entry_matches(&copy, parent, hash, name, namelen))
+		return DCACHE_MISS;
+
+	if (copy.gen != __atomic_load_n(&parent->dcache_gen, __ATOMIC_ACQUIRE))
+		return DCACHE_MISS;
+
+	if (!copy.child)
+		return DCACHE_NEGATIVE;
+
+	*child = copy.child;
+	return DCACHE_HIT;
+}
+
+/*
+ * dcache_count -- adds n lookups with result res to statistics
+ */
+void
+dcache_count(PMEMfilepool *pfp, enum dcache_result res, uint64_t n)
+{
+	struct dcache *dc = pfp->dcache;
+
+	if (dc->nslots == 0)
+		return;
+
+	uint64_t id = (uint64_t)(uintptr_t)&dcache_thread *
+			0x9E3779B97F4A7C15ULL;
+	struct dcache_counters *c = &dc->counters[(id >> 32) % DCACHE_COUNTERS];
+
+	if (res == DCACHE_HIT)
+		__sync_fetch_and_add(&c->hits, n);
+	else if (res == DCACHE_NEGATIVE)
+		__sync_fetch_and_add(&c->negative_hits, n);
+	else
+		__sync_fetch_and_add(&c->misses, n);
+}
+
+/*
+ * dcache_lookup -- looks up name in parent directory
+ *
+ * On DCACHE_HIT takes reference on the child and stores it in *child.
+ * DCACHE_NEGATIVE means the name doesn't exist.
+ *
+ * Caller must hold reference to parent, but doesn't need to lock it.
+ */
+enum dcache_result
+dcache_lookup(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *name, size_t namelen,
+		struct pmemfile_vinode **child)
+{
+	enum dcache_result res = DCACHE_MISS;
+
+	if (pfp->dcache->nslots == 0 || !rcu_read_lock())
+		return DCACHE_MISS;
+
+	res = dcache_peek(pfp, parent, name, namelen, child);
+
+	/* entry may have been dropped and its child freed in the meantime */
+	if (res == DCACHE_HIT && !vinode_tryref(pfp, *child))
+		res = DCACHE_MISS;
+
+	rcu_read_unlock();
+
+	dcache_count(pfp, res, 1);
+
+	return res;
+}
+
+/*
+ * dcache_insert -- caches result of a lookup of name in parent directory
+ *
+ * child can be NULL, which means the name doesn't exist. Returns vinode
+ * of the replaced entry (or NULL), which caller must unref.
+ *
+ * Caller must hold parent lock from the lookup until this call, so that
+ * the result isn't already stale.
+ */
+struct pmemfile_vinode *
+dcache_insert(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *name, size_t namelen,
+		struct pmemfile_vinode *child)
+{
+	struct dcache *dc = pfp->dcache;
+
+	if (dc->nslots == 0)
+		return NULL;
+
+	struct dcache_name *copy = pf_malloc(sizeof(*copy) + namelen);
+	if (!copy)
+		return NULL;
+	memcpy(copy->name, name, namelen);
+
+	uint64_t hash = dcache_hash(parent, name, namelen);
+	size_t i = dcache_slot(dc, hash);
+	struct dcache_entry *e = dcache_write_begin(dc, i);
+
+	struct dcache_entry old = *e;
+
+	e->parent = parent;
+	e->gen = parent->dcache_gen;
+	e->hash = hash;
+	e->name = copy;
+	e->namelen = namelen;
+	e->child = child ? vinode_ref(pfp, child) : NULL;
+
+	dcache_write_end(dc, i);
+
+	if (old.name)
+		rcu_free(&old.name->rcu, old.name);
+
+	return old.child;
+}
+
+/*
+ * dcache_forget -- drops cached lookup of name in parent directory
+ *
+ * Called after name was removed from parent (or started pointing to
+ * a different inode), to drop reference to the old child.
+ *
+ * Can't be called in a transaction.
+ */
+void
+dcache_forget(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *name, size_t namelen)
+{
+	struct dcache *dc = pfp->dcache;
+
+	ASSERT_NOT_IN_TX();
+
+	if (dc->nslots == 0)
+		return;
+
+	uint64_t hash = dcache_hash(parent, name, namelen);
+	size_t i = dcache_slot(dc, hash);
+	struct dcache_entry *e = dcache_write_begin(dc, i);
+	struct dcache_entry old;
+
+	/* stale entries are dropped too - they may still hold a reference */
+	if (dcache_entry_matches(e, parent, hash, name, namelen)) {
+		old = *e;
+		e->name = NULL;
+		e->child = NULL;
+	} else {
+		old.name = NULL;
+		old.child = NULL;
+	}
+
+	dcache_write_end(dc, i);
+
+	dcache_entry_drop(pfp, &old);
+}
+
+/*
+ * dcache_stats -- fills cache counters of pool statistics
+ */
+void
+dcache_stats(PMEMfilepool *pfp, struct pmemfile_stats *stats)
+{
+	struct dcache *dc = pfp->dcache;
+
+	stats->dcache_hits = 0;
+	stats->dcache_negative_hits = 0;
+	stats->dcache_misses = 0;
+
+	for (unsigned i = 0; i < DCACHE_COUNTERS; ++i) {
+		struct dcache_counters *c = &dc->counters[i];
+
+		stats->dcache_hits += __sync_fetch_and_add(&c->hits, 0);
+		stats->dcache_negative_hits +=
+				__sync_fetch_and_add(&c->negative_hits, 0);
+		stats->dcache_misses += __sync_fetch_and_add(&c->misses, 0);
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * dcache.h -- pool-wide cache of path component lookups
+ */
+
+#ifndef PMEMFILE_DCACHE_H
+#define PMEMFILE_DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libpmemfile-posix.h"
+
+struct pmemfile_vinode;
+struct dcache;
+
+/* number of entries of a cache, 0 disables the cache */
+extern size_t pmemfile_dcache_size;
+
+enum dcache_result {
+	DCACHE_MISS,
+	DCACHE_HIT,
+	DCACHE_NEGATIVE,
+};
+
+struct dcache *dcache_alloc(size_t size);
+void dcache_free(PMEMfilepool *pfp);
+void dcache_flush(PMEMfilepool *pfp);
+
+void dcache_invalidate(PMEMfilepool *pfp, struct pmemfile_vinode *dir);
+
+enum dcache_result dcache_peek(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent, const char *name,
+		size_t namelen, struct pmemfile_vinode **child);
+void dcache_count(PMEMfilepool *pfp, enum dcache_result res, uint64_t n);
+enum dcache_result dcache_lookup(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent, const char *name,
+		size_t namelen, struct pmemfile_vinode **child);
+struct pmemfile_vinode *dcache_insert(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent, const char *name,
+		size_t namelen, struct pmemfile_vinode *child);
+void dcache_forget(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *name, size_t namelen);
+
+void dcache_stats(PMEMfilepool *pfp, struct pmemfile_stats *stats);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * defrag.c -- pmemfile_defrag implementation
+ *
+ * A file grown by small writes is made of many small blocks. pmemfile_defrag
+ * replaces groups of adjacent blocks by single blocks of the largest data
+ * allocation class that fits. A group is merged only if its total size is
+ * exactly the size of an allocation class, so no block is ever split.
+ * Blocks shared with other files (see block_ref.c) are left alone.
+ *
+ * Every group is merged in its own transaction and the vinode lock is
+ * released between groups, so the file stays usable while it's being
+ * defragmented.
+ */
+
+#include "block_array.h"
+#include "blocks.h"
+#include "callbacks.h"
+#include "data.h"
+#include "file.h"
+#include "libpmemfile-posix.h"
+#include "mmap.h"
+#include "out.h"
+#include "pool.h"
+#include "utils.h"
+
+/*
+ * is_data_block_size -- returns true if size is the size of a data
+ * allocation class
+ */
+static bool
+is_data_block_size(size_t size)
+{
+	return data_block_info(size, size)->size == size;
+}
+
+/*
+ * find_merge_group -- returns the size of the largest group of adjacent
+ * blocks, starting at block, which can be replaced by one block, or 0 if
+ * there's no such group
+ */
+static uint64_t
+find_merge_group(PMEMfilepool *pfp, struct pmemfile_block_desc *block,
+		uint64_t end)
+{
+	size_t max = data_block_info(MAX_BLOCK_SIZE, MAX_BLOCK_SIZE)->size;
+	uint64_t start = block->offset;
+	uint64_t len = 0;
+	uint64_t group = 0;
+	unsigned count = 0;
+
+	while (block != NULL && block->offset == start + len &&
+			block->offset < end &&
+			!(block->flags & BLOCK_SHARED)) {
+		len += block->size;
+		if (len > max)
+			break;
+
+		if (++count > 1 && is_data_block_size(len))
+			group = len;
+
+		block = PF_RW(pfp, block->next);
+	}
+
+	return group;
+}
+
+/*
+ * vinode_defrag_step -- merges the first group of blocks in
+ * [*offset, end) range and moves *offset past it; vinode must be locked
+ * in write mode
+ *
+ * Sets *offset to end when there's nothing more to merge.
+ */
+static int
+vinode_defrag_step(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t *offset, uint64_t end)
+{
+	ASSERT_NOT_IN_TX();
+
+	if (vinode->blocks == NULL) {
+		int error = vinode_rebuild_block_tree(pfp, vinode);
+		if (error)
+			return -error;
+	}
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, *offset);
+	if (block == NULL || block->offset + block->size <= *offset)
+		block = block ? PF_RW(pfp, block->next) : vinode->first_block;
+
+	uint64_t len = 0;
+	while (block != NULL && block->offset < end) {
+		len = find_merge_group(pfp, block, end);
+		if (len > 0)
+			break;
+		block = PF_RW(pfp, block->next);
+	}
+
+	if (len == 0) {
+		*offset = end;
+		return 0;
+	}
+
+	uint64_t start = block->offset;
+
+	/* blocks of borrowed ranges can't be freed */
+	int error = vinode_check_leases(vinode, start, len);
+	if (error)
+		return error;
+	vinode_detach_mappings(pfp, vinode, start, len);
+
+	vinode_snapshot(vinode);
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		vinode_merge_blocks(pfp, vinode, start, len);
+	} TX_ONABORT {
+		if (errno == ENOMEM)
+			errno = ENOSPC;
+		error = errno;
+		vinode_restore_on_abort(vinode);
+	} TX_END
+
+	*offset = start + len;
+
+	return error;
+}
+
+/*
+ * pmemfile_defrag -- replaces runs of small blocks in
+ * [offset, offset + length) range of file by bigger blocks
+ */
+int
+pmemfile_defrag(PMEMfilepool *pfp, PMEMfile *file, pmemfile_off_t offset,
+		pmemfile_off_t length)
+{
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!file) {
+		LOG(LUSR, "NULL file");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (offset < 0 || length < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	os_mutex_lock(&file->mutex);
+	uint64_t flags = file->flags;
+	struct pmemfile_vinode *vinode = file->vinode;
+	os_mutex_unlock(&file->mutex);
+
+	if ((flags & PFILE_WRITE) == 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (!vinode_is_regular_file(vinode)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	uint64_t off = (uint64_t)offset;
+	uint64_t end = off + (uint64_t)length;
+	int error = 0;
+
+	while (off < end && error == 0) {
+		vinode_wrlock_unleased(vinode, off, end - off);
+		error = vinode_defrag_step(pfp, vinode, &off, end);
+
+		/* merged blocks may start before off */
+		if (error == EBUSY) {
+			vinode_unlock_wait_leases(vinode);
+			error = 0;
+			continue;
+		}
+
+		os_rwlock_unlock(&vinode->rwlock);
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
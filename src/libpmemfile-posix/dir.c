@@ -38,11 +38,15 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "alloc.h"
 #include "blocks.h"
 #include "callbacks.h"
+#include "dcache.h"
 #include "dir.h"
+#include "dir_hash.h"
+#include "dir_index.h"
 
 #include "compiler_utils.h"
 #include "file.h"
@@ -51,8 +55,12 @@
 #include "locks.h"
 #include "os_thread.h"
 #include "out.h"
+#include "rcu.h"
 #include "utils.h"
 
+/* directories smaller than that are scanned without building an index */
+#define DIR_INDEX_MIN_SIZE (4 * METADATA_BLOCK_SIZE)
+
 /*
  * vinode_set_debug_path_locked -- sets full path in runtime
  * structures of child_inode based on parent inode and name.
@@ -133,14 +141,134 @@ vinode_replace_debug_path_locked(PMEMfilepool *pfp,
 }
 
 /*
- * inode_add_dirent -- adds child inode to parent directory
+ * dir_list_append_page -- appends new, empty page to a directory with a list
+ * of pages
+ */
+static struct pmemfile_dir *
+dir_list_append_page(PMEMfilepool *pfp, struct pmemfile_inode *parent,
+		struct pmemfile_dir *last)
+{
+	const struct pmem_block_info *info = metadata_block_info();
+
+	TX_ADD_DIRECT(&last->next);
+	last->next = TX_XALLOC(struct pmemfile_dir, info->size,
+		POBJ_XALLOC_ZERO | info->class_id);
+
+	struct pmemfile_dir *dir = PF_RW(pfp, last->next);
+	dir->version = PMEMFILE_DIR_VERSION(1);
+
+	size_t sz = METADATA_BLOCK_SIZE;
+
+	inode_tx_set_size(parent, inode_get_size(parent) + sz);
+
+	dir->num_elements = (uint32_t)(sz - sizeof(struct pmemfile_dir)) /
+			sizeof(struct pmemfile_dirent);
+
+	return dir;
+}
+
+/*
+ * dir_index_new_dirent -- returns empty entry of a directory with a list
+ * of pages, using free entry tracking of the name index
  *
- * Must be called in a transaction. Caller must have exclusive access to parent
- * inode, by locking parent in WRITE mode.
+ * Name must have been checked not to exist. Sets *page to the number of
+ * page holding the entry. Directory which is full and has more than
+ * pmemfile_dir_hash_threshold entries is converted to a hashed one.
  */
-void
-inode_add_dirent(PMEMfilepool *pfp,
+static struct pmemfile_dirent *
+dir_index_new_dirent(PMEMfilepool *pfp, struct pmemfile_inode *parent,
+		struct dir_index *idx, const char *name, size_t namelen,
+		size_t *page)
+{
+	struct pmemfile_dir *dir = dir_index_free_page(idx, page);
+
+	if (!dir) {
+		/* all pages are full, so every entry is in the index */
+		if (dir_index_entries(idx) >= pmemfile_dir_hash_threshold) {
+			dir_hash_convert(pfp, parent);
+			return dir_hash_new_dirent(pfp, parent, name, namelen);
+		}
+
+		bool empty;
+		struct pmemfile_dir *last = dir_index_last_page(idx, page,
+				&empty);
+
+		dir = dir_list_append_page(pfp, parent, last);
+
+		int ret = dir_index_add_page(idx, dir, dir->num_elements);
+		if (ret)
+			pmemfile_tx_abort(-ret);
+
+		*page = *page + 1;
+	}
+
+	dir_index_use_entry(idx, *page);
+
+	for (uint32_t i = 0; i < dir->num_elements; ++i) {
+		if (dir->dirents[i].name[0] == 0)
+			return &dir->dirents[i];
+	}
+
+	FATAL("free entry not found in directory page");
+}
+
+/*
+ * dir_list_new_dirent -- returns empty entry of a directory with a list of
+ * pages, after checking the name doesn't exist
+ *
+ * Directory which is full and has more than pmemfile_dir_hash_threshold
+ * entries is converted to a hashed one.
+ */
+static struct pmemfile_dirent *
+dir_list_new_dirent(PMEMfilepool *pfp, struct pmemfile_inode *parent,
+		const char *name, size_t namelen)
+{
+	struct pmemfile_dir *dir = &parent->file_data.dir;
+
+	struct pmemfile_dirent *dirent = NULL;
+	uint64_t slots = 0;
+
+	while (true) {
+		for (uint32_t i = 0; i < dir->num_elements; ++i) {
+			if (str_compare(dir->dirents[i].name, name,
+					namelen) == 0)
+				pmemfile_tx_abort(EEXIST);
+
+			if (!dirent && dir->dirents[i].name[0] == 0)
+				dirent = &dir->dirents[i];
+		}
+		slots += dir->num_elements;
+
+		if (TOID_IS_NULL(dir->next))
+			break;
+
+		dir = PF_RW(pfp, dir->next);
+	}
+
+	if (dirent)
+		return dirent;
+
+	if (slots >= pmemfile_dir_hash_threshold) {
+		dir_hash_convert(pfp, parent);
+		return dir_hash_new_dirent(pfp, parent, name, namelen);
+	}
+
+	return &dir_list_append_page(pfp, parent, dir)->dirents[0];
+}
+
+/*
+ * dir_add_dirent -- adds child inode to parent directory
+ *
+ * If the directory has a name index, it's used to check whether the name
+ * already exists and to find a free entry, otherwise all entries have to be
+ * compared. Returns the new entry and sets *page to the number of page
+ * holding it, if the index was used.
+ */
+static struct pmemfile_dirent *
+dir_add_dirent(PMEMfilepool *pfp,
 		TOID(struct pmemfile_inode) parent_tinode,
+		struct dir_index *idx,
+		size_t *page,
 		const char *name,
 		size_t namelen,
 		TOID(struct pmemfile_inode) child_tinode,
@@ -170,47 +298,23 @@ inode_add_dirent(PMEMfilepool *pfp,
 			pmemfile_tx_abort(ENOENT);
 	}
 
-	struct pmemfile_dir *dir = &parent->file_data.dir;
-
-	struct pmemfile_dirent *dirent = NULL;
-	bool found = false;
-
-	do {
-		for (uint32_t i = 0; i < dir->num_elements; ++i) {
-			if (str_compare(dir->dirents[i].name, name, namelen)
-					== 0)
-				pmemfile_tx_abort(EEXIST);
-
-			if (!found && dir->dirents[i].name[0] == 0) {
-				dirent = &dir->dirents[i];
-				found = true;
-			}
-		}
-
-		if (!found && TOID_IS_NULL(dir->next)) {
-			const struct pmem_block_info *info =
-				metadata_block_info();
-
-			TX_ADD_DIRECT(&dir->next);
-			dir->next = TX_XALLOC(struct pmemfile_dir, info->size,
-				POBJ_XALLOC_ZERO | info->class_id);
-
-			PF_RW(pfp, dir->next)->version =
-				PMEMFILE_DIR_VERSION(1);
-
-			size_t sz = METADATA_BLOCK_SIZE;
+	struct pmemfile_dirent *dirent;
 
-			inode_tx_set_size(parent, inode_get_size(parent) + sz);
+	if (inode_is_hashed_dir(parent)) {
+		if (dir_hash_lookup(pfp, parent, name, namelen))
+			pmemfile_tx_abort(EEXIST);
 
-			PF_RW(pfp, dir->next)->num_elements =
-				(uint32_t)(sz - sizeof(struct pmemfile_dir)) /
-					sizeof(struct pmemfile_dirent);
-		}
+		dirent = dir_hash_new_dirent(pfp, parent, name, namelen);
+	} else if (idx) {
+		if (dir_index_find(idx, name, namelen))
+			pmemfile_tx_abort(EEXIST);
 
-		dir = PF_RW(pfp, dir->next);
-	} while (dir);
+		dirent = dir_index_new_dirent(pfp, parent, idx, name, namelen,
+				page);
+	} else {
+		dirent = dir_list_new_dirent(pfp, parent, name, namelen);
+	}
 
-	ASSERT(dirent != NULL);
 	pmemobj_tx_add_range_direct(dirent,
 			sizeof(dirent->inode) + namelen + 1);
 
@@ -243,8 +347,388 @@ inode_add_dirent(PMEMfilepool *pfp,
 	 * and st_mtime fields of the parent directory."
 	 */
 	inode_tx_set_ctime(parent, tm);
+
+	return dirent;
 }
 
+/*
+ * inode_add_dirent -- adds child inode to parent directory which doesn't
+ * have a vinode yet
+ *
+ * Must be called in a transaction.
+ */
+void
+inode_add_dirent(PMEMfilepool *pfp,
+		TOID(struct pmemfile_inode) parent_tinode,
+		const char *name,
+		size_t namelen,
+		TOID(struct pmemfile_inode) child_tinode,
+		struct pmemfile_time tm)
+{
+	dir_add_dirent(pfp, parent_tinode, NULL, NULL, name, namelen,
+			child_tinode, tm);
+}
+
+/*
+ * vinode_drop_dir_index -- frees name index of a directory
+ *
+ * The index is just a cache, so it can be dropped at any time by someone
+ * holding the lock in WRITE mode. It will be rebuilt on next use.
+ */
+void
+vinode_drop_dir_index(struct pmemfile_vinode *vinode)
+{
+	if (!vinode->dir_index)
+		return;
+
+	dir_index_free(vinode->dir_index);
+	vinode->dir_index = NULL;
+}
+
+/*
+ * dir_index_abort_cb -- drops name index, which may contain changes of
+ * aborted transaction
+ */
+static void
+dir_index_abort_cb(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	(void) pfp;
+
+	vinode_drop_dir_index(vinode);
+}
+
+/*
+ * vinode_build_dir_index -- builds name index of a directory, if it's big
+ * enough to benefit from one
+ *
+ * Caller must hold lock on vinode in WRITE mode. Failure to build the index
+ * is not an error - lookups just fall back to scanning all entries.
+ */
+static void
+vinode_build_dir_index(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	if (vinode->dir_index || !vinode_is_dir(vinode) ||
+			inode_is_hashed_dir(vinode->inode))
+		return;
+
+	if (inode_get_size(vinode->inode) < DIR_INDEX_MIN_SIZE)
+		return;
+
+	vinode->dir_index = dir_index_build(pfp,
+			&vinode->inode->file_data.dir);
+	if (!vinode->dir_index)
+		LOG(LINF, "!building directory index failed");
+}
+
+/*
+ * vinode_dir_index_insert -- adds dirent stored in page number "page" to
+ * the name index of parent
+ *
+ * Must be called in a transaction, after the name was written to dirent.
+ * Caller must have exclusive access to parent.
+ */
+static void
+vinode_dir_index_insert(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		struct pmemfile_dirent *dirent, size_t page)
+{
+	(void) pfp;
+
+	ASSERT_IN_TX();
+
+	if (!parent->dir_index)
+		return;
+
+	cb_push_front(TX_STAGE_ONABORT, (cb_basic)dir_index_abort_cb, parent);
+
+	if (dir_index_insert(parent->dir_index, dirent, page))
+		vinode_drop_dir_index(parent);
+}
+
+/*
+ * vinode_dir_index_remove -- removes dirent from the name index of parent
+ * and returns number of the page holding it
+ *
+ * Must be called in a transaction, before the name in dirent is overwritten.
+ * Caller must have exclusive access to parent.
+ */
+static size_t
+vinode_dir_index_remove(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		struct pmemfile_dirent *dirent)
+{
+	(void) pfp;
+
+	ASSERT_IN_TX();
+
+	if (!parent->dir_index)
+		return 0;
+
+	cb_push_front(TX_STAGE_ONABORT, (cb_basic)dir_index_abort_cb, parent);
+
+	return dir_index_remove(parent->dir_index, dirent);
+}
+
+/*
+ * vinode_add_dirent -- adds child inode to parent directory
+ *
+ * Must be called in a transaction. Caller must have exclusive access to parent
+ * inode, by locking parent in WRITE mode.
+ */
+void
+vinode_add_dirent(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent,
+		const char *name,
+		size_t namelen,
+		TOID(struct pmemfile_inode) child_tinode,
+		struct pmemfile_time tm)
+{
+	dcache_invalidate(pfp, parent);
+
+	vinode_build_dir_index(pfp, parent);
+
+	/* free entry accounting of the index changes before the insert */
+	if (parent->dir_index)
+		cb_push_front(TX_STAGE_ONABORT, (cb_basic)dir_index_abort_cb,
+				parent);
+
+	size_t page = 0;
+	struct pmemfile_dirent *dirent = dir_add_dirent(pfp, parent->tinode,
+			parent->dir_index, &page, name, namelen, child_tinode,
+			tm);
+
+	/* directory might have been converted to a hashed one */
+	if (inode_is_hashed_dir(parent->inode)) {
+		vinode_drop_dir_index(parent);
+		return;
+	}
+
+	if (parent->dir_index &&
+			dir_index_insert(parent->dir_index, dirent, page))
+		vinode_drop_dir_index(parent);
+}
+
+/*
+ * vinode_add_dirents -- adds count freshly allocated child inodes to parent
+ * directory, using their creation times as the time of modification
+ *
+ * Directory with a list of pages gets a name index even if it's small, so
+ * that existing names and free slots are found in one scan of all pages
+ * instead of one scan per added entry.
+ *
+ * Must be called in a transaction. Caller must have exclusive access to parent
+ * inode, by locking parent in WRITE mode.
+ */
+void
+vinode_add_dirents(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent,
+		const char *const *names,
+		const TOID(struct pmemfile_inode) *child_tinodes,
+		size_t count)
+{
+	if (count > 1 && !parent->dir_index &&
+			!inode_is_hashed_dir(parent->inode)) {
+		parent->dir_index = dir_index_build(pfp,
+				&parent->inode->file_data.dir);
+		if (!parent->dir_index)
+			LOG(LINF, "!building directory index failed");
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		const struct pmemfile_inode *child =
+				PF_RO(pfp, child_tinodes[i]);
+
+		vinode_add_dirent(pfp, parent, names[i], strlen(names[i]),
+				child_tinodes[i], inode_get_ctime(child));
+	}
+}
+
+/*
+ * vinode_dir_list_shrink -- frees empty pages from the end of a directory
+ * with a list of pages
+ *
+ * Readdir offsets of the remaining entries don't change, but open files
+ * can't use their cached page pointers anymore.
+ */
+static void
+vinode_dir_list_shrink(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+	struct dir_index *idx = vinode->dir_index;
+	uint64_t freed = 0;
+
+	if (idx) {
+		size_t page;
+		bool empty;
+
+		dir_index_last_page(idx, &page, &empty);
+		while (page > 0 && empty) {
+			dir_index_remove_last_page(idx);
+
+			struct pmemfile_dir *prev =
+				dir_index_last_page(idx, &page, &empty);
+
+			TX_FREE(prev->next);
+			TX_SET_DIRECT(prev, next,
+					TOID_NULL(struct pmemfile_dir));
+			freed++;
+		}
+	} else {
+		struct pmemfile_dir *last_used = &inode->file_data.dir;
+
+		for (struct pmemfile_dir *dir = PF_RW(pfp, last_used->next);
+				dir; dir = PF_RW(pfp, dir->next)) {
+			for (uint32_t i = 0; i < dir->num_elements; ++i) {
+				if (dir->dirents[i].name[0] != 0) {
+					last_used = dir;
+					break;
+				}
+			}
+		}
+
+		TOID(struct pmemfile_dir) next = last_used->next;
+		if (!TOID_IS_NULL(next))
+			TX_SET_DIRECT(last_used, next,
+					TOID_NULL(struct pmemfile_dir));
+
+		while (!TOID_IS_NULL(next)) {
+			TOID(struct pmemfile_dir) tdir = next;
+
+			next = PF_RO(pfp, tdir)->next;
+			TX_FREE(tdir);
+			freed++;
+		}
+	}
+
+	if (freed == 0)
+		return;
+
+	inode_tx_set_size(inode,
+			inode_get_size(inode) - freed * METADATA_BLOCK_SIZE);
+	vinode->dir_page_invalidation_counter++;
+}
+
+/*
+ * vinode_remove_dirent -- removes entry from parent directory
+ *
+ * Doesn't touch the inode the entry points to and doesn't move other entries
+ * of the directory. Empty pages at the end of the directory are freed. Must be
+ * called in a transaction. Caller must have exclusive access to parent.
+ */
+void
+vinode_remove_dirent(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		struct pmemfile_dirent *dirent)
+{
+	ASSERT_IN_TX();
+
+	dcache_invalidate(pfp, parent);
+
+	if (inode_is_hashed_dir(parent->inode)) {
+		dir_hash_remove_dirent(pfp, parent->inode, dirent);
+		return;
+	}
+
+	size_t page = vinode_dir_index_remove(pfp, parent, dirent);
+
+	pmemobj_tx_add_range_direct(dirent, sizeof(dirent->inode) + 1);
+
+	dirent->name[0] = '\0';
+	dirent->inode = TOID_NULL(struct pmemfile_inode);
+
+	if (parent->dir_index)
+		dir_index_release_entry(parent->dir_index, page);
+
+	vinode_dir_list_shrink(pfp, parent);
+}
+
+/*
+ * vinode_shrink_dir -- gives back space of a directory from which entries
+ * were removed
+ *
+ * May move entries, so no pointers to entries of the directory can be used
+ * after this call. Must be called in a transaction. Caller must have exclusive
+ * access to vinode.
+ */
+void
+vinode_shrink_dir(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	ASSERT_IN_TX();
+
+	if (inode_is_hashed_dir(vinode->inode))
+		dir_hash_shrink(pfp, vinode->inode);
+}
+
+/*
+ * vinode_rename_dirent -- changes name of an entry of parent directory
+ *
+ * In hashed directory the entry may land in another bucket, so the returned
+ * pointer may differ from "dirent". Must be called in a transaction. Caller
+ * must have exclusive access to parent.
+ */
+struct pmemfile_dirent *
+vinode_rename_dirent(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		struct pmemfile_dirent *dirent, const char *name,
+		size_t namelen)
+{
+	ASSERT_IN_TX();
+	ASSERT(namelen <= PMEMFILE_MAX_FILE_NAME);
+
+	dcache_invalidate(pfp, parent);
+
+	if (!inode_is_hashed_dir(parent->inode)) {
+		size_t page = vinode_dir_index_remove(pfp, parent, dirent);
+
+		pmemobj_tx_add_range_direct(dirent->name, namelen + 1);
+		strncpy(dirent->name, name, namelen);
+		dirent->name[namelen] = '\0';
+
+		vinode_dir_index_insert(pfp, parent, dirent, page);
+
+		return dirent;
+	}
+
+	TOID(struct pmemfile_inode) tinode = dirent->inode;
+
+	vinode_remove_dirent(pfp, parent, dirent);
+
+	dirent = dir_hash_new_dirent(pfp, parent->inode, name, namelen);
+
+	pmemobj_tx_add_range_direct(dirent,
+			sizeof(dirent->inode) + namelen + 1);
+	dirent->inode = tinode;
+	strncpy(dirent->name, name, namelen);
+	dirent->name[namelen] = '\0';
+
+	return dirent;
+}
+
+/*
+ * vinode_rdlock_with_dir_index -- acquire read lock on a directory and build
+ * its name index if needed
+ *
+ * Works like vinode_rdlock_with_block_tree, except that the index is
+ * optional, so there's no need to retry if another thread dropped it while
+ * we weren't holding the lock.
+ */
+static void
+vinode_rdlock_with_dir_index(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	os_rwlock_rdlock(&vinode->rwlock);
+
+	/* hashed directories don't need the index */
+	if (vinode->dir_index || !vinode_is_dir(vinode) ||
+			inode_is_hashed_dir(vinode->inode) ||
+			inode_get_size(vinode->inode) < DIR_INDEX_MIN_SIZE)
+		return;
+
+	os_rwlock_unlock(&vinode->rwlock);
+
+	os_rwlock_wrlock(&vinode->rwlock);
+	vinode_build_dir_index(pfp, vinode);
+	os_rwlock_unlock(&vinode->rwlock);
+
+	os_rwlock_rdlock(&vinode->rwlock);
+}
+
+
 /*
  * vinode_lookup_dirent_by_name_locked -- looks up file name in passed directory
  *
@@ -273,6 +757,18 @@ vinode_lookup_dirent_by_name_locked(PMEMfilepool *pfp,
 	ASSERTne(namelen, 0);
 	ASSERTne(name[0], 0);
 
+	if (parent->dir_index || inode_is_hashed_dir(iparent)) {
+		struct pmemfile_dirent *d;
+
+		if (parent->dir_index)
+			d = dir_index_find(parent->dir_index, name, namelen);
+		else
+			d = dir_hash_lookup(pfp, iparent, name, namelen);
+		if (!d)
+			errno = ENOENT;
+		return d;
+	}
+
 	struct pmemfile_dir *dir = &iparent->file_data.dir;
 
 	while (dir != NULL) {
@@ -333,16 +829,16 @@ vinode_lookup_dirent_by_vinode_locked(PMEMfilepool *pfp,
 	}
 
 	struct pmemfile_dir *dir = &iparent->file_data.dir;
+	uint64_t bucket = 0;
 
 	while (dir != NULL) {
-		for (uint32_t i = 0; i < dir->num_elements; ++i) {
-			struct pmemfile_dirent *d = &dir->dirents[i];
-
+		for (struct pmemfile_dirent *d = dir_page_next_dirent(dir,
+				NULL); d; d = dir_page_next_dirent(dir, d)) {
 			if (TOID_EQUALS(d->inode, child->tinode))
 				return d;
 		}
 
-		dir = PF_RW(pfp, dir->next);
+		dir = dir_next_page(pfp, iparent, dir, &bucket);
 	}
 
 	errno = ENOENT;
@@ -377,8 +873,28 @@ vinode_lookup_dirent(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
 	}
 
 	struct pmemfile_vinode *vinode = NULL;
+	struct pmemfile_vinode *evicted = NULL;
 
-	os_rwlock_rdlock(&parent->rwlock);
+	/*
+	 * "." and ".." are not cached - entries pointing to the directory
+	 * itself or to its parent would keep them alive after rmdir.
+	 */
+	bool cacheable = str_compare(".", name, namelen) != 0 &&
+			str_compare("..", name, namelen) != 0;
+
+	if (cacheable) {
+		switch (dcache_lookup(pfp, parent, name, namelen, &vinode)) {
+		case DCACHE_HIT:
+			return vinode;
+		case DCACHE_NEGATIVE:
+			errno = ENOENT;
+			return NULL;
+		case DCACHE_MISS:
+			break;
+		}
+	}
+
+	vinode_rdlock_with_dir_index(pfp, parent);
 
 	if (str_compare("..", name, namelen) == 0) {
 		vinode = vinode_ref(pfp, parent->parent);
@@ -389,9 +905,18 @@ vinode_lookup_dirent(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
 		vinode_lookup_vinode_by_name_locked(pfp, parent, name, namelen);
 	vinode = info.vinode;
 
+	if (cacheable && (vinode || errno == ENOENT))
+		evicted = dcache_insert(pfp, parent, name, namelen, vinode);
+
 end:
 	os_rwlock_unlock(&parent->rwlock);
 
+	if (evicted) {
+		int oerrno = errno;
+		vinode_unref(pfp, evicted);
+		errno = oerrno;
+	}
+
 	return vinode;
 }
 
@@ -509,6 +1034,117 @@ resolve_pathat_nested(PMEMfilepool *pfp, const struct pmemfile_cred *cred,
 	}
 }
 
+/*
+ * resolve_pathat_rcu -- traverses directory structure like
+ * resolve_pathat_nested, but without taking any locks
+ *
+ * Components are looked up only in dcache and permissions of directories are
+ * read under their sequence counters. Only the final vinode is referenced.
+ *
+ * Returns false if path can't be resolved this way (a component is not
+ * cached, is a symlink or "..", walk raced with a modification or there was
+ * an error), in which case caller has to use the locked walk, which also
+ * fills the cache.
+ */
+static bool
+resolve_pathat_rcu(PMEMfilepool *pfp, const struct pmemfile_cred *cred,
+		struct pmemfile_vinode *parent, const char *path,
+		struct pmemfile_path_info *path_info, int flags)
+{
+	ASSERT_NOT_IN_TX();
+
+	if (path[0] == 0)
+		return false;
+
+	if (path[0] == '/') {
+		while (path[0] == '/')
+			path++;
+		parent = pfp->root[0];
+	}
+
+	const char *ending_slash = NULL;
+
+	size_t off = strlen(path);
+	while (off >= 1 && path[off - 1] == '/') {
+		ending_slash = path + off - 1;
+		off--;
+	}
+
+	int want = PFILE_WANT_EXECUTE;
+	if (flags & PMEMFILE_OPEN_PARENT_USE_EACCESS)
+		want |= PFILE_USE_EACCESS;
+	else if (flags & PMEMFILE_OPEN_PARENT_USE_RACCESS)
+		want |= PFILE_USE_RACCESS;
+
+	if (!rcu_read_lock())
+		return false;
+
+	bool resolved = false;
+	uint64_t hits = 0;
+
+	while (1) {
+		struct pmemfile_vinode *child;
+		const char *slash = strchr(path, '/');
+
+		if (slash == NULL || slash == ending_slash) {
+			resolved = true;
+			break;
+		}
+
+		size_t namelen = (uintptr_t)slash - (uintptr_t)path;
+		if (namelen > PMEMFILE_MAX_FILE_NAME)
+			break;
+
+		if (str_compare(".", path, namelen) == 0) {
+			child = parent;
+		} else if (str_compare("..", path, namelen) == 0) {
+			break;
+		} else {
+			if (dcache_peek(pfp, parent, path, namelen, &child) !=
+					DCACHE_HIT)
+				break;
+			hits++;
+		}
+
+		struct inode_perms child_perms;
+		if (!vinode_get_perms_rcu(child, &child_perms))
+			break;
+
+		if (PMEMFILE_S_ISLNK(child_perms.flags))
+			break;
+
+		if (PMEMFILE_S_ISDIR(child_perms.flags) &&
+				!can_access(cred, child_perms, want))
+			break;
+
+		parent = child;
+		path = slash + 1;
+
+		while (path[0] == '/')
+			path++;
+	}
+
+	if (resolved)
+		resolved = vinode_tryref(pfp, parent);
+
+	rcu_read_unlock();
+
+	if (!resolved)
+		return false;
+
+	dcache_count(pfp, DCACHE_HIT, hits);
+
+	path_info->remaining = strdup(path);
+	path_info->parent = parent;
+
+	if (!vinode_is_dir(path_info->parent))
+		path_info->error = ENOTDIR;
+	else if (more_than_1_component(path_info->remaining))
+		path_info->error = ENOENT;
+
+	return true;
+}
+
 /*
  * resolve_pathat - traverses directory structure
  *
@@ -530,6 +1166,9 @@ resolve_pathat(PMEMfilepool *pfp, const struct pmemfile_cred *cred,
 
 	memset(path_info, 0, sizeof(*path_info));
 
+	if (resolve_pathat_rcu(pfp, cred, parent, path, path_info, flags))
+		return;
+
 	resolve_pathat_nested(pfp, cred, parent, path, path_info, flags, 1);
 }
 
@@ -649,7 +1288,7 @@ lock_parent_and_child(PMEMfilepool *pfp,
 
 	size_t src_namelen = component_length(path->remaining);
 
-	os_rwlock_rdlock(&path->parent->rwlock);
+	vinode_rdlock_with_dir_index(pfp, path->parent);
 
 	/* resolve file */
 	*info = vinode_lookup_vinode_by_name_locked(pfp, path->parent,
@@ -668,6 +1307,8 @@ lock_parent_and_child(PMEMfilepool *pfp,
 	/* and now lock both inodes in correct order */
 	vinode_wrlock2(path->parent, info->vinode);
 
+	vinode_build_dir_index(pfp, path->parent);
+
 	/* another thread may have modified parent, refresh */
 	info->dirent = vinode_lookup_dirent_by_name_locked(pfp, path->parent,
 			path->remaining, src_namelen);
@@ -695,6 +1336,90 @@ race:
 	return 1;
 }
 
+/*
+ * lock_parent_and_many_children -- resolve count files with respect to parent
+ * directory and lock all inodes in write mode
+ *
+ * On success "children" holds referenced inodes of all files (the same inode
+ * may appear many times) and "vinodes" holds all locked inodes, without
+ * duplicates and NULL-terminated. "vinodes" must have room for count + 5
+ * entries.
+ *
+ * Returns 0 on success.
+ * Returns negated errno when failed.
+ * Returns 1 when there was a race.
+ */
+int
+lock_parent_and_many_children(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent,
+		const char *const *names,
+		size_t count,
+		struct pmemfile_vinode **children,
+		struct pmemfile_vinode **vinodes)
+{
+	ASSERT_NOT_IN_TX();
+
+	size_t i;
+
+	vinode_rdlock_with_dir_index(pfp, parent);
+
+	/* resolve files */
+	for (i = 0; i < count; ++i) {
+		struct pmemfile_dirent_info info =
+			vinode_lookup_vinode_by_name_locked(pfp, parent,
+					names[i], strlen(names[i]));
+		if (!info.vinode) {
+			int error = errno;
+
+			os_rwlock_unlock(&parent->rwlock);
+
+			while (i > 0)
+				vinode_unref(pfp, children[--i]);
+
+			return -error;
+		}
+
+		children[i] = info.vinode;
+	}
+
+	/* drop the lock on parent */
+	os_rwlock_unlock(&parent->rwlock);
+
+	/* and now lock all inodes in correct order */
+	vinodes[0] = parent;
+	memcpy(&vinodes[1], children, count * sizeof(children[0]));
+	vinode_wrlock_many(vinodes, count + 1);
+
+	vinode_build_dir_index(pfp, parent);
+
+	/* another thread may have modified parent, validate all files */
+	for (i = 0; i < count; ++i) {
+		struct pmemfile_dirent *dirent =
+			vinode_lookup_dirent_by_name_locked(pfp, parent,
+					names[i], strlen(names[i]));
+
+		/* file no longer exists */
+		if (!dirent)
+			goto race;
+
+		/* another thread replaced the file with another file */
+		if (!TOID_EQUALS(dirent->inode, children[i]->tinode))
+			goto race;
+	}
+
+	return 0;
+
+race:
+	vinode_unlockN(vinodes);
+
+	for (i = 0; i < count; ++i) {
+		vinode_unref(pfp, children[i]);
+		children[i] = NULL;
+	}
+
+	return 1;
+}
+
 /*
  * lock_parents_and_children -- resolve 2 files with respect to parent
  * directories and lock all 4 inodes in write mode
@@ -760,6 +1485,9 @@ lock_parents_and_children(PMEMfilepool *pfp,
 			src->parent, src_info->vinode,
 			dst->parent, dst_info->vinode);
 
+	vinode_build_dir_index(pfp, src->parent);
+	vinode_build_dir_index(pfp, dst->parent);
+
 	/* another thread may have modified [src|dst]_parent, refresh */
 	src_info->dirent = vinode_lookup_dirent_by_name_locked(pfp, src->parent,
 			src->remaining, src_namelen);
@@ -78,6 +78,28 @@ void inode_add_dirent(PMEMfilepool *pfp,
 		TOID(struct pmemfile_inode) child_tinode,
 		struct pmemfile_time tm);
 
+void vinode_add_dirent(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent,
+		const char *name,
+		size_t namelen,
+		TOID(struct pmemfile_inode) child_tinode,
+		struct pmemfile_time tm);
+
+void vinode_add_dirents(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent,
+		const char *const *names,
+		const TOID(struct pmemfile_inode) *child_tinodes,
+		size_t count);
+
+void vinode_remove_dirent(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		struct pmemfile_dirent *dirent);
+void vinode_shrink_dir(PMEMfilepool *pfp, struct pmemfile_vinode *vinode);
+struct pmemfile_dirent *vinode_rename_dirent(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent, struct pmemfile_dirent *dirent,
+		const char *name, size_t namelen);
+
+void vinode_drop_dir_index(struct pmemfile_vinode *vinode);
+
 void vinode_set_debug_path_locked(PMEMfilepool *pfp,
 		struct pmemfile_vinode *parent_vinode,
 		struct pmemfile_vinode *child_vinode,
@@ -111,6 +133,13 @@ int lock_parent_and_child(PMEMfilepool *pfp,
 		struct pmemfile_path_info *path,
 		struct pmemfile_dirent_info *info);
 
+int lock_parent_and_many_children(PMEMfilepool *pfp,
+		struct pmemfile_vinode *parent,
+		const char *const *names,
+		size_t count,
+		struct pmemfile_vinode **children,
+		struct pmemfile_vinode **vinodes);
+
 int lock_parents_and_children(PMEMfilepool *pfp,
 		struct pmemfile_path_info *src,
 		struct pmemfile_dirent_info *src_info,
@@ -0,0 +1,885 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * dir_hash.c -- persistent hash table of a directory
+ *
+ * Small directories keep their entries in a list of pmemfile_dir pages, so
+ * looking up a name means comparing it with every entry. Once a directory
+ * outgrows pmemfile_dir_hash_threshold entries, it's converted to a hash
+ * table, which stays fast right after the pool is opened.
+ *
+ * "." and ".." stay in the inode. All other entries live in buckets, which
+ * are lists of pmemfile_dir pages, and their bucket is picked by linear
+ * hashing: a bucket is split in two whenever the average number of entries
+ * per bucket exceeds DIR_HASH_LOAD. Splits happen one bucket at a time, so
+ * no single insert has to move more than one bucket worth of entries.
+ *
+ * Bucket pages hold compact entries, which take only as much space as their
+ * names need, and store 32 bits of the name hash, so lookups compare just
+ * a few bytes of most entries. Buckets made of pages with fixed-size entries
+ * (created by previous versions of the library) are converted on first
+ * insert.
+ *
+ * Buckets are addressed through pages of bucket pointers, which hang off the
+ * root page of the table. That limits the number of buckets to
+ * NUMTABLES_PER_DIR_HASH * NUMBUCKETS_PER_TABLE - after that bucket lists
+ * just grow.
+ *
+ * Readdir positions are name hashes with bits reversed. A bucket with depth
+ * "d" holds all hashes with the same "d" low bits, which is a contiguous
+ * range of reversed hashes, and splitting a bucket divides its range in two.
+ * So a position stays valid no matter how many buckets are split between
+ * two getdents calls.
+ *
+ * All modifying functions must be called in a transaction.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "blocks.h"
+#include "dir_hash.h"
+#include "inode.h"
+#include "out.h"
+#include "utils.h"
+
+/*
+ * Average number of entries per bucket which triggers a split. With names of
+ * typical length that many entries fit in one compact page.
+ */
+#define DIR_HASH_LOAD 48
+
+#define DIR_HASH_MAX_BUCKETS \
+	((uint64_t)NUMTABLES_PER_DIR_HASH * NUMBUCKETS_PER_TABLE)
+
+/* space for entries in a compact page */
+#define COMPACT_PAGE_SPACE \
+	(METADATA_BLOCK_SIZE - sizeof(struct pmemfile_dir_compact))
+
+/* size of the header of a compact entry */
+#define COMPACT_DIRENT_HDR_SIZE \
+	offsetof(struct pmemfile_compact_dirent, dirent)
+
+uint64_t pmemfile_dir_hash_threshold = 1024;
+
+static inline void *
+off_to_ptr(PMEMfilepool *pfp, uint64_t off)
+{
+	return (void *)((uintptr_t)pfp->pop + off);
+}
+
+/*
+ * name_hash -- returns hash of a name, used to pick a bucket
+ */
+static uint64_t
+name_hash(const char *name, size_t namelen)
+{
+	return str_hash(name, namelen) & (DIR_HASH_POS_END - 1);
+}
+
+/*
+ * reverse_hash -- reverses order of DIR_HASH_BITS low bits
+ */
+static uint64_t
+reverse_hash(uint64_t v)
+{
+	v = ((v >> 1) & 0x5555555555555555ULL) |
+		((v & 0x5555555555555555ULL) << 1);
+	v = ((v >> 2) & 0x3333333333333333ULL) |
+		((v & 0x3333333333333333ULL) << 2);
+	v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) |
+		((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	v = ((v >> 8) & 0x00FF00FF00FF00FFULL) |
+		((v & 0x00FF00FF00FF00FFULL) << 8);
+	v = ((v >> 16) & 0x0000FFFF0000FFFFULL) |
+		((v & 0x0000FFFF0000FFFFULL) << 16);
+	v = (v >> 32) | (v << 32);
+
+	return v >> (64 - DIR_HASH_BITS);
+}
+
+static TOID(struct pmemfile_dir)
+page_oid(struct pmemfile_dir *dir)
+{
+	return (TOID(struct pmemfile_dir))pmemobj_oid(dir);
+}
+
+static inline struct pmemfile_dir_hash *
+dir_hash_root(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	return PF_RW(pfp, inode->dir_hash);
+}
+
+static inline uint64_t
+bucket_count(const struct pmemfile_dir_hash *root)
+{
+	return (1ULL << root->level) + root->split;
+}
+
+/*
+ * bucket_index -- returns number of the bucket for specified hash
+ */
+static uint64_t
+bucket_index(const struct pmemfile_dir_hash *root, uint64_t hash)
+{
+	uint64_t b = hash & ((1ULL << root->level) - 1);
+
+	if (b < root->split)
+		b = hash & ((2ULL << root->level) - 1);
+
+	return b;
+}
+
+/*
+ * bucket_depth -- returns number of hash bits shared by entries of a bucket
+ */
+static unsigned
+bucket_depth(const struct pmemfile_dir_hash *root, uint64_t b)
+{
+	if (b < root->split || b >= (1ULL << root->level))
+		return root->level + 1;
+
+	return root->level;
+}
+
+static uint64_t *
+bucket_ptr(PMEMfilepool *pfp, struct pmemfile_dir_hash *root, uint64_t b)
+{
+	struct pmemfile_dir_hash_table *table = off_to_ptr(pfp,
+			root->tables[b / NUMBUCKETS_PER_TABLE]);
+
+	return &table->buckets[b % NUMBUCKETS_PER_TABLE];
+}
+
+static struct pmemfile_dir *
+bucket_get(PMEMfilepool *pfp, struct pmemfile_dir_hash *root, uint64_t b)
+{
+	return off_to_ptr(pfp, *bucket_ptr(pfp, root, b));
+}
+
+/*
+ * compact_dirent_size -- returns size of compact entry for a name of specified
+ * length
+ */
+static inline uint16_t
+compact_dirent_size(size_t namelen)
+{
+	size_t size = offsetof(struct pmemfile_compact_dirent, dirent.name) +
+			namelen + 1;
+
+	return (uint16_t)((size + 7) & ~(size_t)7);
+}
+
+/*
+ * page_alloc -- allocates new, empty page of compact entries
+ */
+static TOID(struct pmemfile_dir)
+page_alloc(PMEMfilepool *pfp)
+{
+	const struct pmem_block_info *info = metadata_block_info();
+
+	TOID(struct pmemfile_dir) tdir = TX_XALLOC(struct pmemfile_dir,
+			info->size, POBJ_XALLOC_ZERO | info->class_id);
+
+	struct pmemfile_dir_compact *page =
+			(struct pmemfile_dir_compact *)PF_RW(pfp, tdir);
+	page->version = DIR_COMPACT_VERSION;
+	page->used = 0;
+
+	return tdir;
+}
+
+/*
+ * bucket_add -- appends new, empty bucket to the table
+ *
+ * Returns number of allocated pages.
+ */
+static unsigned
+bucket_add(PMEMfilepool *pfp, struct pmemfile_dir_hash *root, uint64_t b)
+{
+	const struct pmem_block_info *info = metadata_block_info();
+	unsigned pages = 1;
+	uint64_t t = b / NUMBUCKETS_PER_TABLE;
+
+	if (root->tables[t] == 0) {
+		TOID(struct pmemfile_dir_hash_table) table =
+			TX_XALLOC(struct pmemfile_dir_hash_table, info->size,
+				POBJ_XALLOC_ZERO | info->class_id);
+		PF_RW(pfp, table)->version =
+				PMEMFILE_DIR_HASH_TABLE_VERSION(1);
+
+		TX_ADD_DIRECT(&root->tables[t]);
+		root->tables[t] = table.oid.off;
+		pages++;
+	}
+
+	uint64_t *ptr = bucket_ptr(pfp, root, b);
+	TX_ADD_DIRECT(ptr);
+	*ptr = page_alloc(pfp).oid.off;
+
+	return pages;
+}
+
+/*
+ * page_new_dirent -- returns empty entry for a name of specified length in
+ * a compact page, or NULL if there's no space for it
+ *
+ * Reuses the first hole which is big enough (splitting it if the rest can
+ * hold another entry) or appends a new entry to the used part of the page.
+ * Caller has to fill and snapshot the inode and the name.
+ */
+static struct pmemfile_dirent *
+page_new_dirent(struct pmemfile_dir_compact *page, uint64_t hash,
+		size_t namelen)
+{
+	struct pmemfile_dir *dir = (struct pmemfile_dir *)page;
+	uint16_t size = compact_dirent_size(namelen);
+	struct pmemfile_compact_dirent *e = NULL;
+
+	for (struct pmemfile_dirent *d = dir_page_next_dirent(dir, NULL); d;
+			d = dir_page_next_dirent(dir, d)) {
+		if (TOID_IS_NULL(d->inode) &&
+				compact_dirent(d)->size >= size) {
+			e = compact_dirent(d);
+			break;
+		}
+	}
+
+	if (e) {
+		pmemobj_tx_add_range_direct(e, COMPACT_DIRENT_HDR_SIZE);
+
+		if (e->size - size >= compact_dirent_size(1)) {
+			struct pmemfile_compact_dirent *rest =
+				(struct pmemfile_compact_dirent *)
+					((uintptr_t)e + size);
+
+			pmemobj_tx_add_range_direct(rest,
+				offsetof(struct pmemfile_compact_dirent,
+					dirent.name) + 1);
+			rest->hash = 0;
+			rest->size = (uint16_t)(e->size - size);
+			rest->namelen = 0;
+			rest->padding = 0;
+			rest->dirent.inode = TOID_NULL(struct pmemfile_inode);
+			rest->dirent.name[0] = '\0';
+
+			e->size = size;
+		}
+	} else {
+		if (COMPACT_PAGE_SPACE - page->used < size)
+			return NULL;
+
+		e = (struct pmemfile_compact_dirent *)&page->data[page->used];
+		pmemobj_tx_add_range_direct(e, COMPACT_DIRENT_HDR_SIZE);
+		e->size = size;
+		e->padding = 0;
+
+		TX_ADD_FIELD_DIRECT(page, used);
+		page->used += size;
+	}
+
+	e->hash = (uint32_t)hash;
+	e->namelen = (uint8_t)namelen;
+
+	return &e->dirent;
+}
+
+/*
+ * bucket_new_dirent -- returns empty entry in a bucket, appending new page
+ * if needed
+ *
+ * Increments *pages if a page was allocated.
+ */
+static struct pmemfile_dirent *
+bucket_new_dirent(PMEMfilepool *pfp, struct pmemfile_dir *dir,
+		uint64_t hash, size_t namelen, unsigned *pages)
+{
+	while (true) {
+		ASSERT(dir_page_is_compact(dir));
+
+		struct pmemfile_dirent *d = page_new_dirent(
+				(struct pmemfile_dir_compact *)dir, hash,
+				namelen);
+		if (d)
+			return d;
+
+		if (TOID_IS_NULL(dir->next))
+			break;
+
+		dir = PF_RW(pfp, dir->next);
+	}
+
+	TX_ADD_DIRECT(&dir->next);
+	dir->next = page_alloc(pfp);
+	(*pages)++;
+
+	return page_new_dirent(
+			(struct pmemfile_dir_compact *)PF_RW(pfp, dir->next),
+			hash, namelen);
+}
+
+/*
+ * dirent_move -- moves entry to a bucket
+ *
+ * Destination bucket must consist of pages allocated in the current
+ * transaction, so the new entry doesn't need to be snapshotted.
+ * Increments *pages if a page was allocated.
+ */
+static void
+dirent_move(PMEMfilepool *pfp, struct pmemfile_dir *bucket,
+		struct pmemfile_dirent *src, uint64_t hash, bool clear_src,
+		unsigned *pages)
+{
+	size_t len = strlen(src->name);
+	struct pmemfile_dirent *dst =
+			bucket_new_dirent(pfp, bucket, hash, len, pages);
+
+	dst->inode = src->inode;
+	memcpy(dst->name, src->name, len + 1);
+
+	if (clear_src) {
+		pmemobj_tx_add_range_direct(src, sizeof(src->inode) + 1);
+		src->name[0] = '\0';
+		src->inode = TOID_NULL(struct pmemfile_inode);
+	}
+}
+
+/*
+ * bucket_lookup -- looks up file name in a bucket
+ */
+static struct pmemfile_dirent *
+bucket_lookup(PMEMfilepool *pfp, struct pmemfile_dir *dir,
+		const char *name, size_t namelen, uint64_t hash)
+{
+	for (; dir; dir = PF_RW(pfp, dir->next)) {
+		bool compact = dir_page_is_compact(dir);
+
+		for (struct pmemfile_dirent *d = dir_page_next_dirent(dir,
+				NULL); d; d = dir_page_next_dirent(dir, d)) {
+			if (compact && (compact_dirent(d)->hash !=
+					(uint32_t)hash ||
+					compact_dirent(d)->namelen != namelen))
+				continue;
+
+			if (str_compare(d->name, name, namelen) == 0)
+				return d;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * bucket_compact -- converts bucket made of pages with fixed-size entries
+ * to compact pages
+ *
+ * Returns change of the number of pages.
+ */
+static int64_t
+bucket_compact(PMEMfilepool *pfp, struct pmemfile_dir_hash *root, uint64_t b)
+{
+	struct pmemfile_dir *dir = bucket_get(pfp, root, b);
+	if (dir_page_is_compact(dir))
+		return 0;
+
+	TOID(struct pmemfile_dir) tbucket = page_alloc(pfp);
+	struct pmemfile_dir *bucket = PF_RW(pfp, tbucket);
+	unsigned pages = 1;
+	int64_t freed = 0;
+
+	while (dir) {
+		ASSERT(!dir_page_is_compact(dir));
+
+		for (uint32_t i = 0; i < dir->num_elements; ++i) {
+			struct pmemfile_dirent *d = &dir->dirents[i];
+
+			if (d->name[0] == 0)
+				continue;
+
+			dirent_move(pfp, bucket, d,
+					name_hash(d->name, strlen(d->name)),
+					false, &pages);
+		}
+
+		TOID(struct pmemfile_dir) next = dir->next;
+		TX_FREE(page_oid(dir));
+		freed++;
+
+		dir = PF_RW(pfp, next);
+	}
+
+	uint64_t *ptr = bucket_ptr(pfp, root, b);
+	TX_ADD_DIRECT(ptr);
+	*ptr = tbucket.oid.off;
+
+	return (int64_t)pages - freed;
+}
+
+static void
+inode_tx_add_size(struct pmemfile_inode *inode, int64_t pages)
+{
+	inode_tx_set_size(inode, (uint64_t)((int64_t)inode_get_size(inode) +
+			pages * METADATA_BLOCK_SIZE));
+}
+
+/*
+ * dir_hash_split -- splits next bucket in two
+ */
+static void
+dir_hash_split(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		struct pmemfile_dir_hash *root)
+{
+	uint64_t src = root->split;
+	uint64_t dst = src + (1ULL << root->level);
+	uint64_t bit = 1ULL << root->level;
+
+	unsigned pages = bucket_add(pfp, root, dst);
+
+	struct pmemfile_dir *dst_dir = bucket_get(pfp, root, dst);
+	struct pmemfile_dir *dir = bucket_get(pfp, root, src);
+
+	while (dir) {
+		for (struct pmemfile_dirent *d = dir_page_next_dirent(dir,
+				NULL); d; d = dir_page_next_dirent(dir, d)) {
+			if (d->name[0] == 0)
+				continue;
+
+			uint64_t hash = name_hash(d->name, strlen(d->name));
+			if (!(hash & bit))
+				continue;
+
+			dirent_move(pfp, dst_dir, d, hash, true, &pages);
+		}
+
+		dir = PF_RW(pfp, dir->next);
+	}
+
+	TX_ADD_FIELD_DIRECT(root, split);
+	if (++root->split == bit) {
+		TX_ADD_FIELD_DIRECT(root, level);
+		root->level++;
+		root->split = 0;
+	}
+
+	inode_tx_add_size(inode, pages);
+}
+
+/*
+ * dir_hash_convert -- converts directory with a list of pages to a hashed one
+ *
+ * Bumps inode version, so the inode can't be opened by versions of the
+ * library which don't know about hashed directories.
+ */
+void
+dir_hash_convert(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	ASSERT_IN_TX();
+	ASSERT(!inode_is_hashed_dir(inode));
+
+	struct pmemfile_dir *first = &inode->file_data.dir;
+	uint64_t entries = 0;
+
+	for (struct pmemfile_dir *dir = PF_RW(pfp, first->next); dir;
+			dir = PF_RW(pfp, dir->next)) {
+		for (uint32_t i = 0; i < dir->num_elements; ++i) {
+			if (dir->dirents[i].name[0] != 0)
+				entries++;
+		}
+	}
+
+	const struct pmem_block_info *info = metadata_block_info();
+	TOID(struct pmemfile_dir_hash) troot = TX_XALLOC(
+			struct pmemfile_dir_hash, info->size,
+			POBJ_XALLOC_ZERO | info->class_id);
+	struct pmemfile_dir_hash *root = PF_RW(pfp, troot);
+
+	root->version = PMEMFILE_DIR_HASH_VERSION(1);
+	root->entries = entries;
+
+	/* start with buckets filled to about half of the split threshold */
+	while ((1ULL << root->level) * DIR_HASH_LOAD < 2 * entries &&
+			(2ULL << root->level) <= DIR_HASH_MAX_BUCKETS)
+		root->level++;
+
+	int64_t pages = 1;
+	for (uint64_t b = 0; b < (1ULL << root->level); ++b)
+		pages += bucket_add(pfp, root, b);
+
+	unsigned overflow = 0;
+	struct pmemfile_dir *dir = PF_RW(pfp, first->next);
+	while (dir) {
+		for (uint32_t i = 0; i < dir->num_elements; ++i) {
+			struct pmemfile_dirent *d = &dir->dirents[i];
+
+			if (d->name[0] == 0)
+				continue;
+
+			uint64_t hash = name_hash(d->name, strlen(d->name));
+			dirent_move(pfp, bucket_get(pfp, root,
+					bucket_index(root, hash)), d, hash,
+					false, &overflow);
+		}
+
+		TOID(struct pmemfile_dir) next = dir->next;
+		TX_FREE(page_oid(dir));
+		pages--;
+
+		dir = PF_RW(pfp, next);
+	}
+	pages += overflow;
+
+	TX_SET_DIRECT(first, next, TOID_NULL(struct pmemfile_dir));
+
+	inode_tx_add_size(inode, pages);
+
+	TX_SET_DIRECT(inode, dir_hash, troot);
+	TX_SET_DIRECT(inode, version, PMEMFILE_INODE_VERSION(4));
+}
+
+/*
+ * dir_hash_free -- frees all pages of a hashed directory
+ */
+void
+dir_hash_free(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	ASSERT_IN_TX();
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+
+	for (uint64_t b = 0; b < bucket_count(root); ++b) {
+		struct pmemfile_dir *dir = bucket_get(pfp, root, b);
+
+		while (dir) {
+			TOID(struct pmemfile_dir) next = dir->next;
+			TX_FREE(page_oid(dir));
+			dir = PF_RW(pfp, next);
+		}
+	}
+
+	for (unsigned t = 0; t < NUMTABLES_PER_DIR_HASH; ++t) {
+		if (root->tables[t] == 0)
+			break;
+
+		TX_FREE((TOID(struct pmemfile_dir_hash_table))
+			pmemobj_oid(off_to_ptr(pfp, root->tables[t])));
+	}
+
+	TX_FREE(inode->dir_hash);
+	TX_SET_DIRECT(inode, dir_hash, TOID_NULL(struct pmemfile_dir_hash));
+}
+
+/*
+ * dir_hash_lookup -- looks up file name in a hashed directory
+ */
+struct pmemfile_dirent *
+dir_hash_lookup(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		const char *name, size_t namelen)
+{
+	struct pmemfile_dir *dir = &inode->file_data.dir;
+
+	for (uint32_t i = 0; i < dir->num_elements; ++i) {
+		if (str_compare(dir->dirents[i].name, name, namelen) == 0)
+			return &dir->dirents[i];
+	}
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+	uint64_t hash = name_hash(name, namelen);
+
+	return bucket_lookup(pfp, bucket_get(pfp, root,
+			bucket_index(root, hash)), name, namelen, hash);
+}
+
+/*
+ * dir_hash_new_dirent -- returns empty entry for specified name
+ *
+ * May split a bucket, which moves other entries of the directory.
+ */
+struct pmemfile_dirent *
+dir_hash_new_dirent(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		const char *name, size_t namelen)
+{
+	ASSERT_IN_TX();
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+
+	TX_ADD_FIELD_DIRECT(root, entries);
+	root->entries++;
+
+	uint64_t buckets = bucket_count(root);
+	if (root->entries > buckets * DIR_HASH_LOAD &&
+			buckets < DIR_HASH_MAX_BUCKETS)
+		dir_hash_split(pfp, inode, root);
+
+	uint64_t hash = name_hash(name, namelen);
+	uint64_t b = bucket_index(root, hash);
+	int64_t pages = bucket_compact(pfp, root, b);
+
+	unsigned new_pages = 0;
+	struct pmemfile_dirent *dirent = bucket_new_dirent(pfp,
+			bucket_get(pfp, root, b), hash, namelen, &new_pages);
+	pages += new_pages;
+
+	if (pages)
+		inode_tx_add_size(inode, pages);
+
+	return dirent;
+}
+
+/*
+ * bucket_trim -- drops trailing free space of the page of bucket "b" holding
+ * "dirent", which has just been removed, and frees the page if it's empty
+ * and not the first one
+ *
+ * Returns number of freed pages.
+ */
+static int64_t
+bucket_trim(PMEMfilepool *pfp, struct pmemfile_dir_hash *root, uint64_t b,
+		const struct pmemfile_dirent *dirent)
+{
+	struct pmemfile_dir *prev = NULL;
+	struct pmemfile_dir *dir = bucket_get(pfp, root, b);
+
+	while ((uintptr_t)dirent - (uintptr_t)dir >= METADATA_BLOCK_SIZE) {
+		prev = dir;
+		dir = PF_RW(pfp, dir->next);
+		ASSERTne(dir, NULL);
+	}
+
+	/* old pages are converted on next insert */
+	if (!dir_page_is_compact(dir))
+		return 0;
+
+	struct pmemfile_dir_compact *page = (struct pmemfile_dir_compact *)dir;
+	uint32_t used = 0;
+
+	for (struct pmemfile_dirent *d = dir_page_next_dirent(dir, NULL); d;
+			d = dir_page_next_dirent(dir, d)) {
+		if (TOID_IS_NULL(d->inode))
+			continue;
+
+		struct pmemfile_compact_dirent *e = compact_dirent(d);
+		used = (uint32_t)((uintptr_t)e - (uintptr_t)page->data) +
+				e->size;
+	}
+
+	if (used == 0 && prev) {
+		TX_SET_DIRECT(prev, next, dir->next);
+		TX_FREE(page_oid(dir));
+		return 1;
+	}
+
+	if (used != page->used)
+		TX_SET_DIRECT(page, used, used);
+
+	return 0;
+}
+
+/*
+ * dir_hash_remove_dirent -- removes entry from a hashed directory
+ *
+ * Entries which were stored in the inode before conversion stay there and
+ * are not counted. Doesn't move other entries.
+ */
+void
+dir_hash_remove_dirent(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		struct pmemfile_dirent *dirent)
+{
+	ASSERT_IN_TX();
+
+	const struct pmemfile_dir *first = &inode->file_data.dir;
+	bool in_inode = dirent >= &first->dirents[0] &&
+			dirent < &first->dirents[first->num_elements];
+	uint64_t hash = 0;
+
+	if (!in_inode)
+		hash = name_hash(dirent->name, strlen(dirent->name));
+
+	pmemobj_tx_add_range_direct(dirent, sizeof(dirent->inode) + 1);
+	dirent->name[0] = '\0';
+	dirent->inode = TOID_NULL(struct pmemfile_inode);
+
+	if (in_inode)
+		return;
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+
+	ASSERTne(root->entries, 0);
+	TX_ADD_FIELD_DIRECT(root, entries);
+	root->entries--;
+
+	int64_t freed = bucket_trim(pfp, root, bucket_index(root, hash),
+			dirent);
+	if (freed)
+		inode_tx_add_size(inode, -freed);
+}
+
+/*
+ * dir_hash_merge -- merges the last bucket into the bucket it was split from
+ *
+ * Returns change of the number of pages.
+ */
+static int64_t
+dir_hash_merge(PMEMfilepool *pfp, struct pmemfile_dir_hash *root)
+{
+	TX_ADD_FIELD_DIRECT(root, split);
+	if (root->split == 0) {
+		TX_ADD_FIELD_DIRECT(root, level);
+		root->level--;
+		root->split = 1ULL << root->level;
+	}
+	root->split--;
+
+	uint64_t dst = root->split;
+	uint64_t src = dst + (1ULL << root->level);
+
+	int64_t pages = bucket_compact(pfp, root, dst);
+	unsigned new_pages = 0;
+
+	struct pmemfile_dir *dst_dir = bucket_get(pfp, root, dst);
+	struct pmemfile_dir *dir = bucket_get(pfp, root, src);
+
+	while (dir) {
+		for (struct pmemfile_dirent *d = dir_page_next_dirent(dir,
+				NULL); d; d = dir_page_next_dirent(dir, d)) {
+			if (d->name[0] == 0)
+				continue;
+
+			size_t len = strlen(d->name);
+			struct pmemfile_dirent *n = bucket_new_dirent(pfp,
+					dst_dir, name_hash(d->name, len), len,
+					&new_pages);
+
+			pmemobj_tx_add_range_direct(n,
+					sizeof(n->inode) + len + 1);
+			n->inode = d->inode;
+			memcpy(n->name, d->name, len + 1);
+		}
+
+		TOID(struct pmemfile_dir) next = dir->next;
+		TX_FREE(page_oid(dir));
+		pages--;
+
+		dir = PF_RW(pfp, next);
+	}
+
+	uint64_t *ptr = bucket_ptr(pfp, root, src);
+	TX_ADD_DIRECT(ptr);
+	*ptr = 0;
+
+	return pages + new_pages;
+}
+
+/*
+ * dir_hash_shrink -- merges a bucket if directory has much fewer entries than
+ * its buckets can hold
+ *
+ * Moves entries, so no pointers to entries of the directory can be used after
+ * this call.
+ */
+void
+dir_hash_shrink(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	ASSERT_IN_TX();
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+	uint64_t buckets = bucket_count(root);
+
+	if (buckets == 1 || root->entries >= buckets * DIR_HASH_LOAD / 4)
+		return;
+
+	int64_t pages = dir_hash_merge(pfp, root);
+	if (pages)
+		inode_tx_add_size(inode, pages);
+}
+
+/*
+ * dir_hash_entries -- returns number of entries of a hashed directory stored
+ * outside of the inode
+ */
+uint64_t
+dir_hash_entries(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	return dir_hash_root(pfp, inode)->entries;
+}
+
+/*
+ * dir_next_page -- returns page of a directory following "dir"
+ *
+ * Works for both formats. Iteration has to start from the page in the inode,
+ * with *bucket set to 0.
+ */
+struct pmemfile_dir *
+dir_next_page(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		struct pmemfile_dir *dir, uint64_t *bucket)
+{
+	if (!TOID_IS_NULL(dir->next))
+		return PF_RW(pfp, dir->next);
+
+	if (!inode_is_hashed_dir(inode))
+		return NULL;
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+	if (*bucket >= bucket_count(root))
+		return NULL;
+
+	return bucket_get(pfp, root, (*bucket)++);
+}
+
+/*
+ * dir_hash_pos -- returns readdir position of a name
+ */
+uint64_t
+dir_hash_pos(const char *name)
+{
+	return reverse_hash(name_hash(name, strlen(name)));
+}
+
+/*
+ * dir_hash_bucket_at -- returns bucket holding entries with readdir position
+ * "pos" and the end of its range of positions
+ */
+struct pmemfile_dir *
+dir_hash_bucket_at(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		uint64_t pos, uint64_t *end)
+{
+	ASSERT(pos < DIR_HASH_POS_END);
+
+	struct pmemfile_dir_hash *root = dir_hash_root(pfp, inode);
+	uint64_t b = bucket_index(root, reverse_hash(pos));
+	unsigned depth = bucket_depth(root, b);
+
+	*end = reverse_hash(b) + (DIR_HASH_POS_END >> depth);
+
+	return bucket_get(pfp, root, b);
+}
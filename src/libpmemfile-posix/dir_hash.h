@@ -0,0 +1,136 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * dir_hash.h -- persistent hash table of a directory
+ */
+
+#ifndef PMEMFILE_DIR_HASH_H
+#define PMEMFILE_DIR_HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "layout.h"
+#include "libpmemfile-posix.h"
+
+/* number of bits of name hash */
+#define DIR_HASH_BITS 61
+
+/* end of the space of readdir positions of a hashed directory */
+#define DIR_HASH_POS_END (1ULL << DIR_HASH_BITS)
+
+/*
+ * Directory offset of a readdir position of a hashed directory. Offsets
+ * below DIR_HASH_OFFSET(0) point to entries stored in the inode.
+ */
+#define DIR_HASH_OFFSET(pos) ((1ULL << 62) | (pos))
+
+/* number of entries after which a directory is converted to a hashed one */
+extern uint64_t pmemfile_dir_hash_threshold;
+
+static inline bool
+inode_is_hashed_dir(const struct pmemfile_inode *inode)
+{
+	return !TOID_IS_NULL(inode->dir_hash);
+}
+
+/* version of pages of compact entries */
+#define DIR_COMPACT_VERSION PMEMFILE_DIR_VERSION(3)
+
+static inline bool
+dir_page_is_compact(const struct pmemfile_dir *dir)
+{
+	return dir->version == DIR_COMPACT_VERSION;
+}
+
+static inline struct pmemfile_compact_dirent *
+compact_dirent(struct pmemfile_dirent *dirent)
+{
+	return (struct pmemfile_compact_dirent *)((uintptr_t)dirent -
+			offsetof(struct pmemfile_compact_dirent, dirent));
+}
+
+/*
+ * dir_page_next_dirent -- returns entry of a directory page following "prev",
+ * or the first one if "prev" is NULL
+ *
+ * Works for pages of all formats. Returns NULL at the end of the page.
+ * Returned entries may be empty.
+ */
+static inline struct pmemfile_dirent *
+dir_page_next_dirent(struct pmemfile_dir *dir, struct pmemfile_dirent *prev)
+{
+	if (!dir_page_is_compact(dir)) {
+		struct pmemfile_dirent *d = prev ? prev + 1 : &dir->dirents[0];
+
+		return d < &dir->dirents[dir->num_elements] ? d : NULL;
+	}
+
+	struct pmemfile_dir_compact *page = (struct pmemfile_dir_compact *)dir;
+	uint32_t off = 0;
+
+	if (prev) {
+		struct pmemfile_compact_dirent *e = compact_dirent(prev);
+
+		off = (uint32_t)((uintptr_t)e - (uintptr_t)page->data) +
+				e->size;
+	}
+
+	if (off >= page->used)
+		return NULL;
+
+	return &((struct pmemfile_compact_dirent *)&page->data[off])->dirent;
+}
+
+void dir_hash_convert(PMEMfilepool *pfp, struct pmemfile_inode *inode);
+void dir_hash_free(PMEMfilepool *pfp, struct pmemfile_inode *inode);
+
+struct pmemfile_dirent *dir_hash_lookup(PMEMfilepool *pfp,
+		struct pmemfile_inode *inode, const char *name, size_t namelen);
+struct pmemfile_dirent *dir_hash_new_dirent(PMEMfilepool *pfp,
+		struct pmemfile_inode *inode, const char *name, size_t namelen);
+void dir_hash_remove_dirent(PMEMfilepool *pfp, struct pmemfile_inode *inode,
+		struct pmemfile_dirent *dirent);
+void dir_hash_shrink(PMEMfilepool *pfp, struct pmemfile_inode *inode);
+uint64_t dir_hash_entries(PMEMfilepool *pfp, struct pmemfile_inode *inode);
+
+struct pmemfile_dir *dir_next_page(PMEMfilepool *pfp,
+		struct pmemfile_inode *inode, struct pmemfile_dir *dir,
+		uint64_t *bucket);
+
+uint64_t dir_hash_pos(const char *name);
+struct pmemfile_dir *dir_hash_bucket_at(PMEMfilepool *pfp,
+		struct pmemfile_inode *inode, uint64_t pos, uint64_t *end);
+
+#endif
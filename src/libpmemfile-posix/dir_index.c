@@ -0,0 +1,388 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * dir_index.c -- volatile name index of a directory
+ *
+ * Entries of a directory are kept in a chain of pmemfile_dir pages in no
+ * particular order, so finding a name means comparing it with every entry.
+ * For big directories we build an open addressing hash table mapping hashes
+ * of names to dirents. Collisions are resolved by linear probing and every
+ * hit is verified by comparing names, so the table doesn't have to store
+ * names.
+ *
+ * The index also tracks pages of the directory and number of free entries
+ * in each of them, so inserts can go straight to a page with a free entry
+ * and removals can tell when trailing pages become empty.
+ *
+ * The index is built on first use and is kept in sync by code which adds and
+ * removes entries. It holds pointers to persistent memory, so it can't
+ * survive pool suspend.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "dir_index.h"
+#include "layout.h"
+#include "out.h"
+#include "utils.h"
+
+#define DIR_INDEX_MIN_SLOTS 64
+
+/* marker of a removed entry, lookups have to probe past it */
+#define DIR_INDEX_TOMBSTONE ((struct pmemfile_dirent *)(uintptr_t)1)
+
+struct dir_index_slot {
+	uint64_t hash;
+	struct pmemfile_dirent *dirent;
+
+	/* number of the page holding dirent */
+	size_t page;
+};
+
+struct dir_index_page {
+	struct pmemfile_dir *dir;
+
+	/* number of free entries */
+	uint32_t free;
+};
+
+struct dir_index {
+	/* number of slots, power of 2 */
+	size_t nslots;
+
+	/* number of live entries */
+	size_t entries;
+
+	/* number of tombstones */
+	size_t removed;
+
+	struct dir_index_slot *slots;
+
+	/* pages of the directory, in list order */
+	struct dir_index_page *pages;
+	size_t npages;
+	size_t pages_size;
+
+	/* no page before this one has free entries */
+	size_t first_free;
+};
+
+/*
+ * slot_put -- puts dirent into the first free slot of its probe sequence
+ */
+static void
+slot_put(struct dir_index_slot *slots, size_t nslots, uint64_t hash,
+		struct pmemfile_dirent *dirent, size_t page)
+{
+	size_t mask = nslots - 1;
+	size_t i = hash & mask;
+
+	while (slots[i].dirent != NULL)
+		i = (i + 1) & mask;
+
+	slots[i].hash = hash;
+	slots[i].dirent = dirent;
+	slots[i].page = page;
+}
+
+/*
+ * dir_index_resize -- rehashes the index into a table with room for
+ * at least "entries" entries, dropping tombstones
+ */
+static int
+dir_index_resize(struct dir_index *idx, size_t entries)
+{
+	size_t nslots = DIR_INDEX_MIN_SLOTS;
+	while (nslots < 2 * entries)
+		nslots *= 2;
+
+	struct dir_index_slot *slots = pf_calloc(nslots, sizeof(*slots));
+	if (!slots)
+		return -errno;
+
+	for (size_t i = 0; i < idx->nslots; ++i) {
+		struct dir_index_slot *s = &idx->slots[i];
+
+		if (s->dirent != NULL && s->dirent != DIR_INDEX_TOMBSTONE)
+			slot_put(slots, nslots, s->hash, s->dirent, s->page);
+	}
+
+	pf_free(idx->slots);
+	idx->slots = slots;
+	idx->nslots = nslots;
+	idx->removed = 0;
+
+	return 0;
+}
+
+/*
+ * dir_index_insert -- adds dirent stored in page number "page" to the index
+ *
+ * Dirent must already contain the name. Doesn't change number of free entries
+ * of the page. Returns 0 on success, negative errno on failure.
+ */
+int
+dir_index_insert(struct dir_index *idx, struct pmemfile_dirent *dirent,
+		size_t page)
+{
+	/* keep at least half of slots empty, so probe sequences stay short */
+	if (2 * (idx->entries + idx->removed + 1) > idx->nslots) {
+		int ret = dir_index_resize(idx, 2 * (idx->entries + 1));
+		if (ret)
+			return ret;
+	}
+
+	slot_put(idx->slots, idx->nslots,
+			str_hash(dirent->name, strlen(dirent->name)), dirent,
+			page);
+	idx->entries++;
+
+	return 0;
+}
+
+/*
+ * dir_index_remove -- removes dirent from the index and returns number
+ * of the page holding it
+ *
+ * Must be called before the name in dirent is overwritten. Doesn't change
+ * number of free entries of the page.
+ */
+size_t
+dir_index_remove(struct dir_index *idx, struct pmemfile_dirent *dirent)
+{
+	size_t mask = idx->nslots - 1;
+	size_t i = str_hash(dirent->name, strlen(dirent->name)) & mask;
+
+	while (idx->slots[i].dirent != NULL) {
+		if (idx->slots[i].dirent == dirent) {
+			idx->slots[i].dirent = DIR_INDEX_TOMBSTONE;
+			idx->entries--;
+			idx->removed++;
+			return idx->slots[i].page;
+		}
+
+		i = (i + 1) & mask;
+	}
+
+	FATAL("dirent %s not found in directory index", dirent->name);
+}
+
+/*
+ * dir_index_entries -- returns number of entries in the index
+ */
+size_t
+dir_index_entries(struct dir_index *idx)
+{
+	return idx->entries;
+}
+
+/*
+ * dir_index_add_page -- appends page to the list of pages of the directory
+ *
+ * Returns 0 on success, negative errno on failure.
+ */
+int
+dir_index_add_page(struct dir_index *idx, struct pmemfile_dir *dir,
+		uint32_t free)
+{
+	if (idx->npages == idx->pages_size) {
+		size_t size = idx->pages_size ? 2 * idx->pages_size : 16;
+		struct dir_index_page *pages =
+			pf_realloc(idx->pages, size * sizeof(*pages));
+		if (!pages)
+			return -errno;
+
+		idx->pages = pages;
+		idx->pages_size = size;
+	}
+
+	idx->pages[idx->npages].dir = dir;
+	idx->pages[idx->npages].free = free;
+	idx->npages++;
+
+	return 0;
+}
+
+/*
+ * dir_index_free_page -- returns the first page with a free entry and its
+ * number, or NULL if all pages are full
+ */
+struct pmemfile_dir *
+dir_index_free_page(struct dir_index *idx, size_t *page)
+{
+	while (idx->first_free < idx->npages &&
+			idx->pages[idx->first_free].free == 0)
+		idx->first_free++;
+
+	if (idx->first_free == idx->npages)
+		return NULL;
+
+	*page = idx->first_free;
+	return idx->pages[idx->first_free].dir;
+}
+
+/*
+ * dir_index_use_entry -- accounts for an entry of page taken by new name
+ */
+void
+dir_index_use_entry(struct dir_index *idx, size_t page)
+{
+	ASSERT(page < idx->npages);
+	ASSERTne(idx->pages[page].free, 0);
+
+	idx->pages[page].free--;
+}
+
+/*
+ * dir_index_release_entry -- accounts for an entry of page freed by removal
+ * of a name
+ */
+void
+dir_index_release_entry(struct dir_index *idx, size_t page)
+{
+	ASSERT(page < idx->npages);
+
+	idx->pages[page].free++;
+	if (page < idx->first_free)
+		idx->first_free = page;
+}
+
+/*
+ * dir_index_last_page -- returns the last page of the directory, its number
+ * and whether all its entries are free
+ */
+struct pmemfile_dir *
+dir_index_last_page(struct dir_index *idx, size_t *page, bool *empty)
+{
+	ASSERTne(idx->npages, 0);
+
+	struct dir_index_page *last = &idx->pages[idx->npages - 1];
+
+	*page = idx->npages - 1;
+	*empty = last->free == last->dir->num_elements;
+
+	return last->dir;
+}
+
+/*
+ * dir_index_remove_last_page -- removes the last, empty page from the list
+ * of pages of the directory
+ */
+void
+dir_index_remove_last_page(struct dir_index *idx)
+{
+	ASSERT(idx->npages > 1);
+
+	idx->npages--;
+	if (idx->first_free > idx->npages)
+		idx->first_free = idx->npages;
+}
+
+/*
+ * dir_index_find -- looks up file name in the index
+ */
+struct pmemfile_dirent *
+dir_index_find(struct dir_index *idx, const char *name, size_t namelen)
+{
+	uint64_t hash = str_hash(name, namelen);
+	size_t mask = idx->nslots - 1;
+	size_t i = hash & mask;
+
+	while (idx->slots[i].dirent != NULL) {
+		struct dir_index_slot *s = &idx->slots[i];
+
+		if (s->dirent != DIR_INDEX_TOMBSTONE && s->hash == hash &&
+				str_compare(s->dirent->name, name,
+						namelen) == 0)
+			return s->dirent;
+
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+/*
+ * dir_index_build -- builds index of all entries of a directory
+ */
+struct dir_index *
+dir_index_build(PMEMfilepool *pfp, struct pmemfile_dir *dir)
+{
+	struct dir_index *idx = pf_calloc(1, sizeof(*idx));
+	if (!idx)
+		return NULL;
+
+	if (dir_index_resize(idx, 0))
+		goto err;
+
+	while (dir != NULL) {
+		size_t page = idx->npages;
+		uint32_t free = 0;
+
+		for (uint32_t i = 0; i < dir->num_elements; ++i) {
+			struct pmemfile_dirent *d = &dir->dirents[i];
+
+			if (d->name[0] == 0) {
+				free++;
+				continue;
+			}
+
+			if (dir_index_insert(idx, d, page))
+				goto err;
+		}
+
+		if (dir_index_add_page(idx, dir, free))
+			goto err;
+
+		dir = PF_RW(pfp, dir->next);
+	}
+
+	return idx;
+
+err:
+	dir_index_free(idx);
+	return NULL;
+}
+
+/*
+ * dir_index_free -- frees the index
+ */
+void
+dir_index_free(struct dir_index *idx)
+{
+	pf_free(idx->pages);
+	pf_free(idx->slots);
+	pf_free(idx);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * dir_index.h -- volatile name index of a directory
+ */
+
+#ifndef PMEMFILE_DIR_INDEX_H
+#define PMEMFILE_DIR_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libpmemfile-posix.h"
+
+struct pmemfile_dir;
+struct pmemfile_dirent;
+struct dir_index;
+
+struct dir_index *dir_index_build(PMEMfilepool *pfp,
+		struct pmemfile_dir *dir);
+void dir_index_free(struct dir_index *idx);
+
+struct pmemfile_dirent *dir_index_find(struct dir_index *idx,
+		const char *name, size_t namelen);
+int dir_index_insert(struct dir_index *idx, struct pmemfile_dirent *dirent,
+		size_t page);
+size_t dir_index_remove(struct dir_index *idx, struct pmemfile_dirent *dirent);
+size_t dir_index_entries(struct dir_index *idx);
+
+int dir_index_add_page(struct dir_index *idx, struct pmemfile_dir *dir,
+		uint32_t free);
+struct pmemfile_dir *dir_index_free_page(struct dir_index *idx, size_t *page);
+void dir_index_use_entry(struct dir_index *idx, size_t page);
+void dir_index_release_entry(struct dir_index *idx, size_t page);
+struct pmemfile_dir *dir_index_last_page(struct dir_index *idx, size_t *page,
+		bool *empty);
+void dir_index_remove_last_page(struct dir_index *idx);
+
+#endif
@@ -41,10 +41,99 @@
 #include "data.h"
 #include "file.h"
 #include "libpmemfile-posix.h"
+#include "mmap.h"
 #include "out.h"
 #include "pool.h"
 #include "utils.h"
 
+/*
+ * vinode_shift_range -- removes [offset, offset + length) range from a file
+ * (PMEMFILE_FALLOC_FL_COLLAPSE_RANGE), or inserts a hole of this size at
+ * offset (PMEMFILE_FALLOC_FL_INSERT_RANGE)
+ *
+ * No data is moved, only offsets of blocks after the range change. Blocks
+ * crossing the edges of the range are split first, so the cost depends on
+ * the number of blocks after offset, not on the number of bytes.
+ */
+static int
+vinode_shift_range(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		int mode, uint64_t offset, uint64_t length)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+	uint64_t size = inode_get_size(inode);
+
+	if (mode & PMEMFILE_FALLOC_FL_COLLAPSE_RANGE) {
+		/*
+		 * from man 2 fallocate:
+		 *
+		 * "EINVAL - mode is FALLOC_FL_COLLAPSE_RANGE and the range
+		 * specified by offset plus len reaches or passes the end of
+		 * the file."
+		 */
+		if (offset + length >= size)
+			return EINVAL;
+	} else {
+		/*
+		 * from man 2 fallocate:
+		 *
+		 * "EINVAL - mode is FALLOC_FL_INSERT_RANGE and the range
+		 * specified by offset reaches or passes the end of the file."
+		 */
+		if (offset >= size)
+			return EINVAL;
+
+		if (size + length > (size_t)SSIZE_MAX)
+			return EFBIG;
+	}
+
+	/* blocks are going to move, so the data can't stay in the inode */
+	int error = vinode_inline_to_blocks(pfp, vinode);
+	if (error)
+		return error;
+
+	vinode_snapshot(vinode);
+
+	if (vinode->blocks == NULL) {
+		error = vinode_rebuild_block_tree(pfp, vinode);
+		if (error)
+			return -error;
+	}
+
+	/* contents of the file after offset are going to move */
+	error = vinode_check_leases(vinode, offset, UINT64_MAX - offset);
+	if (error)
+		return error;
+	vinode_revoke_mappings(pfp, vinode, offset, UINT64_MAX - offset);
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		size_t allocated_space = inode_get_allocated_space(inode);
+
+		vinode_split_block_at(pfp, vinode, offset);
+
+		if (mode & PMEMFILE_FALLOC_FL_COLLAPSE_RANGE) {
+			vinode_split_block_at(pfp, vinode, offset + length);
+			allocated_space -= vinode_remove_interval(pfp, vinode,
+				offset, length);
+			vinode_shift_blocks(pfp, vinode, offset + length,
+				offset);
+			inode_tx_set_size(inode, size - length);
+		} else {
+			vinode_shift_blocks(pfp, vinode, offset,
+				offset + length);
+			inode_tx_set_size(inode, size + length);
+		}
+
+		inode_tx_set_allocated_space(inode, allocated_space);
+	} TX_ONABORT {
+		if (errno == ENOMEM)
+			errno = ENOSPC;
+		error = errno;
+		vinode_restore_on_abort(vinode);
+	} TX_END
+
+	return error;
+}
+
 static int
 vinode_fallocate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode, int mode,
 		uint64_t offset, uint64_t length)
@@ -57,14 +146,24 @@ vinode_fallocate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode, int mode,
 	if (!vinode_is_regular_file(vinode))
 		return EBADF;
 
+	if (mode & (PMEMFILE_FALLOC_FL_COLLAPSE_RANGE |
+			PMEMFILE_FALLOC_FL_INSERT_RANGE))
+		return vinode_shift_range(pfp, vinode, mode, offset, length);
+
 	uint64_t off_plus_len = offset + length;
 
-	if (!(mode & PMEMFILE_FALLOC_FL_PUNCH_HOLE))
+	if (!(mode & (PMEMFILE_FALLOC_FL_PUNCH_HOLE |
+			PMEMFILE_FALLOC_FL_ZERO_RANGE)))
 		expand_to_full_pages(&offset, &length);
 
 	if (length == 0)
 		return 0;
 
+	/* space is allocated and freed in blocks */
+	error = vinode_inline_to_blocks(pfp, vinode);
+	if (error)
+		return error;
+
 	vinode_snapshot(vinode);
 
 	if (vinode->blocks == NULL) {
@@ -73,6 +172,20 @@ vinode_fallocate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode, int mode,
 			return error;
 	}
 
+	/* blocks of borrowed or mapped ranges can't be freed */
+	if (mode & (PMEMFILE_FALLOC_FL_PUNCH_HOLE |
+			PMEMFILE_FALLOC_FL_ZERO_RANGE)) {
+		error = vinode_check_leases(vinode, offset, length);
+		if (error)
+			return error;
+		vinode_revoke_mappings(pfp, vinode, offset, length);
+
+		/* blocks at the edges of the range are going to be modified */
+		error = vinode_unshare_edges(pfp, vinode, offset, length);
+		if (error)
+			return error;
+	}
+
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
 		size_t allocated_space = inode_get_allocated_space(inode);
 
@@ -81,6 +194,10 @@ vinode_fallocate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode, int mode,
 			allocated_space -= vinode_remove_interval(pfp, vinode,
 				offset, length);
 		} else {
+			if (mode & PMEMFILE_FALLOC_FL_ZERO_RANGE)
+				allocated_space -= vinode_zero_interval(pfp,
+					vinode, offset, length);
+
 			allocated_space += vinode_allocate_interval(pfp, vinode,
 				offset, length);
 			if ((mode & PMEMFILE_FALLOC_FL_KEEP_SIZE) == 0 &&
@@ -131,25 +248,38 @@ fallocate_check_arguments(int mode, pmemfile_off_t offset,
 	 * fd does not support this operation; or the mode is not supported by
 	 * the filesystem containing the file referred to by fd."
 	 *
-	 * As of now, pmemfile_fallocate supports allocating disk space, and
-	 * punching holes.
+	 * pmemfile_fallocate supports all modes, except for
+	 * FALLOC_FL_UNSHARE_RANGE.
 	 */
-	if (mode & PMEMFILE_FALLOC_FL_COLLAPSE_RANGE) {
-		ERR("PMEMFILE_FL_COLLAPSE_RANGE is not supported");
-		return EOPNOTSUPP;
-	}
-
-	if (mode & PMEMFILE_FALLOC_FL_ZERO_RANGE) {
-		ERR("PMEMFILE_FL_ZERO_RANGE is not supported");
-		return EOPNOTSUPP;
-	}
-
-	if (mode & PMEMFILE_FALLOC_FL_INSERT_RANGE) {
-		ERR("PMEMFILE_FL_INSERT_RANGE is not supported");
-		return EOPNOTSUPP;
-	}
+	if (mode & (PMEMFILE_FALLOC_FL_COLLAPSE_RANGE |
+			PMEMFILE_FALLOC_FL_INSERT_RANGE)) {
+		/*
+		 * from man 2 fallocate:
+		 *
+		 * "EINVAL - mode contains one of FALLOC_FL_COLLAPSE_RANGE or
+		 * FALLOC_FL_INSERT_RANGE and also other flags; no other flags
+		 * are permitted with FALLOC_FL_COLLAPSE_RANGE or
+		 * FALLOC_FL_INSERT_RANGE."
+		 */
+		if (mode != PMEMFILE_FALLOC_FL_COLLAPSE_RANGE &&
+				mode != PMEMFILE_FALLOC_FL_INSERT_RANGE)
+			return EINVAL;
 
-	if (mode & PMEMFILE_FALLOC_FL_PUNCH_HOLE) {
+		/*
+		 * "EINVAL - mode is FALLOC_FL_COLLAPSE_RANGE or
+		 * FALLOC_FL_INSERT_RANGE, but either offset or len is not a
+		 * multiple of the filesystem block size."
+		 *
+		 * Here it's the smallest block size, the alignment of blocks.
+		 */
+		if ((uint64_t)offset % block_alignment != 0 ||
+				(uint64_t)length % block_alignment != 0)
+			return EINVAL;
+	} else if (mode & PMEMFILE_FALLOC_FL_ZERO_RANGE) {
+		if ((mode & ~(PMEMFILE_FALLOC_FL_ZERO_RANGE |
+				PMEMFILE_FALLOC_FL_KEEP_SIZE)) != 0)
+			return EINVAL;
+	} else if (mode & PMEMFILE_FALLOC_FL_PUNCH_HOLE) {
 		/*
 		 * from man 2 fallocate:
 		 *
@@ -218,10 +348,23 @@ pmemfile_fallocate(PMEMfilepool *pfp, PMEMfile *file, int mode,
 		goto end;
 	}
 
-	os_rwlock_wrlock(&vinode->rwlock);
-
-	error = vinode_fallocate(pfp, vinode, mode, (uint64_t)offset,
-			(uint64_t)length);
+	/* ranges which are going to be freed or moved can't be borrowed */
+	uint64_t leased_len = 0;
+	if (mode & (PMEMFILE_FALLOC_FL_COLLAPSE_RANGE |
+			PMEMFILE_FALLOC_FL_INSERT_RANGE))
+		leased_len = UINT64_MAX - (uint64_t)offset;
+	else if (mode & (PMEMFILE_FALLOC_FL_PUNCH_HOLE |
+			PMEMFILE_FALLOC_FL_ZERO_RANGE))
+		leased_len = (uint64_t)length;
+
+	vinode_wrlock_unleased(vinode, (uint64_t)offset, leased_len);
+
+	/* blocks to unshare may reach past the range */
+	while ((error = vinode_fallocate(pfp, vinode, mode, (uint64_t)offset,
+			(uint64_t)length)) == EBUSY) {
+		vinode_unlock_wait_leases(vinode);
+		vinode_wrlock_unleased(vinode, (uint64_t)offset, leased_len);
+	}
 
 	os_rwlock_unlock(&vinode->rwlock);
 
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * fiemap.c -- pmemfile_fiemap implementation
+ *
+ * Reports the layout of a file as extents: runs of adjacent blocks with the
+ * same state. The blocks are found through the block tree (or the block
+ * index), so the cost depends on the number of blocks in the range, not on
+ * its length.
+ */
+
+#include "data.h"
+#include "file.h"
+#include "inode.h"
+#include "libpmemfile-posix.h"
+#include "out.h"
+#include "utils.h"
+
+/*
+ * block_extent_flags -- returns PMEMFILE_FIEMAP_EXTENT_* flags describing
+ * block
+ */
+static uint32_t
+block_extent_flags(const struct pmemfile_block_desc *block)
+{
+	uint32_t flags = 0;
+
+	if (!(block->flags & BLOCK_INITIALIZED))
+		flags |= PMEMFILE_FIEMAP_EXTENT_UNWRITTEN;
+	if (block->flags & BLOCK_SHARED)
+		flags |= PMEMFILE_FIEMAP_EXTENT_SHARED;
+
+	return flags;
+}
+
+/*
+ * vinode_fiemap -- fills extents with up to count extents of vinode starting
+ * in [offset, end) range, or counts all of them if count is 0
+ *
+ * Expects the vinode to be locked, with the block tree built.
+ */
+static size_t
+vinode_fiemap(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t end, struct pmemfile_extent *extents,
+		size_t count)
+{
+	ASSERT(vinode->blocks != NULL);
+
+	/* data stored in the inode is reported as one extent */
+	if (vinode_has_inline_data(vinode)) {
+		uint64_t size = inode_get_size(vinode->inode);
+		if (offset >= size || end == 0)
+			return 0;
+
+		if (count > 0) {
+			extents[0].offset = 0;
+			extents[0].length = size;
+			extents[0].flags = PMEMFILE_FIEMAP_EXTENT_DATA_INLINE |
+					PMEMFILE_FIEMAP_EXTENT_NOT_ALIGNED |
+					PMEMFILE_FIEMAP_EXTENT_LAST;
+		}
+
+		return 1;
+	}
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, offset);
+	if (block == NULL)
+		block = vinode->first_block;
+	else if (!is_offset_in_block(block, offset))
+		block = PF_RW(pfp, block->next);
+
+	size_t n = 0;
+
+	while (block != NULL && block->offset < end) {
+		if (count > 0 && n == count)
+			break;
+
+		uint64_t ext_offset = block->offset;
+		uint64_t ext_end = block->offset + block->size;
+		uint32_t flags = block_extent_flags(block);
+
+		block = PF_RW(pfp, block->next);
+		while (block != NULL && block->offset == ext_end &&
+				block_extent_flags(block) == flags) {
+			ext_end += block->size;
+			block = PF_RW(pfp, block->next);
+		}
+
+		if (count > 0) {
+			if (block == NULL)
+				flags |= PMEMFILE_FIEMAP_EXTENT_LAST;
+
+			extents[n].offset = ext_offset;
+			extents[n].length = ext_end - ext_offset;
+			extents[n].flags = flags;
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * pmemfile_fiemap -- reports extents of file, which start in
+ * [offset, offset + length) range
+ */
+pmemfile_ssize_t
+pmemfile_fiemap(PMEMfilepool *pfp, PMEMfile *file, pmemfile_off_t offset,
+		pmemfile_off_t length, struct pmemfile_extent *extents,
+		size_t count)
+{
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!file) {
+		LOG(LUSR, "NULL file");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (count > 0 && !extents) {
+		LOG(LUSR, "NULL extents");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (offset < 0 || length < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	os_mutex_lock(&file->mutex);
+	uint64_t flags = file->flags;
+	struct pmemfile_vinode *vinode = file->vinode;
+	os_mutex_unlock(&file->mutex);
+
+	if (flags & PFILE_PATH) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (!vinode_is_regular_file(vinode)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int error = vinode_rdlock_with_block_tree(pfp, vinode);
+	if (error) {
+		errno = -error;
+		return -1;
+	}
+
+	size_t n = vinode_fiemap(pfp, vinode, (uint64_t)offset,
+			(uint64_t)offset + (uint64_t)length, extents, count);
+
+	os_rwlock_unlock(&vinode->rwlock);
+
+	return (pmemfile_ssize_t)n;
+}
@@ -40,6 +40,7 @@
 #include "callbacks.h"
 #include "dir.h"
 #include "file.h"
+#include "group_commit.h"
 #include "libpmemfile-posix.h"
 #include "out.h"
 #include "pool.h"
@@ -170,6 +171,34 @@ check_flags(int flags)
 	return 0;
 }
 
+struct create_args {
+	struct pmemfile_cred *cred;
+	pmemfile_mode_t mode;
+	struct pmemfile_vinode *parent;
+	const char *name;
+	size_t namelen;
+
+	TOID(struct pmemfile_inode) tinode;
+};
+
+/*
+ * create_file_tx -- transaction body of file creation, may be batched with
+ * other operations
+ */
+static void
+create_file_tx(PMEMfilepool *pfp, void *arg)
+{
+	struct create_args *args = arg;
+
+	args->tinode = inode_alloc(pfp, args->cred,
+			PMEMFILE_S_IFREG | args->mode);
+
+	struct pmemfile_time t = inode_get_ctime(PF_RO(pfp, args->tinode));
+
+	vinode_add_dirent(pfp, args->parent, args->name, args->namelen,
+			args->tinode, t);
+}
+
 /*
  * _pmemfile_openat -- open file
  */
@@ -399,30 +428,28 @@ _pmemfile_openat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 			goto end;
 		}
 
-		if (tmpfile)
-			/* access to orphaned list requires superblock lock */
-			os_rwlock_wrlock(&pfp->super_rwlock);
-
 		struct inode_orphan_info orphan_info;
 
-		TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
-			tinode = inode_alloc(pfp, &cred,
-					PMEMFILE_S_IFREG | mode);
+		if (tmpfile) {
+			TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+				tinode = inode_alloc(pfp, &cred,
+						PMEMFILE_S_IFREG | mode);
 
-			if (tmpfile)
 				orphan_info = inode_orphan(pfp, tinode);
-			else
-				inode_add_dirent(pfp, vparent->tinode,
-					info.remaining, namelen, tinode,
-					inode_get_ctime(PF_RO(pfp, tinode)));
-		} TX_ONABORT {
-			if (errno == ENOMEM)
-				errno = ENOSPC;
-			error = errno;
-		} TX_END
+			} TX_ONABORT {
+				error = errno;
+			} TX_END
+		} else {
+			struct create_args args = { &cred, mode, vparent,
+					info.remaining, namelen,
+					TOID_NULL(struct pmemfile_inode) };
 
-		if (tmpfile)
-			os_rwlock_unlock(&pfp->super_rwlock);
+			error = group_commit_tx(pfp, create_file_tx, &args);
+			tinode = args.tinode;
+		}
+
+		if (error == ENOMEM)
+			error = ENOSPC;
 
 		if (error) {
 			os_rwlock_unlock(&vparent->rwlock);
@@ -452,9 +479,13 @@ _pmemfile_openat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 		os_rwlock_unlock(&vparent->rwlock);
 	} else {
 		if (flags & PMEMFILE_O_TRUNC) {
-			os_rwlock_wrlock(&vinode->rwlock);
+			vinode_wrlock_unleased(vinode, 0, UINT64_MAX);
 
-			error = vinode_truncate(pfp, vinode, 0);
+			while ((error = vinode_truncate(pfp, vinode, 0)) ==
+					EBUSY) {
+				vinode_unlock_wait_leases(vinode);
+				vinode_wrlock_unleased(vinode, 0, UINT64_MAX);
+			}
 
 			os_rwlock_unlock(&vinode->rwlock);
 
@@ -471,12 +502,18 @@ _pmemfile_openat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 			if ((flags & clrflags) &&
 					cred.fsuid != inode->uid) {
 
+				os_rwlock_wrlock(&vinode->rwlock);
+				vinode_seq_write_begin(vinode);
+
 				TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
 					inode_tx_set_flags(inode,
 							flags & ~clrflags);
 				} TX_ONABORT {
 					error = errno;
 				} TX_END
+
+				vinode_seq_write_end(vinode);
+				os_rwlock_unlock(&vinode->rwlock);
 			}
 		}
 	}
@@ -599,6 +636,161 @@ pmemfile_create(PMEMfilepool *pfp, const char *pathname, pmemfile_mode_t mode)
 			PMEMFILE_O_WRONLY | PMEMFILE_O_TRUNC, mode);
 }
 
+/*
+ * _pmemfile_create_batch -- creates count regular files in parent directory
+ * in one transaction
+ */
+static int
+_pmemfile_create_batch(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *const names[], const pmemfile_mode_t modes[],
+		PMEMfile *out[], size_t count)
+{
+	struct pmemfile_cred cred;
+	if (cred_acquire(pfp, &cred))
+		return errno;
+
+	int error = 0;
+	size_t opened = 0;
+
+	TOID(struct pmemfile_inode) *tinodes =
+			pf_calloc(count, sizeof(*tinodes));
+	if (!tinodes) {
+		error = errno;
+		goto end;
+	}
+
+	os_rwlock_wrlock(&parent->rwlock);
+
+	if (!vinode_is_dir(parent)) {
+		error = ENOTDIR;
+		goto end_unlock;
+	}
+
+	if (!_vinode_can_access(&cred, parent, PFILE_WANT_WRITE)) {
+		LOG(LUSR, "non-writable parent directory");
+		error = EACCES;
+		goto end_unlock;
+	}
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		for (size_t i = 0; i < count; ++i) {
+			pmemfile_mode_t mode = modes[i] & PMEMFILE_ALLPERMS;
+			mode &= ~pfp->umask;
+
+			tinodes[i] = inode_alloc(pfp, &cred,
+					PMEMFILE_S_IFREG | mode);
+		}
+
+		vinode_add_dirents(pfp, parent, names, tinodes, count);
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	if (error == ENOMEM)
+		error = ENOSPC;
+
+	if (error || !out)
+		goto end_unlock;
+
+	/*
+	 * Refing needs to happen before anyone can access these inodes,
+	 * see _pmemfile_openat.
+	 */
+	for (; opened < count; ++opened) {
+		PMEMfile *file = pf_calloc(1, sizeof(*file));
+		if (!file) {
+			error = errno;
+			break;
+		}
+
+		file->vinode = inode_ref(pfp, tinodes[opened], parent,
+				names[opened], strlen(names[opened]));
+		if (!file->vinode) {
+			error = errno;
+			pf_free(file);
+			break;
+		}
+
+		file->flags = PFILE_WRITE;
+		os_mutex_init(&file->mutex);
+
+		out[opened] = file;
+	}
+
+end_unlock:
+	os_rwlock_unlock(&parent->rwlock);
+
+	/* files are already created, but we can't return all of them */
+	if (error) {
+		while (opened > 0) {
+			--opened;
+			pmemfile_close(pfp, out[opened]);
+			out[opened] = NULL;
+		}
+	}
+end:
+	pf_free(tinodes);
+	cred_release(&cred);
+
+	return error;
+}
+
+/*
+ * pmemfile_create_batch -- creates count regular files in directory dir,
+ * all or none of them, and optionally opens them for writing
+ *
+ * Not in POSIX.
+ */
+int
+pmemfile_create_batch(PMEMfilepool *pfp, PMEMfile *dir,
+		const char *const names[], const pmemfile_mode_t modes[],
+		PMEMfile *out[], size_t count)
+{
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!dir || !names || !modes) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (count == 0)
+		return 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!names[i]) {
+			errno = EFAULT;
+			return -1;
+		}
+
+		if (names[i][0] == 0 || strchr(names[i], '/')) {
+			LOG(LUSR, "invalid name %s", names[i]);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	struct pmemfile_vinode *at;
+	bool at_unref;
+
+	at = pool_get_dir_for_path(pfp, dir, names[0], &at_unref);
+
+	int error = _pmemfile_create_batch(pfp, at, names, modes, out, count);
+
+	if (at_unref)
+		vinode_unref(pfp, at);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  * pmemfile_open_parent -- open a parent directory and return filename
  *
@@ -75,6 +75,9 @@ struct pmemfile_file {
 
 		/* id of the current directory list */
 		unsigned dir_id;
+
+		/* dir_page_invalidation_counter of vinode dir was taken at */
+		uint64_t invalidation_observed;
 	} dir_pos;
 };
 
@@ -35,7 +35,10 @@
  */
 
 #include <limits.h>
+#include <stdlib.h>
 
+#include "alloc.h"
+#include "dir_hash.h"
 #include "file.h"
 #include "inode.h"
 #include "libpmemfile-posix.h"
@@ -59,6 +62,15 @@ file_seek_dir(PMEMfilepool *pfp, PMEMfile *file, struct pmemfile_dir **dir,
 {
 	struct pmemfile_inode *inode = file->vinode->inode;
 
+	if (file->dir_pos.invalidation_observed !=
+			file->vinode->dir_page_invalidation_counter) {
+		/* cached page might have been freed, look it up again */
+		file->dir_pos.dir = NULL;
+		file->dir_pos.dir_id = UINT_MAX;
+		file->dir_pos.invalidation_observed =
+			file->vinode->dir_page_invalidation_counter;
+	}
+
 	if (file->offset == 0) {
 		file->dir_pos.dir = &inode->file_data.dir;
 		file->dir_pos.dir_id = 0;
@@ -298,6 +310,174 @@ pmemfile_getdents_worker(PMEMfilepool *pfp, PMEMfile *file, char *data,
 	return read1;
 }
 
+/*
+ * hashed_dirent -- entry of a bucket of hashed directory with its readdir
+ * position
+ */
+struct hashed_dirent {
+	uint64_t pos;
+	struct pmemfile_dirent *dirent;
+};
+
+static int
+hashed_dirent_cmp(const void *a, const void *b)
+{
+	const struct hashed_dirent *da = a;
+	const struct hashed_dirent *db = b;
+
+	if (da->pos < db->pos)
+		return -1;
+	return da->pos > db->pos;
+}
+
+/*
+ * getdents_hashed_bucket -- fills dirent information of entries of
+ * a bucket, starting from position "pos"
+ *
+ * Entries are returned in order of their positions, so offset of the next
+ * entry doesn't depend on where entries are stored and it stays valid when
+ * buckets are split. Entries with the same position (hash collision) are
+ * returned together or not at all.
+ *
+ * Returns number of bytes filled or -errno. Sets *done when there's no more
+ * space in the buffer.
+ */
+static int
+getdents_hashed_bucket(PMEMfilepool *pfp, PMEMfile *file, char *data,
+		unsigned left, fill_dirent_type fill_dirent,
+		struct pmemfile_dir *bucket, uint64_t pos, bool *done)
+{
+	size_t nents = 0;
+
+	for (struct pmemfile_dir *dir = bucket; dir;
+			dir = PF_RW(pfp, dir->next)) {
+		for (struct pmemfile_dirent *d = dir_page_next_dirent(dir,
+				NULL); d; d = dir_page_next_dirent(dir, d))
+			nents++;
+	}
+
+	struct hashed_dirent *ents = pf_malloc((nents + 1) * sizeof(*ents));
+	if (!ents)
+		return -ENOMEM;
+
+	nents = 0;
+	for (struct pmemfile_dir *dir = bucket; dir;
+			dir = PF_RW(pfp, dir->next)) {
+		for (struct pmemfile_dirent *d = dir_page_next_dirent(dir,
+				NULL); d; d = dir_page_next_dirent(dir, d)) {
+			if (TOID_IS_NULL(d->inode))
+				continue;
+
+			uint64_t p = dir_hash_pos(d->name);
+			if (p < pos)
+				continue;
+
+			ents[nents].pos = p;
+			ents[nents].dirent = d;
+			nents++;
+		}
+	}
+
+	qsort(ents, nents, sizeof(ents[0]), hashed_dirent_cmp);
+
+	int read1 = 0;
+	/* number of bytes filled before the current group of entries */
+	int group_read = 0;
+
+	for (size_t i = 0; i < nents; ++i) {
+		if (i > 0 && ents[i].pos != ents[i - 1].pos)
+			group_read = read1;
+
+		uint64_t next_off = DIR_HASH_OFFSET(ents[i].pos + 1);
+
+		unsigned short slen = fill_dirent(pfp, ents[i].dirent,
+				next_off, left - (unsigned)read1, data + read1);
+
+		if (slen == 0) {
+			/* roll back entries with the same position */
+			read1 = group_read;
+			*done = true;
+			break;
+		}
+
+		read1 += slen;
+
+		if (i + 1 == nents || ents[i + 1].pos != ents[i].pos)
+			file->offset = next_off;
+	}
+
+	pf_free(ents);
+
+	return read1;
+}
+
+/*
+ * pmemfile_getdents_hashed -- traverses hashed directory and fills dirent
+ * information
+ *
+ * Offsets below DIR_HASH_OFFSET(0) are indexes of entries stored in the inode,
+ * the rest are positions in the hash space.
+ */
+static int
+pmemfile_getdents_hashed(PMEMfilepool *pfp, PMEMfile *file, char *data,
+		unsigned count, fill_dirent_type fill_dirent)
+{
+	struct pmemfile_inode *inode = file->vinode->inode;
+	struct pmemfile_dir *first = &inode->file_data.dir;
+	int read1 = 0;
+
+	while (file->offset < DIR_HASH_OFFSET(0)) {
+		if (file->offset >= first->num_elements) {
+			file->offset = DIR_HASH_OFFSET(0);
+			break;
+		}
+
+		struct pmemfile_dirent *dirent = &first->dirents[file->offset];
+		uint64_t next_off = file->offset + 1;
+		if (next_off == first->num_elements)
+			next_off = DIR_HASH_OFFSET(0);
+
+		if (!TOID_IS_NULL(dirent->inode)) {
+			unsigned short slen = fill_dirent(pfp, dirent,
+				next_off, count - (unsigned)read1, data);
+
+			if (slen == 0)
+				return read1 ? read1 : -EINVAL;
+
+			data += slen;
+			read1 += slen;
+		}
+
+		file->offset = next_off;
+	}
+
+	bool done = false;
+
+	while (!done && file->offset - DIR_HASH_OFFSET(0) < DIR_HASH_POS_END) {
+		uint64_t pos = file->offset - DIR_HASH_OFFSET(0);
+		uint64_t end;
+		struct pmemfile_dir *bucket =
+				dir_hash_bucket_at(pfp, inode, pos, &end);
+
+		int r = getdents_hashed_bucket(pfp, file, data,
+				count - (unsigned)read1, fill_dirent, bucket,
+				pos, &done);
+		if (r < 0)
+			return read1 ? read1 : r;
+
+		data += r;
+		read1 += r;
+
+		if (!done)
+			file->offset = DIR_HASH_OFFSET(end);
+	}
+
+	if (done && read1 == 0)
+		return -EINVAL;
+
+	return read1;
+}
+
 /*
  * pmemfile_getdents_generic -- generic implementation of pmemfile_getdents
  * which allows caller to pick ABI (fill_dirent)
@@ -345,7 +525,12 @@ pmemfile_getdents_generic(PMEMfilepool *pfp, PMEMfile *file, char *data,
 	os_mutex_lock(&file->mutex);
 	os_rwlock_rdlock(&vinode->rwlock);
 
-	read = pmemfile_getdents_worker(pfp, file, data, count, fill_dirent);
+	if (inode_is_hashed_dir(vinode->inode))
+		read = pmemfile_getdents_hashed(pfp, file, data, count,
+				fill_dirent);
+	else
+		read = pmemfile_getdents_worker(pfp, file, data, count,
+				fill_dirent);
 
 	os_rwlock_unlock(&vinode->rwlock);
 	os_mutex_unlock(&file->mutex);
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * group_commit.c -- batching of metadata transactions of concurrent threads
+ *
+ * Every metadata operation runs its own libpmemobj transaction and pays for
+ * its begin and commit (undo log flushes and fences), which dominates when
+ * many small files are created at once. When enabled, operations that arrive
+ * concurrently are queued and the first of them which finds nobody committing
+ * (the leader) runs bodies of up to max_ops queued operations in one
+ * transaction, while the others wait for the result. Operations which arrive
+ * in the meantime form the next group, so the added latency is bounded by
+ * the duration of one group of max_ops operations.
+ *
+ * libpmemobj transactions can't be partially rolled back, so when a group
+ * aborts the leader retries its operations one by one, to give each of them
+ * its own result.
+ */
+
+#include <errno.h>
+
+#include "callbacks.h"
+#include "group_commit.h"
+#include "out.h"
+#include "pool.h"
+#include "utils.h"
+
+unsigned pmemfile_group_commit_size = 0;
+
+struct group_commit_req {
+	group_commit_fn fn;
+	void *arg;
+
+	int error;
+	bool done;
+
+	struct group_commit_req *next;
+};
+
+/*
+ * group_commit_init -- initializes group commit state of the pool
+ */
+void
+group_commit_init(struct group_commit *gc, unsigned max_ops)
+{
+	os_mutex_init(&gc->lock);
+	os_cond_init(&gc->cond);
+	gc->head = NULL;
+	gc->tail = &gc->head;
+	gc->leader = false;
+	gc->max_ops = max_ops;
+}
+
+/*
+ * group_commit_fini -- destroys group commit state of the pool
+ */
+void
+group_commit_fini(struct group_commit *gc)
+{
+	ASSERTeq(gc->head, NULL);
+
+	os_cond_destroy(&gc->cond);
+	os_mutex_destroy(&gc->lock);
+}
+
+/*
+ * run_single -- runs one operation in its own transaction
+ */
+static int
+run_single(PMEMfilepool *pfp, group_commit_fn fn, void *arg)
+{
+	int error = 0;
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		fn(pfp, arg);
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	return error;
+}
+
+/*
+ * run_group -- runs operations from the list in one transaction and sets
+ * their results
+ */
+static void
+run_group(PMEMfilepool *pfp, struct group_commit_req *first)
+{
+	int error = 0;
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		for (struct group_commit_req *r = first; r; r = r->next)
+			r->fn(pfp, r->arg);
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	if (error && first->next) {
+		/* nothing was committed, find out which operation failed */
+		for (struct group_commit_req *r = first; r; r = r->next)
+			r->error = run_single(pfp, r->fn, r->arg);
+	} else {
+		for (struct group_commit_req *r = first; r; r = r->next)
+			r->error = error;
+	}
+}
+
+/*
+ * group_commit_tx -- runs fn in a transaction, possibly in another thread and
+ * together with operations of other threads, and returns 0 or error code of
+ * aborted transaction
+ *
+ * Returns when the transaction is committed or aborted. Caller must hold all
+ * locks needed by fn.
+ */
+int
+group_commit_tx(PMEMfilepool *pfp, group_commit_fn fn, void *arg)
+{
+	ASSERT_NOT_IN_TX();
+
+	struct group_commit *gc = &pfp->group_commit;
+	if (gc->max_ops <= 1)
+		return run_single(pfp, fn, arg);
+
+	struct group_commit_req req = { fn, arg, 0, false, NULL };
+
+	os_mutex_lock(&gc->lock);
+
+	*gc->tail = &req;
+	gc->tail = &req.next;
+
+	while (!req.done && gc->leader)
+		os_cond_wait(&gc->cond, &gc->lock);
+
+	if (req.done) {
+		os_mutex_unlock(&gc->lock);
+		return req.error;
+	}
+
+	gc->leader = true;
+
+	/* operations queued after ours are left for the next leader */
+	while (!req.done) {
+		struct group_commit_req *first = gc->head;
+		struct group_commit_req *last = first;
+		for (unsigned n = 1; n < gc->max_ops && last->next; ++n)
+			last = last->next;
+
+		gc->head = last->next;
+		if (!gc->head)
+			gc->tail = &gc->head;
+		last->next = NULL;
+
+		os_mutex_unlock(&gc->lock);
+
+		run_group(pfp, first);
+
+		os_mutex_lock(&gc->lock);
+
+		/* requests live on stacks of waiters, don't touch them later */
+		while (first) {
+			struct group_commit_req *next = first->next;
+			first->done = true;
+			first = next;
+		}
+
+		os_cond_broadcast(&gc->cond);
+	}
+
+	gc->leader = false;
+	os_cond_broadcast(&gc->cond);
+
+	os_mutex_unlock(&gc->lock);
+
+	return req.error;
+}
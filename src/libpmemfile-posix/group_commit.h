@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * group_commit.h -- batching of metadata transactions of concurrent threads
+ */
+
+#ifndef PMEMFILE_GROUP_COMMIT_H
+#define PMEMFILE_GROUP_COMMIT_H
+
+#include <stdbool.h>
+
+#include "libpmemfile-posix.h"
+#include "os_thread.h"
+
+/* maximum number of operations in one transaction, 0 disables batching */
+extern unsigned pmemfile_group_commit_size;
+
+/*
+ * Transaction body of a single operation. Runs in a transaction, possibly in
+ * another thread and together with bodies of other operations, so it must not
+ * take any locks (the caller holds everything it needs) and must not rely on
+ * thread local state.
+ */
+typedef void (*group_commit_fn)(PMEMfilepool *pfp, void *arg);
+
+struct group_commit_req;
+
+struct group_commit {
+	os_mutex_t lock;
+	os_cond_t cond;
+
+	/* queue of operations waiting for a transaction */
+	struct group_commit_req *head;
+	struct group_commit_req **tail;
+
+	/* some thread runs transactions on behalf of others */
+	bool leader;
+
+	unsigned max_ops;
+};
+
+void group_commit_init(struct group_commit *gc, unsigned max_ops);
+void group_commit_fini(struct group_commit *gc);
+
+int group_commit_tx(PMEMfilepool *pfp, group_commit_fn fn, void *arg);
+
+#endif
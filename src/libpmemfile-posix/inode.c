@@ -38,18 +38,24 @@
 #include <inttypes.h>
 
 #include "alloc.h"
+#include "block_ref.h"
 #include "blocks.h"
 #include "callbacks.h"
 #include "data.h"
+#include "dcache.h"
 #include "dir.h"
+#include "dir_hash.h"
 #include "hash_map.h"
 #include "inode.h"
 #include "inode_array.h"
 #include "locks.h"
 #include "os_thread.h"
 #include "out.h"
+#include "reclaim.h"
 #include "utils.h"
 
+size_t pmemfile_vinode_cache_size = 1024;
+
 static void
 log_leak(uint64_t key, void *value, void *arg)
 {
@@ -65,20 +71,90 @@ log_leak(uint64_t key, void *value, void *arg)
 #endif
 }
 
+/*
+ * inode_map_alloc -- allocates inode hash map
+ */
+int
+inode_map_alloc(PMEMfilepool *pfp)
+{
+	for (unsigned i = 0; i < INODE_MAP_SHARDS; ++i) {
+		struct inode_map_shard *shard = &pfp->inode_map[i];
+
+		shard->map = hash_map_alloc();
+		if (!shard->map) {
+			int error = errno;
+
+			while (i-- > 0) {
+				hash_map_free(pfp->inode_map[i].map);
+				pfp->inode_map[i].map = NULL;
+				os_rwlock_destroy(&pfp->inode_map[i].rwlock);
+			}
+
+			errno = error;
+			return -1;
+		}
+
+		os_rwlock_init(&shard->rwlock);
+	}
+
+	struct vinode_lru *lru = &pfp->vinode_lru;
+	os_mutex_init(&lru->lock);
+	lru->head = lru->tail = NULL;
+	lru->count = 0;
+	lru->capacity = pmemfile_vinode_cache_size;
+
+	return 0;
+}
+
+/*
+ * inode_map_traverse -- calls fun for every vinode in the map
+ *
+ * Takes no locks - caller must make sure nobody refs or unrefs vinodes.
+ */
+void
+inode_map_traverse(PMEMfilepool *pfp, hash_map_cb fun, void *arg)
+{
+	for (unsigned i = 0; i < INODE_MAP_SHARDS; ++i)
+		hash_map_traverse(pfp->inode_map[i].map, fun, arg);
+}
+
 /*
  * inode_map_free -- destroys inode hash map
  */
 void
 inode_map_free(PMEMfilepool *pfp)
 {
-	struct hash_map *map = pfp->inode_map;
-	int ref_leaks = hash_map_traverse(map, log_leak, NULL);
+	vinode_lru_flush(pfp);
+	ASSERTeq(pfp->vinode_lru.count, 0);
+	os_mutex_destroy(&pfp->vinode_lru.lock);
+
+	int ref_leaks = 0;
+	for (unsigned i = 0; i < INODE_MAP_SHARDS; ++i)
+		ref_leaks += hash_map_traverse(pfp->inode_map[i].map,
+				log_leak, NULL);
 	if (ref_leaks)
 		FATAL("%d inode reference leaks (forgot to close some files?)",
 				ref_leaks);
 
-	hash_map_free(map);
-	pfp->inode_map = NULL;
+	for (unsigned i = 0; i < INODE_MAP_SHARDS; ++i) {
+		struct inode_map_shard *shard = &pfp->inode_map[i];
+
+		hash_map_free(shard->map);
+		shard->map = NULL;
+		os_rwlock_destroy(&shard->rwlock);
+	}
+}
+
+/*
+ * inode_map_shard -- returns part of the inode map responsible for inode
+ */
+static inline struct inode_map_shard *
+inode_map_shard(PMEMfilepool *pfp, TOID(struct pmemfile_inode) inode)
+{
+	/* inodes are cache line aligned, so low bits of offset are useless */
+	uint64_t h = inode.oid.off * 0x9E3779B97F4A7C15ULL;
+
+	return &pfp->inode_map[(h >> 32) % INODE_MAP_SHARDS];
 }
 
 /*
@@ -95,43 +171,62 @@ inode_ref(PMEMfilepool *pfp, TOID(struct pmemfile_inode) inode,
 		struct pmemfile_vinode *parent,
 		const char *name, size_t namelen)
 {
-	struct hash_map *map = pfp->inode_map;
+	struct inode_map_shard *shard = inode_map_shard(pfp, inode);
 
 	ASSERT_NOT_IN_TX();
 
-	if (PF_RO(pfp, inode)->version != PMEMFILE_INODE_VERSION(2)) {
+	/*
+	 * version 3 differs only by the block index, version 4 only by
+	 * the directory hash table, version 5 only by inline data, version 6
+	 * is the compact layout, versions 7 (full size) and 8 (compact) may
+	 * have blocks with shared data
+	 */
+	uint32_t version = PF_RO(pfp, inode)->version;
+	if (version != PMEMFILE_INODE_VERSION(2) &&
+			version != PMEMFILE_INODE_VERSION(3) &&
+			version != PMEMFILE_INODE_VERSION(4) &&
+			version != PMEMFILE_INODE_VERSION(5) &&
+			version != PMEMFILE_INODE_VERSION(6) &&
+			version != PMEMFILE_INODE_VERSION(7) &&
+			version != PMEMFILE_INODE_VERSION(8)) {
 		ERR("unknown inode version 0x%x for inode 0x%" PRIx64,
-				PF_RO(pfp, inode)->version, inode.oid.off);
+				version, inode.oid.off);
 		errno = EINVAL;
 		return NULL;
 	}
 
-	os_rwlock_rdlock(&pfp->inode_map_rwlock);
+	os_rwlock_rdlock(&shard->rwlock);
 
 	struct pmemfile_vinode *vinode =
-			hash_map_get(map, inode.oid.off);
+			hash_map_get(shard->map, inode.oid.off);
 	if (vinode)
 		goto end;
 
-	os_rwlock_unlock(&pfp->inode_map_rwlock);
+	os_rwlock_unlock(&shard->rwlock);
 
 	vinode = pf_calloc(1, sizeof(*vinode));
+	/* give memory held by unreferenced vinodes back and try again */
+	if (!vinode && vinode_lru_flush(pfp))
+		vinode = pf_calloc(1, sizeof(*vinode));
 	if (!vinode) {
 		ERR("!can't allocate vinode");
 		return NULL;
 	}
 
-	os_rwlock_wrlock(&pfp->inode_map_rwlock);
+	os_rwlock_wrlock(&shard->rwlock);
 
 	struct pmemfile_vinode *put =
-			hash_map_put(map, inode.oid.off, vinode);
+			hash_map_put(shard->map, inode.oid.off, vinode);
 	/* have we managed to insert vinode into hash map? */
 	if (put == vinode) {
 		/* finish initialization */
 		os_rwlock_init(&vinode->rwlock);
+		range_lock_init(&vinode->range_lock);
+		range_lock_init(&vinode->leases);
 		vinode->tinode = inode;
 		vinode->inode = PF_RW(pfp, inode);
 		vinode->atime = inode_get_atime(vinode->inode);
+		dcache_invalidate(pfp, vinode);
 		if (inode_is_dir(vinode->inode) && parent)
 			vinode->parent = vinode_ref(pfp, parent);
 
@@ -145,8 +240,13 @@ inode_ref(PMEMfilepool *pfp, TOID(struct pmemfile_inode) inode,
 	}
 
 end:
+	/*
+	 * Vinodes in the map with zero reference count are cached
+	 * (see vinode_lru_put) and can be reused only with the shard lock
+	 * held - they are released with the lock held in write mode.
+	 */
 	__sync_fetch_and_add(&vinode->ref, 1);
-	os_rwlock_unlock(&pfp->inode_map_rwlock);
+	os_rwlock_unlock(&shard->rwlock);
 
 	return vinode;
 }
@@ -165,46 +265,321 @@ vinode_ref(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 	return vinode;
 }
 
+/*
+ * vinode_tryref -- increases inode runtime reference counter, unless it
+ * already dropped to 0
+ *
+ * Used by lockless lookups, which can find a vinode which is being released.
+ * Memory of such vinode stays valid until the end of rcu read-side section.
+ */
+bool
+vinode_tryref(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	(void) pfp;
+
+	uint32_t ref = __atomic_load_n(&vinode->ref, __ATOMIC_RELAXED);
+
+	do {
+		if (ref == 0)
+			return false;
+	} while (!__atomic_compare_exchange_n(&vinode->ref, &ref, ref + 1,
+			true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	return true;
+}
+
+/*
+ * vinode_unref_nonlast -- decreases inode reference counter, unless it's the
+ * last reference
+ *
+ * Returns false if caller has to drop the last reference under the shard lock.
+ */
+static inline bool
+vinode_unref_nonlast(struct pmemfile_vinode *vinode)
+{
+	uint32_t ref = __atomic_load_n(&vinode->ref, __ATOMIC_RELAXED);
+
+	do {
+		ASSERTne(ref, 0);
+		if (ref == 1)
+			return false;
+	} while (!__atomic_compare_exchange_n(&vinode->ref, &ref, ref - 1,
+			true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return true;
+}
+
+/*
+ * vinode_lru_link -- inserts vinode at the head of the cache of unreferenced
+ * vinodes
+ *
+ * Has to be called with both the cache lock and the shard lock held.
+ */
 static void
-vinode_free_pmem(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+vinode_lru_link(struct vinode_lru *lru, struct pmemfile_vinode *vinode)
+{
+	vinode->lru.prev = NULL;
+	vinode->lru.next = lru->head;
+	if (lru->head)
+		lru->head->lru.prev = vinode;
+	else
+		lru->tail = vinode;
+	lru->head = vinode;
+
+	vinode->lru.cached = true;
+	vinode->lru.active = false;
+	__atomic_store_n(&lru->count, lru->count + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * vinode_lru_unlink -- removes vinode from the cache of unreferenced vinodes
+ *
+ * Has to be called with both the cache lock and the shard lock held.
+ */
+static void
+vinode_lru_unlink(struct vinode_lru *lru, struct pmemfile_vinode *vinode)
+{
+	if (vinode->lru.prev)
+		vinode->lru.prev->lru.next = vinode->lru.next;
+	else
+		lru->head = vinode->lru.next;
+
+	if (vinode->lru.next)
+		vinode->lru.next->lru.prev = vinode->lru.prev;
+	else
+		lru->tail = vinode->lru.prev;
+
+	vinode->lru.prev = vinode->lru.next = NULL;
+	vinode->lru.cached = false;
+	vinode->lru.active = false;
+	__atomic_store_n(&lru->count, lru->count - 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * vinode_release -- releases persistent state of vinode which reference
+ * counter dropped to 0 and removes it from the inode map
+ *
+ * Has to be called with the shard lock held in write mode. Returns true if
+ * the inode was unlinked and has to be freed (see reclaim_inode) after
+ * the shard lock is dropped.
+ */
+static bool
+vinode_release(PMEMfilepool *pfp, struct inode_map_shard *shard,
+		struct pmemfile_vinode *vinode)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+
+	/* tell lockless readers the vinode is going away */
+	vinode_seq_write_begin(vinode);
+
+	if (vinode->lru.cached) {
+		os_mutex_lock(&pfp->vinode_lru.lock);
+		vinode_lru_unlink(&pfp->vinode_lru, vinode);
+		os_mutex_unlock(&pfp->vinode_lru.lock);
+	}
+
+	bool reclaim = false;
+	uint64_t nlink = inode_get_nlink(inode);
+	if (inode->suspended_references == 0 && nlink == 0) {
+		reclaim = true;
+		inode = vinode->inode = NULL;
+	} else if (vinode->atime_dirty) {
+		inode_slot atime_slot = inode_next_atime_slot(inode);
+		inode->atime[atime_slot] = vinode->atime;
+		pmemfile_persist(pfp, &inode->atime[atime_slot]);
+
+		inode->slots.bits.atime = atime_slot;
+		pmemfile_persist(pfp, &inode->slots);
+	}
+
+	if (hash_map_remove(shard->map, vinode->tinode.oid.off, vinode))
+		FATAL("vinode not found");
+
+	return reclaim;
+}
+
+/*
+ * vinode_destroy -- frees volatile state of released vinode
+ *
+ * Returns parent directory which reference has to be dropped.
+ */
+static struct pmemfile_vinode *
+vinode_destroy(struct pmemfile_vinode *vinode)
 {
 	/*
-	 * Undo log space in transaction is limited, so when it's exhausted
-	 * pmemobj needs to allocate more to extend it.
-	 * If all space is used by user data pmemobj is not able to do that,
-	 * which means frees fail.
+	 * We don't need to take the vinode lock to read parent because
+	 * at this point (when ref count drops to 0) nobody should have
+	 * access to this vinode.
 	 *
-	 * To fix this, do as many frees outside of transaction as possible,
-	 * while still maintaining consistency.
+	 * Can't use vinode_is_root here, as that function dereferences
+	 * vinode->inode, which might point to already deallocated
+	 * memory -- see reclaim_inode call after vinode_release.
 	 */
-	inode_trim(pfp, vinode->tinode);
+	struct pmemfile_vinode *next;
+	if (vinode->parent && vinode->parent != vinode)
+		next = vinode->parent;
+	else
+		next = NULL;
 
-	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
-		inode_array_unregister(pfp, vinode->orphaned.arr,
-				vinode->orphaned.idx);
+	if (vinode->blocks)
+		offset_map_delete(vinode->blocks);
+	if (vinode->index)
+		block_index_close(vinode->index);
+	if (vinode->dir_index)
+		dir_index_free(vinode->dir_index);
+
+#ifdef DEBUG
+	/* "path" field is defined only in DEBUG builds */
+	pf_free(vinode->path);
+#endif
+	range_lock_destroy(&vinode->leases);
+	range_lock_destroy(&vinode->range_lock);
+	os_rwlock_destroy(&vinode->rwlock);
+	rcu_free(&vinode->rcu, vinode);
 
-		inode_free(pfp, vinode->tinode);
-	} TX_ONABORT {
+	return next;
+}
+
+/*
+ * vinode_lru_put -- keeps vinode which reference counter dropped to 0 in
+ * the cache of unreferenced vinodes, so its block tree and directory index
+ * don't have to be rebuilt when it's used again
+ *
+ * Has to be called with the shard lock held in write mode. Returns false if
+ * vinode can't be cached and has to be released.
+ */
+static bool
+vinode_lru_put(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	struct vinode_lru *lru = &pfp->vinode_lru;
+	struct pmemfile_inode *inode = vinode->inode;
+
+	/* unlinked inodes have to be freed as soon as possible */
+	if (inode->suspended_references != 0 || inode_get_nlink(inode) == 0)
+		return false;
+
+	if (vinode->lru.cached) {
 		/*
-		 * Sometimes even with inode_trim it's not possible to get
-		 * enough space for transaction to succeed.
-		 * However, if user wants that, we can ignore transaction error
-		 * and temporarily leak this inode. It will be freed the next
-		 * time pmemfile_pool_open is called.
+		 * Reused since it was cached. Don't touch the list (and its
+		 * lock), eviction will move it to the head.
 		 */
-		const char *env = getenv("PMEMFILE_IGNORE_INODE_FREE_ERRORS");
+		vinode->lru.active = true;
+		return true;
+	}
 
-		if (env && env[0] == '1')
-			LOG(LINF, "Freeing inode %lu failed!",
-				vinode->tinode.oid.off);
-		else
-			FATAL("!vinode_free_pmem");
-	} TX_END
+	if (lru->capacity == 0)
+		return false;
+
+	os_mutex_lock(&lru->lock);
+	vinode_lru_link(lru, vinode);
+	os_mutex_unlock(&lru->lock);
+
+	return true;
+}
+
+/*
+ * vinode_lru_evict -- releases the least recently used unreferenced vinode
+ *
+ * Unless "all" is set, vinodes reused since they were cached are moved to
+ * the head of the list instead. Returns false if the cache is empty.
+ */
+static bool
+vinode_lru_evict(PMEMfilepool *pfp, bool all)
+{
+	struct vinode_lru *lru = &pfp->vinode_lru;
+
+	os_mutex_lock(&lru->lock);
+	struct pmemfile_vinode *vinode = lru->tail;
+	if (!vinode) {
+		os_mutex_unlock(&lru->lock);
+		return false;
+	}
+	struct inode_map_shard *shard = inode_map_shard(pfp, vinode->tinode);
+	os_mutex_unlock(&lru->lock);
+
+	/*
+	 * Shard lock has to be taken before the cache lock. Vinode can't leave
+	 * the cache without both of them, so if it's still the tail of the list
+	 * (and it's the same vinode) it's safe to use.
+	 */
+	os_rwlock_wrlock(&shard->rwlock);
+	os_mutex_lock(&lru->lock);
+
+	if (lru->tail != vinode ||
+			inode_map_shard(pfp, vinode->tinode) != shard) {
+		os_mutex_unlock(&lru->lock);
+		os_rwlock_unlock(&shard->rwlock);
+		return true;
+	}
+
+	if (vinode->lru.active && !all) {
+		vinode_lru_unlink(lru, vinode);
+		vinode_lru_link(lru, vinode);
+		os_mutex_unlock(&lru->lock);
+		os_rwlock_unlock(&shard->rwlock);
+		return true;
+	}
+
+	vinode_lru_unlink(lru, vinode);
+	os_mutex_unlock(&lru->lock);
+
+	/* still in use - it will be cached again when it's unrefed */
+	if (__atomic_load_n(&vinode->ref, __ATOMIC_RELAXED) != 0) {
+		os_rwlock_unlock(&shard->rwlock);
+		return true;
+	}
+
+	bool reclaim = vinode_release(pfp, shard, vinode);
+	os_rwlock_unlock(&shard->rwlock);
+
+	if (reclaim)
+		reclaim_inode(pfp, vinode->tinode, vinode->orphaned);
+
+	vinode_unref(pfp, vinode_destroy(vinode));
+
+	return true;
+}
+
+/*
+ * vinode_lru_shrink -- evicts unreferenced vinodes over the cache capacity
+ */
+static void
+vinode_lru_shrink(PMEMfilepool *pfp)
+{
+	struct vinode_lru *lru = &pfp->vinode_lru;
+
+	while (__atomic_load_n(&lru->count, __ATOMIC_RELAXED) >
+			lru->capacity) {
+		if (!vinode_lru_evict(pfp, false))
+			break;
+	}
+}
+
+/*
+ * vinode_lru_flush -- releases all unreferenced vinodes
+ *
+ * Returns true if anything was released.
+ */
+bool
+vinode_lru_flush(PMEMfilepool *pfp)
+{
+	ASSERT_NOT_IN_TX();
+
+	bool released = false;
+
+	while (vinode_lru_evict(pfp, true))
+		released = true;
+
+	return released;
 }
 
 /*
  * vinode_unref -- decreases inode reference counter
  *
+ * Only the last reference is dropped under the inode map lock (of the shard
+ * the vinode lives in), so inode_ref can't find a vinode which is being
+ * released.
+ *
  * Can't be called in a transaction.
  */
 void
@@ -212,59 +587,33 @@ vinode_unref(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 {
 	ASSERT_NOT_IN_TX();
 
-	os_rwlock_wrlock(&pfp->inode_map_rwlock);
-
-	while (vinode && __sync_sub_and_fetch(&vinode->ref, 1) == 0) {
-		struct pmemfile_inode *inode = vinode->inode;
+	while (vinode && !vinode_unref_nonlast(vinode)) {
+		struct inode_map_shard *shard =
+				inode_map_shard(pfp, vinode->tinode);
 
-		uint64_t nlink = inode_get_nlink(inode);
-		if (inode->suspended_references == 0 && nlink == 0) {
-			vinode_free_pmem(pfp, vinode);
-			inode = vinode->inode = NULL;
-		} else if (vinode->atime_dirty) {
-			inode_slot atime_slot = inode_next_atime_slot(inode);
-			inode->atime[atime_slot] = vinode->atime;
-			pmemfile_persist(pfp, &inode->atime[atime_slot]);
+		os_rwlock_wrlock(&shard->rwlock);
 
-			inode->slots.bits.atime = atime_slot;
-			pmemfile_persist(pfp, &inode->slots);
+		/* somebody (vinode_tryref) might have taken a reference */
+		if (__sync_sub_and_fetch(&vinode->ref, 1) != 0) {
+			os_rwlock_unlock(&shard->rwlock);
+			break;
 		}
 
-		/*
-		 * We don't need to take the vinode lock to read parent because
-		 * at this point (when ref count drops to 0) nobody should have
-		 * access to this vinode.
-		 *
-		 * Can't use vinode_is_root here, as that function dereferences
-		 * vinode->inode, which might point to already deallocated
-		 * memory -- see vinode_free_pmem call above.
-		 */
-		struct pmemfile_vinode *next;
-		if (vinode->parent && vinode->parent != vinode)
-			next = vinode->parent;
-		else
-			next = NULL;
-
-		struct hash_map *map = pfp->inode_map;
-
-		if (hash_map_remove(map, vinode->tinode.oid.off,
-				vinode))
-			FATAL("vinode not found");
+		if (vinode_lru_put(pfp, vinode)) {
+			os_rwlock_unlock(&shard->rwlock);
+			vinode_lru_shrink(pfp);
+			break;
+		}
 
-		if (vinode->blocks)
-			offset_map_delete(vinode->blocks);
+		bool reclaim = vinode_release(pfp, shard, vinode);
+		os_rwlock_unlock(&shard->rwlock);
 
-#ifdef DEBUG
-		/* "path" field is defined only in DEBUG builds */
-		pf_free(vinode->path);
-#endif
-		os_rwlock_destroy(&vinode->rwlock);
-		pf_free(vinode);
+		/* freeing big files takes long, don't block the whole shard */
+		if (reclaim)
+			reclaim_inode(pfp, vinode->tinode, vinode->orphaned);
 
-		vinode = next;
+		vinode = vinode_destroy(vinode);
 	}
-
-	os_rwlock_unlock(&pfp->inode_map_rwlock);
 }
 
 void
@@ -293,7 +642,12 @@ inode_alloc(PMEMfilepool *pfp, struct pmemfile_cred *cred, uint64_t flags)
 
 	ASSERT_IN_TX();
 
-	const struct pmem_block_info *info = metadata_block_info();
+	/* directories keep "." and ".." in the inode, so they need full one */
+	bool compact = !PMEMFILE_S_ISDIR(flags) &&
+			pfp->super->inode_size == PMEMFILE_COMPACT_INODE_SIZE;
+
+	const struct pmem_block_info *info = compact ?
+			compact_inode_block_info() : metadata_block_info();
 
 	TOID(struct pmemfile_inode) tinode =
 		TX_XALLOC(struct pmemfile_inode, info->size,
@@ -304,7 +658,8 @@ inode_alloc(PMEMfilepool *pfp, struct pmemfile_cred *cred, uint64_t flags)
 	struct pmemfile_time t;
 	get_current_time(&t);
 
-	inode->version = PMEMFILE_INODE_VERSION(2);
+	inode->version = compact ? PMEMFILE_INODE_VERSION(6) :
+			PMEMFILE_INODE_VERSION(2);
 	inode->flags[0] = flags;
 	inode->ctime[0] = t;
 	inode->mtime[0] = t;
@@ -314,12 +669,13 @@ inode_alloc(PMEMfilepool *pfp, struct pmemfile_cred *cred, uint64_t flags)
 	inode->gid = cred->egid;
 
 	if (inode_is_regular_file(inode)) {
-		inode->file_data.blocks.version =
-			PMEMFILE_BLOCK_ARRAY_VERSION(1);
-		inode->file_data.blocks.length =
-				(sizeof(inode->file_data) -
-				sizeof(inode->file_data.blocks)) /
-				sizeof(struct pmemfile_block_desc);
+		struct pmemfile_block_array *arr =
+				&inode_file_data(inode)->blocks;
+
+		arr->version = PMEMFILE_BLOCK_ARRAY_VERSION(1);
+		arr->length = (uint32_t)
+				((inode_file_data_size(inode) - sizeof(*arr)) /
+				sizeof(struct pmemfile_block_desc));
 	} else if (inode_is_dir(inode)) {
 		inode->file_data.dir.version = PMEMFILE_DIR_VERSION(1);
 		inode->file_data.dir.num_elements =
@@ -332,30 +688,24 @@ inode_alloc(PMEMfilepool *pfp, struct pmemfile_cred *cred, uint64_t flags)
 	return tinode;
 }
 
+/* only address is used, to pick the list of orphans of the current thread */
+static __thread char orphan_thread;
+
 /*
- * vinode_orphan_unlocked -- register specified inode in orphaned_inodes array
- *
- * Must be called in a transaction.
+ * inode_orphan_array -- returns list of orphaned inodes the current thread
+ * should add inodes to
  *
- * Assumes superblock lock already has been taken.
+ * Threads are spread over PMEMFILE_ORPHAN_SHARDS lists, so concurrent unlinks
+ * of open files don't serialize on locks of one list.
  */
-void
-vinode_orphan_unlocked(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+TOID(struct pmemfile_inode_array)
+inode_orphan_array(PMEMfilepool *pfp)
 {
-	LOG(LDBG, "inode 0x%" PRIx64 " path %s", vinode->tinode.oid.off,
-			pmfi_path(vinode));
-
-	ASSERT_IN_TX();
-	ASSERTeq(vinode->orphaned.arr, NULL);
+	uint64_t id = (uint64_t)(uintptr_t)&orphan_thread *
+			0x9E3779B97F4A7C15ULL;
 
-	if (vinode->inode->suspended_references > 0)
-		return;
-
-	TOID(struct pmemfile_inode_array) orphaned =
-			pfp->super->orphaned_inodes;
-
-	inode_array_add(pfp, orphaned, vinode->tinode,
-			&vinode->orphaned.arr, &vinode->orphaned.idx);
+	return *pool_orphaned_shard(pfp,
+			(unsigned)((id >> 32) % PMEMFILE_ORPHAN_SHARDS));
 }
 
 struct inode_orphan_info
@@ -367,25 +717,32 @@ inode_orphan(PMEMfilepool *pfp, TOID(struct pmemfile_inode) tinode)
 
 	struct inode_orphan_info info;
 
-	inode_array_add(pfp, pfp->super->orphaned_inodes, tinode, &info.arr,
+	inode_array_add(pfp, inode_orphan_array(pfp), tinode, &info.arr,
 			&info.idx);
 
 	return info;
 }
 
 /*
- * vinode_orphan -- register specified inode in orphaned_inodes array
+ * vinode_orphan -- register specified inode in one of the lists of orphaned
+ * inodes
  *
  * Must be called in a transaction.
  */
 void
 vinode_orphan(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 {
-	rwlock_tx_wlock(&pfp->super_rwlock);
+	LOG(LDBG, "inode 0x%" PRIx64 " path %s", vinode->tinode.oid.off,
+			pmfi_path(vinode));
+
+	ASSERT_IN_TX();
+	ASSERTeq(vinode->orphaned.arr, NULL);
 
-	vinode_orphan_unlocked(pfp, vinode);
+	if (vinode->inode->suspended_references > 0)
+		return;
 
-	rwlock_tx_unlock_on_commit(&pfp->super_rwlock);
+	inode_array_add(pfp, inode_orphan_array(pfp), vinode->tinode,
+			&vinode->orphaned.arr, &vinode->orphaned.idx);
 }
 
 /*
@@ -411,6 +768,13 @@ inode_free_dir(PMEMfilepool *pfp, struct pmemfile_inode *inode)
 		tdir = next;
 		dir = PF_RW(pfp, tdir);
 	}
+
+	if (inode_is_hashed_dir(inode)) {
+		if (dir_hash_entries(pfp, inode))
+			FATAL("Trying to free non-empty directory");
+
+		dir_hash_free(pfp, inode);
+	}
 }
 
 /*
@@ -422,11 +786,14 @@ inode_trim_reg_file(PMEMfilepool *pfp, struct pmemfile_inode *inode)
 {
 	ASSERT_NOT_IN_TX();
 
-	struct pmemfile_block_array *arr = &inode->file_data.blocks;
+	struct pmemfile_block_array *arr = &inode_file_data(inode)->blocks;
 
 	while (arr != NULL) {
-		for (unsigned i = 0; i < arr->length; ++i)
-			POBJ_FREE(&arr->blocks[i].data);
+		for (unsigned i = 0; i < arr->length; ++i) {
+			/* shared data is released in a transaction */
+			if (!(arr->blocks[i].flags & BLOCK_SHARED))
+				POBJ_FREE(&arr->blocks[i].data);
+		}
 
 		arr = PF_RW(pfp, arr->next);
 	}
@@ -447,13 +814,13 @@ inode_free_reg_file(PMEMfilepool *pfp, struct pmemfile_inode *inode)
 {
 	ASSERT_IN_TX();
 
-	struct pmemfile_block_array *arr = &inode->file_data.blocks;
+	struct pmemfile_block_array *arr = &inode_file_data(inode)->blocks;
 	TOID(struct pmemfile_block_array) tarr =
 			TOID_NULL(struct pmemfile_block_array);
 
 	while (arr != NULL) {
 		for (unsigned i = 0; i < arr->length; ++i)
-			TX_FREE(arr->blocks[i].data);
+			block_data_free(pfp, &arr->blocks[i]);
 
 		TOID(struct pmemfile_block_array) next = arr->next;
 		if (!TOID_IS_NULL(tarr))
@@ -461,6 +828,8 @@ inode_free_reg_file(PMEMfilepool *pfp, struct pmemfile_inode *inode)
 		tarr = next;
 		arr = PF_RW(pfp, tarr);
 	}
+
+	block_index_free(pfp, inode);
 }
 
 /*
@@ -629,6 +998,95 @@ vinode_wrlockN(struct pmemfile_vinode *v[static 5],
 		os_rwlock_wrlock(&v[i++]->rwlock);
 }
 
+/*
+ * vinode_wrlock_many -- take WRITE locks on n inodes from "v" (which may
+ * contain duplicates) in ascending order
+ *
+ * Sorts "v", removes duplicates and terminates it with NULL, so it can be
+ * passed to vinode_unlockN. "v" must have room for at least 5 entries and
+ * n + 1 entries.
+ */
+void
+vinode_wrlock_many(struct pmemfile_vinode **v, size_t n)
+{
+	qsort(v, n, sizeof(v[0]), vinode_cmp);
+
+	size_t unique = 0;
+	for (size_t i = 0; i < n; ++i)
+		if (unique == 0 || v[unique - 1] != v[i])
+			v[unique++] = v[i];
+	v[unique] = NULL;
+
+	/* take all locks in order of increasing addresses */
+	for (size_t i = 0; i < unique; ++i)
+		os_rwlock_wrlock(&v[i]->rwlock);
+}
+
+/*
+ * vinode_wrlock_unleased -- take WRITE lock on vinode once nobody borrows
+ * data from [offset, offset + len) range of it
+ *
+ * Lease holders may need the vinode lock in read mode (e.g. for pread) before
+ * they release their leases, so they are waited for without the lock held and
+ * checked again after it's taken. While the lock is held no new leases can be
+ * given out.
+ */
+void
+vinode_wrlock_unleased(struct pmemfile_vinode *vinode, uint64_t offset,
+		uint64_t len)
+{
+	if (len == 0) {
+		os_rwlock_wrlock(&vinode->rwlock);
+		return;
+	}
+
+	while (true) {
+		range_lock_wait(&vinode->leases, offset, len);
+		os_rwlock_wrlock(&vinode->rwlock);
+
+		if (!range_lock_is_locked(&vinode->leases, offset, len))
+			return;
+
+		os_rwlock_unlock(&vinode->rwlock);
+	}
+}
+
+/*
+ * vinode_check_leases -- returns EBUSY if somebody borrows data from
+ * [offset, offset + len) range of vinode locked in write mode
+ *
+ * Operations which find out what they are going to free only after taking
+ * the lock can't wait for leases there. On EBUSY they drop the lock with
+ * vinode_unlock_wait_leases and start over.
+ */
+int
+vinode_check_leases(struct pmemfile_vinode *vinode, uint64_t offset,
+		uint64_t len)
+{
+	if (!range_lock_is_locked(&vinode->leases, offset, len))
+		return 0;
+
+	vinode->busy_offset = offset;
+	vinode->busy_len = len;
+
+	return EBUSY;
+}
+
+/*
+ * vinode_unlock_wait_leases -- drop WRITE lock on vinode and wait for
+ * the range found by failed vinode_check_leases to be released
+ */
+void
+vinode_unlock_wait_leases(struct pmemfile_vinode *vinode)
+{
+	uint64_t offset = vinode->busy_offset;
+	uint64_t len = vinode->busy_len;
+
+	os_rwlock_unlock(&vinode->rwlock);
+
+	range_lock_wait(&vinode->leases, offset, len);
+}
+
 /*
  * vinode_unlockN -- drop locks on specified inodes
  */
@@ -672,6 +1130,11 @@ vinode_restore_on_abort(struct pmemfile_vinode *vinode)
 		offset_map_delete(vinode->blocks);
 		vinode->blocks = NULL;
 	}
+
+	if (vinode->index) {
+		block_index_close(vinode->index);
+		vinode->index = NULL;
+	}
 }
 
 /*
@@ -706,7 +1169,7 @@ vinode_rdlock_with_block_tree(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 		os_rwlock_unlock(&vinode->rwlock);
 
 		if (err != 0)
-			return -err;
+			return err;
 
 		os_rwlock_rdlock(&vinode->rwlock);
 	}
@@ -738,6 +1201,16 @@ vinode_suspend(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 		vinode->blocks = NULL;
 	}
 
+	if (vinode->index) {
+		block_index_close(vinode->index);
+		vinode->index = NULL;
+	}
+
+	if (vinode->dir_index) {
+		dir_index_free(vinode->dir_index);
+		vinode->dir_index = NULL;
+	}
+
 	vinode->first_free_block.arr = NULL;
 	vinode->first_free_block.idx = 0;
 
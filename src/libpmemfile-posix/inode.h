@@ -37,28 +37,85 @@
 #include <time.h>
 
 #include "libpmemfile-posix.h"
+#include "block_index.h"
+#include "dir_index.h"
+#include "hash_map.h"
 #include "layout.h"
 #include "offset_mapping.h"
 #include "os_thread.h"
+#include "range_lock.h"
+#include "rcu.h"
 
 #define PMEMFILE_S_LONGSYMLINK 0x10000
 COMPILE_ERROR_ON((PMEMFILE_S_IFMT | PMEMFILE_ALLPERMS) &
 		PMEMFILE_S_LONGSYMLINK);
 
+/* data of a regular file is stored in inode->inline_data instead of blocks */
+#define PMEMFILE_S_INLINE_DATA 0x20000
+COMPILE_ERROR_ON((PMEMFILE_S_IFMT | PMEMFILE_ALLPERMS) &
+		PMEMFILE_S_INLINE_DATA);
+
+/* some blocks of a regular file may share data with other blocks */
+#define PMEMFILE_S_SHARED_BLOCKS 0x40000
+COMPILE_ERROR_ON((PMEMFILE_S_IFMT | PMEMFILE_ALLPERMS) &
+		PMEMFILE_S_SHARED_BLOCKS);
+
 /* volatile inode */
 struct pmemfile_vinode {
 	/* reference counter */
 	uint32_t ref;
 
+	/*
+	 * Sequence counter of fields read by lockless path walk (permissions),
+	 * odd while they are being modified and after the vinode is released.
+	 * Modified only with rwlock held in write mode.
+	 */
+	uint32_t seq;
+
 	/* read-write lock, also protects inode read/writes */
 	os_rwlock_t rwlock;
 
+	/*
+	 * Byte-range lock for writes which don't need to modify metadata.
+	 * Taken only when rwlock is held in read mode.
+	 */
+	struct range_lock range_lock;
+
+	/*
+	 * Read leases given out by pmemfile_pread_borrow, locked in shared
+	 * mode. Data blocks of leased ranges must not be freed.
+	 */
+	struct range_lock leases;
+
+	/*
+	 * Leased range found by the last vinode_check_leases which failed,
+	 * written with rwlock held in write mode.
+	 */
+	uint64_t busy_offset;
+	uint64_t busy_len;
+
+	/* memory mappings of this file, protected by rwlock */
+	struct pmemfile_mapping *mappings;
+
 	/*
 	 * Counter to keep track of modifications that potentially
 	 * invalidate a block_pointer_cache field in pmemfile_file struct.
 	 */
 	uint64_t block_pointer_invalidation_counter;
 
+	/*
+	 * Counter of modifications which free pages of a directory and
+	 * invalidate dir_pos field in pmemfile_file struct.
+	 */
+	uint64_t dir_page_invalidation_counter;
+
+	/*
+	 * Generation of a directory, changed on every modification of its
+	 * entries. Lookups cached in dcache are valid only if the generation
+	 * didn't change.
+	 */
+	uint64_t dcache_gen;
+
 	/* persistent inode */
 	struct pmemfile_inode *inode;
 
@@ -97,9 +154,28 @@ struct pmemfile_vinode {
 	/* first used block */
 	struct pmemfile_block_desc *first_block;
 
-	/* tree mapping offsets to blocks */
+	/*
+	 * Tree mapping offsets to blocks. It's empty if the file has
+	 * a persistent block index, which is used for lookups instead.
+	 */
 	struct offset_map *blocks;
 
+	/* runtime state of the block index, valid only if blocks is set */
+	struct block_index *index;
+
+	/*
+	 * Some blocks may share data with other blocks and have to be copied
+	 * before modification. Set when the block tree is built or a block
+	 * becomes shared, never cleared.
+	 */
+	bool has_shared_blocks;
+
+	/*
+	 * Hash index of names of a big directory, built on first use. Points
+	 * to dirents, so it's dropped on pool suspend.
+	 */
+	struct dir_index *dir_index;
+
 	/* space for volatile snapshots */
 	struct {
 		struct block_info first_free_block;
@@ -108,6 +184,22 @@ struct pmemfile_vinode {
 
 	struct pmemfile_time atime;
 	bool atime_dirty;
+
+	/*
+	 * Position in the cache of unreferenced vinodes. Modified only with
+	 * both the cache lock and the inode map shard lock held.
+	 */
+	struct {
+		struct pmemfile_vinode *prev;
+		struct pmemfile_vinode *next;
+		bool cached;
+
+		/* reused since it was cached - gets another chance */
+		bool active;
+	} lru;
+
+	/* for rcu_free - lockless readers may still use released vinode */
+	struct rcu_head rcu;
 };
 
 /*
@@ -306,6 +398,45 @@ inode_tx_set_flags(struct pmemfile_inode *i, uint64_t f)
 	*flags = f;
 }
 
+/*
+ * vinode_seq_write_begin -- marks start of modification of fields read by
+ * lockless path walk
+ */
+static inline void
+vinode_seq_write_begin(struct pmemfile_vinode *vinode)
+{
+	__atomic_store_n(&vinode->seq, vinode->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * vinode_seq_write_end -- marks end of modification of fields read by
+ * lockless path walk
+ */
+static inline void
+vinode_seq_write_end(struct pmemfile_vinode *vinode)
+{
+	__atomic_store_n(&vinode->seq, vinode->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t
+vinode_seq_read_begin(struct pmemfile_vinode *vinode)
+{
+	return __atomic_load_n(&vinode->seq, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * vinode_seq_read_retry -- returns true if data read since
+ * vinode_seq_read_begin may be inconsistent
+ */
+static inline bool
+vinode_seq_read_retry(struct pmemfile_vinode *vinode, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (seq & 1) ||
+		__atomic_load_n(&vinode->seq, __ATOMIC_RELAXED) != seq;
+}
+
 static inline bool inode_is_dir(const struct pmemfile_inode *inode)
 {
 	return PMEMFILE_S_ISDIR(inode_get_flags(inode));
@@ -352,6 +483,77 @@ static inline bool vinode_is_longsymlink(struct pmemfile_vinode *vinode)
 	return inode_is_longsymlink(vinode->inode);
 }
 
+static inline bool inode_is_compact(const struct pmemfile_inode *inode)
+{
+	return inode->version == PMEMFILE_INODE_VERSION(6) ||
+			inode->version == PMEMFILE_INODE_VERSION(8);
+}
+
+static inline bool
+inode_has_shared_blocks(const struct pmemfile_inode *inode)
+{
+	return inode_get_flags(inode) & PMEMFILE_S_SHARED_BLOCKS;
+}
+
+/*
+ * inode_tx_set_shared_blocks -- marks inode as one which blocks may share
+ * data with other blocks
+ *
+ * Bumps inode version, so the inode can't be opened by versions of the
+ * library which would free shared data once for every block pointing to it.
+ */
+static inline void
+inode_tx_set_shared_blocks(struct pmemfile_inode *inode)
+{
+	if (inode_has_shared_blocks(inode))
+		return;
+
+	inode_tx_set_flags(inode, inode_get_flags(inode) |
+			PMEMFILE_S_SHARED_BLOCKS);
+
+	if (inode_is_compact(inode))
+		TX_SET_DIRECT(inode, version, PMEMFILE_INODE_VERSION(8));
+	else
+		TX_SET_DIRECT(inode, version, PMEMFILE_INODE_VERSION(7));
+}
+
+/*
+ * inode_file_data -- returns type specific data of the inode (block array,
+ * symlink), which lives at a different offset in compact inodes
+ */
+static inline union pmemfile_inode_data *
+inode_file_data(struct pmemfile_inode *inode)
+{
+	if (inode_is_compact(inode))
+		return (union pmemfile_inode_data *)
+			((struct pmemfile_compact_inode *)inode)->file_data;
+
+	return &inode->file_data;
+}
+
+/*
+ * inode_file_data_size -- returns number of bytes available for type specific
+ * data of the inode
+ */
+static inline size_t
+inode_file_data_size(const struct pmemfile_inode *inode)
+{
+	if (inode_is_compact(inode))
+		return PMEMFILE_COMPACT_INODE_DATA_SIZE;
+
+	return sizeof(inode->file_data);
+}
+
+static inline bool inode_has_inline_data(const struct pmemfile_inode *inode)
+{
+	return inode_get_flags(inode) & PMEMFILE_S_INLINE_DATA;
+}
+
+static inline bool vinode_has_inline_data(struct pmemfile_vinode *vinode)
+{
+	return inode_has_inline_data(vinode->inode);
+}
+
 const char *get_symlink(PMEMfilepool *pfp, struct pmemfile_vinode *vinode);
 
 struct pmemfile_cred;
@@ -363,8 +565,15 @@ void inode_trim(PMEMfilepool *pfp, TOID(struct pmemfile_inode) tinode);
 
 struct pmemfile_vinode *vinode_ref(PMEMfilepool *pfp,
 		struct pmemfile_vinode *vinode);
+bool vinode_tryref(PMEMfilepool *pfp, struct pmemfile_vinode *vinode);
+
+/* number of cached unreferenced vinodes, 0 disables the cache */
+extern size_t pmemfile_vinode_cache_size;
 
+int inode_map_alloc(PMEMfilepool *pfp);
 void inode_map_free(PMEMfilepool *pfp);
+void inode_map_traverse(PMEMfilepool *pfp, hash_map_cb fun, void *arg);
+bool vinode_lru_flush(PMEMfilepool *pfp);
 
 struct pmemfile_vinode *inode_ref(PMEMfilepool *pfp,
 		TOID(struct pmemfile_inode) inode,
@@ -379,7 +588,7 @@ void vinode_cleanup(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 struct inode_orphan_info inode_orphan(PMEMfilepool *pfp,
 		TOID(struct pmemfile_inode) tinode);
 
-void vinode_orphan_unlocked(PMEMfilepool *pfp, struct pmemfile_vinode *vinode);
+TOID(struct pmemfile_inode_array) inode_orphan_array(PMEMfilepool *pfp);
 void vinode_orphan(PMEMfilepool *pfp, struct pmemfile_vinode *vinode);
 
 void vinode_snapshot(struct pmemfile_vinode *vinode);
@@ -393,6 +602,12 @@ void vinode_wrlockN(struct pmemfile_vinode *v[static 5],
 		struct pmemfile_vinode *v2,
 		struct pmemfile_vinode *v3,
 		struct pmemfile_vinode *v4);
+void vinode_wrlock_many(struct pmemfile_vinode **v, size_t n);
+void vinode_wrlock_unleased(struct pmemfile_vinode *vinode, uint64_t offset,
+		uint64_t len);
+int vinode_check_leases(struct pmemfile_vinode *vinode, uint64_t offset,
+		uint64_t len);
+void vinode_unlock_wait_leases(struct pmemfile_vinode *vinode);
 void vinode_unlockN(struct pmemfile_vinode *v[static 5]);
 
 static inline TOID(struct pmemfile_block_desc)
@@ -162,6 +162,77 @@ inode_array_add(PMEMfilepool *pfp,
 	_inode_array_add(pfp, array, tinode, ins, ins_idx, INODE_ARRAY_LOCK);
 }
 
+/*
+ * inode_array_add_many -- adds count inodes to array, stores their positions
+ * in ins and ins_idx
+ *
+ * Unlike inode_array_add called count times, this locks every page of the
+ * array only once (until the end of transaction), so it can be used to add
+ * multiple inodes in one transaction.
+ *
+ * Must be called in a transaction.
+ */
+void
+inode_array_add_many(PMEMfilepool *pfp,
+		TOID(struct pmemfile_inode_array) array,
+		const TOID(struct pmemfile_inode) *tinodes,
+		size_t count,
+		struct pmemfile_inode_array **ins,
+		unsigned *ins_idx)
+{
+	ASSERT_IN_TX();
+
+	size_t added = 0;
+
+	while (added < count) {
+		struct pmemfile_inode_array *cur = PF_RW(pfp, array);
+		bool modified = false;
+
+		pmemobj_mutex_lock_nofail(pfp->pop, &cur->mtx);
+
+		for (unsigned i = 0; i < NUMINODES_PER_ENTRY &&
+				cur->used < NUMINODES_PER_ENTRY &&
+				added < count; ++i) {
+			if (!TOID_IS_NULL(cur->inodes[i]))
+				continue;
+
+			if (!modified) {
+				mutex_tx_unlock_on_abort(&cur->mtx);
+				TX_ADD_DIRECT(&cur->used);
+				modified = true;
+			}
+
+			TX_ADD_DIRECT(&cur->inodes[i]);
+			cur->inodes[i] = tinodes[added];
+			cur->used++;
+
+			ins[added] = cur;
+			ins_idx[added] = i;
+			added++;
+		}
+
+		if (added < count && TOID_IS_NULL(cur->next)) {
+			if (!modified) {
+				mutex_tx_unlock_on_abort(&cur->mtx);
+				modified = true;
+			}
+
+			TX_ADD_DIRECT(&cur->next);
+			cur->next = inode_array_alloc(pfp);
+			PF_RW(pfp, cur->next)->prev = array;
+		}
+
+		TOID(struct pmemfile_inode_array) next = cur->next;
+
+		if (modified)
+			mutex_tx_unlock_on_commit(&cur->mtx);
+		else
+			pmemobj_mutex_unlock_nofail(pfp->pop, &cur->mtx);
+
+		array = next;
+	}
+}
+
 void
 _inode_array_unregister(PMEMfilepool *pfp,
 		struct pmemfile_inode_array *cur,
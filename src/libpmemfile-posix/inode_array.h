@@ -49,6 +49,12 @@ void inode_array_add(PMEMfilepool *pfp,
 		TOID(struct pmemfile_inode) tinode,
 		struct pmemfile_inode_array **ins,
 		unsigned *ins_idx);
+void inode_array_add_many(PMEMfilepool *pfp,
+		TOID(struct pmemfile_inode_array) array,
+		const TOID(struct pmemfile_inode) *tinodes,
+		size_t count,
+		struct pmemfile_inode_array **ins,
+		unsigned *ins_idx);
 
 void _inode_array_unregister(PMEMfilepool *pfp,
 		struct pmemfile_inode_array *cur,
@@ -51,6 +51,11 @@ POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_block_array);
 POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_block_desc);
 POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_inode_array);
 POBJ_LAYOUT_TOID(pmemfile, char);
+POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_block_refs);
+POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_block_ref_page);
+POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_block_index);
+POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_dir_hash);
+POBJ_LAYOUT_TOID(pmemfile, struct pmemfile_dir_hash_table);
 POBJ_LAYOUT_END(pmemfile);
 
 #define METADATA_BLOCK_SIZE 4096
@@ -77,6 +82,14 @@ struct pmemfile_block_desc {
 
 #define BLOCK_INITIALIZED 1
 
+/*
+ * Block data is shared with blocks of other files (or other parts of the same
+ * file) and can't be modified in place. Number of references is kept in
+ * the pmemfile_block_refs table. Inodes with such blocks have
+ * PMEMFILE_INODE_VERSION(7) or (8).
+ */
+#define BLOCK_SHARED 2
+
 #define PMEMFILE_BLOCK_ARRAY_VERSION(a) ((uint32_t)0x00414C42 | \
 		((uint32_t)(a + '0') << 24))
 
@@ -129,6 +142,103 @@ struct pmemfile_dir {
 	struct pmemfile_dirent dirents[];
 };
 
+/*
+ * Entry of a compact directory page. Its size depends on the length of the
+ * name - "dirent" is cut after the terminating NUL of the name and the whole
+ * entry is padded to 8 bytes.
+ */
+struct pmemfile_compact_dirent {
+	/* low 32 bits of hash of the name */
+	uint32_t hash;
+
+	/* size of the whole entry */
+	uint16_t size;
+
+	/* length of the name */
+	uint8_t namelen;
+
+	/* padding / unused */
+	uint8_t padding;
+
+	/* inode and name */
+	struct pmemfile_dirent dirent;
+};
+
+/*
+ * Page of compact directory entries, PMEMFILE_DIR_VERSION(3). Used by buckets
+ * of hashed directories. Header matches pmemfile_dir, so both kinds of pages
+ * can be linked on one list.
+ */
+struct pmemfile_dir_compact {
+	/* layout version */
+	uint32_t version;
+
+	/* number of bytes of "data" used by entries */
+	uint32_t used;
+
+	/* next batch of entries */
+	TOID(struct pmemfile_dir) next;
+
+	/* packed pmemfile_compact_dirent entries */
+	char data[];
+};
+
+COMPILE_ERROR_ON(offsetof(struct pmemfile_dir_compact, next) !=
+		offsetof(struct pmemfile_dir, next));
+COMPILE_ERROR_ON(sizeof(struct pmemfile_dir_compact) % 8 != 0);
+
+#define PMEMFILE_DIR_HASH_VERSION(a) ((uint32_t)0x00524844 | \
+		((uint32_t)(a + '0') << 24))
+#define PMEMFILE_DIR_HASH_TABLE_VERSION(a) ((uint32_t)0x00544844 | \
+		((uint32_t)(a + '0') << 24))
+
+/* number of bucket pointers for pmemfile_dir_hash_table to fit in 4kB */
+#define NUMBUCKETS_PER_TABLE 511
+
+/* page of bucket pointers of a hashed directory */
+struct pmemfile_dir_hash_table {
+	/* layout version */
+	uint32_t version;
+
+	/* padding / unused */
+	uint32_t padding;
+
+	/* pool offsets of first pages of buckets */
+	uint64_t buckets[NUMBUCKETS_PER_TABLE];
+};
+
+/* number of table pointers for pmemfile_dir_hash to fit in 4kB */
+#define NUMTABLES_PER_DIR_HASH 509
+
+/*
+ * Root of a hashed directory. Entries other than "." and ".." are kept
+ * in buckets, which are lists of pmemfile_dir_compact pages (or pmemfile_dir
+ * pages of version 2, converted on first insert to the bucket). Bucket of an
+ * entry is picked by linear hashing of its name: there are (2^level + split)
+ * buckets and buckets with numbers lower than "split" have already been split
+ * in two, using one more bit of the hash.
+ */
+struct pmemfile_dir_hash {
+	/* layout version */
+	uint32_t version;
+
+	/* number of low bits of name hash used to pick a bucket */
+	uint32_t level;
+
+	/* next bucket to split, < 2^level */
+	uint64_t split;
+
+	/* number of entries in buckets */
+	uint64_t entries;
+
+	/* pool offsets of pages of bucket pointers */
+	uint64_t tables[NUMTABLES_PER_DIR_HASH];
+};
+
+COMPILE_ERROR_ON(sizeof(struct pmemfile_dir_hash_table) !=
+		METADATA_BLOCK_SIZE);
+COMPILE_ERROR_ON(sizeof(struct pmemfile_dir_hash) != METADATA_BLOCK_SIZE);
+
 struct pmemfile_time {
 	/* seconds */
 	int64_t sec;
@@ -143,6 +253,7 @@ struct pmemfile_time {
 #define PMEMFILE_INODE_SIZE METADATA_BLOCK_SIZE
 #define PMEMFILE_IN_INODE_STORAGE \
 	(sizeof(struct pmemfile_dir) + 2 * sizeof(struct pmemfile_dirent) + 8)
+#define PMEMFILE_INODE_INLINE_DATA_SIZE 3072
 
 /* Inode */
 struct pmemfile_inode {
@@ -213,12 +324,36 @@ struct pmemfile_inode {
 
 	/* ---- cacheline boundary ---- */
 
-	uint8_t padding3[3200];
+	/*
+	 * Offset-ordered index of blocks of a regular file, NULL if the file
+	 * doesn't have one. Present only in inodes of version 3 or higher.
+	 */
+	TOID(struct pmemfile_block_index) block_index;
+
+	/*
+	 * Hash table of a directory, NULL if its entries are kept in a list of
+	 * pages. Present only in inodes of version 4 or higher.
+	 */
+	TOID(struct pmemfile_dir_hash) dir_hash;
+
+	uint8_t padding3[32];
+
+	/* ---- cacheline boundary ---- */
+
+	/*
+	 * Contents of a small regular file, valid only if the file has
+	 * PMEMFILE_S_INLINE_DATA flag set. Bytes past the file size are
+	 * undefined. Present only in inodes of version 5 (not in compact
+	 * inodes, see below).
+	 */
+	char inline_data[PMEMFILE_INODE_INLINE_DATA_SIZE];
+
+	uint8_t padding4[64];
 
 	/* ---- cacheline boundary ---- */
 
 	/* data! */
-	union {
+	union pmemfile_inode_data {
 		/* file specific data */
 		struct pmemfile_block_array blocks;
 
@@ -239,6 +374,80 @@ COMPILE_ERROR_ON(sizeof(union pmemfile_inode_slots) != 8);
 
 COMPILE_ERROR_ON(sizeof(struct pmemfile_inode) != PMEMFILE_INODE_SIZE);
 
+/*
+ * Fields of pmemfile_inode up to and including dir_hash, shared by both
+ * inode layouts.
+ */
+#define PMEMFILE_INODE_HEADER_SIZE 352
+COMPILE_ERROR_ON(offsetof(struct pmemfile_inode, padding3) !=
+		PMEMFILE_INODE_HEADER_SIZE);
+
+#define PMEMFILE_COMPACT_INODE_SIZE 512
+#define PMEMFILE_COMPACT_INODE_DATA_SIZE \
+	(PMEMFILE_COMPACT_INODE_SIZE - PMEMFILE_INODE_HEADER_SIZE)
+
+/*
+ * Compact inode, PMEMFILE_INODE_VERSION(6) (or 8 when it has shared
+ * blocks). Used for all files except
+ * directories in pools created with PMEMFILE_COMPACT_INODE_SIZE inodes.
+ *
+ * Its header is the same as in pmemfile_inode, so all metadata is accessed
+ * the same way, but file_data is smaller and starts right after the header.
+ * It holds only 2 block descriptors (the rest of them goes to block arrays
+ * allocated out of line) or a symlink of up to 159 characters. There's no
+ * room for inline data.
+ */
+struct pmemfile_compact_inode {
+	char header[PMEMFILE_INODE_HEADER_SIZE];
+
+	/* laid out like file_data of pmemfile_inode */
+	char file_data[PMEMFILE_COMPACT_INODE_DATA_SIZE];
+};
+
+COMPILE_ERROR_ON(sizeof(struct pmemfile_compact_inode) !=
+		PMEMFILE_COMPACT_INODE_SIZE);
+COMPILE_ERROR_ON(sizeof(struct pmemfile_block_array) +
+		2 * sizeof(struct pmemfile_block_desc) !=
+		PMEMFILE_COMPACT_INODE_DATA_SIZE);
+
+#define PMEMFILE_BLOCK_INDEX_VERSION(a) ((uint32_t)0x00584449 | \
+		((uint32_t)(a + '0') << 24))
+
+/* single entry of the block index */
+struct pmemfile_block_index_entry {
+	/* offset in file, equal to block->offset */
+	uint64_t offset;
+
+	/* pool offset of block metadata */
+	uint64_t block;
+};
+
+/* number of entries for pmemfile_block_index to fit in 4kB */
+#define NUMEXTENTS_PER_INDEX 253
+
+/*
+ * Page of the block index. Pages are linked in offset order, entries of
+ * a page are sorted by offset and offsets in a page are lower than offsets
+ * in the next one.
+ */
+struct pmemfile_block_index {
+	/* layout version */
+	uint32_t version;
+
+	/* number of used entries, <0, NUMEXTENTS_PER_INDEX> */
+	uint32_t length;
+
+	/* padding / unused */
+	uint64_t padding;
+
+	TOID(struct pmemfile_block_index) prev;
+	TOID(struct pmemfile_block_index) next;
+
+	struct pmemfile_block_index_entry entries[NUMEXTENTS_PER_INDEX];
+};
+
+COMPILE_ERROR_ON(sizeof(struct pmemfile_block_index) != METADATA_BLOCK_SIZE);
+
 #define PMEMFILE_INODE_ARRAY_VERSION(a) ((uint32_t)0x00414E49 | \
 		((uint32_t)(a + '0') << 24))
 #define PMEMFILE_INODE_ARRAY_SIZE METADATA_BLOCK_SIZE
@@ -274,6 +483,60 @@ struct pmemfile_inode_array {
 COMPILE_ERROR_ON(sizeof(struct pmemfile_inode_array) !=
 		PMEMFILE_INODE_ARRAY_SIZE);
 
+#define PMEMFILE_BLOCK_REFS_VERSION(a) ((uint32_t)0x00464552 | \
+		((uint32_t)(a + '0') << 24))
+
+/* reference counter of block data shared by multiple block descriptors */
+struct pmemfile_block_ref {
+	/* pool offset of block data, 0 means the entry is unused */
+	uint64_t data;
+
+	/* number of block descriptors pointing to the data */
+	uint64_t refcount;
+};
+
+/* number of references for pmemfile_block_ref_page to fit in 4kB */
+#define NUMREFS_PER_PAGE 254
+
+/* page of reference counters, part of pmemfile_block_refs bucket */
+struct pmemfile_block_ref_page {
+	/* layout version */
+	uint32_t version;
+
+	/* number of entries ever used, <0, NUMREFS_PER_PAGE> */
+	uint32_t used;
+
+	/* padding / unused */
+	uint64_t padding;
+
+	/* next page in the same bucket */
+	TOID(struct pmemfile_block_ref_page) next;
+
+	struct pmemfile_block_ref refs[NUMREFS_PER_PAGE];
+};
+
+COMPILE_ERROR_ON(sizeof(struct pmemfile_block_ref_page) !=
+		METADATA_BLOCK_SIZE);
+
+/* number of buckets for pmemfile_block_refs to fit in 4kB */
+#define NUMREF_BUCKETS 255
+
+/* hash table of reference counters of shared block data */
+struct pmemfile_block_refs {
+	/* layout version */
+	uint32_t version;
+
+	/* padding / unused */
+	uint32_t padding1;
+
+	/* padding / unused */
+	uint64_t padding2;
+
+	TOID(struct pmemfile_block_ref_page) buckets[NUMREF_BUCKETS];
+};
+
+COMPILE_ERROR_ON(sizeof(struct pmemfile_block_refs) != METADATA_BLOCK_SIZE);
+
 #define PMEMFILE_SUPER_VERSION(a, b) ((uint64_t)0x000056454C494650 | \
 		((uint64_t)(a + '0') << 48) | ((uint64_t)(b + '0') << 56))
 #define PMEMFILE_SUPER_SIZE METADATA_BLOCK_SIZE
@@ -286,6 +549,12 @@ COMPILE_ERROR_ON(sizeof(struct pmemfile_inode_array) !=
  */
 #define PMEMFILE_ROOT_COUNT 4
 
+/*
+ * Number of lists of orphaned inodes. Threads add inodes to different lists,
+ * so they don't serialize on locks of one list.
+ */
+#define PMEMFILE_ORPHAN_SHARDS 16
+
 /* superblock */
 struct pmemfile_super {
 	/* superblock version */
@@ -305,11 +574,32 @@ struct pmemfile_super {
 	 */
 	TOID(struct pmemfile_inode) root_inode[PMEMFILE_ROOT_COUNT];
 
+	/* reference counters of shared blocks, allocated on first use */
+	TOID(struct pmemfile_block_refs) block_refs;
+
+	/*
+	 * Size of inodes of files other than directories, PMEMFILE_INODE_SIZE
+	 * or PMEMFILE_COMPACT_INODE_SIZE. 0 in pools created before it was
+	 * introduced, which means PMEMFILE_INODE_SIZE.
+	 */
+	uint64_t inode_size;
+
+	/*
+	 * More lists of arrays of orphaned inodes, orphaned_inodes is shard 0.
+	 * NULL in pools created before they were introduced, allocated when
+	 * such pool is opened.
+	 */
+	TOID(struct pmemfile_inode_array)
+		orphaned_shards[PMEMFILE_ORPHAN_SHARDS - 1];
+
 	char padding[PMEMFILE_SUPER_SIZE
 			- 8  /* version */
 			- 16 * (PMEMFILE_ROOT_COUNT) /* toid */
 			- 16 /* toid */
-			- 16 /* toid */];
+			- 16 /* toid */
+			- 16 /* toid */
+			- 8  /* inode_size */
+			- 16 * (PMEMFILE_ORPHAN_SHARDS - 1) /* toid */];
 };
 
 COMPILE_ERROR_ON(sizeof(struct pmemfile_super) != PMEMFILE_SUPER_SIZE);
@@ -104,7 +104,7 @@ _pmemfile_linkat(PMEMfilepool *pfp,
 
 		struct pmemfile_time t;
 		get_current_time(&t);
-		inode_add_dirent(pfp, dst.parent->tinode, dst.remaining,
+		vinode_add_dirent(pfp, dst.parent, dst.remaining,
 				dst_namelen, src_vinode->tinode, t);
 	} TX_ONABORT {
 		if (errno == ENOMEM)
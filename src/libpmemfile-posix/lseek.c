@@ -35,6 +35,7 @@
  */
 
 #include "data.h"
+#include "dir_hash.h"
 #include "file.h"
 #include "inode.h"
 #include "libpmemfile-posix.h"
@@ -51,6 +52,10 @@ lseek_seek_data(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 {
 	ASSERT(vinode->blocks != NULL);
 
+	/* data stored in the inode has no holes */
+	if (vinode_has_inline_data(vinode))
+		return offset;
+
 	struct pmemfile_block_desc *block =
 			find_closest_block(vinode, (uint64_t)offset);
 	if (block == NULL) {
@@ -82,6 +87,9 @@ lseek_seek_hole(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 {
 	ASSERT(vinode->blocks != NULL);
 
+	if (vinode_has_inline_data(vinode))
+		return fsize;
+
 	struct pmemfile_block_desc *block =
 			find_closest_block(vinode, (uint64_t)offset);
 
@@ -109,6 +117,11 @@ static pmemfile_off_t
 lseek_end_directory(PMEMfilepool *pfp, struct pmemfile_inode *inode,
 			pmemfile_off_t offset)
 {
+	/* end of a hashed directory is the end of its hash space */
+	if (inode_is_hashed_dir(inode))
+		return (pmemfile_off_t)DIR_HASH_OFFSET(DIR_HASH_POS_END) +
+				offset;
+
 	pmemfile_off_t ret = 0;
 	pmemfile_off_t ret_dir_num = 0;
 	pmemfile_off_t dir_num = 0;
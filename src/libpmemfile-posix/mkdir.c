@@ -36,8 +36,8 @@
 
 #include <inttypes.h>
 
-#include "callbacks.h"
 #include "dir.h"
+#include "group_commit.h"
 #include "inode.h"
 #include "libpmemfile-posix.h"
 #include "mkdir.h"
@@ -81,13 +81,32 @@ vinode_new_dir(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
 		inode_add_dirent(pfp, tchild, "..", 2, tchild, t);
 	} else {
 		inode_add_dirent(pfp, tchild, "..", 2, parent->tinode, t);
-		inode_add_dirent(pfp, parent->tinode, name, namelen, tchild,
-				t);
+		vinode_add_dirent(pfp, parent, name, namelen, tchild, t);
 	}
 
 	return tchild;
 }
 
+struct mkdir_args {
+	struct pmemfile_cred *cred;
+	pmemfile_mode_t mode;
+	struct pmemfile_vinode *parent;
+	const char *name;
+	size_t namelen;
+};
+
+/*
+ * mkdir_tx -- transaction body of mkdir, may be batched with other operations
+ */
+static void
+mkdir_tx(PMEMfilepool *pfp, void *arg)
+{
+	struct mkdir_args *args = arg;
+
+	vinode_new_dir(pfp, args->parent, args->name, args->namelen,
+			args->cred, args->mode);
+}
+
 static int
 _pmemfile_mkdirat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 		const char *path, pmemfile_mode_t mode)
@@ -117,19 +136,16 @@ _pmemfile_mkdirat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 
 	os_rwlock_wrlock(&parent->rwlock);
 
-	ASSERT_NOT_IN_TX();
-
-	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
-		if (!_vinode_can_access(&cred, parent, PFILE_WANT_WRITE))
-			pmemfile_tx_abort(EACCES);
+	if (!_vinode_can_access(&cred, parent, PFILE_WANT_WRITE)) {
+		error = EACCES;
+	} else {
+		struct mkdir_args args = { &cred, mode, parent, info.remaining,
+				namelen };
 
-		vinode_new_dir(pfp, parent, info.remaining, namelen, &cred,
-				mode);
-	} TX_ONABORT {
-		if (errno == ENOMEM)
-			errno = ENOSPC;
-		error = errno;
-	} TX_END
+		error = group_commit_tx(pfp, mkdir_tx, &args);
+		if (error == ENOMEM)
+			error = ENOSPC;
+	}
 
 	os_rwlock_unlock(&parent->rwlock);
 
@@ -32,68 +32,1153 @@
 
 /*
  * mmap.c -- pmemfile_* memory mapping implementation
+ *
+ * Pages of shared mappings which are fully backed by initialized, page
+ * aligned parts of data blocks are mapped straight from the pool (by creating
+ * a second mapping of the same pages of the pool file), so loads and stores
+ * go directly to the file. All other pages ("shadow" pages) are anonymous
+ * memory with a copy of file data. Modified shadow pages of shared mappings
+ * are written back to the file by msync and munmap.
+ *
+ * Blocks whose data is shared with other files (see block_ref.c) are never
+ * mapped directly, their pages are copy-on-write by the means of shadow
+ * pages. Direct pages are detached before their blocks become shared.
+ *
+ * Before blocks backing direct pages are freed (truncate, punching holes)
+ * those pages are replaced by shadow pages and the freed range is zeroed in
+ * all shared mappings (see vinode_revoke_mappings). Data written to the file
+ * by other means shows up in shadow pages only after msync with
+ * PMEMFILE_MS_INVALIDATE.
+ *
+ * Locking: pool mappings_mutex protects the list of all mappings in the pool,
+ * vinode rwlock (in write mode) protects the list of mappings of a file and
+ * the state of their pages. Mappings mutex must be taken before vinode lock.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "data.h"
+#include "file.h"
+#include "inode.h"
 #include "libpmemfile-posix.h"
+#include "mmap.h"
 #include "out.h"
+#include "pool.h"
+#include "utils.h"
+
+/* page maps pool memory directly */
+#define PAGE_DIRECT ((uint8_t)0x80)
+
+/* page was writable since last synchronization with the file */
+#define PAGE_WRITABLE ((uint8_t)0x40)
+
+/* protection of page (PMEMFILE_PROT_*) */
+#define PAGE_PROT_MASK ((uint8_t)(PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE | \
+		PMEMFILE_PROT_EXEC))
+
+struct pmemfile_mapping {
+	/* first mapped byte, page aligned */
+	char *addr;
+
+	/* number of mapped pages */
+	size_t npages;
+
+	/* file offset of the first page */
+	uint64_t offset;
+
+	/* PMEMFILE_MAP_SHARED or PMEMFILE_MAP_PRIVATE */
+	int type;
+
+	/* file was opened for writing */
+	bool writable;
+
+	struct pmemfile_vinode *vinode;
+
+	/* state of each page */
+	uint8_t *pages;
+
+	/*
+	 * Contents of shadow pages of shared mapping as of the last
+	 * synchronization with the file, used to find modified pages.
+	 */
+	char *pristine;
+
+	/* next mapping of the same file */
+	struct pmemfile_mapping *vinode_next;
+
+	/* next mapping in the pool */
+	struct pmemfile_mapping *next;
+};
+
+static size_t Pagesize;
+
+/*
+ * mmap_init -- initializes mmap module
+ */
+void
+mmap_init(void)
+{
+	long ps = sysconf(_SC_PAGESIZE);
+	if (ps < 0)
+		FATAL("!sysconf PAGESIZE");
+
+	Pagesize = (size_t)ps;
+}
+
+static inline char *
+page_addr(const struct pmemfile_mapping *m, size_t page)
+{
+	return m->addr + page * Pagesize;
+}
+
+static inline uint64_t
+page_offset(const struct pmemfile_mapping *m, size_t page)
+{
+	return m->offset + page * Pagesize;
+}
+
+static inline int
+page_prot(const struct pmemfile_mapping *m, size_t page)
+{
+	return m->pages[page] & PAGE_PROT_MASK;
+}
+
+static inline char *
+mapping_end(const struct pmemfile_mapping *m)
+{
+	return page_addr(m, m->npages);
+}
+
+/*
+ * file_read -- reads len bytes of file at offset to buf, filling holes and
+ * space past the end of file with zeros; vinode must be locked
+ */
+static void
+file_read(PMEMfilepool *pfp, struct pmemfile_vinode *vinode, uint64_t offset,
+		char *buf, size_t len)
+{
+	uint64_t size = inode_get_size(vinode->inode);
+	size_t count = 0;
+
+	if (offset < size) {
+		count = size - offset < len ? (size_t)(size - offset) : len;
+
+		struct pmemfile_block_desc *block =
+				find_closest_block(vinode, offset);
+		iterate_on_file_range(pfp, vinode, block, offset, count, buf,
+				read_from_blocks);
+	}
+
+	memset(buf + count, 0, len - count);
+}
+
+/*
+ * direct_page_data -- returns pool memory which holds one page of file
+ * data at offset, if it can be mapped directly, NULL otherwise
+ */
+static char *
+direct_page_data(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset)
+{
+	if (offset + Pagesize > inode_get_size(vinode->inode))
+		return NULL;
+
+	struct pmemfile_block_desc *block = find_closest_block(vinode, offset);
+	if (!block || !is_offset_in_block(block, offset))
+		return NULL;
+
+	/* data of shared blocks can't be modified in place */
+	if (!(block->flags & BLOCK_INITIALIZED) ||
+			(block->flags & BLOCK_SHARED))
+		return NULL;
+
+	uint64_t in_block = offset - block->offset;
+	if (in_block + Pagesize > block->size)
+		return NULL;
+
+	char *data = (char *)PF_RW(pfp, block->data) + in_block;
+	if ((uintptr_t)data % Pagesize)
+		return NULL;
+
+	return data;
+}
+
+/*
+ * mapping_populate -- fills pages of a new mapping, vinode must be locked
+ */
+static void
+mapping_populate(PMEMfilepool *pfp, struct pmemfile_mapping *m)
+{
+	size_t p = 0;
+
+	while (p < m->npages) {
+		char *data = NULL;
+		if (m->type == PMEMFILE_MAP_SHARED)
+			data = direct_page_data(pfp, m->vinode,
+					page_offset(m, p));
+
+		if (data) {
+			size_t n = 1;
+			while (p + n < m->npages && direct_page_data(pfp,
+					m->vinode, page_offset(m, p + n)) ==
+					data + n * Pagesize)
+				n++;
+
+			/*
+			 * mremap with old_size == 0 creates a new mapping of
+			 * the same pages of a shared mapping.
+			 */
+			void *addr = mremap(data, 0, n * Pagesize,
+					MREMAP_MAYMOVE | MREMAP_FIXED,
+					page_addr(m, p));
+			if (addr != MAP_FAILED) {
+				for (size_t i = p; i < p + n; ++i)
+					m->pages[i] |= PAGE_DIRECT;
+				p += n;
+				continue;
+			}
+
+			LOG(LINF, "cannot map pool memory directly: %d",
+					errno);
+		}
+
+		size_t n = 1;
+		if (!data) {
+			while (p + n < m->npages && (m->type !=
+					PMEMFILE_MAP_SHARED ||
+					!direct_page_data(pfp, m->vinode,
+						page_offset(m, p + n))))
+				n++;
+		}
+
+		file_read(pfp, m->vinode, page_offset(m, p), page_addr(m, p),
+				n * Pagesize);
+		if (m->pristine)
+			memcpy(m->pristine + p * Pagesize, page_addr(m, p),
+					n * Pagesize);
+
+		p += n;
+	}
+}
+
+/*
+ * mapping_create -- creates a new mapping of vinode
+ *
+ * If src is not NULL, first src_len bytes of private mapping are copied from
+ * it instead of the file.
+ */
+static struct pmemfile_mapping *
+mapping_create(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		bool writable, void *addr, size_t len, int prot, int flags,
+		uint64_t offset, const char *src, size_t src_len)
+{
+	int error;
+	size_t npages = len / Pagesize;
+
+	struct pmemfile_mapping *m = pf_calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+
+	m->pages = pf_malloc(npages);
+	if (!m->pages) {
+		error = errno;
+		goto pages_fail;
+	}
+
+	m->npages = npages;
+	m->offset = offset;
+	m->type = flags & (PMEMFILE_MAP_SHARED | PMEMFILE_MAP_PRIVATE);
+	m->writable = writable;
+	m->vinode = vinode;
+
+	uint8_t state = (uint8_t)prot;
+	if (prot & PMEMFILE_PROT_WRITE)
+		state |= PAGE_WRITABLE;
+	memset(m->pages, state, npages);
+
+	/* reserve address space, which will be filled with shadow pages */
+	m->addr = mmap(addr, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS |
+			(flags & PMEMFILE_MAP_FIXED), -1, 0);
+	if (m->addr == MAP_FAILED) {
+		error = errno;
+		goto addr_fail;
+	}
+
+	if (m->type == PMEMFILE_MAP_SHARED) {
+		m->pristine = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m->pristine == MAP_FAILED) {
+			error = errno;
+			goto pristine_fail;
+		}
+	}
+
+	os_rwlock_wrlock(&vinode->rwlock);
+
+	if (!vinode->blocks) {
+		error = vinode_rebuild_block_tree(pfp, vinode);
+		if (error) {
+			error = -error;
+			os_rwlock_unlock(&vinode->rwlock);
+			goto populate_fail;
+		}
+	}
+
+	mapping_populate(pfp, m);
+	if (src)
+		memcpy(m->addr, src, src_len < len ? src_len : len);
+
+	if (mprotect(m->addr, len, prot)) {
+		error = errno;
+		os_rwlock_unlock(&vinode->rwlock);
+		goto populate_fail;
+	}
+
+	m->vinode = vinode_ref(pfp, vinode);
+	m->vinode_next = vinode->mappings;
+	vinode->mappings = m;
+
+	os_rwlock_unlock(&vinode->rwlock);
+
+	return m;
+
+populate_fail:
+	if (m->pristine)
+		munmap(m->pristine, len);
+pristine_fail:
+	munmap(m->addr, len);
+addr_fail:
+	pf_free(m->pages);
+pages_fail:
+	pf_free(m);
+	errno = error;
+	return NULL;
+}
+
+/*
+ * mapping_destroy -- unmaps memory of mapping removed from all lists and
+ * frees it
+ */
+static void
+mapping_destroy(PMEMfilepool *pfp, struct pmemfile_mapping *m)
+{
+	size_t len = m->npages * Pagesize;
+
+	if (munmap(m->addr, len))
+		FATAL("!munmap");
+	if (m->pristine && munmap(m->pristine, len))
+		FATAL("!munmap");
+
+	vinode_unref(pfp, m->vinode);
+	pf_free(m->pages);
+	pf_free(m);
+}
+
+/*
+ * mapping_split -- splits mapping into pages [0, page) and [page, npages)
+ *
+ * Both pool mappings_mutex and vinode lock (in write mode) must be held.
+ */
+static int
+mapping_split(PMEMfilepool *pfp, struct pmemfile_mapping *m, size_t page)
+{
+	ASSERT(page > 0 && page < m->npages);
+
+	struct pmemfile_mapping *n = pf_malloc(sizeof(*n));
+	if (!n)
+		return -1;
+
+	*n = *m;
+	n->npages = m->npages - page;
+
+	n->pages = pf_malloc(n->npages);
+	if (!n->pages) {
+		pf_free(n);
+		return -1;
+	}
+
+	memcpy(n->pages, m->pages + page, n->npages);
+	n->addr = page_addr(m, page);
+	n->offset = page_offset(m, page);
+	if (m->pristine)
+		n->pristine = m->pristine + page * Pagesize;
+	n->vinode = vinode_ref(pfp, m->vinode);
+
+	m->npages = page;
+	m->vinode_next = n;
+	m->next = n;
+
+	return 0;
+}
+
+/*
+ * vinode_remove_mapping -- removes mapping from the list of file mappings
+ */
+static void
+vinode_remove_mapping(struct pmemfile_vinode *vinode,
+		struct pmemfile_mapping *m)
+{
+	struct pmemfile_mapping **pm = &vinode->mappings;
+
+	while (*pm != m)
+		pm = &(*pm)->vinode_next;
+
+	*pm = m->vinode_next;
+}
+
+/*
+ * mapping_set_access -- temporarily makes pages [first, last) which are
+ * going to be synchronized with the file readable and writable (or restores
+ * their protection, if restore is set)
+ */
+static void
+mapping_set_access(struct pmemfile_mapping *m, size_t first, size_t last,
+		bool invalidate, bool restore)
+{
+	const int rw = PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE;
+
+	for (size_t p = first; p < last; ++p) {
+		int prot = page_prot(m, p);
+
+		if ((m->pages[p] & PAGE_DIRECT) || (prot & rw) == rw)
+			continue;
+		if (!(m->pages[p] & PAGE_WRITABLE) && !invalidate)
+			continue;
+
+		if (mprotect(page_addr(m, p), Pagesize,
+				restore ? prot : prot | rw))
+			FATAL("!mprotect");
+	}
+}
+
+/*
+ * mapping_write_back -- writes pages [first, first + n) of mapping to
+ * the file, skipping the part past the end of file
+ */
+static int
+mapping_write_back(PMEMfilepool *pfp, struct pmemfile_mapping *m,
+		size_t first, size_t n)
+{
+	uint64_t size = inode_get_size(m->vinode->inode);
+	uint64_t offset = page_offset(m, first);
+	size_t len = n * Pagesize;
+
+	if (offset < size && m->writable) {
+		size_t count = len;
+		if (size - offset < count)
+			count = (size_t)(size - offset);
+
+		if (vinode_pwrite_locked(pfp, m->vinode, offset,
+				page_addr(m, first), count) < 0)
+			return -1;
+	}
+
+	memcpy(m->pristine + first * Pagesize, page_addr(m, first), len);
+
+	return 0;
+}
+
+/*
+ * mapping_sync -- synchronizes pages [first, last) of shared mapping with
+ * the file, vinode must be locked in write mode
+ *
+ * Modified shadow pages are written back to the file and direct pages are
+ * flushed. If invalidate is set unmodified shadow pages are reloaded from
+ * the file.
+ */
+static int
+mapping_sync(PMEMfilepool *pfp, struct pmemfile_mapping *m, size_t first,
+		size_t last, bool invalidate)
+{
+	if (m->type != PMEMFILE_MAP_SHARED)
+		return 0;
+
+	mapping_set_access(m, first, last, invalidate, false);
+
+	int ret = 0;
+	size_t dirty = 0;
+
+	for (size_t p = first; p < last; ++p) {
+		uint8_t state = m->pages[p];
+		char *page = page_addr(m, p);
+		char *pristine = m->pristine + p * Pagesize;
+		bool modified = false;
+
+		if (state & PAGE_DIRECT) {
+			/* flush through the pool mapping of the same memory */
+			char *data = direct_page_data(pfp, m->vinode,
+					page_offset(m, p));
+			if ((state & PAGE_WRITABLE) && data)
+				pmemobj_flush(pfp->pop, data, Pagesize);
+		} else if (state & PAGE_WRITABLE) {
+			modified = memcmp(page, pristine, Pagesize) != 0;
+		}
+
+		if (!modified && invalidate && !(state & PAGE_DIRECT)) {
+			file_read(pfp, m->vinode, page_offset(m, p), page,
+					Pagesize);
+			memcpy(pristine, page, Pagesize);
+		}
+
+		if (modified) {
+			dirty++;
+			continue;
+		}
+
+		if (dirty && ret == 0)
+			ret = mapping_write_back(pfp, m, p - dirty, dirty);
+		dirty = 0;
+	}
+
+	if (dirty && ret == 0)
+		ret = mapping_write_back(pfp, m, last - dirty, dirty);
+
+	pmemfile_drain(pfp);
+
+	mapping_set_access(m, first, last, invalidate, true);
+
+	if (ret == 0) {
+		for (size_t p = first; p < last; ++p)
+			if (!(page_prot(m, p) & PMEMFILE_PROT_WRITE))
+				m->pages[p] &= (uint8_t)~PAGE_WRITABLE;
+	}
+
+	return ret;
+}
+
+/*
+ * page_detach -- replaces direct page of mapping by a shadow page with
+ * the same contents
+ */
+static void
+page_detach(struct pmemfile_mapping *m, size_t p)
+{
+	char *page = page_addr(m, p);
+	char *copy = m->pristine + p * Pagesize;
+	int prot = page_prot(m, p);
+
+	if (!(prot & PMEMFILE_PROT_READ) &&
+			mprotect(page, Pagesize, PROT_READ))
+		FATAL("!mprotect");
+
+	memcpy(copy, page, Pagesize);
 
+	if (mmap(page, Pagesize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+			MAP_FAILED)
+		FATAL("!mmap");
+
+	memcpy(page, copy, Pagesize);
+
+	if (mprotect(page, Pagesize, prot))
+		FATAL("!mprotect");
+
+	m->pages[p] &= (uint8_t)~PAGE_DIRECT;
+}
+
+/*
+ * page_zero -- zeroes [start, end) range of the file in shadow page of
+ * mapping
+ */
+static void
+page_zero(struct pmemfile_mapping *m, size_t p, uint64_t start, uint64_t end)
+{
+	const int rw = PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE;
+	char *page = page_addr(m, p);
+	uint64_t off = page_offset(m, p);
+	int prot = page_prot(m, p);
+
+	uint64_t zstart = start > off ? start : off;
+	uint64_t zend = end < off + Pagesize ? end : off + Pagesize;
+
+	if ((prot & rw) != rw && mprotect(page, Pagesize, prot | rw))
+		FATAL("!mprotect");
+
+	memset(page + (zstart - off), 0, zend - zstart);
+	memset(m->pristine + p * Pagesize + (zstart - off), 0, zend - zstart);
+
+	if ((prot & rw) != rw && mprotect(page, Pagesize, prot))
+		FATAL("!mprotect");
+}
+
+/*
+ * page_revoke -- replaces direct page of mapping by a shadow page with
+ * the same contents, except for [start, end) range of the file which is
+ * zeroed
+ */
+static void
+page_revoke(struct pmemfile_mapping *m, size_t p, uint64_t start,
+		uint64_t end)
+{
+	uint64_t off = page_offset(m, p);
+
+	if (start > off || end < off + Pagesize) {
+		page_detach(m, p);
+		page_zero(m, p, start, end);
+		return;
+	}
+
+	char *page = page_addr(m, p);
+
+	memset(m->pristine + p * Pagesize, 0, Pagesize);
+
+	if (mmap(page, Pagesize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+			MAP_FAILED)
+		FATAL("!mmap");
+
+	if (mprotect(page, Pagesize, page_prot(m, p)))
+		FATAL("!mprotect");
+
+	m->pages[p] &= (uint8_t)~PAGE_DIRECT;
+}
+
+/*
+ * mapping_pages_in_range -- finds pages [*first, *last) of shared mapping
+ * which intersect [start, end) range of the file, returns false if there
+ * are none
+ */
+static bool
+mapping_pages_in_range(const struct pmemfile_mapping *m, uint64_t start,
+		uint64_t end, size_t *first, size_t *last)
+{
+	uint64_t mstart = m->offset;
+	uint64_t mend = page_offset(m, m->npages);
+
+	if (m->type != PMEMFILE_MAP_SHARED || end <= mstart || start >= mend)
+		return false;
+
+	*first = 0;
+	if (start > mstart)
+		*first = (start - mstart) / Pagesize;
+
+	*last = m->npages;
+	if (end < mend)
+		*last = (end - mstart + Pagesize - 1) / Pagesize;
+
+	return true;
+}
+
+/*
+ * vinode_revoke_mappings -- detaches direct pages of file mappings in
+ * [offset, offset + len) range from the pool and zeroes this range in all
+ * shared mappings; vinode must be locked in write mode
+ *
+ * Must be called before blocks in this range are freed.
+ */
+void
+vinode_revoke_mappings(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	(void) pfp;
+
+	uint64_t end = len > UINT64_MAX - offset ? UINT64_MAX : offset + len;
+	size_t first, last;
+
+	for (struct pmemfile_mapping *m = vinode->mappings; m;
+			m = m->vinode_next) {
+		if (!mapping_pages_in_range(m, offset, end, &first, &last))
+			continue;
+
+		for (size_t p = first; p < last; ++p) {
+			if (m->pages[p] & PAGE_DIRECT)
+				page_revoke(m, p, offset, end);
+			else
+				page_zero(m, p, offset, end);
+		}
+	}
+}
+
+/*
+ * vinode_detach_mappings -- replaces direct pages of file mappings in
+ * [offset, offset + len) range by shadow pages with the same contents;
+ * vinode must be locked in write mode
+ *
+ * Must be called before blocks in this range are freed or shared with other
+ * files, when their contents are going to be preserved.
+ */
+void
+vinode_detach_mappings(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t offset, uint64_t len)
+{
+	(void) pfp;
+
+	uint64_t end = len > UINT64_MAX - offset ? UINT64_MAX : offset + len;
+	size_t first, last;
+
+	for (struct pmemfile_mapping *m = vinode->mappings; m;
+			m = m->vinode_next) {
+		if (!mapping_pages_in_range(m, offset, end, &first, &last))
+			continue;
+
+		for (size_t p = first; p < last; ++p)
+			if (m->pages[p] & PAGE_DIRECT)
+				page_detach(m, p);
+	}
+}
+
+/*
+ * pool_unmap -- removes all mappings of [addr, addr + len) range, writing
+ * back modified pages; pool mappings_mutex must be held
+ */
+static int
+pool_unmap(PMEMfilepool *pfp, char *addr, size_t len)
+{
+	char *end = addr + len;
+	struct pmemfile_mapping **pm = &pfp->mappings;
+
+	while (*pm) {
+		struct pmemfile_mapping *m = *pm;
+
+		if (mapping_end(m) <= addr || m->addr >= end) {
+			pm = &m->next;
+			continue;
+		}
+
+		struct pmemfile_vinode *vinode = m->vinode;
+		os_rwlock_wrlock(&vinode->rwlock);
+
+		if (m->addr < addr) {
+			/* keep the first part, the second one is next */
+			int ret = mapping_split(pfp, m,
+					(size_t)(addr - m->addr) / Pagesize);
+			os_rwlock_unlock(&vinode->rwlock);
+			if (ret)
+				return -1;
+
+			pm = &m->next;
+			continue;
+		}
+
+		if (mapping_end(m) > end &&
+				mapping_split(pfp, m,
+				(size_t)(end - m->addr) / Pagesize)) {
+			os_rwlock_unlock(&vinode->rwlock);
+			return -1;
+		}
+
+		if (mapping_sync(pfp, m, 0, m->npages, false))
+			ERR("!cannot write back mapped file data");
+
+		vinode_remove_mapping(vinode, m);
+		os_rwlock_unlock(&vinode->rwlock);
+
+		*pm = m->next;
+		mapping_destroy(pfp, m);
+	}
+
+	return 0;
+}
+
+/*
+ * pool_unmap_all -- removes all mappings of files in the pool
+ */
+void
+pool_unmap_all(PMEMfilepool *pfp)
+{
+	os_mutex_lock(&pfp->mappings_mutex);
+
+	while (pfp->mappings) {
+		struct pmemfile_mapping *m = pfp->mappings;
+		pool_unmap(pfp, m->addr, m->npages * Pagesize);
+	}
+
+	os_mutex_unlock(&pfp->mappings_mutex);
+}
+
+/*
+ * pool_is_mapped -- returns true if whole [addr, addr + len) range is
+ * covered by file mappings; pool mappings_mutex must be held
+ */
+static bool
+pool_is_mapped(PMEMfilepool *pfp, char *addr, size_t len)
+{
+	char *end = addr + len;
+	size_t covered = 0;
+
+	for (struct pmemfile_mapping *m = pfp->mappings; m; m = m->next) {
+		char *s = m->addr > addr ? m->addr : addr;
+		char *e = mapping_end(m) < end ? mapping_end(m) : end;
+
+		if (s < e)
+			covered += (size_t)(e - s);
+	}
+
+	return covered == len;
+}
+
+/*
+ * page_roundup -- rounds len up to the page size, returns 0 on overflow
+ */
+static size_t
+page_roundup(size_t len)
+{
+	if (len > SIZE_MAX - Pagesize + 1)
+		return 0;
+
+	return (len + Pagesize - 1) & ~(Pagesize - 1);
+}
+
+/*
+ * pmemfile_mmap -- maps file into memory
+ */
 void *
 pmemfile_mmap(PMEMfilepool *pfp, void *addr, size_t len,
 		int prot, int flags, PMEMfile *file, pmemfile_off_t off)
 {
-	(void) addr;
-	(void) len;
-	(void) prot;
-	(void) flags;
-	(void) off;
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	if (!file) {
+		LOG(LUSR, "NULL file");
+		errno = EFAULT;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	int type = flags & (PMEMFILE_MAP_SHARED | PMEMFILE_MAP_PRIVATE);
+
+	if (len == 0 || off < 0 || (uint64_t)off % Pagesize ||
+			(type != PMEMFILE_MAP_SHARED &&
+			type != PMEMFILE_MAP_PRIVATE) ||
+			(prot & ~PAGE_PROT_MASK) ||
+			((flags & PMEMFILE_MAP_FIXED) &&
+			(uintptr_t)addr % Pagesize)) {
+		errno = EINVAL;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	len = page_roundup(len);
+	if (len == 0) {
+		errno = ENOMEM;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	if ((uint64_t)off > UINT64_MAX - len) {
+		errno = EOVERFLOW;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	os_mutex_lock(&file->mutex);
+	struct pmemfile_vinode *vinode = file->vinode;
+	uint64_t file_flags = file->flags;
+	os_mutex_unlock(&file->mutex);
+
+	if (file_flags & PFILE_PATH) {
+		errno = EBADF;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	if (!vinode_is_regular_file(vinode)) {
+		errno = ENODEV;
+		return PMEMFILE_MAP_FAILED;
+	}
 
-	errno = ENOTSUP;
-	return PMEMFILE_MAP_FAILED;
+	bool writable = (file_flags & PFILE_WRITE) &&
+			!(file_flags & PFILE_APPEND);
+
+	if (!(file_flags & PFILE_READ) || (type == PMEMFILE_MAP_SHARED &&
+			(prot & PMEMFILE_PROT_WRITE) && !writable)) {
+		errno = EACCES;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	os_mutex_lock(&pfp->mappings_mutex);
+
+	struct pmemfile_mapping *m = NULL;
+	if (!(flags & PMEMFILE_MAP_FIXED) ||
+			pool_unmap(pfp, addr, len) == 0)
+		m = mapping_create(pfp, vinode, writable, addr, len, prot,
+				flags, (uint64_t)off, NULL, 0);
+
+	if (m) {
+		m->next = pfp->mappings;
+		pfp->mappings = m;
+	}
+
+	os_mutex_unlock(&pfp->mappings_mutex);
+
+	return m ? m->addr : PMEMFILE_MAP_FAILED;
 }
 
+/*
+ * pmemfile_munmap -- unmaps memory mapped files
+ */
 int
 pmemfile_munmap(PMEMfilepool *pfp, void *addr, size_t len)
 {
-	(void) addr;
-	(void) len;
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	len = page_roundup(len);
+	if ((uintptr_t)addr % Pagesize || len == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	os_mutex_lock(&pfp->mappings_mutex);
+	int ret = pool_unmap(pfp, addr, len);
+	os_mutex_unlock(&pfp->mappings_mutex);
 
-	errno = ENOTSUP;
-	return -1;
+	return ret;
 }
 
+/*
+ * pmemfile_mremap -- resizes or moves file mapping
+ *
+ * Mapping can be shrunk in place or moved to a new address. Moved mapping
+ * gets protection of the first remapped page. Contents of moved shared
+ * mapping are written back and mapped again, contents of private mapping are
+ * copied.
+ */
 void *
 pmemfile_mremap(PMEMfilepool *pfp, void *old_addr, size_t old_size,
 			size_t new_size, int flags, void *new_addr)
 {
-	(void) old_addr;
-	(void) new_addr;
-	(void) old_size;
-	(void) new_size;
-	(void) flags;
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	old_size = page_roundup(old_size);
+	new_size = page_roundup(new_size);
+
+	if ((uintptr_t)old_addr % Pagesize || old_size == 0 ||
+			new_size == 0 ||
+			(flags & ~(PMEMFILE_MREMAP_MAYMOVE |
+			PMEMFILE_MREMAP_FIXED)) ||
+			((flags & PMEMFILE_MREMAP_FIXED) &&
+			(!(flags & PMEMFILE_MREMAP_MAYMOVE) ||
+			(uintptr_t)new_addr % Pagesize))) {
+		errno = EINVAL;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	char *old = old_addr;
+	char *new = new_addr;
+	bool fixed = flags & PMEMFILE_MREMAP_FIXED;
+
+	if (fixed && new < old + old_size && old < new + new_size) {
+		errno = EINVAL;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	os_mutex_lock(&pfp->mappings_mutex);
+
+	struct pmemfile_mapping *m = pfp->mappings;
+	while (m && (old < m->addr || old + old_size > mapping_end(m)))
+		m = m->next;
 
-	errno = ENOTSUP;
-	return PMEMFILE_MAP_FAILED;
+	void *ret = PMEMFILE_MAP_FAILED;
+
+	if (!m) {
+		errno = EFAULT;
+	} else if (!fixed && new_size <= old_size) {
+		if (new_size == old_size ||
+				pool_unmap(pfp, old + new_size,
+				old_size - new_size) == 0)
+			ret = old;
+	} else if (!(flags & PMEMFILE_MREMAP_MAYMOVE)) {
+		errno = ENOMEM;
+	} else {
+		/* m may be split or removed by pool_unmap below */
+		struct pmemfile_vinode *vinode = vinode_ref(pfp, m->vinode);
+		size_t first = (size_t)(old - m->addr) / Pagesize;
+		uint64_t offset = page_offset(m, first);
+		int prot = page_prot(m, first);
+		int map_flags = m->type;
+		bool writable = m->writable;
+		const char *src = NULL;
+
+		/* new mapping must see modifications done by the old one */
+		os_rwlock_wrlock(&vinode->rwlock);
+		int error = mapping_sync(pfp, m, first,
+				first + old_size / Pagesize, false);
+		os_rwlock_unlock(&vinode->rwlock);
+
+		if (m->type == PMEMFILE_MAP_PRIVATE &&
+				(prot & PMEMFILE_PROT_READ))
+			src = old;
+
+		if (fixed) {
+			map_flags |= PMEMFILE_MAP_FIXED;
+			if (!error)
+				error = pool_unmap(pfp, new, new_size);
+		}
+
+		struct pmemfile_mapping *n = NULL;
+		if (!error)
+			n = mapping_create(pfp, vinode, writable,
+				fixed ? new : NULL, new_size, prot, map_flags,
+				offset, src, old_size);
+
+		if (n) {
+			n->next = pfp->mappings;
+			pfp->mappings = n;
+
+			pool_unmap(pfp, old, old_size);
+			ret = n->addr;
+		}
+
+		vinode_unref(pfp, vinode);
+	}
+
+	os_mutex_unlock(&pfp->mappings_mutex);
+
+	return ret;
 }
 
+/*
+ * pmemfile_msync -- synchronizes file with memory mapping
+ */
 int
 pmemfile_msync(PMEMfilepool *pfp, void *addr, size_t len, int flags)
 {
-	(void) addr;
-	(void) len;
-	(void) flags;
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if ((uintptr_t)addr % Pagesize ||
+			(flags & ~(PMEMFILE_MS_ASYNC | PMEMFILE_MS_INVALIDATE |
+			PMEMFILE_MS_SYNC)) ||
+			((flags & PMEMFILE_MS_ASYNC) &&
+			(flags & PMEMFILE_MS_SYNC))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	len = page_roundup(len);
+	if (len == 0)
+		return 0;
+
+	char *start = addr;
+	char *end = start + len;
+	int ret = 0;
+
+	os_mutex_lock(&pfp->mappings_mutex);
+
+	if (!pool_is_mapped(pfp, start, len)) {
+		os_mutex_unlock(&pfp->mappings_mutex);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (struct pmemfile_mapping *m = pfp->mappings; m && ret == 0;
+			m = m->next) {
+		if (mapping_end(m) <= start || m->addr >= end)
+			continue;
+
+		size_t first = 0;
+		if (start > m->addr)
+			first = (size_t)(start - m->addr) / Pagesize;
 
-	errno = ENOTSUP;
-	return -1;
+		size_t last = m->npages;
+		if (end < mapping_end(m))
+			last = (size_t)(end - m->addr) / Pagesize;
+
+		os_rwlock_wrlock(&m->vinode->rwlock);
+		ret = mapping_sync(pfp, m, first, last,
+				flags & PMEMFILE_MS_INVALIDATE);
+		os_rwlock_unlock(&m->vinode->rwlock);
+	}
+
+	os_mutex_unlock(&pfp->mappings_mutex);
+
+	return ret;
 }
 
+/*
+ * pmemfile_mprotect -- changes protection of memory mapped files
+ */
 int
 pmemfile_mprotect(PMEMfilepool *pfp, void *addr, size_t len, int prot)
 {
-	(void) addr;
-	(void) len;
-	(void) prot;
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if ((uintptr_t)addr % Pagesize || (prot & ~PAGE_PROT_MASK)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	len = page_roundup(len);
+	if (len == 0)
+		return 0;
+
+	char *start = addr;
+	char *end = start + len;
+	int ret = 0;
+
+	os_mutex_lock(&pfp->mappings_mutex);
+
+	if (!pool_is_mapped(pfp, start, len)) {
+		os_mutex_unlock(&pfp->mappings_mutex);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (struct pmemfile_mapping *m = pfp->mappings; m; m = m->next) {
+		if (mapping_end(m) <= start || m->addr >= end)
+			continue;
+
+		if (m->type == PMEMFILE_MAP_SHARED && !m->writable &&
+				(prot & PMEMFILE_PROT_WRITE)) {
+			os_mutex_unlock(&pfp->mappings_mutex);
+			errno = EACCES;
+			return -1;
+		}
+	}
+
+	for (struct pmemfile_mapping *m = pfp->mappings; m && ret == 0;
+			m = m->next) {
+		if (mapping_end(m) <= start || m->addr >= end)
+			continue;
+
+		size_t first = 0;
+		if (start > m->addr)
+			first = (size_t)(start - m->addr) / Pagesize;
+
+		size_t last = m->npages;
+		if (end < mapping_end(m))
+			last = (size_t)(end - m->addr) / Pagesize;
+
+		os_rwlock_wrlock(&m->vinode->rwlock);
+
+		ret = mprotect(page_addr(m, first), (last - first) * Pagesize,
+				prot);
+		if (ret == 0) {
+			for (size_t p = first; p < last; ++p) {
+				uint8_t state = m->pages[p] &
+						(uint8_t)~PAGE_PROT_MASK;
+				state |= (uint8_t)prot;
+				if (prot & PMEMFILE_PROT_WRITE)
+					state |= PAGE_WRITABLE;
+				m->pages[p] = state;
+			}
+		}
+
+		os_rwlock_unlock(&m->vinode->rwlock);
+	}
+
+	os_mutex_unlock(&pfp->mappings_mutex);
 
-	errno = ENOTSUP;
-	return -1;
+	return ret;
 }
@@ -34,86 +34,81 @@
  * offset_mapping.c - implementation of tree mapping offsets directly to
  * a block.
  *
- * Every entry in tree maps certain range to blocks, if there is more than
- * one block at this range, offset_map_entry holds a pointer to an array of
- * next level offset_map_entries (with smaller range) - size of this array
- * is const and equal to N_CHILDREN
+ * The tree is a B+tree of extents: every block is exactly one entry, keyed
+ * by its offset, no matter how big the block is. Keys of a node are kept
+ * in a small sorted array (NODE_KEYS 8-byte keys, a couple of cache lines),
+ * separate from the child pointers, so a lookup reads one compact array per
+ * level and picks the child with a branchless scan of it.
  *
- * Below examples assumes that N_CHILDREN = 16
- *  * - means that node is internal
+ * keys[i] of an internal node is the lowest offset in the subtree pointed
+ * to by ptrs[i], so the lowest key of a node is the lowest key of its
+ * subtree. Unused keys are set to KEY_NONE, so the scan always covers the
+ * whole array and doesn't depend on the number of keys in the node.
  *
- * Example - insert block (1) with offset 256k, size 256k to empty tree:
+ * Example - blocks (1) at 0, (2) at 16k, (3) at 2M, (4) at 4M, (5) at 6M
+ * with NODE_KEYS = 4:
  * ---------------------------------------------------------------------------
- *                                | 0 - 4M |
- *                                |   *    |
+ *                         | 0  | 2M |    |    |
+ *                         | *  | *  |    |    |
  * ---------------------------------------------------------------------------
- *             |0 - 256k|    |256k - 512k|    |512k - 768k|     ...
- *             |  NULL  |    |    (1)    |    |    NULL   |   NULLs ...
+ *     | 0  | 16k|    |    |         | 2M | 4M | 6M |    |
+ *     |(1) |(2) |    |    |         |(3) |(4) |(5) |    |
  * ---------------------------------------------------------------------------
  *
- * Example - insert block (2) with offset 240k, size 256k to empty tree:
- * ---------------------------------------------------------------------------
- *                                | 0 - 4M |
- *                                |   *    |
- * ---------------------------------------------------------------------------
- *         |0 - 256k|                           |256k - 512k|           ...
- *         |    *   |                           |     *     |        NULLs ...
- * ---------------------------------------------------------------------------
- * |0-16k |  ...  |240k-256k|    |256k-272k|   ...   |480k-496k| |496k-512k|
- * | NULL | NULLs |    (2)  |    |   (2)   | ..(2).. |   (2)   | |   NULL  |
- * ---------------------------------------------------------------------------
- * 16 entries will be updated (blocks covering offsets 240k - 496k)
+ * Full nodes are split in half, except when a key is appended at the end of
+ * the rightmost node - then it goes to a new node and the full one is left
+ * intact, so trees built in offset order (vinode_rebuild_block_tree,
+ * appending writes) are packed densely. A node which drops below
+ * NODE_MIN_KEYS keys is merged with a neighbour, if they fit in one node.
  */
 
+#include <string.h>
+
 #include "alloc.h"
 #include "offset_mapping.h"
 #include "blocks.h"
 #include "out.h"
 #include "utils.h"
 
-/* branching factor is 2^N_CHILDREN_POW */
-#define N_CHILDREN_POW 4
+#define NODE_KEYS 16
 
-#define N_CHILDREN (1 << N_CHILDREN_POW)
+#define NODE_MIN_KEYS (NODE_KEYS / 4)
 
-struct offset_map_entry {
+/* no block can start at this offset */
+#define KEY_NONE UINT64_MAX
 
-	/*
-	 * data holds pointer to pmemfile_block_desc when internal == false
-	 * or to offset_map_entry array otherwise
-	 */
+/*
+ * The tree grows only when its full root is split and every split leaves
+ * at least NODE_KEYS / 2 entries in a node, so this is never reached.
+ */
+#define MAX_HEIGHT 64
 
-	union {
-		struct pmemfile_block_desc *block;
+struct offset_map_node {
+	/* sorted offsets */
+	uint64_t keys[NODE_KEYS];
 
-		struct offset_map_entry *children;
-	} data;
+	/* offset_map_node children, or pmemfile_block_descs if leaf */
+	void *ptrs[NODE_KEYS];
 
-	bool internal;
+	unsigned count;
+
+	bool leaf;
 };
 
 struct offset_map {
+	/* NULL if there are no blocks */
+	struct offset_map_node *root;
 
-	struct offset_map_entry entry;
+	unsigned height;
 
 	PMEMfilepool *pfp;
-
-	/*
-	 * specifies range covered by offset_map:
-	 * range starts at 0 and has length of 2^range_length_bits
-	 */
-	int range_length_bits;
 };
 
-static uint64_t
-max_map_offset(struct offset_map *m)
-{
-	if (m->range_length_bits < 64)
-		return (1ULL << m->range_length_bits)
-				- ((uint64_t) MIN_BLOCK_SIZE);
-	else
-		return UINT64_MAX - ((uint64_t) MIN_BLOCK_SIZE) + 1;
-}
+/* nodes allocated up front, so that insert can't fail half way */
+struct node_pool {
+	struct offset_map_node *nodes[MAX_HEIGHT + 1];
+	unsigned count;
+};
 
 /*
  * create new offset_map
@@ -122,25 +117,26 @@ struct offset_map *
 offset_map_new(PMEMfilepool *pfp)
 {
 	struct offset_map *m = pf_calloc(1, sizeof(*m));
-	m->range_length_bits = __builtin_ctzll(MIN_BLOCK_SIZE);
+	if (!m)
+		return NULL;
+
 	m->pfp = pfp;
 
 	return m;
 }
 
 /*
- * recursively remove entry in offset_map
+ * recursively remove node and its children
  */
 static void
-offset_entry_delete(struct offset_map_entry *e)
+node_delete(struct offset_map_node *n)
 {
-	if (e->internal) {
-		struct offset_map_entry *children = e->data.children;
-		for (unsigned i = 0; i < N_CHILDREN; ++i)
-			offset_entry_delete(children + i);
-
-		pf_free(children);
+	if (!n->leaf) {
+		for (unsigned i = 0; i < n->count; ++i)
+			node_delete(n->ptrs[i]);
 	}
+
+	pf_free(n);
 }
 
 /*
@@ -149,44 +145,28 @@ offset_entry_delete(struct offset_map_entry *e)
 void
 offset_map_delete(struct offset_map *m)
 {
-	offset_entry_delete(&m->entry);
+	if (m->root)
+		node_delete(m->root);
 
 	pf_free(m);
 }
 
 /*
- * adds new level to the tree, doesn't allocate memory if there
- * are noe entries
+ * node_find -- returns index of the last key lower than or equal to offset,
+ * -1 if there is no such key
+ *
+ * offset must be lower than KEY_NONE.
  */
-static int
-add_new_level(struct offset_map *m)
+static inline int
+node_find(const struct offset_map_node *n, uint64_t offset)
 {
-	if (m->range_length_bits > 64)
-		return 1;
-
-	m->range_length_bits += N_CHILDREN_POW;
-
-	if (m->entry.data.children != NULL) {
-		/*
-		 * if current root had any children we must allocate
-		 * new array(level) and move child to first entry
-		 * in the array
-		 */
-		struct offset_map_entry *new_entries =
-			pf_calloc(N_CHILDREN,
-				sizeof(struct offset_map_entry));
+	const uint64_t *base = n->keys;
 
-		if (new_entries == NULL)
-			return 1;
-
-		new_entries[0] = m->entry;
-		m->entry.internal = true;
-		m->entry.data.children = new_entries;
-	} else {
-		m->entry.internal = false;
-	}
+	/* branchless binary search, NODE_KEYS is a power of 2 */
+	for (unsigned len = NODE_KEYS / 2; len > 0; len /= 2)
+		base = base[len] <= offset ? base + len : base;
 
-	return 0;
+	return (int)(base - n->keys) - (*base > offset);
 }
 
 /*
@@ -196,178 +176,199 @@ add_new_level(struct offset_map *m)
 struct pmemfile_block_desc *
 block_find_closest(struct offset_map *m, uint64_t offset)
 {
-	int range_bits = m->range_length_bits;
-	struct offset_map_entry *entry = &m->entry, *children;
+	struct offset_map_node *n = m->root;
+
+	if (n == NULL)
+		return NULL;
 
-	uint64_t max_offset = max_map_offset(m);
+	if (offset == KEY_NONE)
+		offset--;
 
-	/* make sure we don't go beyond allocated range */
-	if (offset > max_offset)
-		offset = max_offset;
+	if (offset < n->keys[0]) {
+		/*
+		 * Offset is lower than offset of all blocks in the map, so
+		 * return the block preceding the first one on the list (which
+		 * is NULL if all blocks of the file are in the map).
+		 */
+		while (!n->leaf)
+			n = n->ptrs[0];
 
-	while (entry->internal) {
-		children = entry->data.children;
-		range_bits -= N_CHILDREN_POW;
-		entry = children + ((offset >> range_bits) &
-						((1 << N_CHILDREN_POW) - 1));
+		struct pmemfile_block_desc *first = n->ptrs[0];
+
+		return PF_RW(m->pfp, first->prev);
 	}
 
-	/* if found entry is not NULL it is the requested block */
-	if (entry->data.block != NULL)
-		return entry->data.block;
+	/* lowest key of every node on the way is <= offset */
+	while (!n->leaf)
+		n = n->ptrs[node_find(n, offset)];
+
+	return n->ptrs[node_find(n, offset)];
+}
 
-	/*
-	 * if entry at requested offset was NULL
-	 * find first not NULL entry at this level with smaller offset
-	 */
+/*
+ * node_insert_at -- inserts key and pointer at index i of a node which is
+ * not full
+ */
+static void
+node_insert_at(struct offset_map_node *n, unsigned i, uint64_t key,
+		void *ptr)
+{
+	ASSERT(n->count < NODE_KEYS);
+	ASSERT(i <= n->count);
 
-	/* if 'entry' is the top level entry, there are no blocks in the tree */
-	if (entry == &m->entry)
-		return NULL;
+	memmove(&n->keys[i + 1], &n->keys[i],
+			(n->count - i) * sizeof(n->keys[0]));
+	memmove(&n->ptrs[i + 1], &n->ptrs[i],
+			(n->count - i) * sizeof(n->ptrs[0]));
 
-	struct offset_map_entry *e;
-
-	/*
-	 * look for block in entries with lower offset
-	 *
-	 * Example: offset = 48k
-	 * -------------------------------------------------------------------
-	 *                           | 0 - 256k |
-	 *                           |    *     |
-	 * -------------------------------------------------------------------
-	 * |0  - 16k| |16k - 32k| |32k - 48k| |48k - 64k| |64k - 80k|   ...
-	 * |  NULL  | |   AAA   | |   NULL  | |   NULL  | |  BBB    |   ...
-	 * -------------------------------------------------------------------
-	 *
-	 * entry mapping offset 48k to block is NULL, so in this case
-	 * AAA will be returned
-	 */
-	e = entry - 1;
-	while (e >= children) {
-		if (e->data.block == NULL)
-			e--;
-		else if (!e->internal)
-			return e->data.block;
-		else {
-			children = e->data.children;
-			e = children + N_CHILDREN - 1;
-		}
-	}
+	n->keys[i] = key;
+	n->ptrs[i] = ptr;
+	n->count++;
+}
 
-	/*
-	 * look for block in entries with higher offset,
-	 * if found, then return previous block
-	 *
-	 * Example: offset = 48k
-	 * -------------------------------------------------------------------
-	 *                           | 0 - 256k |
-	 *                           |     *    |
-	 * -------------------------------------------------------------------
-	 * |0  - 16k| |16k - 32k| |32k - 48k| |48k - 64k| |64k - 80k|   ...
-	 * |  NULL  | |   NULL  | |   NULL  | |   NULL  | |  BBB    |   ...
-	 * -------------------------------------------------------------------
-	 *
-	 * entry mapping offset 48k to block is NULL, and there is
-	 * no non-NULL entry to the left, so in this case BBB->prev
-	 * will be returned
-	 */
-	e = entry + 1;
-	while (e < children + N_CHILDREN) {
-		if (e->data.block == NULL)
-			e++;
-		else if (!e->internal) {
-			return PF_RW(m->pfp, e->data.block->prev);
-		} else {
-			children = e->data.children;
-			e = children;
-		}
-	}
+/*
+ * node_delete_at -- removes key and pointer at index i
+ */
+static void
+node_delete_at(struct offset_map_node *n, unsigned i)
+{
+	ASSERT(i < n->count);
 
-	return NULL;
+	memmove(&n->keys[i], &n->keys[i + 1],
+			(n->count - i - 1) * sizeof(n->keys[0]));
+	memmove(&n->ptrs[i], &n->ptrs[i + 1],
+			(n->count - i - 1) * sizeof(n->ptrs[0]));
+
+	n->count--;
+	n->keys[n->count] = KEY_NONE;
 }
 
 /*
- * frees memory used by 'child' if  all child entries are NULL
+ * node_init -- initializes an empty node
  */
 static void
-check_and_free_range(struct offset_map_entry *entry)
+node_init(struct offset_map_node *n, bool leaf)
 {
-	for (unsigned i = 0; i < N_CHILDREN; ++i) {
-		struct offset_map_entry *e = entry->data.children;
-		if (e[i].data.children != NULL)
-			return;
-	}
+	for (unsigned i = 0; i < NODE_KEYS; ++i)
+		n->keys[i] = KEY_NONE;
+	n->count = 0;
+	n->leaf = leaf;
+}
+
+static struct offset_map_node *
+node_pool_get(struct node_pool *pool)
+{
+	ASSERT(pool->count > 0);
 
-	pf_free(entry->data.children);
-	entry->data.children = NULL;
-	entry->internal = false;
+	return pool->nodes[--pool->count];
 }
 
-static int
-check_and_allocate_range(struct offset_map_entry *entry)
+/*
+ * node_add -- inserts key and pointer at index i of node n, splitting it
+ * if it's full
+ *
+ * Returns the new right sibling of n if n was split, NULL otherwise.
+ */
+static struct offset_map_node *
+node_add(struct offset_map_node *n, unsigned i, uint64_t key, void *ptr,
+		bool rightmost, struct node_pool *pool)
 {
-	if (entry->data.children == NULL) {
-		entry->data.children = pf_calloc(N_CHILDREN,
-			sizeof(struct offset_map_entry));
+	if (n->count < NODE_KEYS) {
+		node_insert_at(n, i, key, ptr);
+		return NULL;
+	}
 
-		if (entry->data.children == NULL)
-			return 1;
+	struct offset_map_node *s = node_pool_get(pool);
+	node_init(s, n->leaf);
 
-		entry->internal = true;
+	if (rightmost && i == NODE_KEYS) {
+		/* append - leave n full */
+		node_insert_at(s, 0, key, ptr);
+		return s;
 	}
 
-	return 0;
+	unsigned half = NODE_KEYS / 2;
+
+	memcpy(s->keys, &n->keys[half], half * sizeof(n->keys[0]));
+	memcpy(s->ptrs, &n->ptrs[half], half * sizeof(n->ptrs[0]));
+	s->count = half;
+	n->count = half;
+	for (unsigned k = half; k < NODE_KEYS; ++k)
+		n->keys[k] = KEY_NONE;
+
+	if (i <= half)
+		node_insert_at(n, i, key, ptr);
+	else
+		node_insert_at(s, i - half, key, ptr);
+
+	return s;
 }
 
 /*
- * put (or delete) block to offset_map
- * block can occupy one or more entries in map
+ * node_insert -- inserts block into the subtree of n
+ *
+ * Returns the new right sibling of n if n was split, NULL otherwise.
  */
-static int
-set_range(struct offset_map_entry *entry, void *block, size_t offset,
-	size_t remaining, uint64_t range)
+static struct offset_map_node *
+node_insert(struct offset_map_node *n, struct pmemfile_block_desc *block,
+		bool rightmost, struct node_pool *pool)
 {
-	int ret = 0;
-	entry += offset / range;
+	int i = node_find(n, block->offset);
 
-	while (remaining > 0) {
-		if (offset % range == 0 && remaining >= range) {
-			/* case when block covers whole range */
-			entry->internal = false;
-			entry->data.block = block;
+	if (n->leaf) {
+		ASSERT(i < 0 || n->keys[i] != block->offset);
 
-			offset += range;
-			remaining -= range;
-		} else {
-			/* case when block covers only part of range */
-			ret = check_and_allocate_range(entry);
-			if (ret)
-				return ret;
+		return node_add(n, (unsigned)(i + 1), block->offset, block,
+				rightmost, pool);
+	}
 
-			size_t sub_offset = offset % range;
-			size_t sub_remaining = range - sub_offset;
+	/* a key lower than all others goes to the first child */
+	unsigned c = i < 0 ? 0 : (unsigned)i;
+	struct offset_map_node *child = n->ptrs[c];
 
-			if (remaining < sub_remaining)
-				sub_remaining = remaining;
+	struct offset_map_node *s = node_insert(child, block,
+			rightmost && c == n->count - 1, pool);
 
-			ret = set_range(entry->data.children, block,
-				sub_offset, sub_remaining,
-				range >> N_CHILDREN_POW);
+	n->keys[c] = child->keys[0];
 
-			if (ret)
-				return ret;
+	if (s == NULL)
+		return NULL;
 
-			offset += sub_remaining;
-			remaining -= sub_remaining;
+	return node_add(n, c + 1, s->keys[0], s, rightmost, pool);
+}
 
-			if (block == NULL) /* removing block */
-				check_and_free_range(entry);
-		}
+/*
+ * nodes_needed -- returns number of nodes insert of a block with given offset
+ * may need to allocate
+ */
+static unsigned
+nodes_needed(struct offset_map *m, uint64_t offset)
+{
+	struct offset_map_node *n = m->root;
+	unsigned full = 0;
+
+	if (n == NULL)
+		return 1;
+
+	/* only full nodes with full nodes below them can be split */
+	while (true) {
+		if (n->count == NODE_KEYS)
+			full++;
+		else
+			full = 0;
+
+		if (n->leaf)
+			break;
 
-		entry++;
+		int i = node_find(n, offset);
+		n = n->ptrs[i < 0 ? 0 : i];
 	}
 
-	return 0;
+	/* new root */
+	if (full == m->height)
+		full++;
+
+	return full;
 }
 
 /*
@@ -377,30 +378,112 @@ int
 insert_block(struct offset_map *m, struct pmemfile_block_desc *block)
 {
 	ASSERT(UINT64_MAX - block->offset >= block->size - 1);
+	ASSERT(block->offset != KEY_NONE);
+
+	struct node_pool pool;
+	pool.count = nodes_needed(m, block->offset);
+	ASSERT(pool.count <= MAX_HEIGHT + 1);
+
+	for (unsigned i = 0; i < pool.count; ++i) {
+		pool.nodes[i] = pf_malloc(sizeof(struct offset_map_node));
+		if (pool.nodes[i] == NULL) {
+			while (i > 0)
+				pf_free(pool.nodes[--i]);
+			errno = ENOMEM;
+			return ENOMEM;
+		}
+	}
 
-	int ret = 0;
+	if (m->root == NULL) {
+		struct offset_map_node *n = node_pool_get(&pool);
+		node_init(n, true);
+		node_insert_at(n, 0, block->offset, block);
 
-	/*
-	 * add as many levels as necessary to cover range from 0 to end
-	 * of the block
-	 */
-	while (m->range_length_bits < 64 &&
-			max_map_offset(m) + MIN_BLOCK_SIZE <=
-				block->offset + block->size) {
+		m->root = n;
+		m->height = 1;
+	} else {
+		struct offset_map_node *s = node_insert(m->root, block, true,
+				&pool);
+
+		if (s != NULL) {
+			struct offset_map_node *root = node_pool_get(&pool);
+			node_init(root, false);
+			node_insert_at(root, 0, m->root->keys[0], m->root);
+			node_insert_at(root, 1, s->keys[0], s);
 
-		ret = add_new_level(m);
-		if (ret)
-			return ret;
+			m->root = root;
+			m->height++;
+		}
 	}
 
-	if (m->range_length_bits >= 64)
-		ASSERT(max_map_offset(m) > block->offset + block->size);
+	/* splits can stop earlier than the worst case */
+	while (pool.count > 0)
+		pf_free(node_pool_get(&pool));
 
-	check_and_allocate_range(&m->entry);
-	uint64_t range = 1ULL << (m->range_length_bits - N_CHILDREN_POW);
+	return 0;
+}
+
+/*
+ * node_merge -- merges children i and i + 1 of n if they fit in one node
+ */
+static bool
+node_merge(struct offset_map_node *n, unsigned i)
+{
+	struct offset_map_node *left = n->ptrs[i];
+	struct offset_map_node *right = n->ptrs[i + 1];
+
+	if (left->count + right->count > NODE_KEYS)
+		return false;
+
+	memcpy(&left->keys[left->count], right->keys,
+			right->count * sizeof(right->keys[0]));
+	memcpy(&left->ptrs[left->count], right->ptrs,
+			right->count * sizeof(right->ptrs[0]));
+	left->count += right->count;
+
+	pf_free(right);
+	node_delete_at(n, i + 1);
 
-	return set_range(m->entry.data.children, block, block->offset,
-		block->size, range);
+	return true;
+}
+
+/*
+ * node_remove -- removes block from the subtree of n
+ */
+static void
+node_remove(struct offset_map_node *n, struct pmemfile_block_desc *block)
+{
+	int i = node_find(n, block->offset);
+	ASSERT(i >= 0);
+
+	if (n->leaf) {
+		ASSERT(n->keys[i] == block->offset);
+		ASSERT(n->ptrs[i] == block);
+
+		node_delete_at(n, (unsigned)i);
+		return;
+	}
+
+	struct offset_map_node *child = n->ptrs[i];
+
+	node_remove(child, block);
+
+	if (child->count == 0) {
+		pf_free(child);
+		node_delete_at(n, (unsigned)i);
+		return;
+	}
+
+	n->keys[i] = child->keys[0];
+
+	if (child->count >= NODE_MIN_KEYS)
+		return;
+
+	if (i > 0 && node_merge(n, (unsigned)i - 1))
+		return;
+
+	if ((unsigned)i + 1 < n->count)
+		node_merge(n, (unsigned)i);
 }
 
 /*
@@ -409,74 +492,63 @@ insert_block(struct offset_map *m, struct pmemfile_block_desc *block)
 int
 remove_block(struct offset_map *m, struct pmemfile_block_desc *block)
 {
-	uint64_t range = 1ULL << (m->range_length_bits - N_CHILDREN_POW);
-
-	int ret = set_range(m->entry.data.children, NULL, block->offset,
-						block->size, range);
-
-	if (ret)
-		return ret;
-
-	check_and_free_range(&m->entry);
-
-	/*
-	 * cleans up offset_map tree
-	 * if at the top level only first entry is internal and not null
-	 * its children can be transferred one level up and height of
-	 * the tree can be decreased
-	 *
-	 * Example:
-	 *
-	 * Before cleanup:
-	 * -------------------------------------------------------------------
-	 *                           | 0 - 4M |
-	 *                           |   *    |
-	 * -------------------------------------------------------------------
-	 *               |0 - 256k|               ...
-	 *               |   *    |  rest of the entries are NULL
-	 * -------------------------------------------------------------------
-	 * |0  - 16k| |16k - 32k| |32k - 48k|           ...
-	 * |   YYY  | |   YYY   | |   YYY   |
-	 * -------------------------------------------------------------------
-	 * there is at least one non-null entry at the last level (16k range)
-	 * this is because set_range(..., NULL, ...) removes levels where all
-	 * entries are NULL
-	 *
-	 * After cleanup:
-	 * -------------------------------------------------------------------
-	 *                           | 0 - 256k |
-	 *                           |    *     |
-	 * -------------------------------------------------------------------
-	 * |0  - 16k| |16k - 32k| |32k - 48k|           ...
-	 * |   YYY  | |   YYY   | |   YYY   |
-	 * -------------------------------------------------------------------
-	 */
-	while (m->range_length_bits > __builtin_ctzll(MIN_BLOCK_SIZE)) {
-		if (!m->entry.internal) {
-			m->range_length_bits = __builtin_ctzll(MIN_BLOCK_SIZE);
-		} else {
-			struct offset_map_entry *child = m->entry.data.children;
-
-			/* if first entry is leaf, no cleanup is needed */
-			if (!child[0].internal)
-				return 0;
-
-			/* check if all entries except first are NULL */
-			for (unsigned i = 1; i < N_CHILDREN; ++i) {
-				if (child[i].data.children != NULL)
-					return 0;
-			}
-
-			struct offset_map_entry *grandchild =
-				child[0].data.children;
-			ASSERT(grandchild != NULL);
-
-			pf_free(m->entry.data.children);
-			m->entry.data.children = grandchild;
-
-			m->range_length_bits -= N_CHILDREN_POW;
-		}
+	ASSERT(m->root != NULL);
+
+	node_remove(m->root, block);
+
+	if (m->root->count == 0) {
+		pf_free(m->root);
+		m->root = NULL;
+		m->height = 0;
+		return 0;
+	}
+
+	/* shrink the tree while root has only one child */
+	while (!m->root->leaf && m->root->count == 1) {
+		struct offset_map_node *child = m->root->ptrs[0];
+
+		pf_free(m->root);
+		m->root = child;
+		m->height--;
 	}
 
 	return 0;
 }
+
+/*
+ * node_shift -- adds delta to all keys of the subtree of n which are higher
+ * than or equal to from
+ */
+static void
+node_shift(struct offset_map_node *n, uint64_t from, uint64_t delta)
+{
+	for (unsigned i = 0; i < n->count; ++i) {
+		if (n->leaf) {
+			if (n->keys[i] >= from)
+				n->keys[i] += delta;
+			continue;
+		}
+
+		/* all keys of this subtree are lower than from */
+		if (i + 1 < n->count && n->keys[i + 1] <= from)
+			continue;
+
+		struct offset_map_node *child = n->ptrs[i];
+		node_shift(child, from, delta);
+		n->keys[i] = child->keys[0];
+	}
+}
+
+/*
+ * offset_map_shift -- moves all blocks at offsets higher than or equal to
+ * from by delta (which can "wrap around" to move them down)
+ *
+ * Blocks must already have their new offsets and the order of blocks can't
+ * change, so keys are updated in place.
+ */
+void
+offset_map_shift(struct offset_map *m, uint64_t from, uint64_t delta)
+{
+	if (m->root)
+		node_shift(m->root, from, delta);
+}
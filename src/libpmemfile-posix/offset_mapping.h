@@ -51,4 +51,6 @@ int insert_block(struct offset_map *map, struct pmemfile_block_desc *block);
 
 int remove_block(struct offset_map *map, struct pmemfile_block_desc *block);
 
+void offset_map_shift(struct offset_map *m, uint64_t from, uint64_t delta);
+
 #endif
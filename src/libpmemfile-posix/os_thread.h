@@ -45,6 +45,10 @@ typedef struct {
 	long long data[8];
 } os_rwlock_t;
 
+typedef struct {
+	long long data[8];
+} os_cond_t;
+
 /*
  * os_mutex_init -- system mutex init wrapper that never fails from
  * caller perspective. If underlying function failed, this function aborts
@@ -108,6 +112,52 @@ void os_rwlock_unlock(os_rwlock_t *m);
  */
 void os_rwlock_destroy(os_rwlock_t *m);
 
+/*
+ * os_cond_init -- system condition variable init wrapper that never fails
+ * from caller perspective. If underlying function failed, this function aborts
+ * the program.
+ */
+void os_cond_init(os_cond_t *c);
+
+/*
+ * os_cond_destroy -- system condition variable destroy wrapper that never
+ * fails from caller perspective. If underlying function failed, this function
+ * aborts the program.
+ */
+void os_cond_destroy(os_cond_t *c);
+
+/*
+ * os_cond_wait -- system condition variable wait wrapper that never fails
+ * from caller perspective. If underlying function failed, this function aborts
+ * the program.
+ */
+void os_cond_wait(os_cond_t *c, os_mutex_t *m);
+
+/*
+ * os_cond_broadcast -- system condition variable broadcast wrapper that never
+ * fails from caller perspective. If underlying function failed, this function
+ * aborts the program.
+ */
+void os_cond_broadcast(os_cond_t *c);
+
+typedef struct {
+	long long data[1];
+} os_thread_t;
+
+/*
+ * os_thread_create -- system thread create wrapper, returns 0 on success or
+ * error number on failure
+ */
+int os_thread_create(os_thread_t *t, void *(*start_routine)(void *),
+		void *arg);
+
+/*
+ * os_thread_join -- system thread join wrapper that never fails from caller
+ * perspective. If underlying function failed, this function aborts
+ * the program.
+ */
+void os_thread_join(os_thread_t *t);
+
 typedef unsigned os_tls_key_t;
 
 int os_tls_key_create(os_tls_key_t *key, void (*destr_function)(void *));
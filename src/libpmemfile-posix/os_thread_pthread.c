@@ -133,6 +133,65 @@ os_rwlock_destroy(os_rwlock_t *m)
 	}
 }
 
+void
+os_cond_init(os_cond_t *c)
+{
+	COMPILE_ERROR_ON(sizeof(os_cond_t) < sizeof(pthread_cond_t));
+	int tmp = pthread_cond_init((pthread_cond_t *)c, NULL);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!pthread_cond_init");
+	}
+}
+
+void
+os_cond_destroy(os_cond_t *c)
+{
+	int tmp = pthread_cond_destroy((pthread_cond_t *)c);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!pthread_cond_destroy");
+	}
+}
+
+void
+os_cond_wait(os_cond_t *c, os_mutex_t *m)
+{
+	int tmp = pthread_cond_wait((pthread_cond_t *)c, (pthread_mutex_t *)m);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!pthread_cond_wait");
+	}
+}
+
+void
+os_cond_broadcast(os_cond_t *c)
+{
+	int tmp = pthread_cond_broadcast((pthread_cond_t *)c);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!pthread_cond_broadcast");
+	}
+}
+
+int
+os_thread_create(os_thread_t *t, void *(*start_routine)(void *), void *arg)
+{
+	COMPILE_ERROR_ON(sizeof(os_thread_t) < sizeof(pthread_t));
+
+	return pthread_create((pthread_t *)t, NULL, start_routine, arg);
+}
+
+void
+os_thread_join(os_thread_t *t)
+{
+	int tmp = pthread_join(*(pthread_t *)t, NULL);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!pthread_join");
+	}
+}
+
 int
 os_tls_key_create(os_tls_key_t *key, void (*destr_function)(void *))
 {
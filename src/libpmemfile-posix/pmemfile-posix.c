@@ -36,14 +36,22 @@
 
 #define _GNU_SOURCE
 
+#include <inttypes.h>
 #include <limits.h>
 
 #include "blocks.h"
 #include "callbacks.h"
 #include "compiler_utils.h"
 #include "data.h"
+#include "dcache.h"
+#include "dir_hash.h"
+#include "group_commit.h"
+#include "inode.h"
 #include "locks.h"
+#include "mmap.h"
 #include "out.h"
+#include "rcu.h"
+#include "reclaim.h"
 #include "valgrind_internal.h"
 
 #include "verify_consts.h"
@@ -53,6 +61,7 @@
 #define PMEMFILE_POSIX_LOG_FILE_VAR "PMEMFILE_POSIX_LOG_FILE"
 
 bool pmemfile_overallocate_on_append = true;
+size_t pmemfile_inline_data_size = PMEMFILE_INODE_INLINE_DATA_SIZE;
 
 #ifdef ANY_VG_TOOL_ENABLED
 /* initialized to true if the process is running inside Valgrind */
@@ -76,6 +85,9 @@ libpmemfile_posix_init(void)
 			PMEMFILE_MINOR_VERSION);
 	LOG(LDBG, NULL);
 	cb_init();
+	rcu_init();
+	mmap_init();
+	data_init();
 
 	size_t pmemfile_posix_block_size = 0;
 
@@ -106,6 +118,78 @@ libpmemfile_posix_init(void)
 	}
 	LOG(LINF, "overallocate_on_append flag is %s",
 		(pmemfile_overallocate_on_append ? "set" : "not set"));
+
+	env = getenv("PMEMFILE_INLINE_DATA_SIZE");
+	if (env) {
+		char *end;
+		unsigned long long size = strtoull(env, &end, 0);
+		if (env[0] == '\0' || size > PMEMFILE_INODE_INLINE_DATA_SIZE ||
+				end[0] != '\0') {
+			LOG(LUSR, "Invalid value of PMEMFILE_INLINE_DATA_SIZE");
+		} else {
+			pmemfile_inline_data_size = (size_t)size;
+		}
+	}
+	LOG(LINF, "inline data size %zu", pmemfile_inline_data_size);
+
+	env = getenv("PMEMFILE_DIR_HASH_THRESHOLD");
+	if (env) {
+		char *end;
+		unsigned long long threshold = strtoull(env, &end, 0);
+		if (env[0] == '\0' || threshold == ULLONG_MAX ||
+				end[0] != '\0') {
+			LOG(LUSR,
+				"Invalid value of PMEMFILE_DIR_HASH_THRESHOLD");
+		} else {
+			pmemfile_dir_hash_threshold = threshold;
+		}
+	}
+	LOG(LINF, "directory hash threshold %" PRIu64,
+			pmemfile_dir_hash_threshold);
+
+	env = getenv("PMEMFILE_DCACHE_SIZE");
+	if (env) {
+		char *end;
+		unsigned long long size = strtoull(env, &end, 0);
+		if (env[0] == '\0' || size > (1ULL << 32) ||
+				end[0] != '\0') {
+			LOG(LUSR, "Invalid value of PMEMFILE_DCACHE_SIZE");
+		} else {
+			pmemfile_dcache_size = (size_t)size;
+		}
+	}
+	LOG(LINF, "lookup cache size %zu", pmemfile_dcache_size);
+
+	env = getenv("PMEMFILE_VINODE_CACHE_SIZE");
+	if (env) {
+		char *end;
+		unsigned long long size = strtoull(env, &end, 0);
+		if (env[0] == '\0' || size > (1ULL << 32) || end[0] != '\0') {
+			LOG(LUSR,
+				"Invalid value of PMEMFILE_VINODE_CACHE_SIZE");
+		} else {
+			pmemfile_vinode_cache_size = (size_t)size;
+		}
+	}
+	LOG(LINF, "unreferenced vinode cache size %zu",
+			pmemfile_vinode_cache_size);
+
+	env = getenv("PMEMFILE_GROUP_COMMIT");
+	if (env) {
+		char *end;
+		unsigned long long size = strtoull(env, &end, 0);
+		if (env[0] == '\0' || size > UINT_MAX || end[0] != '\0') {
+			LOG(LUSR, "Invalid value of PMEMFILE_GROUP_COMMIT");
+		} else {
+			pmemfile_group_commit_size = (unsigned)size;
+		}
+	}
+	LOG(LINF, "group commit size %u", pmemfile_group_commit_size);
+
+	env = getenv("PMEMFILE_BACKGROUND_RECLAIM");
+	if (env && env[0] == '1')
+		pmemfile_background_reclaim = true;
+	LOG(LINF, "background reclaim %d", pmemfile_background_reclaim);
 }
 
 /*
@@ -118,6 +202,7 @@ libpmemfile_posix_fini(void)
 {
 	LOG(LDBG, NULL);
 	cb_fini();
+	rcu_fini();
 	out_fini();
 }
 
@@ -41,16 +41,20 @@
 #include "blocks.h"
 #include "callbacks.h"
 #include "compiler_utils.h"
+#include "dcache.h"
 #include "dir.h"
 #include "hash_map.h"
 #include "inode.h"
 #include "inode_array.h"
 #include "locks.h"
 #include "mkdir.h"
+#include "mmap.h"
 #include "os_thread.h"
 #include "os_util.h"
 #include "out.h"
 #include "pool.h"
+#include "rcu.h"
+#include "reclaim.h"
 #include "utils.h"
 
 COMPILE_ERROR_ON(PMEMFILE_ROOT_COUNT <= 0);
@@ -66,13 +70,17 @@ pmemfile_pool_root_count(PMEMfilepool *pfp)
 
 #define PMEMFILE_CUR_VERSION \
 	PMEMFILE_SUPER_VERSION(PMEMFILE_MAJOR_VERSION, PMEMFILE_MINOR_VERSION)
+COMPILE_ERROR_ON(PMEMFILE_INODE_SIZE_DEFAULT != PMEMFILE_INODE_SIZE);
+COMPILE_ERROR_ON(PMEMFILE_INODE_SIZE_COMPACT != PMEMFILE_COMPACT_INODE_SIZE);
+
 /*
  * initialize_super_block -- initializes super block
  *
- * Can't be called in a transaction.
+ * inode_size is used only if the pool is new. Can't be called in
+ * a transaction.
  */
 static int
-initialize_super_block(PMEMfilepool *pfp)
+initialize_super_block(PMEMfilepool *pfp, size_t inode_size)
 {
 	LOG(LDBG, "pfp %p", pfp);
 
@@ -88,10 +96,26 @@ initialize_super_block(PMEMfilepool *pfp)
 		return -1;
 	}
 
+	if (!TOID_IS_NULL(super->root_inode[0]) && super->inode_size != 0 &&
+			super->inode_size != PMEMFILE_INODE_SIZE &&
+			super->inode_size != PMEMFILE_COMPACT_INODE_SIZE) {
+		ERR("unknown inode size: %" PRIu64, super->inode_size);
+		errno = EINVAL;
+		return -1;
+	}
+
 	os_rwlock_init(&pfp->cred_rwlock);
 	os_rwlock_init(&pfp->super_rwlock);
 	os_rwlock_init(&pfp->cwd_rwlock);
-	os_rwlock_init(&pfp->inode_map_rwlock);
+	os_mutex_init(&pfp->mappings_mutex);
+	os_mutex_init(&pfp->block_refs_mutex);
+	group_commit_init(&pfp->group_commit, pmemfile_group_commit_size);
+
+	if (reclaimer_init(pfp, pmemfile_background_reclaim)) {
+		error = errno;
+		ERR("!cannot start reclaimer thread");
+		goto reclaimer_init_fail;
+	}
 
 	error = initialize_alloc_classes(pfp->pop);
 	if (error) {
@@ -105,13 +129,19 @@ initialize_super_block(PMEMfilepool *pfp)
 		goto get_cred_fail;
 	}
 
-	pfp->inode_map = hash_map_alloc();
-	if (!pfp->inode_map) {
+	if (inode_map_alloc(pfp)) {
 		error = errno;
 		ERR("!cannot allocate inode map");
 		goto inode_map_alloc_fail;
 	}
 
+	pfp->dcache = dcache_alloc(pmemfile_dcache_size);
+	if (!pfp->dcache) {
+		error = errno;
+		ERR("!cannot allocate lookup cache");
+		goto dcache_alloc_fail;
+	}
+
 	if (TOID_IS_NULL(super->root_inode[0])) {
 		TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
 			TX_ADD_DIRECT(super);
@@ -122,7 +152,10 @@ initialize_super_block(PMEMfilepool *pfp)
 			}
 
 			super->version = PMEMFILE_CUR_VERSION;
-			super->orphaned_inodes = inode_array_alloc(pfp);
+			super->inode_size = inode_size;
+			for (unsigned i = 0; i < PMEMFILE_ORPHAN_SHARDS; ++i)
+				*pool_orphaned_shard(pfp, i) =
+						inode_array_alloc(pfp);
 			super->suspended_inodes = inode_array_alloc(pfp);
 		} TX_ONABORT {
 			error = errno;
@@ -161,26 +194,41 @@ initialize_super_block(PMEMfilepool *pfp)
 	return 0;
 ref_err:
 tx_err:
+	dcache_free(pfp);
+dcache_alloc_fail:
 	inode_map_free(pfp);
 inode_map_alloc_fail:
 	cred_release(&cred);
 get_cred_fail:
+	reclaimer_fini(pfp);
+reclaimer_init_fail:
 	os_rwlock_destroy(&pfp->super_rwlock);
 	os_rwlock_destroy(&pfp->cwd_rwlock);
 	os_rwlock_destroy(&pfp->cred_rwlock);
-	os_rwlock_destroy(&pfp->inode_map_rwlock);
+	os_mutex_destroy(&pfp->mappings_mutex);
+	os_mutex_destroy(&pfp->block_refs_mutex);
+	group_commit_fini(&pfp->group_commit);
 	errno = error;
 	return -1;
 }
 
 /*
- * pmemfile_pool_create -- create pmem file system on specified file
+ * pmemfile_pool_create_ex -- create pmem file system on specified file, with
+ * inodes of inode_size bytes
  */
 PMEMfilepool *
-pmemfile_pool_create(const char *pathname, size_t poolsize,
-		pmemfile_mode_t mode)
+pmemfile_pool_create_ex(const char *pathname, size_t poolsize,
+		pmemfile_mode_t mode, size_t inode_size)
 {
-	LOG(LDBG, "pathname %s poolsize %zu mode %o", pathname, poolsize, mode);
+	LOG(LDBG, "pathname %s poolsize %zu mode %o inode_size %zu", pathname,
+			poolsize, mode, inode_size);
+
+	if (inode_size != PMEMFILE_INODE_SIZE_DEFAULT &&
+			inode_size != PMEMFILE_INODE_SIZE_COMPACT) {
+		LOG(LUSR, "invalid inode size %zu", inode_size);
+		errno = EINVAL;
+		return NULL;
+	}
 
 	PMEMfilepool *pfp = pf_calloc(1, sizeof(*pfp));
 	if (!pfp)
@@ -204,7 +252,7 @@ pmemfile_pool_create(const char *pathname, size_t poolsize,
 	}
 	pfp->super = PF_RW(pfp, super);
 
-	if (initialize_super_block(pfp)) {
+	if (initialize_super_block(pfp, inode_size)) {
 		error = errno;
 		goto init_failed;
 	}
@@ -220,6 +268,17 @@ pool_create:
 	return NULL;
 }
 
+/*
+ * pmemfile_pool_create -- create pmem file system on specified file
+ */
+PMEMfilepool *
+pmemfile_pool_create(const char *pathname, size_t poolsize,
+		pmemfile_mode_t mode)
+{
+	return pmemfile_pool_create_ex(pathname, poolsize, mode,
+			PMEMFILE_INODE_SIZE_DEFAULT);
+}
+
 static void
 inode_trim_cb(PMEMfilepool *pfp, TOID(struct pmemfile_inode) inode)
 {
@@ -262,25 +321,36 @@ pmemfile_pool_open(const char *pathname)
 	}
 	pfp->super = pmemobj_direct(super);
 
-	if (initialize_super_block(pfp)) {
+	if (initialize_super_block(pfp, 0)) {
 		error = errno;
 		goto init_failed;
 	}
 
-	TOID(struct pmemfile_inode_array) orphaned =
-			pfp->super->orphaned_inodes;
-	if (!inode_array_empty(pfp, orphaned) ||
-			!inode_array_is_small(pfp, orphaned)) {
-		inode_array_traverse(pfp, orphaned, inode_trim_cb);
+	/* free inodes left in all lists of orphans, allocate missing lists */
+	for (unsigned i = 0; i < PMEMFILE_ORPHAN_SHARDS; ++i) {
+		TOID(struct pmemfile_inode_array) *shard =
+				pool_orphaned_shard(pfp, i);
+		TOID(struct pmemfile_inode_array) orphaned = *shard;
+
+		if (!TOID_IS_NULL(orphaned) &&
+				inode_array_empty(pfp, orphaned) &&
+				inode_array_is_small(pfp, orphaned))
+			continue;
+
+		if (!TOID_IS_NULL(orphaned))
+			inode_array_traverse(pfp, orphaned, inode_trim_cb);
 
 		TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
-			TX_ADD_FIELD_DIRECT(pfp->super, orphaned_inodes);
+			TX_ADD_DIRECT(shard);
 
-			inode_array_traverse(pfp, orphaned, inode_free_cb);
+			if (!TOID_IS_NULL(orphaned)) {
+				inode_array_traverse(pfp, orphaned,
+						inode_free_cb);
 
-			inode_array_free(pfp, orphaned);
+				inode_array_free(pfp, orphaned);
+			}
 
-			pfp->super->orphaned_inodes = inode_array_alloc(pfp);
+			*shard = inode_array_alloc(pfp);
 		} TX_ONABORT {
 			FATAL("!cannot cleanup list of deleted files");
 		} TX_END
@@ -316,14 +386,21 @@ pmemfile_pool_close(PMEMfilepool *pfp)
 
 	pf_free(pfp->cred.groups);
 
+	pool_unmap_all(pfp);
+
+	dcache_free(pfp);
 	vinode_unref(pfp, pfp->cwd);
 	for (unsigned i = 0; i < PMEMFILE_ROOT_COUNT; ++i)
 		vinode_unref(pfp, pfp->root[i]);
 	inode_map_free(pfp);
+	reclaimer_fini(pfp);
+	rcu_synchronize();
 	os_rwlock_destroy(&pfp->cred_rwlock);
 	os_rwlock_destroy(&pfp->super_rwlock);
 	os_rwlock_destroy(&pfp->cwd_rwlock);
-	os_rwlock_destroy(&pfp->inode_map_rwlock);
+	os_mutex_destroy(&pfp->mappings_mutex);
+	os_mutex_destroy(&pfp->block_refs_mutex);
+	group_commit_fini(&pfp->group_commit);
 
 	pmemobj_close(pfp->pop);
 
@@ -392,7 +469,7 @@ pmemfile_pool_resume(PMEMfilepool *pfp, const char *pathname)
 	struct resume_info arg = {pfp, old_pop};
 
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
-		hash_map_traverse(pfp->inode_map, inode_resume_cb, &arg);
+		inode_map_traverse(pfp, inode_resume_cb, &arg);
 	} TX_ONABORT {
 		error = -1;
 	} TX_END
@@ -407,7 +484,7 @@ pmemfile_pool_resume(PMEMfilepool *pfp, const char *pathname)
 		return -1;
 	}
 
-	hash_map_traverse(pfp->inode_map, vinode_resume_cb, &arg);
+	inode_map_traverse(pfp, vinode_resume_cb, &arg);
 
 	return 0;
 }
@@ -419,14 +496,27 @@ pmemfile_pool_resume(PMEMfilepool *pfp, const char *pathname)
  * This function CAN NOT be called while any pmemfile function (including this
  * one) is in progress (even for other pools, because of pmemobj_close/open
  * not being safe)!
+ *
+ * Pool with memory mapped files can't be suspended.
  */
 int
 pmemfile_pool_suspend(PMEMfilepool *pfp)
 {
 	int error = 0;
 
+	if (pfp->mappings) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* cached lookups would keep otherwise unused inodes suspended */
+	dcache_flush(pfp);
+	vinode_lru_flush(pfp);
+	/* queued inodes point to the mapping of the pool */
+	reclaim_drain(pfp);
+
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
-		hash_map_traverse(pfp->inode_map, vinode_suspend_cb, pfp);
+		inode_map_traverse(pfp, vinode_suspend_cb, pfp);
 	} TX_ONABORT {
 		error = -1;
 	} TX_END
@@ -437,3 +527,20 @@ pmemfile_pool_suspend(PMEMfilepool *pfp)
 	pmemobj_close(pfp->pop);
 	return 0;
 }
+
+/*
+ * pmemfile_pool_reclaim -- waits until space of all unlinked files which are
+ * no longer open is given back to the pool
+ */
+int
+pmemfile_pool_reclaim(PMEMfilepool *pfp)
+{
+	if (!pfp) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	reclaim_drain(pfp);
+
+	return 0;
+}
@@ -37,10 +37,37 @@
  */
 
 #include "creds.h"
+#include "group_commit.h"
 #include "hash_map.h"
 #include "inode.h"
 #include "layout.h"
 #include "os_thread.h"
+#include "reclaim.h"
+
+#define INODE_MAP_SHARDS 64
+
+/* part of the map between inodes and vinodes */
+struct inode_map_shard {
+	os_rwlock_t rwlock;
+	struct hash_map *map;
+
+	/* keep shards on separate cache lines */
+	char padding[128 - sizeof(os_rwlock_t) - sizeof(struct hash_map *)];
+};
+
+/* cache of unreferenced vinodes, kept in the inode map */
+struct vinode_lru {
+	os_mutex_t lock;
+
+	/* most recently released */
+	struct pmemfile_vinode *head;
+
+	/* next eviction candidate */
+	struct pmemfile_vinode *tail;
+
+	size_t count;
+	size_t capacity;
+};
 
 /* Pool */
 struct pmemfilepool {
@@ -59,15 +86,49 @@ struct pmemfilepool {
 
 	/* superblock */
 	struct pmemfile_super *super;
+	/* serializes renames between directories */
 	os_rwlock_t super_rwlock;
 
-	/* map between inodes and vinodes */
-	struct hash_map *inode_map;
-	os_rwlock_t inode_map_rwlock;
+	/* map between inodes and vinodes, sharded by inode offset */
+	struct inode_map_shard inode_map[INODE_MAP_SHARDS];
+	struct vinode_lru vinode_lru;
+
+	/* cache of path component lookups */
+	struct dcache *dcache;
 
 	/* current credentials */
 	struct pmemfile_cred cred;
 	os_rwlock_t cred_rwlock;
+
+	/* list of memory mappings of files */
+	struct pmemfile_mapping *mappings;
+	os_mutex_t mappings_mutex;
+
+	/*
+	 * Protects super->block_refs, held until the end of transaction.
+	 * There's one for the whole pool, so transactions which share, unshare
+	 * or free shared blocks are serialized, even for unrelated files.
+	 */
+	os_mutex_t block_refs_mutex;
+
+	/* batching of metadata transactions */
+	struct group_commit group_commit;
+
+	/* freeing of unlinked inodes */
+	struct reclaimer reclaimer;
 };
 
+/*
+ * pool_orphaned_shard -- returns pointer to the head of list number i of
+ * orphaned inodes
+ */
+static inline TOID(struct pmemfile_inode_array) *
+pool_orphaned_shard(PMEMfilepool *pfp, unsigned i)
+{
+	if (i == 0)
+		return &pfp->super->orphaned_inodes;
+
+	return &pfp->super->orphaned_shards[i - 1];
+}
+
 #endif
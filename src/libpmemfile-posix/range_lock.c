@@ -0,0 +1,206 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * range_lock.c -- byte-range lock
+ *
+ * Range lock allows many threads to hold exclusive access to disjoint parts
+ * of the same object at the same time. Ranges can also be locked in shared
+ * mode - shared ranges conflict only with overlapping exclusive ranges.
+ * Caller provides storage for the entry describing the range (usually on
+ * stack), so locking never allocates memory.
+ *
+ * Waiting is done on one condition variable shared by all ranges, so
+ * unlocking wakes up all waiters. It is meant to be used only for short
+ * critical sections with low probability of conflicts.
+ */
+
+#include "out.h"
+#include "range_lock.h"
+
+/*
+ * range_lock_init -- initializes range lock
+ */
+void
+range_lock_init(struct range_lock *rl)
+{
+	os_mutex_init(&rl->mutex);
+	os_cond_init(&rl->cond);
+	rl->ranges = NULL;
+}
+
+/*
+ * range_lock_destroy -- destroys range lock
+ */
+void
+range_lock_destroy(struct range_lock *rl)
+{
+	ASSERTeq(rl->ranges, NULL);
+
+	os_cond_destroy(&rl->cond);
+	os_mutex_destroy(&rl->mutex);
+}
+
+/*
+ * range_lock_find_conflict -- returns true if any of the locked ranges
+ * overlaps with [start, end) and at least one of them is not shared
+ */
+static bool
+range_lock_find_conflict(struct range_lock *rl, uint64_t start, uint64_t end,
+		bool shared)
+{
+	for (struct range_lock_entry *r = rl->ranges; r; r = r->next) {
+		if (r->start < end && start < r->end && !(r->shared && shared))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * range_end -- returns end of [offset, offset + len) range
+ */
+static uint64_t
+range_end(uint64_t offset, uint64_t len)
+{
+	ASSERT(len > 0);
+
+	/* overflow */
+	if (offset + len < offset)
+		return UINT64_MAX;
+
+	return offset + len;
+}
+
+/*
+ * range_lock_add -- waits until e doesn't conflict with any locked range and
+ * adds it to the list of locked ranges
+ */
+static void
+range_lock_add(struct range_lock *rl, struct range_lock_entry *e)
+{
+	os_mutex_lock(&rl->mutex);
+
+	while (range_lock_find_conflict(rl, e->start, e->end, e->shared))
+		os_cond_wait(&rl->cond, &rl->mutex);
+
+	e->next = rl->ranges;
+	rl->ranges = e;
+
+	os_mutex_unlock(&rl->mutex);
+}
+
+/*
+ * range_lock_lock -- locks [offset, offset + len) range in exclusive mode,
+ * waits until no other thread holds a lock on overlapping range
+ */
+void
+range_lock_lock(struct range_lock *rl, struct range_lock_entry *e,
+		uint64_t offset, uint64_t len)
+{
+	e->start = offset;
+	e->end = range_end(offset, len);
+	e->shared = false;
+
+	range_lock_add(rl, e);
+}
+
+/*
+ * range_lock_lock_shared -- locks [offset, offset + len) range in shared mode,
+ * waits until no other thread holds an exclusive lock on overlapping range
+ */
+void
+range_lock_lock_shared(struct range_lock *rl, struct range_lock_entry *e,
+		uint64_t offset, uint64_t len)
+{
+	e->start = offset;
+	e->end = range_end(offset, len);
+	e->shared = true;
+
+	range_lock_add(rl, e);
+}
+
+/*
+ * range_lock_wait -- waits until no thread holds a lock (in any mode) on
+ * a range overlapping with [offset, offset + len)
+ *
+ * Caller has to prevent new locks from being taken, otherwise it may
+ * starve.
+ */
+void
+range_lock_wait(struct range_lock *rl, uint64_t offset, uint64_t len)
+{
+	uint64_t end = range_end(offset, len);
+
+	os_mutex_lock(&rl->mutex);
+
+	while (range_lock_find_conflict(rl, offset, end, false))
+		os_cond_wait(&rl->cond, &rl->mutex);
+
+	os_mutex_unlock(&rl->mutex);
+}
+
+/*
+ * range_lock_is_locked -- returns true if any thread holds a lock (in any
+ * mode) on a range overlapping with [offset, offset + len)
+ */
+bool
+range_lock_is_locked(struct range_lock *rl, uint64_t offset, uint64_t len)
+{
+	uint64_t end = range_end(offset, len);
+
+	os_mutex_lock(&rl->mutex);
+	bool locked = range_lock_find_conflict(rl, offset, end, false);
+	os_mutex_unlock(&rl->mutex);
+
+	return locked;
+}
+
+/*
+ * range_lock_unlock -- unlocks range locked by range_lock_lock
+ */
+void
+range_lock_unlock(struct range_lock *rl, struct range_lock_entry *e)
+{
+	os_mutex_lock(&rl->mutex);
+
+	struct range_lock_entry **prev = &rl->ranges;
+	while (*prev != e) {
+		ASSERTne(*prev, NULL);
+		prev = &(*prev)->next;
+	}
+	*prev = e->next;
+
+	os_cond_broadcast(&rl->cond);
+
+	os_mutex_unlock(&rl->mutex);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * range_lock.h -- byte-range lock
+ */
+
+#ifndef PMEMFILE_RANGE_LOCK_H
+#define PMEMFILE_RANGE_LOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "os_thread.h"
+
+/* one locked byte range, owned by the thread that locked it */
+struct range_lock_entry {
+	uint64_t start;
+	uint64_t end;
+	bool shared;
+	struct range_lock_entry *next;
+};
+
+struct range_lock {
+	/* protects the list of locked ranges */
+	os_mutex_t mutex;
+
+	/* signalled every time a range is unlocked */
+	os_cond_t cond;
+
+	/* list of currently locked ranges */
+	struct range_lock_entry *ranges;
+};
+
+void range_lock_init(struct range_lock *rl);
+void range_lock_destroy(struct range_lock *rl);
+
+void range_lock_lock(struct range_lock *rl, struct range_lock_entry *e,
+		uint64_t offset, uint64_t len);
+void range_lock_lock_shared(struct range_lock *rl, struct range_lock_entry *e,
+		uint64_t offset, uint64_t len);
+void range_lock_unlock(struct range_lock *rl, struct range_lock_entry *e);
+void range_lock_wait(struct range_lock *rl, uint64_t offset, uint64_t len);
+bool range_lock_is_locked(struct range_lock *rl, uint64_t offset,
+		uint64_t len);
+
+#endif
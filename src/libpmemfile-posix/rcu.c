@@ -0,0 +1,284 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * rcu.c -- deferred freeing of memory read without locks
+ *
+ * Lockless readers (see resolve_pathat_rcu) follow pointers to volatile
+ * objects which other threads may concurrently unlink and release. Such
+ * objects are not freed immediately, but passed to rcu_free, which frees
+ * them once no reader could still see them.
+ *
+ * Every thread which enters a read-side section gets its own reader record
+ * and publishes there the global epoch it started in. rcu_free tags object
+ * with the current epoch and advances it. Object can be freed when all
+ * readers are either outside of a read-side section or started in a later
+ * epoch. Readers write only to their own records, so read-side sections
+ * don't bounce cache lines between threads.
+ */
+
+#include <errno.h>
+
+#include "alloc.h"
+#include "os_thread.h"
+#include "os_util.h"
+#include "out.h"
+#include "rcu.h"
+#include "valgrind_internal.h"
+
+#define RCU_READER_SIZE 128
+
+struct rcu_reader {
+	/* epoch at the start of the current read-side section, 0 outside */
+	uint64_t epoch;
+
+	/* record is owned by a thread */
+	uint64_t used;
+
+	struct rcu_reader *next;
+
+	/* keeps records of different threads in different cache lines */
+	char padding[RCU_READER_SIZE - 2 * sizeof(uint64_t) - sizeof(void *)];
+};
+
+static os_tls_key_t rcu_key;
+
+/* protects rcu_readers, rcu_retired and "used" fields */
+static os_mutex_t rcu_lock;
+
+static struct rcu_reader *rcu_readers;
+static struct rcu_head *rcu_retired;
+
+static uint64_t rcu_epoch = 1;
+
+/*
+ * rcu_reader_release -- gives up reader record of an exiting thread
+ */
+static void
+rcu_reader_release(void *arg)
+{
+	struct rcu_reader *r = arg;
+
+	os_mutex_lock(&rcu_lock);
+	__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+	r->used = 0;
+	os_mutex_unlock(&rcu_lock);
+}
+
+/*
+ * rcu_reader_get -- returns reader record of the current thread
+ */
+static struct rcu_reader *
+rcu_reader_get(void)
+{
+	struct rcu_reader *r = os_tls_get(rcu_key);
+	if (r)
+		return r;
+
+	os_mutex_lock(&rcu_lock);
+
+	for (r = rcu_readers; r; r = r->next)
+		if (!r->used)
+			break;
+
+	if (!r) {
+		r = pf_calloc(1, sizeof(*r));
+		if (r) {
+			r->next = rcu_readers;
+			rcu_readers = r;
+		}
+	}
+
+	if (r)
+		r->used = 1;
+
+	os_mutex_unlock(&rcu_lock);
+
+	if (!r)
+		return NULL;
+
+	int ret = os_tls_set(rcu_key, r);
+	if (ret) {
+		errno = ret;
+		ERR("!os_tls_set");
+		rcu_reader_release(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/*
+ * rcu_read_lock -- starts read-side section
+ *
+ * Returns false if it's not possible (because of memory allocation
+ * failure), in which case caller has to use locks.
+ */
+bool
+rcu_read_lock(void)
+{
+	struct rcu_reader *r = rcu_reader_get();
+	if (!r)
+		return false;
+
+	__atomic_store_n(&r->epoch, __atomic_load_n(&rcu_epoch,
+			__ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+	/* publish epoch before reading any pointers */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/*
+	 * Readers race with writers by design and validate what they read
+	 * with sequence counters, so don't let race detectors report it.
+	 */
+	VALGRIND_ANNOTATE_IGNORE_READS_BEGIN();
+
+	return true;
+}
+
+/*
+ * rcu_read_unlock -- ends read-side section
+ */
+void
+rcu_read_unlock(void)
+{
+	struct rcu_reader *r = os_tls_get(rcu_key);
+
+	VALGRIND_ANNOTATE_IGNORE_READS_END();
+
+	__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * rcu_reclaim -- frees objects no reader can see, returns true if there's
+ * nothing more to free
+ *
+ * Must be called with rcu_lock held.
+ */
+static bool
+rcu_reclaim(void)
+{
+	uint64_t min = UINT64_MAX;
+
+	for (struct rcu_reader *r = rcu_readers; r; r = r->next) {
+		uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+
+		if (epoch && epoch < min)
+			min = epoch;
+	}
+
+	struct rcu_head **prev = &rcu_retired;
+	while (*prev) {
+		struct rcu_head *head = *prev;
+
+		if (head->epoch < min) {
+			*prev = head->next;
+			pf_free(head->ptr);
+		} else {
+			prev = &head->next;
+		}
+	}
+
+	return rcu_retired == NULL;
+}
+
+/*
+ * rcu_free -- frees ptr when no reader can access it anymore
+ *
+ * Object must already be unreachable for new readers. head must be a part
+ * of the object pointed by ptr.
+ */
+void
+rcu_free(struct rcu_head *head, void *ptr)
+{
+	head->ptr = ptr;
+	head->epoch = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+
+	os_mutex_lock(&rcu_lock);
+	head->next = rcu_retired;
+	rcu_retired = head;
+	rcu_reclaim();
+	os_mutex_unlock(&rcu_lock);
+}
+
+/*
+ * rcu_synchronize -- waits until all objects passed to rcu_free are freed
+ */
+void
+rcu_synchronize(void)
+{
+	while (1) {
+		os_mutex_lock(&rcu_lock);
+		bool done = rcu_reclaim();
+		os_mutex_unlock(&rcu_lock);
+
+		if (done)
+			break;
+
+		os_usleep(100);
+	}
+}
+
+/*
+ * rcu_init -- initializes rcu module
+ */
+void
+rcu_init(void)
+{
+	os_mutex_init(&rcu_lock);
+
+	int ret = os_tls_key_create(&rcu_key, rcu_reader_release);
+	if (ret)
+		FATAL("!os_tls_key_create");
+}
+
+/*
+ * rcu_fini -- frees all retired objects
+ */
+void
+rcu_fini(void)
+{
+	struct rcu_reader *r = os_tls_get(rcu_key);
+	if (r)
+		rcu_reader_release(r);
+
+	os_mutex_lock(&rcu_lock);
+
+	while (rcu_retired) {
+		struct rcu_head *head = rcu_retired;
+
+		rcu_retired = head->next;
+		pf_free(head->ptr);
+	}
+
+	os_mutex_unlock(&rcu_lock);
+}
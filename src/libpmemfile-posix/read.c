@@ -36,6 +36,7 @@
 
 #include <limits.h>
 
+#include "alloc.h"
 #include "callbacks.h"
 #include "data.h"
 #include "file.h"
@@ -355,3 +356,155 @@ pmemfile_preadv(PMEMfilepool *pfp, PMEMfile *file, const pmemfile_iovec_t *iov,
 
 	return ret;
 }
+
+/* read lease given out by pmemfile_pread_borrow */
+struct pmemfile_lease {
+	struct pmemfile_vinode *vinode;
+	struct range_lock_entry range;
+};
+
+/*
+ * pmemfile_pread_borrow -- fills iov with read-only pointers to file data
+ * starting at a position supplied as argument, without copying it
+ *
+ * On input *iovcnt is the number of available entries in iov, on output it's
+ * the number of used entries. Holes and uninitialized parts of the file
+ * point to a shared zeroed region. Returns number of borrowed bytes, which can
+ * be less than count when iov was too short or the end of file was reached.
+ *
+ * Data stays valid until pmemfile_pread_release is called on returned lease.
+ * Until then truncating or punching a hole in the borrowed range waits, so
+ * the lease should be released as soon as possible and must not be held by
+ * a thread which truncates this file. Borrowed data can still be modified by
+ * concurrent writes.
+ */
+pmemfile_ssize_t
+pmemfile_pread_borrow(PMEMfilepool *pfp, PMEMfile *file, size_t count,
+		pmemfile_off_t offset, pmemfile_iovec_t *iov, int *iovcnt,
+		PMEMfilelease **lease)
+{
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!file) {
+		LOG(LUSR, "NULL file");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!iov || !iovcnt || !lease) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (offset < 0 || *iovcnt <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*lease = NULL;
+
+	pmemfile_ssize_t ret;
+
+	os_mutex_lock(&file->mutex);
+
+	ret = pmemfile_preadv_args_check(file, NULL, 0);
+
+	uint64_t last_bp_iv_obs =
+			file->last_block_pointer_invalidation_observed;
+	struct pmemfile_block_desc *last_block = file->block_pointer_cache;
+	uint64_t flags = file->flags;
+
+	os_mutex_unlock(&file->mutex);
+
+	if (ret != 0)
+		return ret;
+
+	if (count > SSIZE_MAX)
+		count = SSIZE_MAX;
+
+	struct pmemfile_lease *l = pf_malloc(sizeof(*l));
+	if (!l) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	struct pmemfile_vinode *vinode = file->vinode;
+
+	ret = vinode_rdlock_with_block_tree(pfp, vinode);
+	if (ret != 0) {
+		pf_free(l);
+		errno = (int)-ret;
+		return -1;
+	}
+
+	if (last_bp_iv_obs != vinode->block_pointer_invalidation_counter)
+		last_block = NULL;
+
+	uint64_t size = inode_get_size(vinode->inode);
+	uint64_t len = 0;
+	int used = 0;
+
+	if ((uint64_t)offset < size && count > 0) {
+		len = size - (uint64_t)offset;
+		if (count < len)
+			len = count;
+
+		struct pmemfile_block_desc *block =
+			find_closest_block_with_hint(vinode, (uint64_t)offset,
+					last_block);
+
+		used = borrow_file_range(pfp, vinode, block, (uint64_t)offset,
+				&len, iov, *iovcnt);
+	}
+
+	if (len > 0) {
+		/*
+		 * Leases are only locked in shared mode, so this never waits.
+		 * Truncate, punch hole etc. check for leases again once they
+		 * hold the vinode lock in write mode (vinode_wrlock_unleased,
+		 * vinode_check_leases).
+		 */
+		l->vinode = vinode_ref(pfp, vinode);
+		range_lock_lock_shared(&vinode->leases, &l->range,
+				(uint64_t)offset, len);
+	}
+
+	os_rwlock_unlock(&vinode->rwlock);
+
+	if (len > 0)
+		*lease = l;
+	else
+		pf_free(l);
+
+	*iovcnt = used;
+
+	handle_atime(pfp, vinode, flags);
+
+	return (pmemfile_ssize_t)len;
+}
+
+/*
+ * pmemfile_pread_release -- releases lease obtained by pmemfile_pread_borrow
+ */
+void
+pmemfile_pread_release(PMEMfilepool *pfp, PMEMfilelease *lease)
+{
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		return;
+	}
+
+	if (!lease)
+		return;
+
+	struct pmemfile_vinode *vinode = lease->vinode;
+
+	range_lock_unlock(&vinode->leases, &lease->range);
+	vinode_unref(pfp, vinode);
+
+	pf_free(lease);
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * reclaim.c -- freeing of persistent state of unlinked inodes
+ *
+ * When the last reference to an unlinked inode is dropped, all of its blocks,
+ * block arrays and index pages have to be freed. For big files that's a lot
+ * of work, so it's done after the vinode leaves the inode map (without any
+ * lock held) and in transactions of bounded size. The inode stays on its
+ * list of orphans until the last transaction, which frees the inode itself,
+ * so if the process dies in the middle, pmemfile_pool_open finishes the job.
+ *
+ * Optionally (PMEMFILE_BACKGROUND_RECLAIM=1) freeing is handed over to
+ * a thread of the pool, so unlink or close of a big file returns immediately.
+ * Space of such files is returned asynchronously - reclaim_drain waits until
+ * it's done.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "alloc.h"
+#include "block_ref.h"
+#include "callbacks.h"
+#include "inode.h"
+#include "inode_array.h"
+#include "out.h"
+#include "pool.h"
+#include "reclaim.h"
+#include "utils.h"
+
+/* maximum number of objects freed in one transaction */
+#define RECLAIM_FREES_PER_TX 256
+
+bool pmemfile_background_reclaim = false;
+
+struct reclaim_req {
+	TOID(struct pmemfile_inode) tinode;
+	struct inode_orphan_info orphaned;
+
+	struct reclaim_req *next;
+};
+
+/*
+ * reclaim_block_arrays -- frees block arrays of regular file (except the one
+ * embedded in the inode) and pages of its block index, in transactions
+ * of bounded size
+ *
+ * Stops at the first failed transaction.
+ */
+static void
+reclaim_block_arrays(PMEMfilepool *pfp, struct pmemfile_inode *inode)
+{
+	struct pmemfile_block_array *first = &inode_file_data(inode)->blocks;
+	int error = 0;
+
+	while (!error && !TOID_IS_NULL(first->next)) {
+		TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+			TX_ADD_DIRECT(&first->next);
+
+			unsigned frees = 0;
+			while (!TOID_IS_NULL(first->next) &&
+					frees < RECLAIM_FREES_PER_TX) {
+				TOID(struct pmemfile_block_array) tarr =
+						first->next;
+				struct pmemfile_block_array *arr =
+						PF_RW(pfp, tarr);
+
+				for (uint32_t i = 0; i < arr->length; ++i)
+					block_data_free(pfp, &arr->blocks[i]);
+
+				frees += arr->length + 1;
+				first->next = arr->next;
+				TX_FREE(tarr);
+			}
+		} TX_ONABORT {
+			error = errno;
+		} TX_END
+	}
+
+	while (!error && !TOID_IS_NULL(inode->block_index)) {
+		TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+			TX_ADD_DIRECT(&inode->block_index);
+
+			for (unsigned frees = 0;
+					!TOID_IS_NULL(inode->block_index) &&
+					frees < RECLAIM_FREES_PER_TX; ++frees) {
+				TOID(struct pmemfile_block_index) page =
+						inode->block_index;
+				inode->block_index = PF_RO(pfp, page)->next;
+				TX_FREE(page);
+			}
+		} TX_ONABORT {
+			error = errno;
+		} TX_END
+	}
+}
+
+/*
+ * reclaim_free -- frees persistent state of unlinked inode
+ */
+static void
+reclaim_free(PMEMfilepool *pfp, TOID(struct pmemfile_inode) tinode,
+		struct inode_orphan_info orphaned)
+{
+	LOG(LDBG, "inode 0x%" PRIx64, tinode.oid.off);
+
+	/*
+	 * Undo log space in transaction is limited, so when it's exhausted
+	 * pmemobj needs to allocate more to extend it.
+	 * If all space is used by user data pmemobj is not able to do that,
+	 * which means frees fail.
+	 *
+	 * To fix this, do as many frees outside of transaction as possible,
+	 * while still maintaining consistency.
+	 */
+	inode_trim(pfp, tinode);
+
+	/*
+	 * Nothing can reach the inode anymore, so its block arrays can be
+	 * detached one by one. If any of these transactions fails, the last
+	 * one will try again.
+	 */
+	struct pmemfile_inode *inode = PF_RW(pfp, tinode);
+	if (inode_is_regular_file(inode))
+		reclaim_block_arrays(pfp, inode);
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		inode_array_unregister(pfp, orphaned.arr, orphaned.idx);
+
+		inode_free(pfp, tinode);
+	} TX_ONABORT {
+		/*
+		 * Sometimes even with inode_trim it's not possible to get
+		 * enough space for transaction to succeed.
+		 * However, if user wants that, we can ignore transaction error
+		 * and temporarily leak this inode. It will be freed the next
+		 * time pmemfile_pool_open is called.
+		 */
+		const char *env = getenv("PMEMFILE_IGNORE_INODE_FREE_ERRORS");
+
+		if (env && env[0] == '1')
+			LOG(LINF, "Freeing inode %lu failed!", tinode.oid.off);
+		else
+			FATAL("!reclaim_free");
+	} TX_END
+}
+
+/*
+ * reclaim_thread -- frees inodes queued by reclaim_inode until the pool is
+ * closed
+ */
+static void *
+reclaim_thread(void *arg)
+{
+	PMEMfilepool *pfp = arg;
+	struct reclaimer *r = &pfp->reclaimer;
+
+	os_mutex_lock(&r->lock);
+
+	while (true) {
+		while (!r->head && !r->stop)
+			os_cond_wait(&r->cond, &r->lock);
+
+		struct reclaim_req *req = r->head;
+		if (!req)
+			break;
+
+		r->head = req->next;
+		if (!r->head)
+			r->tail = &r->head;
+		r->busy = true;
+
+		os_mutex_unlock(&r->lock);
+
+		reclaim_free(pfp, req->tinode, req->orphaned);
+		pf_free(req);
+
+		os_mutex_lock(&r->lock);
+
+		r->busy = false;
+		os_cond_broadcast(&r->cond);
+	}
+
+	os_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+/*
+ * reclaimer_init -- initializes reclaimer state of the pool and, if background
+ * is set, starts its thread
+ */
+int
+reclaimer_init(PMEMfilepool *pfp, bool background)
+{
+	struct reclaimer *r = &pfp->reclaimer;
+
+	os_mutex_init(&r->lock);
+	os_cond_init(&r->cond);
+	r->head = NULL;
+	r->tail = &r->head;
+	r->busy = false;
+	r->stop = false;
+	r->running = false;
+
+	if (!background)
+		return 0;
+
+	int error = os_thread_create(&r->thread, reclaim_thread, pfp);
+	if (error) {
+		os_cond_destroy(&r->cond);
+		os_mutex_destroy(&r->lock);
+		errno = error;
+		return -1;
+	}
+
+	r->running = true;
+
+	return 0;
+}
+
+/*
+ * reclaimer_fini -- frees all queued inodes, stops reclaimer thread and
+ * destroys reclaimer state of the pool
+ */
+void
+reclaimer_fini(PMEMfilepool *pfp)
+{
+	struct reclaimer *r = &pfp->reclaimer;
+
+	if (r->running) {
+		os_mutex_lock(&r->lock);
+		r->stop = true;
+		os_cond_broadcast(&r->cond);
+		os_mutex_unlock(&r->lock);
+
+		os_thread_join(&r->thread);
+		r->running = false;
+	}
+
+	ASSERTeq(r->head, NULL);
+
+	os_cond_destroy(&r->cond);
+	os_mutex_destroy(&r->lock);
+}
+
+/*
+ * reclaim_inode -- frees persistent state of unlinked inode which vinode was
+ * just released, or queues it for the reclaimer thread
+ *
+ * Can't be called in a transaction or with any lock held.
+ */
+void
+reclaim_inode(PMEMfilepool *pfp, TOID(struct pmemfile_inode) tinode,
+		struct inode_orphan_info orphaned)
+{
+	ASSERT_NOT_IN_TX();
+
+	struct reclaimer *r = &pfp->reclaimer;
+	struct reclaim_req *req = NULL;
+
+	if (r->running)
+		req = pf_malloc(sizeof(*req));
+
+	/* no thread or no memory to queue the inode - free it right now */
+	if (!req) {
+		reclaim_free(pfp, tinode, orphaned);
+		return;
+	}
+
+	req->tinode = tinode;
+	req->orphaned = orphaned;
+	req->next = NULL;
+
+	os_mutex_lock(&r->lock);
+
+	*r->tail = req;
+	r->tail = &req->next;
+
+	os_cond_broadcast(&r->cond);
+	os_mutex_unlock(&r->lock);
+}
+
+/*
+ * reclaim_drain -- waits until all inodes queued for the reclaimer thread
+ * are freed
+ */
+void
+reclaim_drain(PMEMfilepool *pfp)
+{
+	struct reclaimer *r = &pfp->reclaimer;
+
+	if (!r->running)
+		return;
+
+	os_mutex_lock(&r->lock);
+
+	while (r->head || r->busy)
+		os_cond_wait(&r->cond, &r->lock);
+
+	os_mutex_unlock(&r->lock);
+}
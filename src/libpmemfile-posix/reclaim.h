@@ -0,0 +1,77 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * reclaim.h -- freeing of persistent state of unlinked inodes
+ */
+
+#ifndef PMEMFILE_RECLAIM_H
+#define PMEMFILE_RECLAIM_H
+
+#include <stdbool.h>
+
+#include "libpmemfile-posix.h"
+#include "inode.h"
+#include "os_thread.h"
+
+/* free unlinked inodes in a background thread instead of the caller's */
+extern bool pmemfile_background_reclaim;
+
+struct reclaim_req;
+
+struct reclaimer {
+	os_mutex_t lock;
+	os_cond_t cond;
+
+	/* queue of inodes waiting to be freed */
+	struct reclaim_req *head;
+	struct reclaim_req **tail;
+
+	/* reclaimer thread is freeing an inode taken from the queue */
+	bool busy;
+
+	/* reclaimer thread should exit once the queue is empty */
+	bool stop;
+
+	/* reclaimer thread was started */
+	bool running;
+	os_thread_t thread;
+};
+
+int reclaimer_init(PMEMfilepool *pfp, bool background);
+void reclaimer_fini(PMEMfilepool *pfp);
+
+void reclaim_inode(PMEMfilepool *pfp, TOID(struct pmemfile_inode) tinode,
+		struct inode_orphan_info orphaned);
+void reclaim_drain(PMEMfilepool *pfp);
+
+#endif
@@ -35,6 +35,7 @@
  */
 
 #include "callbacks.h"
+#include "dcache.h"
 #include "dir.h"
 #include "libpmemfile-posix.h"
 #include "out.h"
@@ -108,6 +109,9 @@ vinode_exchange(PMEMfilepool *pfp,
 	struct pmemfile_vinode *dst_oldparent = dst_info->vinode->parent;
 
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		dcache_invalidate(pfp, src->parent);
+		dcache_invalidate(pfp, dst->parent);
+
 		TX_ADD_DIRECT(&src_info->dirent->inode);
 		TX_ADD_DIRECT(&dst_info->dirent->inode);
 		src_info->dirent->inode = dst_info->vinode->tinode;
@@ -227,7 +231,7 @@ vinode_rename(PMEMfilepool *pfp,
 			}
 
 			if (inode_get_nlink(dst_info->vinode->inode) == 0)
-				vinode_orphan_unlocked(pfp, dst_info->vinode);
+				vinode_orphan(pfp, dst_info->vinode);
 		}
 
 		if (src->parent == dst->parent) {
@@ -238,12 +242,9 @@ vinode_rename(PMEMfilepool *pfp,
 				pmemfile_tx_abort(ENAMETOOLONG);
 			}
 
-			pmemobj_tx_add_range_direct(src_info->dirent->name,
-					new_name_len + 1);
-
-			strncpy(src_info->dirent->name, dst->remaining,
-					new_name_len);
-			src_info->dirent->name[new_name_len] = '\0';
+			src_info->dirent = vinode_rename_dirent(pfp,
+					src->parent, src_info->dirent,
+					dst->remaining, new_name_len);
 
 			/*
 			 * From "stat" man page:
@@ -259,7 +260,7 @@ vinode_rename(PMEMfilepool *pfp,
 			 */
 			inode_tx_set_ctime(src_info->vinode->inode, t);
 		} else {
-			inode_add_dirent(pfp, dst->parent->tinode,
+			vinode_add_dirent(pfp, dst->parent,
 					dst->remaining, new_name_len,
 					src_info->vinode->tinode, t);
 
@@ -269,6 +270,8 @@ vinode_rename(PMEMfilepool *pfp,
 			if (vinode_is_dir(src_info->vinode))
 				vinode_update_parent(pfp, src_info->vinode,
 						src->parent, dst->parent);
+
+			vinode_shrink_dir(pfp, src->parent);
 		}
 	} TX_ONABORT {
 		error = errno;
@@ -462,6 +465,9 @@ _pmemfile_renameat2(PMEMfilepool *pfp,
 
 		vinode_replace_debug_path_locked(pfp, dst.parent,
 				src_info.vinode, dst.remaining, dst_namelen);
+
+		dcache_forget(pfp, src.parent, src.remaining, src_namelen);
+		dcache_forget(pfp, dst.parent, dst.remaining, dst_namelen);
 	}
 
 end_unlock:
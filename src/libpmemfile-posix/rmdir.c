@@ -35,8 +35,10 @@
  */
 
 #include "callbacks.h"
+#include "dcache.h"
 #include "creds.h"
 #include "dir.h"
+#include "dir_hash.h"
 #include "libpmemfile-posix.h"
 #include "out.h"
 #include "pool.h"
@@ -81,6 +83,11 @@ vinode_unlink_dir(PMEMfilepool *pfp,
 		}
 	}
 
+	if (inode_is_hashed_dir(idir) && dir_hash_entries(pfp, idir) > 0) {
+		LOG(LUSR, "directory %s not empty", path);
+		pmemfile_tx_abort(ENOTEMPTY);
+	}
+
 	ddir = PF_RW(pfp, ddir->next);
 	while (ddir) {
 		for (uint32_t i = 0; i < ddir->num_elements; ++i) {
@@ -95,6 +102,9 @@ vinode_unlink_dir(PMEMfilepool *pfp,
 		ddir = PF_RW(pfp, ddir->next);
 	}
 
+	/* the directory is going away, nobody will look up names in it */
+	vinode_drop_dir_index(vdir);
+
 	pmemobj_tx_add_range_direct(dirdot, sizeof(dirdot->inode) + 1);
 	dirdot->name[0] = '\0';
 	dirdot->inode = TOID_NULL(struct pmemfile_inode);
@@ -109,9 +119,7 @@ vinode_unlink_dir(PMEMfilepool *pfp,
 	TX_ADD_DIRECT(nlink);
 	*nlink = 0;
 
-	pmemobj_tx_add_range_direct(dirent, sizeof(dirent->inode) + 1);
-	dirent->name[0] = '\0';
-	dirent->inode = TOID_NULL(struct pmemfile_inode);
+	vinode_remove_dirent(pfp, vparent, dirent);
 
 	inode_tx_dec_nlink(iparent);
 
@@ -206,10 +214,15 @@ pmemfile_rmdirat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 				dirent_info.vinode, path, t);
 
 		vinode_orphan(pfp, dirent_info.vinode);
+
+		vinode_shrink_dir(pfp, info.parent);
 	} TX_ONABORT {
 		error = errno;
 	} TX_END
 
+	if (!error)
+		dcache_forget(pfp, info.parent, info.remaining, namelen);
+
 vdir_end:
 	vinode_unlock2(dirent_info.vinode, info.parent);
 
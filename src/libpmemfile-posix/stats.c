@@ -35,9 +35,11 @@
  */
 
 #include "blocks.h"
+#include "dcache.h"
 #include "libpmemfile-posix.h"
 #include "out.h"
 #include "pool.h"
+#include "reclaim.h"
 #include "layout.h"
 #include "utils.h"
 
@@ -61,6 +63,14 @@ stats_header(PMEMfilepool *pfp, unsigned t, struct pmemfile_stats *stats)
 		stats->inode_arrays++;
 	else if (t == TOID_TYPE_NUM(char))
 		stats->blocks++;
+	else if (t == TOID_TYPE_NUM(struct pmemfile_block_refs) ||
+			t == TOID_TYPE_NUM(struct pmemfile_block_ref_page))
+		stats->block_refs++;
+	else if (t == TOID_TYPE_NUM(struct pmemfile_block_index))
+		stats->block_index++;
+	else if (t == TOID_TYPE_NUM(struct pmemfile_dir_hash) ||
+			t == TOID_TYPE_NUM(struct pmemfile_dir_hash_table))
+		stats->dirs++;
 	else
 		FATAL("unknown type %u", t);
 }
@@ -80,8 +90,17 @@ stats_alloc_class(PMEMfilepool *pfp, PMEMoid oid, struct pmemfile_stats *stats)
 			stats->block_arrays++;
 		else if (cmp(v, PMEMFILE_INODE_ARRAY_VERSION(0)))
 			stats->inode_arrays++;
+		else if (cmp(v, PMEMFILE_BLOCK_REFS_VERSION(0)))
+			stats->block_refs++;
+		else if (cmp(v, PMEMFILE_BLOCK_INDEX_VERSION(0)))
+			stats->block_index++;
+		else if (cmp(v, PMEMFILE_DIR_HASH_VERSION(0)) ||
+				cmp(v, PMEMFILE_DIR_HASH_TABLE_VERSION(0)))
+			stats->dirs++;
 		else
 			FATAL("unknown metadata 0x%x", v);
+	} else if (size == PMEMFILE_COMPACT_INODE_SIZE) {
+		stats->inodes++;
 	} else if (data_block_info(size, MAX_BLOCK_SIZE)->size == size) {
 		stats->blocks++;
 	} else {
@@ -101,6 +120,13 @@ pmemfile_stats(PMEMfilepool *pfp, struct pmemfile_stats *stats)
 	stats->block_arrays = 0;
 	stats->inode_arrays = 0;
 	stats->blocks = 0;
+	stats->block_refs = 0;
+	stats->block_index = 0;
+
+	/* count only objects of files which are still alive */
+	reclaim_drain(pfp);
+
+	dcache_stats(pfp, stats);
 
 	POBJ_FOREACH(pfp->pop, oid) {
 		unsigned t = (unsigned)pmemobj_type_num(oid);
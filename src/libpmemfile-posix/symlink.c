@@ -49,9 +49,10 @@ get_symlink(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
 	struct pmemfile_inode *inode = vinode->inode;
 
 	if (inode_is_longsymlink(inode))
-		symlink_target = PF_RO(pfp, inode->file_data.long_symlink);
+		symlink_target =
+			PF_RO(pfp, inode_file_data(inode)->long_symlink);
 	else
-		symlink_target = inode->file_data.short_symlink;
+		symlink_target = inode_file_data(inode)->short_symlink;
 
 	return symlink_target;
 }
@@ -116,24 +117,26 @@ _pmemfile_symlinkat(PMEMfilepool *pfp, const char *target,
 		struct pmemfile_inode *inode = PF_RW(pfp, tinode);
 		char *buf;
 
-		if (len + 1 <= sizeof(inode->file_data.short_symlink)) {
-			buf = inode->file_data.short_symlink;
+		union pmemfile_inode_data *data = inode_file_data(inode);
+
+		if (len + 1 <= inode_file_data_size(inode)) {
+			buf = data->short_symlink;
 		} else {
-			inode->file_data.long_symlink =
+			data->long_symlink =
 				TX_XALLOC(char, block_info->size,
 					POBJ_XALLOC_NO_FLUSH |
 					block_info->class_id);
 
 			inode->flags[0] |= PMEMFILE_S_LONGSYMLINK;
 
-			buf = PF_RW(pfp, inode->file_data.long_symlink);
+			buf = PF_RW(pfp, data->long_symlink);
 		}
 
 		pmemobj_memcpy_persist(pfp->pop, buf, target, len + 1);
 
 		*inode_get_size_ptr(inode) = len;
 
-		inode_add_dirent(pfp, vparent->tinode, info.remaining, namelen,
+		vinode_add_dirent(pfp, vparent, info.remaining, namelen,
 				tinode, inode_get_ctime(inode));
 	} TX_ONABORT {
 		if (errno == ENOMEM)
@@ -41,15 +41,61 @@
 #include "dir.h"
 #include "file.h"
 #include "libpmemfile-posix.h"
+#include "mmap.h"
 #include "out.h"
 #include "pool.h"
 #include "truncate.h"
 #include "utils.h"
 
+/*
+ * vinode_truncate_inline -- changes size of a file which stores its data in
+ * the inode
+ */
+static int
+vinode_truncate_inline(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t size)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+	uint64_t inode_size = inode_get_size(inode);
+
+	if (inode_size == size)
+		return 0;
+
+	int error = 0;
+
+	if (size < inode_size) {
+		error = vinode_check_leases(vinode, size, UINT64_MAX - size);
+		if (error)
+			return error;
+		vinode_revoke_mappings(pfp, vinode, size, UINT64_MAX - size);
+	} else {
+		/* bytes past the end of file are undefined */
+		pmemfile_memset_nodrain(pfp, inode->inline_data + inode_size,
+				0, size - inode_size);
+		pmemfile_drain(pfp);
+	}
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		inode_tx_set_size(inode, size);
+
+		struct pmemfile_time tm;
+		get_current_time(&tm);
+		inode_tx_set_mtime(inode, tm);
+		inode_tx_set_ctime(inode, tm);
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	return error;
+}
+
 /*
  * vinode_truncate -- changes file size to size
  *
- * Should only be called without pmemobj transaction.
+ * Should only be called without pmemobj transaction, with vinode locked by
+ * vinode_wrlock_unleased(size, UINT64_MAX - size). Detaches memory mappings
+ * from blocks which are going to be freed. Fails with EBUSY if a block which
+ * has to be unshared is borrowed, see vinode_check_leases.
  */
 int
 vinode_truncate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
@@ -59,6 +105,15 @@ vinode_truncate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 
 	ASSERT_NOT_IN_TX();
 
+	if (vinode_has_inline_data(vinode)) {
+		if (size <= pmemfile_inline_data_size)
+			return vinode_truncate_inline(pfp, vinode, size);
+
+		int err = vinode_inline_to_blocks(pfp, vinode);
+		if (err)
+			return err;
+	}
+
 	if (vinode->blocks == NULL) {
 		int err = vinode_rebuild_block_tree(pfp, vinode);
 		if (err)
@@ -67,6 +122,20 @@ vinode_truncate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 
 	int error = 0;
 
+	/* blocks of borrowed or mapped ranges can't be freed */
+	if (size < UINT64_MAX) {
+		error = vinode_check_leases(vinode, size, UINT64_MAX - size);
+		if (error)
+			return error;
+		vinode_revoke_mappings(pfp, vinode, size, UINT64_MAX - size);
+
+		/* block at the new end of file is going to be modified */
+		error = vinode_unshare_edges(pfp, vinode, size,
+				UINT64_MAX - size);
+		if (error)
+			return error;
+	}
+
 	vinode_snapshot(vinode);
 
 	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
@@ -114,9 +183,14 @@ _pmemfile_ftruncate(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
 	if (!vinode_is_regular_file(vinode))
 		return EINVAL;
 
-	os_rwlock_wrlock(&vinode->rwlock);
+	vinode_wrlock_unleased(vinode, length, UINT64_MAX - length);
 
-	int error = vinode_truncate(pfp, vinode, length);
+	int error;
+	/* block to unshare may start before length */
+	while ((error = vinode_truncate(pfp, vinode, length)) == EBUSY) {
+		vinode_unlock_wait_leases(vinode);
+		vinode_wrlock_unleased(vinode, length, UINT64_MAX - length);
+	}
 
 	os_rwlock_unlock(&vinode->rwlock);
 
@@ -36,8 +36,11 @@
 
 #include <inttypes.h>
 
+#include "alloc.h"
 #include "callbacks.h"
+#include "dcache.h"
 #include "dir.h"
+#include "inode_array.h"
 #include "libpmemfile-posix.h"
 #include "out.h"
 #include "pool.h"
@@ -70,11 +73,6 @@ vinode_unlink_file(PMEMfilepool *pfp,
 	ASSERT(*nlink > 0);
 
 	TX_ADD_DIRECT(nlink);
-	/*
-	 * Snapshot inode and the first byte of a name (because we are going
-	 * to overwrite just one byte) using one call.
-	 */
-	pmemobj_tx_add_range_direct(dirent, sizeof(dirent->inode) + 1);
 
 	if (-- *nlink > 0) {
 		/*
@@ -91,8 +89,7 @@ vinode_unlink_file(PMEMfilepool *pfp,
 	 */
 	inode_tx_set_mtime(parent->inode, tm);
 
-	dirent->name[0] = '\0';
-	dirent->inode = TOID_NULL(struct pmemfile_inode);
+	vinode_remove_dirent(pfp, parent, dirent);
 }
 
 static int
@@ -155,10 +152,16 @@ _pmemfile_unlinkat(PMEMfilepool *pfp, struct pmemfile_vinode *dir,
 
 		if (inode_get_nlink(dirent_info.vinode->inode) == 0)
 			vinode_orphan(pfp, dirent_info.vinode);
+
+		vinode_shrink_dir(pfp, info.parent);
 	} TX_ONABORT {
 		error = errno;
 	} TX_END
 
+	if (!error)
+		dcache_forget(pfp, info.parent, info.remaining,
+				component_length(info.remaining));
+
 end_vinode:
 	vinode_unlock2(dirent_info.vinode, info.parent);
 
@@ -229,3 +232,185 @@ pmemfile_unlink(PMEMfilepool *pfp, const char *pathname)
 {
 	return pmemfile_unlinkat(pfp, PMEMFILE_AT_CWD, pathname, 0);
 }
+
+/*
+ * _pmemfile_unlink_batch -- removes count entries of parent directory in one
+ * transaction
+ */
+static int
+_pmemfile_unlink_batch(PMEMfilepool *pfp, struct pmemfile_vinode *parent,
+		const char *const names[], size_t count)
+{
+	struct pmemfile_cred cred;
+	if (cred_acquire(pfp, &cred))
+		return errno;
+
+	int error = 0;
+
+	struct pmemfile_vinode **children =
+			pf_calloc(count, sizeof(*children));
+	struct pmemfile_vinode **vinodes =
+			pf_calloc(count + 5, sizeof(*vinodes));
+	/* NULL-terminated */
+	struct pmemfile_vinode **orphans =
+			pf_calloc(count + 1, sizeof(*orphans));
+	TOID(struct pmemfile_inode) *tinodes =
+			pf_calloc(count, sizeof(*tinodes));
+	struct pmemfile_inode_array **arrs = pf_calloc(count, sizeof(*arrs));
+	unsigned *idxs = pf_calloc(count, sizeof(*idxs));
+
+	if (!children || !vinodes || !orphans || !tinodes || !arrs || !idxs) {
+		error = errno;
+		goto end;
+	}
+
+	/*
+	 * lock_parent_and_many_children can race with another thread messing
+	 * with parent directory. Loop as long as race occurs.
+	 */
+	do {
+		error = lock_parent_and_many_children(pfp, parent, names, count,
+				children, vinodes);
+	} while (error == 1);
+
+	if (error < 0) {
+		error = -error;
+		goto end;
+	}
+
+	if (!_vinode_can_access(&cred, parent, PFILE_WANT_WRITE)) {
+		error = EACCES;
+		goto end_vinodes;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (vinode_is_dir(children[i])) {
+			error = EISDIR;
+			goto end_vinodes;
+		}
+	}
+
+	ASSERT_NOT_IN_TX();
+
+	struct pmemfile_time t;
+	get_current_time(&t);
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		for (size_t i = 0; i < count; ++i) {
+			struct pmemfile_dirent *dirent =
+				vinode_lookup_dirent_by_name_locked(pfp,
+					parent, names[i], strlen(names[i]));
+
+			/* the same name was passed more than once */
+			if (!dirent)
+				pmemfile_tx_abort(ENOENT);
+
+			vinode_unlink_file(pfp, parent, dirent, children[i],
+					t);
+		}
+
+		/* "vinodes" holds every unlinked inode only once */
+		size_t norphans = 0;
+		for (size_t i = 0; vinodes[i]; ++i) {
+			struct pmemfile_vinode *v = vinodes[i];
+
+			if (v == parent || inode_get_nlink(v->inode) > 0 ||
+					v->inode->suspended_references > 0)
+				continue;
+
+			orphans[norphans] = v;
+			tinodes[norphans] = v->tinode;
+			norphans++;
+		}
+
+		inode_array_add_many(pfp, inode_orphan_array(pfp),
+				tinodes, norphans, arrs, idxs);
+
+		vinode_shrink_dir(pfp, parent);
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	if (!error) {
+		for (size_t i = 0; orphans[i]; ++i) {
+			ASSERTeq(orphans[i]->orphaned.arr, NULL);
+			orphans[i]->orphaned.arr = arrs[i];
+			orphans[i]->orphaned.idx = idxs[i];
+		}
+
+		for (size_t i = 0; i < count; ++i)
+			dcache_forget(pfp, parent, names[i], strlen(names[i]));
+	}
+
+end_vinodes:
+	vinode_unlockN(vinodes);
+
+	for (size_t i = 0; i < count; ++i)
+		vinode_unref(pfp, children[i]);
+
+end:
+	pf_free(idxs);
+	pf_free(arrs);
+	pf_free(tinodes);
+	pf_free(orphans);
+	pf_free(vinodes);
+	pf_free(children);
+	cred_release(&cred);
+
+	return error;
+}
+
+/*
+ * pmemfile_unlink_batch -- removes count entries of directory dir, which must
+ * not be directories, all or none of them
+ *
+ * Not in POSIX.
+ */
+int
+pmemfile_unlink_batch(PMEMfilepool *pfp, PMEMfile *dir,
+		const char *const names[], size_t count)
+{
+	if (!pfp) {
+		LOG(LUSR, "NULL pool");
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!dir || !names) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (count == 0)
+		return 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!names[i]) {
+			errno = EFAULT;
+			return -1;
+		}
+
+		if (names[i][0] == 0 || strchr(names[i], '/')) {
+			LOG(LUSR, "invalid name %s", names[i]);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	struct pmemfile_vinode *at;
+	bool at_unref;
+
+	at = pool_get_dir_for_path(pfp, dir, names[0], &at_unref);
+
+	int error = _pmemfile_unlink_batch(pfp, at, names, count);
+
+	if (at_unref)
+		vinode_unref(pfp, at);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
@@ -84,6 +84,22 @@ str_compare(const char *s1, const char *s2, size_t s2n)
 	return 0;
 }
 
+/*
+ * str_hash -- returns FNV-1a hash of a string of specified length
+ */
+uint64_t
+str_hash(const char *str, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
 /*
  * str_contains -- returns true if string contains specified character in first
  * len bytes
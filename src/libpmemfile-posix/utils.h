@@ -33,6 +33,8 @@
 #ifndef PMEMFILE_UTILS_H
 #define PMEMFILE_UTILS_H
 
+#include <string.h>
+
 #include "inode.h"
 #include "layout.h"
 #include "libpmemfile-posix.h"
@@ -50,6 +52,41 @@ pmemfile_drain(PMEMfilepool *pfp)
 	pmemobj_drain(pfp->pop);
 }
 
+/*
+ * pmemfile_memcpy_nodrain -- copies data to pmem and flushes it, without
+ * waiting for it to reach the medium; caller has to call pmemfile_drain
+ *
+ * libpmemobj >= 1.4 can do it using non-temporal stores, which don't pollute
+ * CPU caches and don't need separate flushing.
+ */
+static inline void
+pmemfile_memcpy_nodrain(PMEMfilepool *pfp, void *dest, const void *src,
+		size_t len)
+{
+#ifdef PMEMOBJ_F_MEM_NODRAIN
+	pmemobj_memcpy(pfp->pop, dest, src, len,
+			PMEMOBJ_F_MEM_NODRAIN | PMEMOBJ_F_MEM_NONTEMPORAL);
+#else
+	memcpy(dest, src, len);
+	pmemobj_flush(pfp->pop, dest, len);
+#endif
+}
+
+/*
+ * pmemfile_memset_nodrain -- memset variant of pmemfile_memcpy_nodrain
+ */
+static inline void
+pmemfile_memset_nodrain(PMEMfilepool *pfp, void *dest, int c, size_t len)
+{
+#ifdef PMEMOBJ_F_MEM_NODRAIN
+	pmemobj_memset(pfp->pop, dest, c, len,
+			PMEMOBJ_F_MEM_NODRAIN | PMEMOBJ_F_MEM_NONTEMPORAL);
+#else
+	memset(dest, c, len);
+	pmemobj_flush(pfp->pop, dest, len);
+#endif
+}
+
 static inline pf_noreturn void
 pmemfile_tx_abort(int err)
 {
@@ -70,6 +107,7 @@ void get_current_time(struct pmemfile_time *t);
 bool is_zeroed(const void *addr, size_t len);
 
 int str_compare(const char *s1, const char *s2, size_t s2n);
+uint64_t str_hash(const char *str, size_t len);
 bool str_contains(const char *str, size_t len, char c);
 bool more_than_1_component(const char *path);
 size_t component_length(const char *path);
@@ -174,6 +174,22 @@ VERIFY(UTIME_OMIT);
 
 VERIFY(MAP_FAILED);
 
+VERIFY(PROT_NONE);
+VERIFY(PROT_READ);
+VERIFY(PROT_WRITE);
+VERIFY(PROT_EXEC);
+
+VERIFY(MAP_SHARED);
+VERIFY(MAP_PRIVATE);
+VERIFY(MAP_FIXED);
+
+VERIFY(MS_ASYNC);
+VERIFY(MS_INVALIDATE);
+VERIFY(MS_SYNC);
+
+VERIFY(MREMAP_MAYMOVE);
+VERIFY(MREMAP_FIXED);
+
 VERIFY(CAP_FOWNER);
 VERIFY(CAP_CHOWN);
 VERIFY(CAP_FSETID);
@@ -73,6 +73,78 @@ vinode_write(PMEMfilepool *pfp, struct pmemfile_vinode *vinode, size_t offset,
 		*last_block = block;
 }
 
+/*
+ * pmemfile_iov_len -- returns number of bytes that can be written from iov
+ * starting at offset
+ */
+static size_t
+pmemfile_iov_len(size_t offset, const pmemfile_iovec_t *iov, int iovcnt)
+{
+	size_t sum_len = 0;
+	for (int i = 0; i < iovcnt; ++i) {
+		size_t len = iov[i].iov_len;
+
+		if ((pmemfile_ssize_t)len < 0)
+			len = SSIZE_MAX;
+
+		if ((pmemfile_ssize_t)(sum_len + len) < 0)
+			len = SSIZE_MAX - sum_len;
+
+		/* overflow check */
+		if (offset + sum_len + len < offset)
+			len = SIZE_MAX - offset - sum_len;
+
+		sum_len += len;
+
+		if (len != iov[i].iov_len)
+			break;
+	}
+
+	return sum_len;
+}
+
+/*
+ * vinode_write_iov -- copies data from iov to the file starting at offset
+ * All blocks needed for writing must be already allocated. Data is not
+ * drained.
+ */
+static size_t
+vinode_write_iov(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc **last_block, size_t offset,
+		const pmemfile_iovec_t *iov, int iovcnt)
+{
+	size_t ret = 0;
+
+	/*
+	 * Data is only flushed here. The caller issues one fence for
+	 * the whole write.
+	 */
+	for (int i = 0; i < iovcnt; ++i) {
+		size_t len = iov[i].iov_len;
+
+		if ((pmemfile_ssize_t)len < 0)
+			len = SSIZE_MAX;
+
+		if ((pmemfile_ssize_t)(ret + len) < 0)
+			len = SSIZE_MAX - ret;
+
+		if (offset + len < offset) /* overflow check */
+			len = SIZE_MAX - offset;
+
+		if (len > 0)
+			vinode_write(pfp, vinode, offset, last_block,
+					iov[i].iov_base, len);
+
+		ret += len;
+		offset += len;
+
+		if (len != iov[i].iov_len)
+			break;
+	}
+
+	return ret;
+}
+
 /*
  * pmemfile_pwritev_args_check - checks some write arguments
  * The arguments here can be examined while holding the mutex for the
@@ -151,6 +223,34 @@ pmemfile_allocate_space(PMEMfilepool *pfp,
 	return error;
 }
 
+/*
+ * vinode_start_inline_data -- makes an empty file without blocks store its
+ * data in the inode
+ */
+static int
+vinode_start_inline_data(PMEMfilepool *pfp, struct pmemfile_vinode *vinode)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+	int error = 0;
+
+	TX_BEGIN_CB(pfp->pop, cb_queue, pfp) {
+		inode_tx_set_flags(inode, inode_get_flags(inode) |
+				PMEMFILE_S_INLINE_DATA);
+
+		/*
+		 * Bump inode version, so the inode can't be opened by versions
+		 * of the library which would look for data in blocks.
+		 */
+		if (inode->version < PMEMFILE_INODE_VERSION(5))
+			TX_SET_DIRECT(inode, version,
+					PMEMFILE_INODE_VERSION(5));
+	} TX_ONABORT {
+		error = errno;
+	} TX_END
+
+	return error;
+}
+
 static pmemfile_ssize_t
 pmemfile_pwritev_internal(PMEMfilepool *pfp,
 		struct pmemfile_vinode *vinode,
@@ -177,30 +277,37 @@ pmemfile_pwritev_internal(PMEMfilepool *pfp,
 	if (file_flags & PFILE_APPEND)
 		offset = inode_get_size(inode);
 
-	size_t sum_len = 0;
-	for (int i = 0; i < iovcnt; ++i) {
-		size_t len = iov[i].iov_len;
-
-		if ((pmemfile_ssize_t)len < 0)
-			len = SSIZE_MAX;
-
-		if ((pmemfile_ssize_t)(sum_len + len) < 0)
-			len = SSIZE_MAX - sum_len;
-
-		/* overflow check */
-		if (offset + sum_len + len < offset)
-			len = SIZE_MAX - offset - sum_len;
-
-		sum_len += len;
-
-		if (len != iov[i].iov_len)
-			break;
-	}
-
+	size_t sum_len = pmemfile_iov_len(offset, iov, iovcnt);
 	if (sum_len == 0)
 		return 0;
 
-	if (!vinode_is_interval_allocated(pfp, vinode, offset, sum_len,
+	/*
+	 * Small files keep their data in the inode until they grow past
+	 * pmemfile_inline_data_size.
+	 */
+	bool inline_data = offset + sum_len <= pmemfile_inline_data_size;
+	if (vinode_has_inline_data(vinode)) {
+		if (!inline_data)
+			error = vinode_inline_to_blocks(pfp, vinode);
+	} else if (inline_data) {
+		/* compact inodes have no room for inline data */
+		if (inode_get_size(inode) == 0 &&
+				inode_get_allocated_space(inode) == 0 &&
+				!inode_is_compact(inode))
+			error = vinode_start_inline_data(pfp, vinode);
+		else
+			inline_data = false;
+	}
+	if (error)
+		goto end;
+
+	if (inline_data) {
+		/* bytes past the end of file are undefined, holes are not */
+		uint64_t size = inode_get_size(inode);
+		if (offset > size)
+			pmemfile_memset_nodrain(pfp, inode->inline_data + size,
+					0, offset - size);
+	} else if (!vinode_is_interval_allocated(pfp, vinode, offset, sum_len,
 			*last_block)) {
 		error = pmemfile_allocate_space(pfp, vinode, offset, sum_len,
 				true);
@@ -224,6 +331,13 @@ pmemfile_pwritev_internal(PMEMfilepool *pfp,
 	if (error)
 		goto end;
 
+	/* copy on write of blocks shared with other files */
+	if (!inline_data && vinode->has_shared_blocks) {
+		error = vinode_unshare_interval(pfp, vinode, offset, sum_len);
+		if (error)
+			goto end;
+	}
+
 	struct pmemfile_time tm;
 	get_current_time(&tm);
 
@@ -246,34 +360,9 @@ pmemfile_pwritev_internal(PMEMfilepool *pfp,
 	 */
 	pmemfile_persist(pfp, &inode->slots);
 
-	/*
-	 * Now write the data. It uses pmemobj_memcpy_persist, which has
-	 * a built-in fence. We actually don't need its fence here, but there's
-	 * no way to opt out of it without introducing new API to pmemobj.
-	 */
-	for (int i = 0; i < iovcnt; ++i) {
-		size_t len = iov[i].iov_len;
-
-		if ((pmemfile_ssize_t)len < 0)
-			len = SSIZE_MAX;
-
-		if ((pmemfile_ssize_t)(ret + len) < 0)
-			len = SSIZE_MAX - ret;
-
-		if (offset + len < offset) /* overflow check */
-			len = SIZE_MAX - offset;
-
-		if (len > 0)
-			vinode_write(pfp, vinode, offset, last_block,
-					iov[i].iov_base, len);
-
-		ret += len;
-		offset += len;
-
-		if (len != iov[i].iov_len)
-			break;
-	}
+	ret = vinode_write_iov(pfp, vinode, last_block, offset, iov, iovcnt);
 	ASSERT(ret > 0);
+	offset += ret;
 
 	struct pmemfile_time starttm = tm;
 	get_current_time(&tm);
@@ -332,8 +421,8 @@ pmemfile_pwritev_internal(PMEMfilepool *pfp,
 		}
 
 		/*
-		 * We will update slot info now, so all slots must be on
-		 * the medium. Issue sfence to wait for that.
+		 * We will update slot info now, so all slots and all written
+		 * data must be on the medium. Issue sfence to wait for that.
 		 */
 		pmemfile_drain(pfp);
 
@@ -350,9 +439,11 @@ pmemfile_pwritev_internal(PMEMfilepool *pfp,
 		__atomic_store_n(&inode->slots.value, slots.value,
 				__ATOMIC_RELAXED);
 		pmemfile_persist(pfp, &inode->slots);
+	} else {
+		/* Data must be on the medium before we return. */
+		pmemfile_drain(pfp);
 	}
 
-
 end:
 	if (error) {
 		errno = error;
@@ -362,6 +453,164 @@ end:
 	return (pmemfile_ssize_t)ret;
 }
 
+/*
+ * Resolution of mtime updates done by writes which don't modify any other
+ * metadata. Such writes skip updating mtime if it was updated less than that
+ * many nanoseconds ago, which allows them to run without the exclusive
+ * vinode lock.
+ */
+#define PMEMFILE_MTIME_GRANULARITY 1000000
+
+/*
+ * pmemfile_can_write_in_place -- returns true if write to
+ * [offset, offset + len) can be done without modifying any metadata
+ *
+ * Must be called with vinode lock held at least in read mode.
+ */
+static bool
+pmemfile_can_write_in_place(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		struct pmemfile_block_desc *last_block, size_t offset,
+		size_t len)
+{
+	struct pmemfile_inode *inode = vinode->inode;
+
+	/* block tree can be rebuilt only under exclusive lock */
+	if (!vinode->blocks)
+		return false;
+
+	/* size update */
+	if (offset + len > inode_get_size(inode))
+		return false;
+
+	struct pmemfile_time tm;
+	get_current_time(&tm);
+	struct pmemfile_time mtime = *inode_get_mtime_ptr(inode);
+
+	int64_t tm_diff = (tm.sec - mtime.sec) * 1000000000 +
+			tm.nsec - mtime.nsec;
+
+	/* mtime update, also when stored mtime is in the future */
+	if (tm_diff < 0 || tm_diff >= PMEMFILE_MTIME_GRANULARITY)
+		return false;
+
+	/* data stored in the inode is overwritten in place */
+	if (vinode_has_inline_data(vinode))
+		return true;
+
+	/*
+	 * Block allocation or zeroing of uninitialized parts of blocks,
+	 * which may be outside of the range we are going to lock.
+	 */
+	return vinode_is_interval_initialized(pfp, vinode, offset, len,
+			last_block);
+}
+
+/*
+ * vinode_pwritev -- writes to a file, taking the vinode lock in
+ * the weakest mode sufficient for this write
+ *
+ * Writes which fit in already allocated and initialized space of the file and
+ * don't need to update size or mtime take the vinode lock in read mode and
+ * lock only the byte range they modify, so writers to disjoint parts of
+ * the file can run in parallel. All other writes take the vinode lock in
+ * write mode.
+ *
+ * last_bp_iv_obs is the value of block_pointer_invalidation_counter
+ * observed when *last_block was cached. Both are updated by this function.
+ */
+static pmemfile_ssize_t
+vinode_pwritev(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		uint64_t *last_bp_iv_obs,
+		struct pmemfile_block_desc **last_block,
+		uint64_t file_flags,
+		size_t offset,
+		const pmemfile_iovec_t *iov,
+		int iovcnt)
+{
+	pmemfile_ssize_t ret;
+	size_t len = pmemfile_iov_len(offset, iov, iovcnt);
+
+	if (!(file_flags & PFILE_APPEND) && len > 0) {
+		os_rwlock_rdlock(&vinode->rwlock);
+
+		if (*last_bp_iv_obs !=
+				vinode->block_pointer_invalidation_counter) {
+			*last_block = NULL;
+			*last_bp_iv_obs =
+				vinode->block_pointer_invalidation_counter;
+		}
+
+		if (pmemfile_can_write_in_place(pfp, vinode, *last_block,
+				offset, len)) {
+			struct range_lock_entry range;
+			range_lock_lock(&vinode->range_lock, &range, offset,
+					len);
+
+			ret = (pmemfile_ssize_t)vinode_write_iov(pfp, vinode,
+					last_block, offset, iov, iovcnt);
+			pmemfile_drain(pfp);
+
+			range_lock_unlock(&vinode->range_lock, &range);
+			os_rwlock_unlock(&vinode->rwlock);
+
+			return ret;
+		}
+
+		os_rwlock_unlock(&vinode->rwlock);
+	}
+
+	os_rwlock_wrlock(&vinode->rwlock);
+
+	while (true) {
+		if (*last_bp_iv_obs !=
+				vinode->block_pointer_invalidation_counter) {
+			*last_block = NULL;
+			*last_bp_iv_obs =
+				vinode->block_pointer_invalidation_counter;
+		}
+
+		ret = pmemfile_pwritev_internal(pfp, vinode, last_block,
+				file_flags, offset, iov, iovcnt);
+		if (ret >= 0 || errno != EBUSY)
+			break;
+
+		/* block which has to be unshared is borrowed */
+		vinode_unlock_wait_leases(vinode);
+		os_rwlock_wrlock(&vinode->rwlock);
+	}
+
+	os_rwlock_unlock(&vinode->rwlock);
+
+	return ret;
+}
+
+/*
+ * vinode_pwritev_locked -- writes iov to a file at offset, vinode must be
+ * locked in write mode
+ */
+pmemfile_ssize_t
+vinode_pwritev_locked(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		size_t offset, const pmemfile_iovec_t *iov, int iovcnt)
+{
+	struct pmemfile_block_desc *last_block = NULL;
+
+	return pmemfile_pwritev_internal(pfp, vinode, &last_block, 0, offset,
+			iov, iovcnt);
+}
+
+/*
+ * vinode_pwrite_locked -- writes count bytes from buf to a file at offset,
+ * vinode must be locked in write mode
+ */
+pmemfile_ssize_t
+vinode_pwrite_locked(PMEMfilepool *pfp, struct pmemfile_vinode *vinode,
+		size_t offset, const void *buf, size_t count)
+{
+	pmemfile_iovec_t iov = { .iov_base = (void *)buf, .iov_len = count };
+
+	return vinode_pwritev_locked(pfp, vinode, offset, &iov, 1);
+}
+
 /*
  * pmemfile_write - same as pmemfile_writev with a single iov buffer
  */
@@ -395,25 +644,14 @@ pmemfile_writev_under_filelock(PMEMfilepool *pfp, PMEMfile *file,
 	if (iovcnt == 0)
 		return 0;
 
-	os_rwlock_wrlock(&file->vinode->rwlock);
-
-	if (file->last_block_pointer_invalidation_observed !=
-			file->vinode->block_pointer_invalidation_counter) {
-		file->block_pointer_cache = NULL;
-		file->last_block_pointer_invalidation_observed =
-			file->vinode->block_pointer_invalidation_counter;
-	}
-
 	last_block = file->block_pointer_cache;
 
-	ret = pmemfile_pwritev_internal(pfp,
-					file->vinode,
-					&last_block,
-					file->flags,
-					file->offset, iov, iovcnt);
-
-
-	os_rwlock_unlock(&file->vinode->rwlock);
+	ret = vinode_pwritev(pfp,
+			file->vinode,
+			&file->last_block_pointer_invalidation_observed,
+			&last_block,
+			file->flags,
+			file->offset, iov, iovcnt);
 
 	if (ret > 0) {
 		file->offset += (size_t)ret;
@@ -569,7 +807,6 @@ pmemfile_pwritev(PMEMfilepool *pfp, PMEMfile *file, const pmemfile_iovec_t *iov,
 	if (iovcnt == 0)
 		return 0;
 
-	os_rwlock_wrlock(&file->vinode->rwlock);
 	/*
 	 * Using the variables last_bp_iv_obs, last_block, and flags, which
 	 * serve to represent the state in which the PMEMfile instance was
@@ -578,14 +815,6 @@ pmemfile_pwritev(PMEMfilepool *pfp, PMEMfile *file, const pmemfile_iovec_t *iov,
 	 * lifetime of the instance, so there is no need to work with a copy of
 	 * that field.
 	 */
-
-	if (last_bp_iv_obs != file->vinode->block_pointer_invalidation_counter)
-		last_block = NULL;
-
-	ret = pmemfile_pwritev_internal(pfp, file->vinode, &last_block, flags,
-		(size_t)offset, iov, iovcnt);
-
-	os_rwlock_unlock(&file->vinode->rwlock);
-
-	return ret;
+	return vinode_pwritev(pfp, file->vinode, &last_bp_iv_obs, &last_block,
+			flags, (size_t)offset, iov, iovcnt);
 }
@@ -75,6 +75,30 @@ wrapper_pmemfile_pool_create(const char *pathname,
 	return ret;
 }
 
+static inline PMEMfilepool *
+wrapper_pmemfile_pool_create_ex(const char *pathname,
+		size_t poolsize,
+		pmemfile_mode_t mode,
+		size_t inode_size)
+{
+	PMEMfilepool *ret;
+
+	ret = pmemfile_pool_create_ex(pathname,
+		poolsize,
+		mode,
+		inode_size);
+
+	log_write(
+	    "pmemfile_pool_create_ex(\"%s\", %zu, %3jo, %zu) = %p",
+		pathname,
+		poolsize,
+		(uintmax_t)mode,
+		inode_size,
+		ret);
+
+	return ret;
+}
+
 static inline PMEMfilepool *
 wrapper_pmemfile_pool_open(const char *pathname)
 {
@@ -155,6 +179,38 @@ wrapper_pmemfile_create(PMEMfilepool *pfp,
 	return ret;
 }
 
+static inline int
+wrapper_pmemfile_create_batch(PMEMfilepool *pfp,
+		PMEMfile *dir,
+		const char *const *names,
+		const pmemfile_mode_t *modes,
+		PMEMfile **out,
+		size_t count)
+{
+	int ret;
+
+	ret = pmemfile_create_batch(pfp,
+		dir,
+		names,
+		modes,
+		out,
+		count);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_create_batch(%p, %p, %p, %p, %p, %zu) = %d",
+		pfp,
+		dir,
+		names,
+		modes,
+		out,
+		count,
+		ret);
+
+	return ret;
+}
+
 static inline void
 wrapper_pmemfile_close(PMEMfilepool *pfp,
 		PMEMfile *file)
@@ -243,6 +299,32 @@ wrapper_pmemfile_unlink(PMEMfilepool *pfp,
 	return ret;
 }
 
+static inline int
+wrapper_pmemfile_unlink_batch(PMEMfilepool *pfp,
+		PMEMfile *dir,
+		const char *const *names,
+		size_t count)
+{
+	int ret;
+
+	ret = pmemfile_unlink_batch(pfp,
+		dir,
+		names,
+		count);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_unlink_batch(%p, %p, %p, %zu) = %d",
+		pfp,
+		dir,
+		names,
+		count,
+		ret);
+
+	return ret;
+}
+
 static inline int
 wrapper_pmemfile_unlinkat(PMEMfilepool *pfp,
 		PMEMfile *dir,
@@ -463,6 +545,54 @@ wrapper_pmemfile_preadv(PMEMfilepool *pfp,
 	return ret;
 }
 
+static inline pmemfile_ssize_t
+wrapper_pmemfile_pread_borrow(PMEMfilepool *pfp,
+		PMEMfile *file,
+		size_t count,
+		pmemfile_off_t offset,
+		pmemfile_iovec_t *iov,
+		int *iovcnt,
+		PMEMfilelease **lease)
+{
+	pmemfile_ssize_t ret;
+
+	ret = pmemfile_pread_borrow(pfp,
+		file,
+		count,
+		offset,
+		iov,
+		iovcnt,
+		lease);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_pread_borrow(%p, %p, %zu, %jx, %p, %p, %p) = %zd",
+		pfp,
+		file,
+		count,
+		(uintmax_t)offset,
+		iov,
+		iovcnt,
+		lease,
+		ret);
+
+	return ret;
+}
+
+static inline void
+wrapper_pmemfile_pread_release(PMEMfilepool *pfp,
+		PMEMfilelease *lease)
+{
+	log_write(
+	    "pmemfile_pread_release(%p, %p)",
+		pfp,
+		lease);
+
+	pmemfile_pread_release(pfp,
+		lease);
+}
+
 static inline pmemfile_ssize_t
 wrapper_pmemfile_write(PMEMfilepool *pfp,
 		PMEMfile *file,
@@ -1875,131 +2005,6 @@ wrapper_pmemfile_posix_fallocate(PMEMfilepool *pfp,
 	return ret;
 }
 
-static inline char *
-wrapper_pmemfile_get_dir_path(PMEMfilepool *pfp,
-		PMEMfile *dir,
-		char *buf,
-		size_t size)
-{
-	char *ret;
-
-	ret = pmemfile_get_dir_path(pfp,
-		dir,
-		buf,
-		size);
-
-	log_write(
-	    "pmemfile_get_dir_path(%p, %p, %p, %zu) = %p",
-		pfp,
-		dir,
-		buf,
-		size,
-		ret);
-
-	return ret;
-}
-
-static inline PMEMfile *
-wrapper_pmemfile_open_parent(PMEMfilepool *pfp,
-		PMEMfile *at,
-		char *path,
-		size_t path_size,
-		int flags)
-{
-	PMEMfile *ret;
-
-	ret = pmemfile_open_parent(pfp,
-		at,
-		path,
-		path_size,
-		flags);
-
-	log_write(
-	    "pmemfile_open_parent(%p, %p, %p, %zu, %d) = %p",
-		pfp,
-		at,
-		path,
-		path_size,
-		flags,
-		ret);
-
-	return ret;
-}
-
-static inline const char *
-wrapper_pmemfile_errormsg(void)
-{
-	const char *ret;
-
-	ret = pmemfile_errormsg();
-
-	log_write(
-	    "pmemfile_errormsg() = %p",
-		ret);
-
-	return ret;
-}
-
-static inline int
-wrapper_pmemfile_pool_resume(PMEMfilepool *pfp,
-		const char *pathname)
-{
-	int ret;
-
-	ret = pmemfile_pool_resume(pfp,
-		pathname);
-	if (ret < 0)
-		ret = -errno;
-
-	log_write(
-	    "pmemfile_pool_resume(%p, \"%s\") = %d",
-		pfp,
-		pathname,
-		ret);
-
-	return ret;
-}
-
-static inline int
-wrapper_pmemfile_pool_suspend(PMEMfilepool *pfp)
-{
-	int ret;
-
-	ret = pmemfile_pool_suspend(pfp);
-	if (ret < 0)
-		ret = -errno;
-
-	log_write(
-	    "pmemfile_pool_suspend(%p) = %d",
-		pfp,
-		ret);
-
-	return ret;
-}
-
-static inline int
-wrapper_pmemfile_flock(PMEMfilepool *pfp,
-		PMEMfile *file,
-		int operation)
-{
-	int ret;
-
-	ret = pmemfile_flock(pfp,
-		file,
-		operation);
-	if (ret < 0)
-		ret = -errno;
-
-	log_write(
-	    "pmemfile_flock(%p, %p, %d) = %d",
-		pfp,
-		file,
-		operation,
-		ret);
-
-	return ret;
-}
-
 static inline void *
 wrapper_pmemfile_mmap(PMEMfilepool *pfp,
 		void *addr,
@@ -2173,6 +2178,206 @@ wrapper_pmemfile_copy_file_range(PMEMfilepool *pfp,
 	return ret;
 }
 
+static inline int
+wrapper_pmemfile_defrag(PMEMfilepool *pfp,
+		PMEMfile *file,
+		pmemfile_off_t offset,
+		pmemfile_off_t length)
+{
+	int ret;
+
+	ret = pmemfile_defrag(pfp,
+		file,
+		offset,
+		length);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_defrag(%p, %p, %jx, %jx) = %d",
+		pfp,
+		file,
+		(uintmax_t)offset,
+		(uintmax_t)length,
+		ret);
+
+	return ret;
+}
+
+static inline pmemfile_ssize_t
+wrapper_pmemfile_fiemap(PMEMfilepool *pfp,
+		PMEMfile *file,
+		pmemfile_off_t offset,
+		pmemfile_off_t length,
+		struct pmemfile_extent *extents,
+		size_t count)
+{
+	pmemfile_ssize_t ret;
+
+	ret = pmemfile_fiemap(pfp,
+		file,
+		offset,
+		length,
+		extents,
+		count);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_fiemap(%p, %p, %jx, %jx, %p, %zu) = %zd",
+		pfp,
+		file,
+		(uintmax_t)offset,
+		(uintmax_t)length,
+		extents,
+		count,
+		ret);
+
+	return ret;
+}
+
+static inline char *
+wrapper_pmemfile_get_dir_path(PMEMfilepool *pfp,
+		PMEMfile *dir,
+		char *buf,
+		size_t size)
+{
+	char *ret;
+
+	ret = pmemfile_get_dir_path(pfp,
+		dir,
+		buf,
+		size);
+
+	log_write(
+	    "pmemfile_get_dir_path(%p, %p, %p, %zu) = %p",
+		pfp,
+		dir,
+		buf,
+		size,
+		ret);
+
+	return ret;
+}
+
+static inline PMEMfile *
+wrapper_pmemfile_open_parent(PMEMfilepool *pfp,
+		PMEMfile *at,
+		char *path,
+		size_t path_size,
+		int flags)
+{
+	PMEMfile *ret;
+
+	ret = pmemfile_open_parent(pfp,
+		at,
+		path,
+		path_size,
+		flags);
+
+	log_write(
+	    "pmemfile_open_parent(%p, %p, %p, %zu, %d) = %p",
+		pfp,
+		at,
+		path,
+		path_size,
+		flags,
+		ret);
+
+	return ret;
+}
+
+static inline const char *
+wrapper_pmemfile_errormsg(void)
+{
+	const char *ret;
+
+	ret = pmemfile_errormsg();
+
+	log_write(
+	    "pmemfile_errormsg() = %p",
+		ret);
+
+	return ret;
+}
+
+static inline int
+wrapper_pmemfile_pool_resume(PMEMfilepool *pfp,
+		const char *pathname)
+{
+	int ret;
+
+	ret = pmemfile_pool_resume(pfp,
+		pathname);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_pool_resume(%p, \"%s\") = %d",
+		pfp,
+		pathname,
+		ret);
+
+	return ret;
+}
+
+static inline int
+wrapper_pmemfile_pool_suspend(PMEMfilepool *pfp)
+{
+	int ret;
+
+	ret = pmemfile_pool_suspend(pfp);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_pool_suspend(%p) = %d",
+		pfp,
+		ret);
+
+	return ret;
+}
+
+static inline int
+wrapper_pmemfile_pool_reclaim(PMEMfilepool *pfp)
+{
+	int ret;
+
+	ret = pmemfile_pool_reclaim(pfp);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_pool_reclaim(%p) = %d",
+		pfp,
+		ret);
+
+	return ret;
+}
+
+static inline int
+wrapper_pmemfile_flock(PMEMfilepool *pfp,
+		PMEMfile *file,
+		int operation)
+{
+	int ret;
+
+	ret = pmemfile_flock(pfp,
+		file,
+		operation);
+	if (ret < 0)
+		ret = -errno;
+
+	log_write(
+	    "pmemfile_flock(%p, %p, %d) = %d",
+		pfp,
+		file,
+		operation,
+		ret);
+
+	return ret;
+}
+
 static inline int
 wrapper_pmemfile_mknodat(PMEMfilepool *pfp,
 		PMEMfile *dir,
@@ -56,6 +56,8 @@
 #include <setjmp.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -63,6 +65,7 @@
 #include <stdio.h>
 #include <limits.h>
 #include <linux/fs.h>
+#include <linux/fiemap.h>
 #include <utime.h>
 #include <sys/fsuid.h>
 #include <sys/capability.h>
@@ -1060,19 +1063,349 @@ hook_fchownat(int fd, const char *path,
 	return ret;
 }
 
+/* maximum number of bytes moved by one write in transfer_data */
+#define TRANSFER_CHUNK_SIZE ((size_t)1 << 20)
+
+#define TRANSFER_IOV_COUNT 64
+
+/*
+ * pipe_space -- returns number of bytes which can be written to fd without
+ * blocking if it's a pipe, SIZE_MAX otherwise
+ */
+static size_t
+pipe_space(int fd)
+{
+	struct stat st;
+	int used;
+
+	if (syscall_no_intercept(SYS_fstat, fd, &st) != 0 ||
+			!S_ISFIFO(st.st_mode))
+		return SIZE_MAX;
+
+	long size = syscall_no_intercept(SYS_fcntl, fd, F_GETPIPE_SZ);
+	if (size <= 0 || syscall_no_intercept(SYS_ioctl, fd, FIONREAD,
+			&used) != 0)
+		return PIPE_BUF;
+
+	/* wait for some space in a full pipe, like splice does */
+	if (used >= size)
+		return PIPE_BUF;
+
+	return (size_t)(size - used);
+}
+
+/*
+ * transfer_from_pmemfile -- moves up to count bytes of a pmemfile file
+ * starting at *off_in to out
+ *
+ * Data is written straight from the pool, using pointers borrowed with
+ * pmemfile_pread_borrow. A kernel out must not have an offset.
+ */
+static long
+transfer_from_pmemfile(struct vfd_reference *in, pmemfile_off_t *off_in,
+		struct vfd_reference *out, loff_t *off_out, size_t count)
+{
+	pmemfile_iovec_t iov[TRANSFER_IOV_COUNT];
+	size_t done = 0;
+	long ret = 0;
+
+	/* a write of more than fits into a pipe would wait for its reader */
+	if (out->pool == NULL) {
+		size_t space = pipe_space(out->kernel_fd);
+		if (count > space)
+			count = space;
+	}
+
+	while (done < count) {
+		int iovcnt = TRANSFER_IOV_COUNT;
+		PMEMfilelease *lease;
+
+		ret = wrapper_pmemfile_pread_borrow(in->pool->pool, in->file,
+				count - done, *off_in, iov, &iovcnt, &lease);
+		if (ret <= 0)
+			break;
+
+		long len = ret;
+
+		if (out->pool == NULL) {
+			ret = syscall_no_intercept(SYS_writev, out->kernel_fd,
+					iov, iovcnt);
+		} else if (off_out == NULL) {
+			ret = wrapper_pmemfile_writev(out->pool->pool,
+					out->file, iov, iovcnt);
+		} else {
+			ret = wrapper_pmemfile_pwritev(out->pool->pool,
+					out->file, iov, iovcnt, *off_out);
+		}
+
+		wrapper_pmemfile_pread_release(in->pool->pool, lease);
+
+		if (ret <= 0)
+			break;
+
+		done += (size_t)ret;
+		*off_in += ret;
+		if (off_out)
+			*off_out += ret;
+
+		/* e.g. a full non-blocking pipe */
+		if (ret < len)
+			break;
+	}
+
+	if (done > 0)
+		return (long)done;
+
+	return ret;
+}
+
+/*
+ * transfer_to_pmemfile -- moves up to count bytes from a kernel fd to
+ * a pmemfile file
+ *
+ * If the source is a regular file, the destination range is allocated up
+ * front, so that data is streamed into blocks allocated in one transaction.
+ */
+static long
+transfer_to_pmemfile(int in_fd, loff_t *off_in, struct vfd_reference *out,
+		loff_t *off_out, size_t count)
+{
+	struct stat st;
+
+	if (syscall_no_intercept(SYS_fstat, in_fd, &st) == 0 &&
+			S_ISREG(st.st_mode)) {
+		loff_t pos = off_in ? *off_in :
+			syscall_no_intercept(SYS_lseek, in_fd, 0, SEEK_CUR);
+		loff_t dst = off_out ? *off_out :
+			wrapper_pmemfile_lseek(out->pool->pool, out->file, 0,
+					PMEMFILE_SEEK_CUR);
+
+		if (pos >= 0 && dst >= 0 && pos < st.st_size) {
+			size_t len = (size_t)(st.st_size - pos);
+			if (len > count)
+				len = count;
+
+			/* only an optimization, errors are reported by write */
+			(void) wrapper_pmemfile_fallocate(out->pool->pool,
+					out->file, PMEMFILE_FALLOC_FL_KEEP_SIZE,
+					dst, (pmemfile_off_t)len);
+		}
+	}
+
+	size_t buf_size = count < TRANSFER_CHUNK_SIZE ?
+			count : TRANSFER_CHUNK_SIZE;
+	char *buf = malloc(buf_size);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	size_t done = 0;
+	long ret = 0;
+
+	while (done < count) {
+		size_t len = count - done;
+		if (len > buf_size)
+			len = buf_size;
+
+		if (off_in)
+			ret = syscall_no_intercept(SYS_pread64, in_fd, buf,
+					len, *off_in);
+		else
+			ret = syscall_no_intercept(SYS_read, in_fd, buf, len);
+
+		if (ret <= 0)
+			break;
+
+		/* don't wait for more data from a pipe */
+		bool last = (size_t)ret < len;
+		len = (size_t)ret;
+
+		if (off_out)
+			ret = wrapper_pmemfile_pwrite(out->pool->pool,
+					out->file, buf, len, *off_out);
+		else
+			ret = wrapper_pmemfile_write(out->pool->pool,
+					out->file, buf, len);
+
+		if (ret <= 0)
+			break;
+
+		done += (size_t)ret;
+		if (off_in)
+			*off_in += ret;
+		if (off_out)
+			*off_out += ret;
+
+		if ((size_t)ret < len || last)
+			break;
+	}
+
+	free(buf);
+
+	if (done > 0)
+		return (long)done;
+
+	return ret;
+}
+
+/*
+ * transfer_within_pool -- moves up to count bytes between two files of the
+ * same pool starting at *off_in, using an intermediate buffer
+ *
+ * Used instead of copy_file_range, which doesn't accept an O_APPEND out.
+ */
+static long
+transfer_within_pool(struct vfd_reference *in, pmemfile_off_t *off_in,
+		struct vfd_reference *out, loff_t *off_out, size_t count)
+{
+	size_t buf_size = count < TRANSFER_CHUNK_SIZE ?
+			count : TRANSFER_CHUNK_SIZE;
+	char *buf = malloc(buf_size);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	size_t done = 0;
+	long ret = 0;
+
+	while (done < count) {
+		size_t len = count - done;
+		if (len > buf_size)
+			len = buf_size;
+
+		ret = wrapper_pmemfile_pread(in->pool->pool, in->file, buf,
+				len, *off_in);
+		if (ret <= 0)
+			break;
+
+		bool last = (size_t)ret < len;
+		len = (size_t)ret;
+
+		if (off_out)
+			ret = wrapper_pmemfile_pwrite(out->pool->pool,
+					out->file, buf, len, *off_out);
+		else
+			ret = wrapper_pmemfile_write(out->pool->pool,
+					out->file, buf, len);
+
+		if (ret <= 0)
+			break;
+
+		done += (size_t)ret;
+		*off_in += ret;
+		if (off_out)
+			*off_out += ret;
+
+		if ((size_t)ret < len || last)
+			break;
+	}
+
+	free(buf);
+
+	if (done > 0)
+		return (long)done;
+
+	return ret;
+}
+
+/*
+ * transfer_data -- implementation of sendfile and splice for files of which
+ * at least one belongs to a pmemfile pool
+ *
+ * NULL offset means the file offset is used and updated, a kernel out
+ * always uses its file offset.
+ */
+static long
+transfer_data(struct vfd_reference *in, loff_t *off_in,
+		struct vfd_reference *out, loff_t *off_out, size_t count)
+{
+	if (count == 0)
+		return 0;
+
+	if (in->pool == NULL)
+		return transfer_to_pmemfile(in->kernel_fd, off_in, out,
+				off_out, count);
+
+	bool buffered = false;
+
+	if (in->pool == out->pool) {
+		int flags = pmemfile_fcntl(out->pool->pool, out->file,
+				PMEMFILE_F_GETFL);
+		if (flags < 0)
+			return flags;
+
+		buffered = (flags & PMEMFILE_O_APPEND) != 0;
+		if (!buffered)
+			return wrapper_pmemfile_copy_file_range(in->pool->pool,
+					in->file, off_in, out->file, off_out,
+					count, 0);
+	}
+
+	pmemfile_off_t pos;
+
+	if (off_in) {
+		pos = *off_in;
+	} else {
+		pos = wrapper_pmemfile_lseek(in->pool->pool, in->file, 0,
+				PMEMFILE_SEEK_CUR);
+		if (pos < 0)
+			return pos;
+	}
+
+	long ret;
+	if (buffered)
+		ret = transfer_within_pool(in, &pos, out, off_out, count);
+	else
+		ret = transfer_from_pmemfile(in, &pos, out, off_out, count);
+
+	if (off_in)
+		*off_in = pos;
+	else if (ret > 0)
+		wrapper_pmemfile_lseek(in->pool->pool, in->file, pos,
+				PMEMFILE_SEEK_SET);
+
+	return ret;
+}
+
+/*
+ * transfer_acquire_pools -- makes pools of both files accessible
+ */
+static void
+transfer_acquire_pools(struct vfd_reference *in, struct vfd_reference *out)
+{
+	if (in->pool != NULL)
+		pool_acquire(in->pool);
+	if (out->pool != NULL && out->pool != in->pool)
+		pool_acquire(out->pool);
+}
+
+static void
+transfer_release_pools(struct vfd_reference *in, struct vfd_reference *out)
+{
+	if (out->pool != NULL && out->pool != in->pool)
+		pool_release(out->pool);
+	if (in->pool != NULL)
+		pool_release(in->pool);
+}
+
 static long
 hook_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
 {
 	long ret;
 
-	struct vfd_reference in = pmemfile_vfd_at_ref(in_fd);
-	struct vfd_reference out = pmemfile_vfd_at_ref(out_fd);
+	struct vfd_reference in = pmemfile_vfd_ref(in_fd);
+	struct vfd_reference out = pmemfile_vfd_ref(out_fd);
 
-	if (in.pool != NULL || out.pool != NULL)
-		ret = check_errno(-ENOTSUP, SYS_sendfile);
-	else
+	if (in.pool != NULL || out.pool != NULL) {
+		transfer_acquire_pools(&in, &out);
+
+		ret = transfer_data(&in, offset, &out, NULL, count);
+
+		transfer_release_pools(&in, &out);
+
+		ret = check_errno(ret, SYS_sendfile);
+	} else {
 		ret = syscall_no_intercept(SYS_sendfile,
-						out_fd, in_fd, offset, count);
+				out.kernel_fd, in.kernel_fd, offset, count);
+	}
 
 	pmemfile_vfd_unref(out);
 	pmemfile_vfd_unref(in);
@@ -1152,20 +1485,40 @@ static long
 hook_splice(int fd_in, loff_t *off_in, int fd_out,
 			loff_t *off_out, size_t len, unsigned flags)
 {
-	/*
-	 * XXX -- this is eerie similar to hook_sendfile and to
-	 * hook_copy_file_range, perhaps these could merged.
-	 */
 	long ret;
 
-	struct vfd_reference in = pmemfile_vfd_at_ref(fd_in);
-	struct vfd_reference out = pmemfile_vfd_at_ref(fd_out);
+	struct vfd_reference in = pmemfile_vfd_ref(fd_in);
+	struct vfd_reference out = pmemfile_vfd_ref(fd_out);
 
-	if (in.pool != NULL || out.pool != NULL)
-		ret = check_errno(-ENOTSUP, SYS_splice);
-	else
-		ret = syscall_no_intercept(SYS_splice,
-				fd_in, off_in, fd_out, off_out, len, flags);
+	if (in.pool == NULL && out.pool == NULL) {
+		ret = syscall_no_intercept(SYS_splice, in.kernel_fd, off_in,
+				out.kernel_fd, off_out, len, flags);
+	} else {
+		/* one of the files must be a pipe, the other one is pmemfile */
+		int pipe_fd = in.pool == NULL ? in.kernel_fd : out.kernel_fd;
+		loff_t *pipe_off = in.pool == NULL ? off_in : off_out;
+		struct stat st;
+
+		if (in.pool != NULL && out.pool != NULL)
+			ret = -EINVAL;
+		else
+			ret = syscall_no_intercept(SYS_fstat, pipe_fd, &st);
+
+		if (ret == 0 && !S_ISFIFO(st.st_mode))
+			ret = -EINVAL;
+		else if (ret == 0 && pipe_off != NULL)
+			ret = -ESPIPE;
+
+		if (ret == 0) {
+			transfer_acquire_pools(&in, &out);
+
+			ret = transfer_data(&in, off_in, &out, off_out, len);
+
+			transfer_release_pools(&in, &out);
+		}
+
+		ret = check_errno(ret, SYS_splice);
+	}
 
 	pmemfile_vfd_unref(out);
 	pmemfile_vfd_unref(in);
@@ -1523,14 +1876,29 @@ hook_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
 {
 	long ret;
 
-	struct vfd_reference in = pmemfile_vfd_at_ref(fd_in);
-	struct vfd_reference out = pmemfile_vfd_at_ref(fd_out);
+	struct vfd_reference in = pmemfile_vfd_ref(fd_in);
+	struct vfd_reference out = pmemfile_vfd_ref(fd_out);
 
-	if (in.pool != NULL || out.pool != NULL)
-		ret = check_errno(-ENOTSUP, SYS_copy_file_range);
-	else
+	if (in.pool != NULL && in.pool == out.pool) {
+		pool_acquire(in.pool);
+
+		ret = wrapper_pmemfile_copy_file_range(in.pool->pool,
+				in.file, off_in, out.file, off_out, len, flags);
+
+		pool_release(in.pool);
+
+		ret = check_errno(ret, SYS_copy_file_range);
+	} else if (in.pool != NULL || out.pool != NULL) {
+		/*
+		 * Files in different file systems - the kernel returns EXDEV
+		 * in this case too, and callers fall back to read/write.
+		 */
+		ret = check_errno(-EXDEV, SYS_copy_file_range);
+	} else {
 		ret = syscall_no_intercept(SYS_copy_file_range,
-				fd_in, off_in, fd_out, off_out, len, flags);
+				in.kernel_fd, off_in, out.kernel_fd, off_out,
+				len, flags);
+	}
 
 	pmemfile_vfd_unref(out);
 	pmemfile_vfd_unref(in);
@@ -1538,19 +1906,430 @@ hook_copy_file_range(int fd_in, loff_t *off_in, int fd_out,
 	return ret;
 }
 
+/*
+ * hook_ioctl_fiemap -- FS_IOC_FIEMAP on pmemfile files, implemented with
+ * pmemfile_fiemap
+ *
+ * pmemfile extents don't have a location on any device, so they are reported
+ * with FIEMAP_EXTENT_UNKNOWN.
+ */
+static long
+hook_ioctl_fiemap(struct vfd_reference *file, struct fiemap *fm)
+{
+	if (!is_accessible(fm, sizeof(*fm)))
+		return -EFAULT;
+
+	if (!is_accessible(fm->fm_extents,
+			fm->fm_extent_count * sizeof(fm->fm_extents[0])))
+		return -EFAULT;
+
+	if (fm->fm_flags & ~(uint32_t)FIEMAP_FLAG_SYNC) {
+		fm->fm_flags &= ~(uint32_t)FIEMAP_FLAG_SYNC;
+		return -EBADR;
+	}
+
+	if (fm->fm_length == 0)
+		return -EINVAL;
+
+	if (fm->fm_start > INT64_MAX)
+		return -EFBIG;
+
+	pmemfile_off_t offset = (pmemfile_off_t)fm->fm_start;
+	pmemfile_off_t length = INT64_MAX - offset;
+	if (fm->fm_length < (uint64_t)length)
+		length = (pmemfile_off_t)fm->fm_length;
+
+	pmemfile_ssize_t ret;
+
+	if (fm->fm_extent_count == 0) {
+		ret = wrapper_pmemfile_fiemap(file->pool->pool, file->file,
+				offset, length, NULL, 0);
+		if (ret < 0)
+			return ret;
+
+		fm->fm_mapped_extents = (uint32_t)ret;
+		return 0;
+	}
+
+	/* extents are converted in batches, starting after the previous one */
+	struct pmemfile_extent extents[64];
+	pmemfile_off_t end = offset + length;
+	uint32_t mapped = 0;
+
+	while (mapped < fm->fm_extent_count && offset < end) {
+		size_t count = fm->fm_extent_count - mapped;
+		if (count > ARRAY_SIZE(extents))
+			count = ARRAY_SIZE(extents);
+
+		ret = wrapper_pmemfile_fiemap(file->pool->pool, file->file,
+				offset, end - offset, extents, count);
+		if (ret < 0)
+			return ret;
+
+		for (pmemfile_ssize_t i = 0; i < ret; ++i) {
+			struct fiemap_extent *fe = &fm->fm_extents[mapped++];
+
+			memset(fe, 0, sizeof(*fe));
+			fe->fe_logical = extents[i].offset;
+			fe->fe_length = extents[i].length;
+			fe->fe_flags = FIEMAP_EXTENT_UNKNOWN;
+			if (extents[i].flags & PMEMFILE_FIEMAP_EXTENT_LAST)
+				fe->fe_flags |= FIEMAP_EXTENT_LAST;
+			if (extents[i].flags & PMEMFILE_FIEMAP_EXTENT_UNWRITTEN)
+				fe->fe_flags |= FIEMAP_EXTENT_UNWRITTEN;
+			if (extents[i].flags & PMEMFILE_FIEMAP_EXTENT_SHARED)
+				fe->fe_flags |= FIEMAP_EXTENT_SHARED;
+			if (extents[i].flags &
+					PMEMFILE_FIEMAP_EXTENT_NOT_ALIGNED)
+				fe->fe_flags |= FIEMAP_EXTENT_NOT_ALIGNED;
+			if (extents[i].flags &
+					PMEMFILE_FIEMAP_EXTENT_DATA_INLINE)
+				fe->fe_flags |= FIEMAP_EXTENT_DATA_INLINE;
+		}
+
+		if ((size_t)ret < count)
+			break;
+
+		offset = (pmemfile_off_t)(extents[ret - 1].offset +
+				extents[ret - 1].length);
+	}
+
+	fm->fm_mapped_extents = mapped;
+
+	return 0;
+}
+
+/*
+ * hook_ioctl -- the only ioctl supported on pmemfile files is FS_IOC_FIEMAP
+ */
+static long
+hook_ioctl(struct vfd_reference *file, unsigned long request, long arg)
+{
+	if (request == FS_IOC_FIEMAP)
+		return hook_ioctl_fiemap(file, (struct fiemap *)arg);
+
+	return -ENOTTY;
+}
+
+/*
+ * Address ranges of memory mapped pmemfile files, sorted by address.
+ * The munmap, mremap, msync and mprotect syscalls don't refer to a file
+ * descriptor, these ranges are used to route them to the right pool.
+ *
+ * munmap can be called by malloc with its internal locks held, so nothing
+ * here can allocate memory.
+ */
+struct mapped_range {
+	char *addr;
+	size_t len;
+	struct pool_description *pool;
+};
+
+static struct mapped_range mapped_ranges[0x400];
+static size_t mapped_range_count;
+static pthread_mutex_t mapped_ranges_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline size_t
+page_roundup(size_t len)
+{
+	return (len + page_size - 1) & ~(page_size - 1);
+}
+
+/*
+ * mapped_range_insert -- inserts a new range at index i, returns false if
+ * there's no space left
+ */
+static bool
+mapped_range_insert(size_t i, char *addr, size_t len,
+		struct pool_description *pool)
+{
+	if (mapped_range_count == ARRAY_SIZE(mapped_ranges))
+		return false;
+
+	memmove(&mapped_ranges[i + 1], &mapped_ranges[i],
+		(mapped_range_count - i) * sizeof(mapped_ranges[0]));
+
+	mapped_ranges[i].addr = addr;
+	mapped_ranges[i].len = len;
+	mapped_ranges[i].pool = pool;
+
+	__atomic_store_n(&mapped_range_count, mapped_range_count + 1,
+			__ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void
+mapped_range_erase(size_t i)
+{
+	memmove(&mapped_ranges[i], &mapped_ranges[i + 1],
+		(mapped_range_count - i - 1) * sizeof(mapped_ranges[0]));
+
+	__atomic_store_n(&mapped_range_count, mapped_range_count - 1,
+			__ATOMIC_RELEASE);
+}
+
+/*
+ * mapped_range_add -- registers [addr, addr + len) as mapped by pool
+ */
+static bool
+mapped_range_add(char *addr, size_t len, struct pool_description *pool)
+{
+	size_t i = 0;
+	while (i < mapped_range_count && mapped_ranges[i].addr < addr)
+		++i;
+
+	return mapped_range_insert(i, addr, len, pool);
+}
+
+/*
+ * mapped_range_remove -- removes [addr, addr + len) from registered ranges
+ */
+static void
+mapped_range_remove(char *addr, size_t len)
+{
+	char *end = addr + len;
+
+	for (size_t i = 0; i < mapped_range_count; ) {
+		struct mapped_range *r = &mapped_ranges[i];
+		char *r_end = r->addr + r->len;
+
+		if (r_end <= addr || r->addr >= end) {
+			++i;
+			continue;
+		}
+
+		if (r->addr < addr && r_end > end) {
+			/*
+			 * Hole in the middle of a range. When there's no space
+			 * for a new entry pmemfile already unmapped the tail,
+			 * so only the head is kept.
+			 */
+			r->len = (size_t)(addr - r->addr);
+			mapped_range_insert(i + 1, end, (size_t)(r_end - end),
+					r->pool);
+			return;
+		}
+
+		if (r->addr < addr) {
+			r->len = (size_t)(addr - r->addr);
+			++i;
+		} else if (r_end > end) {
+			r->len = (size_t)(r_end - end);
+			r->addr = end;
+			++i;
+		} else {
+			mapped_range_erase(i);
+		}
+	}
+}
+
+static bool
+mapped_range_overlaps(char *addr, size_t len)
+{
+	for (size_t i = 0; i < mapped_range_count; ++i) {
+		struct mapped_range *r = &mapped_ranges[i];
+
+		if (r->addr < addr + len && addr < r->addr + r->len)
+			return true;
+	}
+
+	return false;
+}
+
+static long
+mapped_range_call(long syscall_number, struct pool_description *pool,
+		char *addr, size_t len, long arg)
+{
+	long ret;
+
+	pool_acquire(pool);
+
+	switch (syscall_number) {
+	case SYS_munmap:
+		ret = wrapper_pmemfile_munmap(pool->pool, addr, len);
+		break;
+	case SYS_msync:
+		ret = wrapper_pmemfile_msync(pool->pool, addr, len, (int)arg);
+		break;
+	case SYS_mprotect:
+		ret = wrapper_pmemfile_mprotect(pool->pool, addr, len,
+				(int)arg);
+		break;
+	default:
+		assert(0);
+		ret = -ENOTSUP;
+	}
+
+	pool_release(pool);
+
+	return check_errno(ret, syscall_number);
+}
+
+/*
+ * hook_mapped_range -- handles munmap, msync and mprotect
+ *
+ * Parts of [addr, addr + len) range which are mapped by pmemfile are passed
+ * to pmemfile, the rest is passed to the kernel.
+ */
+static long
+hook_mapped_range(long syscall_number, char *addr, size_t len, long arg)
+{
+	if (__atomic_load_n(&mapped_range_count, __ATOMIC_ACQUIRE) == 0)
+		return syscall_no_intercept(syscall_number, addr, len, arg);
+
+	if ((uintptr_t)addr % page_size)
+		return -EINVAL;
+
+	len = page_roundup(len);
+
+	long ret = 0;
+	char *cur = addr;
+	char *end = addr + len;
+
+	util_mutex_lock(&mapped_ranges_mutex);
+
+	for (size_t i = 0; i < mapped_range_count && cur < end; ++i) {
+		struct mapped_range *r = &mapped_ranges[i];
+		char *r_end = r->addr + r->len;
+
+		if (r_end <= cur)
+			continue;
+		if (r->addr >= end)
+			break;
+
+		if (r->addr > cur) {
+			ret = syscall_no_intercept(syscall_number, cur,
+					r->addr - cur, arg);
+			if (ret)
+				break;
+			cur = r->addr;
+		}
+
+		char *e = r_end < end ? r_end : end;
+		ret = mapped_range_call(syscall_number, r->pool, cur,
+				(size_t)(e - cur), arg);
+		if (ret)
+			break;
+		cur = e;
+	}
+
+	if (ret == 0 && cur < end)
+		ret = syscall_no_intercept(syscall_number, cur, end - cur, arg);
+
+	if (syscall_number == SYS_munmap)
+		mapped_range_remove(addr, (size_t)(cur - addr));
+
+	util_mutex_unlock(&mapped_ranges_mutex);
+
+	return ret;
+}
+
+static long
+hook_mremap(char *old_addr, size_t old_size, size_t new_size, int flags,
+		void *new_addr)
+{
+	if (__atomic_load_n(&mapped_range_count, __ATOMIC_ACQUIRE) == 0)
+		return syscall_no_intercept(SYS_mremap, old_addr, old_size,
+				new_size, flags, new_addr);
+
+	struct pool_description *pool = NULL;
+	long ret;
+
+	util_mutex_lock(&mapped_ranges_mutex);
+
+	for (size_t i = 0; i < mapped_range_count; ++i) {
+		struct mapped_range *r = &mapped_ranges[i];
+
+		if (r->addr <= old_addr && old_addr < r->addr + r->len) {
+			pool = r->pool;
+			break;
+		}
+	}
+
+	if (pool == NULL) {
+		ret = syscall_no_intercept(SYS_mremap, old_addr, old_size,
+				new_size, flags, new_addr);
+	} else {
+		pool_acquire(pool);
+
+		void *addr = wrapper_pmemfile_mremap(pool->pool, old_addr,
+				old_size, new_size, flags, new_addr);
+
+		if (addr == PMEMFILE_MAP_FAILED) {
+			ret = -errno;
+		} else {
+			mapped_range_remove(old_addr, page_roundup(old_size));
+			if (mapped_range_add(addr, page_roundup(new_size),
+					pool)) {
+				ret = (long)addr;
+			} else {
+				wrapper_pmemfile_munmap(pool->pool, addr,
+						new_size);
+				ret = -ENOMEM;
+			}
+		}
+
+		pool_release(pool);
+
+		ret = check_errno(ret, SYS_mremap);
+	}
+
+	util_mutex_unlock(&mapped_ranges_mutex);
+
+	return ret;
+}
+
 static long
 hook_mmap(long arg0, long arg1, long arg2,
 		long arg3, int fd, long arg5)
 {
 	long ret;
+	char *addr = (char *)arg0;
+	size_t len = (size_t)arg1;
+
+	/* MAP_FIXED mapping replaces whatever was mapped at addr */
+	if ((arg3 & MAP_FIXED) &&
+	    __atomic_load_n(&mapped_range_count, __ATOMIC_ACQUIRE) != 0) {
+		util_mutex_lock(&mapped_ranges_mutex);
+		bool overlaps = mapped_range_overlaps(addr, len);
+		util_mutex_unlock(&mapped_ranges_mutex);
+
+		if (overlaps) {
+			ret = hook_mapped_range(SYS_munmap, addr, len, 0);
+			if (ret)
+				return ret;
+		}
+	}
 
 	struct vfd_reference file = pmemfile_vfd_ref(fd);
 
-	if (file.pool != NULL)
-		ret = check_errno(-ENOTSUP, SYS_mmap);
-	else
+	if (file.pool != NULL) {
+		pool_acquire(file.pool);
+
+		util_mutex_lock(&mapped_ranges_mutex);
+
+		void *r = wrapper_pmemfile_mmap(file.pool->pool, addr, len,
+				(int)arg2, (int)arg3, file.file, arg5);
+
+		if (r == PMEMFILE_MAP_FAILED) {
+			ret = -errno;
+		} else if (mapped_range_add(r, page_roundup(len), file.pool)) {
+			ret = (long)r;
+		} else {
+			wrapper_pmemfile_munmap(file.pool->pool, r, len);
+			ret = -ENOMEM;
+		}
+
+		util_mutex_unlock(&mapped_ranges_mutex);
+
+		pool_release(file.pool);
+
+		ret = check_errno(ret, SYS_mmap);
+	} else {
 		ret = syscall_no_intercept(SYS_mmap,
 			arg0, arg1, arg2, arg3, file.kernel_fd, arg5);
+	}
 
 	pmemfile_vfd_unref(file);
 
@@ -2000,6 +2779,16 @@ dispatch_syscall(long syscall_number,
 	case SYS_mmap:
 		return hook_mmap(arg0, arg1, arg2, arg3, (int)arg4, arg5);
 
+	case SYS_munmap:
+	case SYS_msync:
+	case SYS_mprotect:
+		return hook_mapped_range(syscall_number, (char *)arg0,
+				(size_t)arg1, arg2);
+
+	case SYS_mremap:
+		return hook_mremap((char *)arg0, (size_t)arg1, (size_t)arg2,
+				(int)arg3, (void *)arg4);
+
 	/*
 	 * NOP implementations for the xattr family. None of these
 	 * actually call pmemfile-posix. Some of them do need path resolution,
@@ -2292,6 +3081,9 @@ dispatch_syscall_fd_first(long syscall_number,
 	case SYS_fallocate:
 		return fd_first_pmemfile_fallocate(arg0, arg1, arg2, arg3);
 
+	case SYS_ioctl:
+		return hook_ioctl(arg0, (unsigned long)arg1, arg2);
+
 	case SYS_fstat: {
 		if (!is_accessible((void *)arg1, sizeof(struct stat)))
 			return -EFAULT;
@@ -147,6 +147,10 @@ static struct syscall_early_filter_entry filter_table[] = {
 	[SYS_getxattr] = {
 		.must_handle = true,
 	},
+	[SYS_ioctl] = {
+		.must_handle = true,
+		.fd_first_arg = true,
+	},
 	[SYS_lchown] = {
 		.must_handle = true,
 	},
@@ -364,6 +368,18 @@ static struct syscall_early_filter_entry filter_table[] = {
 	[SYS_mmap] = {
 		.must_handle = true,
 	},
+	[SYS_mprotect] = {
+		.must_handle = true,
+	},
+	[SYS_mremap] = {
+		.must_handle = true,
+	},
+	[SYS_msync] = {
+		.must_handle = true,
+	},
+	[SYS_munmap] = {
+		.must_handle = true,
+	},
 	[SYS_name_to_handle_at] = {
 		.must_handle = true,
 	},
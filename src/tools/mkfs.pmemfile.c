@@ -59,10 +59,12 @@ static void
 print_usage(FILE *stream)
 {
 	fprintf(stream,
-	    "Usage: %s [-v] [-h] path fs-size\n"
+	    "Usage: %s [-v] [-h] [-i inode-size] path fs-size\n"
 	    "Options:\n"
 	    "  -v      print version\n"
-	    "  -h      print this help text\n",
+	    "  -h      print this help text\n"
+	    "  -i      size of inodes of files other than directories,\n"
+	    "          4096 (default) or 512\n",
 	    progname);
 }
 
@@ -137,10 +139,11 @@ main(int argc, char *argv[])
 	int opt;
 	size_t size;
 	const char *path;
+	size_t inode_size = PMEMFILE_INODE_SIZE_DEFAULT;
 
 	progname = argv[0];
 
-	while ((opt = getopt(argc, argv, "vh")) >= 0) {
+	while ((opt = getopt(argc, argv, "vhi:")) >= 0) {
 		switch (opt) {
 		case 'v':
 		case 'V':
@@ -150,6 +153,15 @@ main(int argc, char *argv[])
 		case 'H':
 			print_usage(stdout);
 			return 0;
+		case 'i':
+			inode_size = parse_size(optarg);
+			if (inode_size != PMEMFILE_INODE_SIZE_DEFAULT &&
+			    inode_size != PMEMFILE_INODE_SIZE_COMPACT) {
+				fputs("Invalid inode size\n", stderr);
+				print_usage(stderr);
+				return 2;
+			}
+			break;
 		default:
 			print_usage(stderr);
 			return 2;
@@ -165,8 +177,8 @@ main(int argc, char *argv[])
 
 	size = parse_size(argv[optind + 1]);
 
-	PMEMfilepool *pool = pmemfile_pool_create(path, size,
-			PMEMFILE_S_IWUSR | PMEMFILE_S_IRUSR);
+	PMEMfilepool *pool = pmemfile_pool_create_ex(path, size,
+			PMEMFILE_S_IWUSR | PMEMFILE_S_IRUSR, inode_size);
 	if (pool == NULL) {
 		perror("pmemfile_mkfs ");
 		return 1;
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * pmemfile-defrag.c -- pmemfile defrag command source file
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "libpmemfile-posix.h"
+
+static void
+print_version(void)
+{
+	puts("pmemfile-defrag v0");
+}
+
+static void
+print_usage(FILE *stream, const char *progname)
+{
+	fprintf(stream, "Usage: %s [OPTION]... POOL FILE...\n", progname);
+}
+
+static void
+defrag_file(PMEMfilepool *pool, const char *path)
+{
+	PMEMfile *file = pmemfile_open(pool, path, PMEMFILE_O_RDWR, 0);
+
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	if (pmemfile_defrag(pool, file, 0, INT64_MAX)) {
+		perror(path);
+		exit(1);
+	}
+
+	pmemfile_close(pool, file);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	PMEMfilepool *pool;
+
+	while ((opt = getopt(argc, argv, "vh")) >= 0) {
+		switch (opt) {
+		case 'v':
+		case 'V':
+			print_version();
+			return 0;
+		case 'h':
+		case 'H':
+			print_usage(stdout, argv[0]);
+			return 0;
+		default:
+			print_usage(stderr, argv[0]);
+			return 2;
+		}
+	}
+
+	if (optind + 1 >= argc) {
+		print_usage(stderr, argv[0]);
+		return 2;
+	}
+
+	pool = pmemfile_pool_open(argv[optind]);
+
+	if (pool == NULL) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	++optind;
+
+	struct pmemfile_stats before;
+	pmemfile_stats(pool, &before);
+
+	while (optind < argc)
+		defrag_file(pool, argv[optind++]);
+
+	struct pmemfile_stats after;
+	pmemfile_stats(pool, &after);
+
+	printf("blocks before: %u\n", before.blocks);
+	printf("blocks after: %u\n", after.blocks);
+
+	pmemfile_pool_close(pool);
+
+	return 0;
+}
@@ -38,8 +38,12 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
 #include <string.h>
 #include <sys/fsuid.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <syscall.h>
 #include <unistd.h>
@@ -241,6 +245,20 @@ pmemfile_pool_create(const char *pathname, size_t poolsize, mode_t mode)
 	return NULL;
 }
 
+PMEMfilepool *
+pmemfile_pool_create_ex(const char *pathname, size_t poolsize, mode_t mode,
+		size_t inode_size)
+{
+	/* the underlying file system has its own idea about inode sizes */
+	if (inode_size != PMEMFILE_INODE_SIZE_DEFAULT &&
+			inode_size != PMEMFILE_INODE_SIZE_COMPACT) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return pmemfile_pool_create(pathname, poolsize, mode);
+}
+
 int
 pmemfile_getdents64(PMEMfilepool *pfp, PMEMfile *file,
 			struct linux_dirent64 *dirp, unsigned count)
@@ -348,9 +366,14 @@ void
 pmemfile_stats(PMEMfilepool *pfp, struct pmemfile_stats *stats)
 {
 	stats->blocks = 0;
+	stats->block_refs = 0;
+	stats->block_index = 0;
 	stats->block_arrays = 0;
 	stats->dirs = 0;
 	stats->inodes = 0;
+	stats->dcache_hits = 0;
+	stats->dcache_negative_hits = 0;
+	stats->dcache_misses = 0;
 	stats->inode_arrays = 0;
 }
 
@@ -497,6 +520,137 @@ pmemfile_posix_fallocate(PMEMfilepool *pfp, PMEMfile *file,
 	return posix_fallocate(file->fd, offset, length);
 }
 
+void *
+pmemfile_mmap(PMEMfilepool *pfp, void *addr, size_t len,
+		int prot, int flags, PMEMfile *file, pmemfile_off_t off)
+{
+	if (pfp == NULL || file == NULL) {
+		errno = EFAULT;
+		return PMEMFILE_MAP_FAILED;
+	}
+
+	return mmap(addr, len, prot, flags, file->fd, off);
+}
+
+int
+pmemfile_munmap(PMEMfilepool *pfp, void *addr, size_t len)
+{
+	return munmap(addr, len);
+}
+
+void *
+pmemfile_mremap(PMEMfilepool *pfp, void *old_addr, size_t old_size,
+			size_t new_size, int flags, void *new_addr)
+{
+	return mremap(old_addr, old_size, new_size, flags, new_addr);
+}
+
+int
+pmemfile_msync(PMEMfilepool *pfp, void *addr, size_t len, int flags)
+{
+	return msync(addr, len, flags);
+}
+
+int
+pmemfile_mprotect(PMEMfilepool *pfp, void *addr, size_t len, int prot)
+{
+	return mprotect(addr, len, prot);
+}
+
+pmemfile_ssize_t
+pmemfile_copy_file_range(PMEMfilepool *pfp,
+		PMEMfile *file_in, pmemfile_off_t *off_in,
+		PMEMfile *file_out, pmemfile_off_t *off_out,
+		size_t len, unsigned flags)
+{
+	if (pfp == NULL || file_in == NULL || file_out == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	return syscall(SYS_copy_file_range, file_in->fd, off_in, file_out->fd,
+			off_out, len, flags);
+}
+
+/*
+ * pmemfile_defrag -- kernel file systems don't expose anything similar,
+ * so only the arguments are checked
+ */
+int
+pmemfile_defrag(PMEMfilepool *pfp, PMEMfile *file, pmemfile_off_t offset,
+		pmemfile_off_t length)
+{
+	if (pfp == NULL || file == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (offset < 0 || length < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int flags = fcntl(file->fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+
+	if ((flags & O_ACCMODE) == O_RDONLY) {
+		errno = EBADF;
+		return -1;
+	}
+
+	return 0;
+}
+
+pmemfile_ssize_t
+pmemfile_fiemap(PMEMfilepool *pfp, PMEMfile *file, pmemfile_off_t offset,
+		pmemfile_off_t length, struct pmemfile_extent *extents,
+		size_t count)
+{
+	if (pfp == NULL || file == NULL || (count > 0 && extents == NULL)) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (offset < 0 || length < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (length == 0)
+		return 0;
+
+	struct fiemap *fm = calloc(1, sizeof(*fm) +
+			count * sizeof(struct fiemap_extent));
+	if (fm == NULL)
+		return -1;
+
+	fm->fm_start = (uint64_t)offset;
+	fm->fm_length = (uint64_t)length;
+	fm->fm_extent_count = (uint32_t)count;
+
+	if (ioctl(file->fd, FS_IOC_FIEMAP, fm)) {
+		int oerrno = errno;
+		free(fm);
+		errno = oerrno;
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < fm->fm_mapped_extents && count > 0; ++i) {
+		extents[i].offset = fm->fm_extents[i].fe_logical;
+		extents[i].length = fm->fm_extents[i].fe_length;
+		extents[i].flags = fm->fm_extents[i].fe_flags &
+				(PMEMFILE_FIEMAP_EXTENT_LAST |
+				PMEMFILE_FIEMAP_EXTENT_UNWRITTEN |
+				PMEMFILE_FIEMAP_EXTENT_SHARED);
+	}
+
+	pmemfile_ssize_t ret = fm->fm_mapped_extents;
+	free(fm);
+
+	return ret;
+}
+
 pmemfile_ssize_t
 pmemfile_pwrite(PMEMfilepool *pfp, PMEMfile *file, const void *buf,
 		size_t count, pmemfile_off_t offset)
@@ -567,6 +721,69 @@ pmemfile_preadv(PMEMfilepool *pfp, PMEMfile *file, const pmemfile_iovec_t *iov,
 	return preadv(file->fd, iov, iovcnt, offset);
 }
 
+struct pmemfile_lease {
+	void *buf;
+};
+
+/*
+ * pmemfile_pread_borrow -- there is no memory to borrow from the kernel,
+ * so read into a private buffer owned by the lease.
+ */
+pmemfile_ssize_t
+pmemfile_pread_borrow(PMEMfilepool *pfp, PMEMfile *file, size_t count,
+		pmemfile_off_t offset, pmemfile_iovec_t *iov, int *iovcnt,
+		PMEMfilelease **lease)
+{
+	if (pfp == NULL || file == NULL || iov == NULL || iovcnt == NULL ||
+			lease == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (*iovcnt <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	PMEMfilelease *l = malloc(sizeof(*l));
+	if (!l)
+		return -1;
+
+	l->buf = malloc(count ? count : 1);
+	if (!l->buf) {
+		free(l);
+		return -1;
+	}
+
+	ssize_t ret = pread(file->fd, l->buf, count, offset);
+	if (ret < 0) {
+		int oerrno = errno;
+		free(l->buf);
+		free(l);
+		errno = oerrno;
+		return -1;
+	}
+
+	iov[0].iov_base = l->buf;
+	iov[0].iov_len = (size_t)ret;
+	*iovcnt = ret > 0 ? 1 : 0;
+	*lease = l;
+
+	return ret;
+}
+
+void
+pmemfile_pread_release(PMEMfilepool *pfp, PMEMfilelease *lease)
+{
+	(void) pfp;
+
+	if (!lease)
+		return;
+
+	free(lease->buf);
+	free(lease);
+}
+
 pmemfile_ssize_t
 pmemfile_writev(PMEMfilepool *pfp, PMEMfile *file, const pmemfile_iovec_t *iov,
 		int iovcnt)
@@ -716,6 +933,54 @@ pmemfile_create(PMEMfilepool *pfp, const char *pathname, pmemfile_mode_t mode)
 	return pf;
 }
 
+int
+pmemfile_create_batch(PMEMfilepool *pfp, PMEMfile *dir,
+		const char *const names[], const pmemfile_mode_t modes[],
+		PMEMfile *out[], size_t count)
+{
+	if (pfp == NULL || dir == NULL || names == NULL || modes == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	int fd = getfiledescriptor(dir);
+
+	/* the underlying file system can't do it atomically, emulate it */
+	for (size_t i = 0; i < count; ++i) {
+		int flags = O_CREAT | O_EXCL | O_WRONLY;
+		int result = openat(fd, names[i], flags, modes[i]);
+		if (result == -1) {
+			int error = errno;
+
+			while (i > 0) {
+				--i;
+				if (out) {
+					pmemfile_close(pfp, out[i]);
+					out[i] = NULL;
+				}
+				unlinkat(fd, names[i], 0);
+			}
+
+			errno = error;
+			return -1;
+		}
+
+		if (!out) {
+			close(result);
+			continue;
+		}
+
+		PMEMfile *pf = malloc(sizeof(*pf));
+		pf->pfp = pfp;
+		pf->fd = result;
+		pf->flags = flags;
+		pf->mode = modes[i];
+		out[i] = pf;
+	}
+
+	return 0;
+}
+
 int
 pmemfile_linkat(PMEMfilepool *pfp, PMEMfile *olddir, const char *oldpath,
 		PMEMfile *newdir, const char *newpath, int flags)
@@ -762,6 +1027,26 @@ pmemfile_unlinkat(PMEMfilepool *pfp, PMEMfile *dir, const char *pathname,
 	return result;
 }
 
+int
+pmemfile_unlink_batch(PMEMfilepool *pfp, PMEMfile *dir,
+		const char *const names[], size_t count)
+{
+	if (pfp == NULL || dir == NULL || names == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	int fd = getfiledescriptor(dir);
+
+	/* not atomic, the underlying file system can't do that */
+	for (size_t i = 0; i < count; ++i) {
+		if (unlinkat(fd, names[i], 0))
+			return -1;
+	}
+
+	return 0;
+}
+
 int
 pmemfile_rename(PMEMfilepool *pfp, const char *old_path, const char *new_path)
 {
@@ -1566,6 +1851,18 @@ pmemfile_pool_root_count(PMEMfilepool *pfp)
 	return 1;
 }
 
+int
+pmemfile_pool_reclaim(PMEMfilepool *pfp)
+{
+	if (pfp == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	/* the underlying file system frees space of unlinked files itself */
+	return 0;
+}
+
 #ifdef FAULT_INJECTION
 void _pmemfile_inject_fault_at(enum pf_allocation_type type, int nth,
 		const char *at)
@@ -33,6 +33,10 @@ include(${SRC_DIR}/../posix-helpers.cmake)
 
 setup()
 
+if(DEFINED background_reclaim)
+	set(ENV{PMEMFILE_BACKGROUND_RECLAIM} ${background_reclaim})
+endif()
+
 execute(${TEST_EXECUTABLE})
 
 cleanup()
@@ -531,44 +531,126 @@ TEST_F(basic, random_stuff)
 	EXPECT_EQ(errno, EFAULT);
 }
 
-TEST_F(basic, unimplemented)
+TEST_F(basic, compact_inodes)
 {
-	if (is_pmemfile_pop)
-		return;
+	pmemfile_pool_close(pfp);
+	(void)std::remove(path.c_str());
 
 	errno = 0;
-	ASSERT_EQ(pmemfile_copy_file_range(NULL, NULL, NULL, NULL, NULL, 0, 0),
-		  -1);
-	EXPECT_EQ(errno, ENOTSUP);
+	pfp = pmemfile_pool_create_ex(path.c_str(), poolsize,
+				      PMEMFILE_S_IWUSR | PMEMFILE_S_IRUSR,
+				      1024);
+	ASSERT_EQ(pfp, nullptr);
+	EXPECT_EQ(errno, EINVAL);
 
-	errno = 0;
-	ASSERT_EQ(pmemfile_flock(NULL, NULL, 0), -1);
-	EXPECT_EQ(errno, ENOTSUP);
+	pfp = pmemfile_pool_create_ex(path.c_str(), poolsize,
+				      PMEMFILE_S_IWUSR | PMEMFILE_S_IRUSR,
+				      PMEMFILE_INODE_SIZE_COMPACT);
+	ASSERT_NE(pfp, nullptr) << strerror(errno);
+	pmemfile_umask(pfp, 0);
 
-	errno = 0;
-	ASSERT_EQ(pmemfile_mknodat(NULL, NULL, NULL, PMEMFILE_S_IFIFO, 0), -1);
-	EXPECT_EQ(errno, ENOTSUP);
+	/* more extents than fit in the inode */
+	char buf[4096];
+	memset(buf, 0xab, sizeof(buf));
 
-	errno = 0;
-	ASSERT_EQ(pmemfile_mmap(NULL, NULL, 0, 0, 0, NULL, 0),
-		  PMEMFILE_MAP_FAILED);
-	EXPECT_EQ(errno, ENOTSUP);
+	PMEMfile *f = pmemfile_open(pfp, "/file",
+				    PMEMFILE_O_CREAT | PMEMFILE_O_RDWR, 0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+	for (pmemfile_off_t i = 0; i < 8; ++i) {
+		pmemfile_ssize_t w = pmemfile_pwrite(pfp, f, buf, sizeof(buf),
+						     i * 1024 * 1024);
+		ASSERT_EQ(w, (pmemfile_ssize_t)sizeof(buf)) << COND_ERROR(w);
+	}
+	pmemfile_close(pfp, f);
 
-	errno = 0;
-	ASSERT_EQ(pmemfile_munmap(NULL, NULL, 0), -1);
-	EXPECT_EQ(errno, ENOTSUP);
+	std::string long_target(300, 'x');
+	ASSERT_EQ(pmemfile_symlink(pfp, "/file", "/short"), 0);
+	ASSERT_EQ(pmemfile_symlink(pfp, long_target.c_str(), "/long"), 0);
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir", 0777), 0);
+	ASSERT_TRUE(test_empty_dir(pfp, "/dir"));
+	f = pmemfile_create(pfp, "/dir/file", 0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+	pmemfile_close(pfp, f);
+
+	pmemfile_pool_close(pfp);
+
+	pfp = pmemfile_pool_open(path.c_str());
+	ASSERT_NE(pfp, nullptr) << strerror(errno);
+
+	f = pmemfile_open(pfp, "/file", PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+	for (pmemfile_off_t i = 0; i < 8; ++i) {
+		char rbuf[4096];
+		pmemfile_ssize_t r = pmemfile_pread(pfp, f, rbuf, sizeof(rbuf),
+						    i * 1024 * 1024);
+		ASSERT_EQ(r, (pmemfile_ssize_t)sizeof(rbuf)) << COND_ERROR(r);
+		EXPECT_EQ(memcmp(rbuf, buf, sizeof(buf)), 0);
+	}
+	pmemfile_close(pfp, f);
+
+	char link[PMEMFILE_PATH_MAX];
+	pmemfile_ssize_t l = pmemfile_readlink(pfp, "/short", link,
+					       sizeof(link));
+	ASSERT_EQ(l, 5) << COND_ERROR(l);
+	EXPECT_EQ(std::string(link, (size_t)l), "/file");
+
+	l = pmemfile_readlink(pfp, "/long", link, sizeof(link));
+	ASSERT_EQ(l, (pmemfile_ssize_t)long_target.size()) << COND_ERROR(l);
+	EXPECT_EQ(std::string(link, (size_t)l), long_target);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dir/file"), 0);
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/long"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/short"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+
+	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 0, 0, 0, 0));
+}
+
+TEST_F(basic, reclaim_unlinked_big_file)
+{
+	PMEMfile *f = pmemfile_open(pfp, "/big", PMEMFILE_O_CREAT |
+			PMEMFILE_O_EXCL | PMEMFILE_O_WRONLY, 0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	/* one block per write, spread over a few block arrays */
+	for (pmemfile_off_t i = 0; i < 400; ++i) {
+		pmemfile_ssize_t written = pmemfile_pwrite(pfp, f, "x", 1,
+				i << 20);
+		ASSERT_EQ(written, 1) << COND_ERROR(written);
+	}
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/big"), 0);
+
+	if (!is_pmemfile_pop) {
+		struct pmemfile_stats stats;
+		pmemfile_stats(pfp, &stats);
+		EXPECT_EQ(stats.blocks, 400u);
+		EXPECT_GT(stats.block_arrays, 1u);
+	}
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_pool_reclaim(pfp), 0);
+	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 0, 0, 0, 0));
 
 	errno = 0;
-	ASSERT_EQ(pmemfile_mremap(NULL, NULL, 0, 0, 0, NULL),
-		  PMEMFILE_MAP_FAILED);
-	EXPECT_EQ(errno, ENOTSUP);
+	ASSERT_EQ(pmemfile_pool_reclaim(NULL), -1);
+	EXPECT_EQ(errno, EFAULT);
+}
+
+TEST_F(basic, unimplemented)
+{
+	if (is_pmemfile_pop)
+		return;
 
 	errno = 0;
-	ASSERT_EQ(pmemfile_msync(NULL, NULL, 0, 0), -1);
+	ASSERT_EQ(pmemfile_flock(NULL, NULL, 0), -1);
 	EXPECT_EQ(errno, ENOTSUP);
 
 	errno = 0;
-	ASSERT_EQ(pmemfile_mprotect(NULL, NULL, 0, 0), -1);
+	ASSERT_EQ(pmemfile_mknodat(NULL, NULL, NULL, PMEMFILE_S_IFIFO, 0), -1);
 	EXPECT_EQ(errno, ENOTSUP);
 }
 
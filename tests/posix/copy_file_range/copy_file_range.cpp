@@ -0,0 +1,496 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * copy_file_range.cpp -- unit test for pmemfile_copy_file_range
+ */
+
+#include "pmemfile_test.hpp"
+
+#include <chrono>
+#include <thread>
+
+#define MB ((size_t)1024 * 1024)
+
+class copy_file_range : public pmemfile_test {
+public:
+	copy_file_range() : pmemfile_test(256 * MB)
+	{
+	}
+
+protected:
+	PMEMfile *
+	create_file(const char *path, size_t size, char pattern)
+	{
+		PMEMfile *f = pmemfile_open(pfp, path, PMEMFILE_O_CREAT |
+						       PMEMFILE_O_EXCL |
+						       PMEMFILE_O_RDWR,
+					    0644);
+		if (!f)
+			return nullptr;
+
+		std::vector<char> buf(size, pattern);
+		if (pmemfile_write(pfp, f, buf.data(), size) !=
+		    (pmemfile_ssize_t)size) {
+			pmemfile_close(pfp, f);
+			return nullptr;
+		}
+
+		return f;
+	}
+
+	bool
+	file_is(PMEMfile *f, pmemfile_off_t offset, size_t len, char pattern)
+	{
+		std::vector<char> buf(len);
+		std::vector<char> expected(len, pattern);
+
+		if (pmemfile_pread(pfp, f, buf.data(), len, offset) !=
+		    (pmemfile_ssize_t)len)
+			return false;
+
+		return memcmp(buf.data(), expected.data(), len) == 0;
+	}
+
+	/* number of allocated data blocks, 0 when running on top of pop */
+	unsigned
+	data_blocks()
+	{
+		if (is_pmemfile_pop)
+			return 0;
+
+		struct pmemfile_stats stats;
+		pmemfile_stats(pfp, &stats);
+
+		return stats.blocks;
+	}
+};
+
+TEST_F(copy_file_range, basic)
+{
+	PMEMfile *src = create_file("/src", 8 * MB, 'a');
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	PMEMfile *dst = pmemfile_open(pfp, "/dst", PMEMFILE_O_CREAT |
+					      PMEMFILE_O_EXCL |
+					      PMEMFILE_O_RDWR,
+				      0644);
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_lseek(pfp, src, 0, PMEMFILE_SEEK_SET), 0);
+
+	unsigned src_blocks = data_blocks();
+
+	/* at least one block of src lies entirely in [0, 6MB) */
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, NULL, dst, NULL, 6 * MB,
+					   0),
+		  (pmemfile_ssize_t)(6 * MB));
+
+	if (!is_pmemfile_pop) {
+		EXPECT_LT(data_blocks() - src_blocks, src_blocks);
+	}
+
+	EXPECT_EQ(pmemfile_lseek(pfp, src, 0, PMEMFILE_SEEK_CUR),
+		  (pmemfile_off_t)(6 * MB));
+	EXPECT_EQ(pmemfile_lseek(pfp, dst, 0, PMEMFILE_SEEK_CUR),
+		  (pmemfile_off_t)(6 * MB));
+	EXPECT_EQ(test_pmemfile_file_size(pfp, dst),
+		  (pmemfile_ssize_t)(6 * MB));
+	EXPECT_TRUE(file_is(dst, 0, 6 * MB, 'a'));
+
+	/* explicit offsets, copy is limited by the size of src */
+	pmemfile_off_t off_in = 6 * MB;
+	pmemfile_off_t off_out = 6 * MB;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   16 * MB, 0),
+		  (pmemfile_ssize_t)(2 * MB));
+	EXPECT_EQ(off_in, (pmemfile_off_t)(8 * MB));
+	EXPECT_EQ(off_out, (pmemfile_off_t)(8 * MB));
+	EXPECT_EQ(pmemfile_lseek(pfp, dst, 0, PMEMFILE_SEEK_CUR),
+		  (pmemfile_off_t)(6 * MB));
+	EXPECT_TRUE(file_is(dst, 0, 8 * MB, 'a'));
+
+	/* nothing to copy past the end of src */
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   MB, 0),
+		  0);
+
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+}
+
+TEST_F(copy_file_range, copy_on_write)
+{
+	PMEMfile *src = create_file("/src", 8 * MB, 'a');
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	PMEMfile *dst = create_file("/dst", 1, 'x');
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	pmemfile_off_t off_in = 0, off_out = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   8 * MB, 0),
+		  (pmemfile_ssize_t)(8 * MB));
+
+	/* marking files as sharing blocks doesn't change their mode */
+	pmemfile_stat_t st;
+	ASSERT_EQ(pmemfile_fstat(pfp, src, &st), 0);
+	EXPECT_EQ(st.st_mode, PMEMFILE_S_IFREG | 0644);
+	ASSERT_EQ(pmemfile_fstat(pfp, dst, &st), 0);
+	EXPECT_EQ(st.st_mode, PMEMFILE_S_IFREG | 0644);
+
+	std::vector<char> b(MB, 'b');
+	ASSERT_EQ(pmemfile_pwrite(pfp, dst, b.data(), MB, MB + 100),
+		  (pmemfile_ssize_t)MB);
+	EXPECT_TRUE(file_is(src, 0, 8 * MB, 'a'));
+	EXPECT_TRUE(file_is(dst, MB + 100, MB, 'b'));
+
+	std::vector<char> c(MB, 'c');
+	ASSERT_EQ(pmemfile_pwrite(pfp, src, c.data(), MB, 4 * MB),
+		  (pmemfile_ssize_t)MB);
+	EXPECT_TRUE(file_is(dst, 0, MB + 100, 'a'));
+	EXPECT_TRUE(file_is(dst, 2 * MB + 100, 6 * MB - 100, 'a'));
+	EXPECT_TRUE(file_is(src, 4 * MB, MB, 'c'));
+
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	/* block trees are rebuilt from the persistent state */
+	src = pmemfile_open(pfp, "/src", PMEMFILE_O_RDWR);
+	ASSERT_NE(src, nullptr) << strerror(errno);
+	dst = pmemfile_open(pfp, "/dst", PMEMFILE_O_RDWR);
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	EXPECT_TRUE(file_is(src, 0, 4 * MB, 'a'));
+	EXPECT_TRUE(file_is(src, 4 * MB, MB, 'c'));
+	EXPECT_TRUE(file_is(src, 5 * MB, 3 * MB, 'a'));
+	EXPECT_TRUE(file_is(dst, 0, MB + 100, 'a'));
+	EXPECT_TRUE(file_is(dst, MB + 100, MB, 'b'));
+	EXPECT_TRUE(file_is(dst, 2 * MB + 100, 6 * MB - 100, 'a'));
+
+	ASSERT_EQ(pmemfile_pwrite(pfp, dst, c.data(), MB, 6 * MB),
+		  (pmemfile_ssize_t)MB);
+	EXPECT_TRUE(file_is(src, 5 * MB, 3 * MB, 'a'));
+
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+}
+
+TEST_F(copy_file_range, write_waits_for_lease)
+{
+	PMEMfile *src = create_file("/src", 8 * MB, 'a');
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	PMEMfile *dst = create_file("/dst", 1, 'x');
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	pmemfile_off_t off_in = 0, off_out = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   8 * MB, 0),
+		  (pmemfile_ssize_t)(8 * MB));
+
+	/* borrow a part of the first shared block, next to the write below */
+	pmemfile_iovec_t iov[16];
+	int cnt = 16;
+	PMEMfilelease *lease;
+	ASSERT_EQ(pmemfile_pread_borrow(pfp, dst, 100, 100, iov, &cnt, &lease),
+		  100);
+
+	std::thread releaser([&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		pmemfile_pread_release(pfp, lease);
+	});
+
+	/* unsharing the block waits for the lease instead of failing */
+	std::vector<char> b(100, 'b');
+	ASSERT_EQ(pmemfile_pwrite(pfp, dst, b.data(), 100, 0), 100)
+		<< strerror(errno);
+
+	releaser.join();
+
+	EXPECT_TRUE(file_is(dst, 0, 100, 'b'));
+	EXPECT_TRUE(file_is(dst, 100, 8 * MB - 100, 'a'));
+	EXPECT_TRUE(file_is(src, 0, 8 * MB, 'a'));
+
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+}
+
+TEST_F(copy_file_range, unaligned)
+{
+	PMEMfile *src = create_file("/src", 4 * MB, 'a');
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	PMEMfile *dst = create_file("/dst", 8 * MB, 'x');
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	pmemfile_off_t off_in = 1, off_out = 4097;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   3 * MB, 0),
+		  (pmemfile_ssize_t)(3 * MB));
+
+	EXPECT_TRUE(file_is(dst, 0, 4097, 'x'));
+	EXPECT_TRUE(file_is(dst, 4097, 3 * MB, 'a'));
+	EXPECT_TRUE(file_is(dst, 3 * MB + 4097, 5 * MB - 4097, 'x'));
+	EXPECT_EQ(test_pmemfile_file_size(pfp, dst),
+		  (pmemfile_ssize_t)(8 * MB));
+
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+}
+
+TEST_F(copy_file_range, holes)
+{
+	PMEMfile *src = pmemfile_open(pfp, "/src", PMEMFILE_O_CREAT |
+					      PMEMFILE_O_EXCL |
+					      PMEMFILE_O_RDWR,
+				      0644);
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	std::vector<char> a(MB, 'a');
+	ASSERT_EQ(pmemfile_pwrite(pfp, src, a.data(), MB, 4 * MB),
+		  (pmemfile_ssize_t)MB);
+
+	PMEMfile *dst = create_file("/dst", 2 * MB, 'x');
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	pmemfile_off_t off_in = 0, off_out = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   5 * MB, 0),
+		  (pmemfile_ssize_t)(5 * MB));
+
+	/* a hole copied over data has to zero it */
+	EXPECT_TRUE(file_is(dst, 0, 4 * MB, 0));
+	EXPECT_TRUE(file_is(dst, 4 * MB, MB, 'a'));
+	EXPECT_EQ(test_pmemfile_file_size(pfp, dst),
+		  (pmemfile_ssize_t)(5 * MB));
+
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+}
+
+TEST_F(copy_file_range, same_file)
+{
+	PMEMfile *f = create_file("/file", 4 * MB, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	std::vector<char> b(2 * MB, 'b');
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, b.data(), 2 * MB, 2 * MB),
+		  (pmemfile_ssize_t)(2 * MB));
+
+	pmemfile_off_t off_in = 2 * MB, off_out = 8 * MB;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, f, &off_in, f, &off_out,
+					   2 * MB, 0),
+		  (pmemfile_ssize_t)(2 * MB));
+
+	off_in = 0;
+	off_out = 6 * MB + 10;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, f, &off_in, f, &off_out, MB,
+					   0),
+		  (pmemfile_ssize_t)MB);
+
+	EXPECT_TRUE(file_is(f, 0, 2 * MB, 'a'));
+	EXPECT_TRUE(file_is(f, 2 * MB, 2 * MB, 'b'));
+	EXPECT_TRUE(file_is(f, 4 * MB, 2 * MB + 10, 0));
+	EXPECT_TRUE(file_is(f, 6 * MB + 10, MB, 'a'));
+	EXPECT_TRUE(file_is(f, 7 * MB + 10, MB - 10, 0));
+	EXPECT_TRUE(file_is(f, 8 * MB, 2 * MB, 'b'));
+
+	/* both copies of shared data are written */
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, "c", 1, 8 * MB), 1);
+	EXPECT_TRUE(file_is(f, 2 * MB, 2 * MB, 'b'));
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, "d", 1, 2 * MB), 1);
+	EXPECT_TRUE(file_is(f, 2 * MB, 1, 'd'));
+	EXPECT_TRUE(file_is(f, 2 * MB + 1, 2 * MB - 1, 'b'));
+	EXPECT_TRUE(file_is(f, 8 * MB, 1, 'c'));
+	EXPECT_TRUE(file_is(f, 8 * MB + 1, 2 * MB - 1, 'b'));
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(copy_file_range, release)
+{
+	PMEMfile *src = create_file("/src", 8 * MB, 'a');
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	PMEMfile *dst = pmemfile_open(pfp, "/dst", PMEMFILE_O_CREAT |
+					      PMEMFILE_O_EXCL |
+					      PMEMFILE_O_RDWR,
+				      0644);
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	pmemfile_off_t off_in = 0, off_out = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, &off_out,
+					   8 * MB, 0),
+		  (pmemfile_ssize_t)(8 * MB));
+
+	pmemfile_close(pfp, src);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+
+	/* data of the unlinked file is kept until dst releases it */
+	EXPECT_TRUE(file_is(dst, 0, 8 * MB, 'a'));
+
+	/* both cut shared blocks in the middle */
+	ASSERT_EQ(pmemfile_fallocate(pfp, dst,
+				     PMEMFILE_FALLOC_FL_PUNCH_HOLE |
+					     PMEMFILE_FALLOC_FL_KEEP_SIZE,
+				     MB + 1, 2 * MB),
+		  0);
+	ASSERT_EQ(pmemfile_ftruncate(pfp, dst, 5 * MB + 3), 0);
+
+	EXPECT_TRUE(file_is(dst, 0, MB + 1, 'a'));
+	EXPECT_TRUE(file_is(dst, MB + 1, 2 * MB, 0));
+	EXPECT_TRUE(file_is(dst, 3 * MB + 1, 2 * MB + 2, 'a'));
+	EXPECT_EQ(test_pmemfile_file_size(pfp, dst),
+		  (pmemfile_ssize_t)(5 * MB + 3));
+
+	pmemfile_close(pfp, dst);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+
+	/* all references are dropped */
+	EXPECT_EQ(data_blocks(), 0u);
+}
+
+TEST_F(copy_file_range, errors)
+{
+	PMEMfile *src = create_file("/src", MB, 'a');
+	ASSERT_NE(src, nullptr) << strerror(errno);
+
+	PMEMfile *dst = create_file("/dst", MB, 'x');
+	ASSERT_NE(dst, nullptr) << strerror(errno);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(NULL, src, NULL, dst, NULL, 1, 0),
+		  -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, NULL, NULL, dst, NULL, 1, 0),
+		  -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, NULL, NULL, NULL, 1, 0),
+		  -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, NULL, dst, NULL, 1, 1),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	pmemfile_off_t off_in = -1;
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, dst, NULL, 1, 0),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	PMEMfile *ro = pmemfile_open(pfp, "/dst", PMEMFILE_O_RDONLY);
+	ASSERT_NE(ro, nullptr) << strerror(errno);
+	PMEMfile *wo = pmemfile_open(pfp, "/src", PMEMFILE_O_WRONLY);
+	ASSERT_NE(wo, nullptr) << strerror(errno);
+	PMEMfile *ap = pmemfile_open(pfp, "/dst",
+				     PMEMFILE_O_WRONLY | PMEMFILE_O_APPEND);
+	ASSERT_NE(ap, nullptr) << strerror(errno);
+	PMEMfile *dir = pmemfile_open(pfp, "/", PMEMFILE_O_DIRECTORY);
+	ASSERT_NE(dir, nullptr) << strerror(errno);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, NULL, ro, NULL, 1, 0), -1);
+	EXPECT_EQ(errno, EBADF);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, wo, NULL, dst, NULL, 1, 0), -1);
+	EXPECT_EQ(errno, EBADF);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, src, NULL, ap, NULL, 1, 0), -1);
+	EXPECT_EQ(errno, EBADF);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_copy_file_range(pfp, dir, NULL, dst, NULL, 1, 0),
+		  -1);
+	EXPECT_EQ(errno, EISDIR);
+
+	if (!is_pmemfile_pop) {
+		pmemfile_off_t off_out = 100;
+		off_in = 0;
+		errno = 0;
+		ASSERT_EQ(pmemfile_copy_file_range(pfp, src, &off_in, src,
+						   &off_out, 200, 0),
+			  -1);
+		EXPECT_EQ(errno, EINVAL);
+	}
+
+	pmemfile_close(pfp, dir);
+	pmemfile_close(pfp, ap);
+	pmemfile_close(pfp, wo);
+	pmemfile_close(pfp, ro);
+	pmemfile_close(pfp, src);
+	pmemfile_close(pfp, dst);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/src"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dst"), 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START();
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s global_path", argv[0]);
+		exit(1);
+	}
+
+	global_path = argv[1];
+
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -33,6 +33,10 @@ include(${SRC_DIR}/../posix-helpers.cmake)
 
 setup()
 
+if(DEFINED default_inline_data)
+	unset(ENV{PMEMFILE_INLINE_DATA_SIZE})
+endif()
+
 set(ENV{ASAN_OPTIONS} detect_leaks=0)
 
 function(exec_stage name)
@@ -45,5 +49,7 @@ exec_stage(crash1)
 exec_stage(openclose2)
 exec_stage(crash2)
 exec_stage(openclose3)
+exec_stage(crash3)
+exec_stage(openclose4)
 
 cleanup()
@@ -36,6 +36,8 @@
 
 #include "pmemfile_test.hpp"
 
+#include <thread>
+
 static PMEMfilepool *
 create_pool(const char *path)
 {
@@ -56,6 +58,30 @@ open_pool(const char *path)
 static const char *path;
 static const char *op;
 
+/*
+ * Leaves open, unlinked file and open temporary file. Every thread uses its
+ * own list of orphaned inodes.
+ */
+static void
+orphan_worker(PMEMfilepool *pfp, unsigned id)
+{
+	std::string name = "/orphan" + std::to_string(id);
+
+	if (!test_pmemfile_create(pfp, name.c_str(), PMEMFILE_O_EXCL, 0644))
+		abort();
+	if (!pmemfile_open(pfp, name.c_str(), PMEMFILE_O_WRONLY))
+		abort();
+	if (pmemfile_unlink(pfp, name.c_str()))
+		abort();
+
+	PMEMfile *f = pmemfile_open(
+		pfp, "/", PMEMFILE_O_TMPFILE | PMEMFILE_O_WRONLY, 0644);
+	if (!f)
+		abort();
+	if (pmemfile_write(pfp, f, "qwerty", 6) != 6)
+		abort();
+}
+
 TEST(crash, 0)
 {
 	if (strcmp(op, "prep") == 0) {
@@ -82,6 +108,17 @@ TEST(crash, 0)
 		ASSERT_NE(pmemfile_open(pfp, "/aaa", 0), nullptr);
 		ASSERT_EQ(pmemfile_unlink(pfp, "/aaa"), 0);
 
+		exit(0);
+	} else if (strcmp(op, "crash3") == 0) {
+		PMEMfilepool *pfp = open_pool(path);
+		ASSERT_NE(pfp, nullptr) << strerror(errno);
+
+		std::vector<std::thread> threads;
+		for (unsigned i = 0; i < 8; ++i)
+			threads.emplace_back(orphan_worker, pfp, i);
+		for (auto &t : threads)
+			t.join();
+
 		exit(0);
 	} else if (strcmp(op, "openclose1") == 0 ||
 		   strcmp(op, "openclose2") == 0) {
@@ -99,7 +136,8 @@ TEST(crash, 0)
 		EXPECT_TRUE(test_pmemfile_stats_match(pfp, 2, 1, 0, 0));
 
 		pmemfile_pool_close(pfp);
-	} else if (strcmp(op, "openclose3") == 0) {
+	} else if (strcmp(op, "openclose3") == 0 ||
+		   strcmp(op, "openclose4") == 0) {
 		PMEMfilepool *pfp = open_pool(path);
 		ASSERT_NE(pfp, nullptr) << strerror(errno);
 
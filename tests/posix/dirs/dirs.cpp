@@ -243,18 +243,231 @@ TEST_F(dirs, lots_of_files)
 	}
 
 	/*
-	 * For now pmemfile doesn't reclaim inode/dirent space when unlinking
-	 * files and it's not easy to calculate how big an inode space is, so
-	 * for now verify only when number of files is known.
+	 * Empty pages at the end of a directory are freed when files are
+	 * unlinked, but big directories are hashed and keep some of their
+	 * pages, so verify only when number of files is known.
 	 */
 	if (ops == 100)
 		EXPECT_TRUE(test_compare_dirs(pfp, "/",
 					      std::vector<pmemfile_ls>{
-						      {040777, 2, 36864, "."},
-						      {040777, 2, 36864, ".."},
+						      {040777, 2, 8192, "."},
+						      {040777, 2, 8192, ".."},
 					      }));
 }
 
+static int
+create_file(PMEMfilepool *pfp, const char *path)
+{
+	PMEMfile *f = pmemfile_open(pfp, path,
+				    PMEMFILE_O_CREAT | PMEMFILE_O_EXCL, 0644);
+	if (!f)
+		return -1;
+
+	pmemfile_close(pfp, f);
+	return 0;
+}
+
+TEST_F(dirs, big_dir_lookups)
+{
+	char buf[100], buf2[100];
+	pmemfile_stat_t st;
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir", 0755), 0);
+
+	/* big enough to get a name index */
+	for (unsigned i = 0; i < 500; ++i) {
+		sprintf(buf, "/dir/file%u", i);
+		ASSERT_EQ(create_file(pfp, buf), 0) << strerror(errno);
+	}
+
+	errno = 0;
+	ASSERT_EQ(create_file(pfp, "/dir/file123"), -1);
+	EXPECT_EQ(errno, EEXIST);
+
+	for (unsigned i = 0; i < 500; i += 2) {
+		sprintf(buf, "/dir/file%u", i);
+		ASSERT_EQ(pmemfile_unlink(pfp, buf), 0) << strerror(errno);
+	}
+
+	for (unsigned i = 1; i < 500; i += 4) {
+		sprintf(buf, "/dir/file%u", i);
+		sprintf(buf2, "/dir/renamed%u", i);
+		ASSERT_EQ(pmemfile_rename(pfp, buf, buf2), 0)
+			<< strerror(errno);
+	}
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir/subdir", 0755), 0);
+	ASSERT_EQ(pmemfile_rename(pfp, "/dir/file3", "/dir/subdir/file3"), 0);
+
+	for (unsigned i = 0; i < 500; ++i) {
+		sprintf(buf, "/dir/file%u", i);
+		sprintf(buf2, "/dir/renamed%u", i);
+
+		int file_ret = pmemfile_stat(pfp, buf, &st);
+		int renamed_ret = pmemfile_stat(pfp, buf2, &st);
+
+		if (i % 2 == 0 || i == 3) {
+			EXPECT_EQ(file_ret, -1) << buf;
+			EXPECT_EQ(renamed_ret, -1) << buf2;
+		} else if (i % 4 == 1) {
+			EXPECT_EQ(file_ret, -1) << buf;
+			EXPECT_EQ(renamed_ret, 0) << buf2;
+		} else {
+			EXPECT_EQ(file_ret, 0) << buf;
+			EXPECT_EQ(renamed_ret, -1) << buf2;
+		}
+	}
+
+	EXPECT_EQ(pmemfile_stat(pfp, "/dir/subdir/file3", &st), 0);
+	EXPECT_EQ(pmemfile_stat(pfp, "/dir/subdir/..", &st), 0);
+
+	/* freed slots and names can be reused */
+	for (unsigned i = 0; i < 500; ++i) {
+		sprintf(buf, "/dir/file%u", i);
+		ASSERT_EQ(create_file(pfp, buf),
+			  i % 2 == 0 || i % 4 == 1 || i == 3 ? 0 : -1)
+			<< buf;
+	}
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dir/subdir/file3"), 0);
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir/subdir"), 0);
+
+	for (unsigned i = 0; i < 500; ++i) {
+		sprintf(buf, "/dir/file%u", i);
+		ASSERT_EQ(pmemfile_unlink(pfp, buf), 0) << buf;
+
+		if (i % 4 == 1) {
+			sprintf(buf2, "/dir/renamed%u", i);
+			ASSERT_EQ(pmemfile_unlink(pfp, buf2), 0) << buf2;
+		}
+	}
+
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir"), 0);
+}
+
+/*
+ * read_dir_chunk -- reads one small chunk of a directory, counting returned
+ * names in "names"
+ */
+static int
+read_dir_chunk(PMEMfilepool *pfp, PMEMfile *f,
+	       std::map<std::string, unsigned> &names,
+	       uint64_t *last_off = nullptr)
+{
+	char buf[512];
+	int r = pmemfile_getdents64(pfp, f, (struct linux_dirent64 *)buf,
+				    sizeof(buf));
+
+	for (int pos = 0; pos < r;) {
+		struct linux_dirent64 *d = (struct linux_dirent64 *)&buf[pos];
+
+		names[d->d_name]++;
+		if (last_off)
+			*last_off = d->d_off;
+		pos += d->d_reclen;
+	}
+
+	return r;
+}
+
+TEST_F(dirs, hashed_dir)
+{
+	char buf[100], buf2[100];
+	pmemfile_stat_t st;
+	std::map<std::string, unsigned> names;
+	int r;
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir", 0755), 0);
+
+	/* big enough to be converted to a hashed directory */
+	for (unsigned i = 0; i < 2000; ++i) {
+		sprintf(buf, "/dir/f%u", i);
+		ASSERT_EQ(create_file(pfp, buf), 0) << strerror(errno);
+	}
+
+	errno = 0;
+	ASSERT_EQ(create_file(pfp, "/dir/f1999"), -1);
+	EXPECT_EQ(errno, EEXIST);
+
+	PMEMfile *f = pmemfile_open(pfp, "/dir",
+				    PMEMFILE_O_DIRECTORY | PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	while ((r = read_dir_chunk(pfp, f, names)) > 0)
+		;
+	ASSERT_EQ(r, 0);
+	EXPECT_EQ(names.size(), 2002u);
+	for (auto &n : names)
+		EXPECT_EQ(n.second, 1u) << n.first;
+
+	/* readdir positions survive growing of the directory */
+	names.clear();
+	uint64_t off = 0;
+	ASSERT_EQ(pmemfile_lseek(pfp, f, 0, PMEMFILE_SEEK_SET), 0);
+	while (names.size() < 1000)
+		ASSERT_GT(read_dir_chunk(pfp, f, names, &off), 0);
+
+	for (unsigned i = 0; i < 2000; ++i) {
+		sprintf(buf, "/dir/g%u", i);
+		ASSERT_EQ(create_file(pfp, buf), 0) << strerror(errno);
+	}
+
+	/* offset of the last returned entry points to the next one */
+	std::map<std::string, unsigned> names2;
+	ASSERT_EQ(pmemfile_lseek(pfp, f, (pmemfile_off_t)off,
+				 PMEMFILE_SEEK_SET),
+		  (pmemfile_off_t)off);
+	ASSERT_GT(read_dir_chunk(pfp, f, names2), 0);
+	ASSERT_EQ(pmemfile_lseek(pfp, f, (pmemfile_off_t)off,
+				 PMEMFILE_SEEK_SET),
+		  (pmemfile_off_t)off);
+
+	while ((r = read_dir_chunk(pfp, f, names)) > 0)
+		;
+	ASSERT_EQ(r, 0);
+	for (auto &n : names)
+		EXPECT_EQ(n.second, 1u) << n.first;
+	for (auto &n : names2)
+		EXPECT_EQ(names[n.first], 1u) << n.first;
+	for (unsigned i = 0; i < 2000; ++i) {
+		sprintf(buf, "f%u", i);
+		EXPECT_EQ(names[buf], 1u) << buf;
+	}
+	EXPECT_EQ(names["."], 1u);
+	EXPECT_EQ(names[".."], 1u);
+
+	pmemfile_close(pfp, f);
+
+	for (unsigned i = 0; i < 2000; i += 3) {
+		sprintf(buf, "/dir/f%u", i);
+		sprintf(buf2, "/dir/renamed%u", i);
+		ASSERT_EQ(pmemfile_rename(pfp, buf, buf2), 0)
+			<< strerror(errno);
+	}
+
+	for (unsigned i = 0; i < 2000; ++i) {
+		sprintf(buf, "/dir/f%u", i);
+		sprintf(buf2, "/dir/renamed%u", i);
+		EXPECT_EQ(pmemfile_stat(pfp, buf, &st), i % 3 ? 0 : -1) << buf;
+		EXPECT_EQ(pmemfile_stat(pfp, buf2, &st), i % 3 ? -1 : 0)
+			<< buf2;
+	}
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir"), -1);
+	EXPECT_EQ(errno, ENOTEMPTY);
+
+	for (unsigned i = 0; i < 2000; ++i) {
+		sprintf(buf, "/dir/%s%u", i % 3 ? "f" : "renamed", i);
+		ASSERT_EQ(pmemfile_unlink(pfp, buf), 0) << buf;
+		sprintf(buf, "/dir/g%u", i);
+		ASSERT_EQ(pmemfile_unlink(pfp, buf), 0) << buf;
+	}
+
+	ASSERT_TRUE(test_empty_dir(pfp, "/dir"));
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir"), 0);
+}
+
 TEST_F(dirs, mkdir_rmdir_unlink_errors)
 {
 	char buf[1001];
@@ -609,6 +822,194 @@ TEST_F(dirs, rmdir_notempty_dir_with_holes)
 	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir1"), 0);
 }
 
+TEST_F(dirs, dir_shrinks_after_unlink)
+{
+	pmemfile_stat_t empty, full, st;
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir1", 0755), 0);
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1", &empty), 0);
+
+	char buf[1001];
+	for (size_t i = 0; i < ops; ++i) {
+		sprintf(buf, "/dir1/file%04zu", i);
+		ASSERT_TRUE(
+			test_pmemfile_create(pfp, buf, PMEMFILE_O_EXCL, 0644));
+	}
+
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1", &full), 0);
+	ASSERT_GT(full.st_size, empty.st_size);
+
+	/* removing entries from the end frees trailing pages */
+	for (size_t i = ops; i > 0; --i) {
+		sprintf(buf, "/dir1/file%04zu", i - 1);
+		ASSERT_EQ(pmemfile_unlink(pfp, buf), 0);
+	}
+
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1", &st), 0);
+	ASSERT_EQ(st.st_size, empty.st_size);
+
+	/* freed space is reused */
+	for (size_t i = 0; i < ops; ++i) {
+		sprintf(buf, "/dir1/file%04zu", i);
+		ASSERT_TRUE(
+			test_pmemfile_create(pfp, buf, PMEMFILE_O_EXCL, 0644));
+	}
+
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1", &st), 0);
+	ASSERT_EQ(st.st_size, full.st_size);
+
+	for (size_t i = 0; i < ops; ++i) {
+		sprintf(buf, "/dir1/file%04zu", i);
+		ASSERT_EQ(pmemfile_unlink(pfp, buf), 0);
+	}
+
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1", &st), 0);
+	ASSERT_EQ(st.st_size, empty.st_size);
+
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir1"), 0);
+}
+
+TEST_F(dirs, create_unlink_batch)
+{
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir1", 0755), 0);
+	PMEMfile *dir = pmemfile_open(pfp, "/dir1", PMEMFILE_O_DIRECTORY);
+	ASSERT_NE(dir, nullptr) << strerror(errno);
+
+	std::vector<std::string> strs;
+	for (size_t i = 0; i < ops; ++i)
+		strs.push_back("file" + std::to_string(i));
+
+	std::vector<const char *> names;
+	for (const std::string &s : strs)
+		names.push_back(s.c_str());
+	std::vector<pmemfile_mode_t> modes(ops, 0644);
+	std::vector<PMEMfile *> files(ops, nullptr);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_create_batch(pfp, dir, names.data(), modes.data(),
+					files.data(), 0),
+		  0);
+	ASSERT_EQ(pmemfile_create_batch(NULL, dir, names.data(), modes.data(),
+					files.data(), ops),
+		  -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	const char *bad[] = {"a", "b/c"};
+	pmemfile_mode_t bad_modes[] = {0644, 0644};
+	ASSERT_EQ(pmemfile_create_batch(pfp, dir, bad, bad_modes, NULL, 2),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	/* the last name exists, so nothing is created */
+	ASSERT_TRUE(test_pmemfile_create(pfp, ("/dir1/" + strs[ops - 1]).c_str(),
+					 0, 0644));
+	ASSERT_EQ(pmemfile_create_batch(pfp, dir, names.data(), modes.data(),
+					files.data(), ops),
+		  -1);
+	EXPECT_EQ(errno, EEXIST);
+	ASSERT_EQ(pmemfile_unlinkat(pfp, dir, names[ops - 1], 0), 0);
+	ASSERT_TRUE(test_empty_dir(pfp, "/dir1"));
+
+	ASSERT_EQ(pmemfile_create_batch(pfp, dir, names.data(), modes.data(),
+					files.data(), ops),
+		  0)
+		<< strerror(errno);
+
+	for (size_t i = 0; i < ops; ++i) {
+		ASSERT_NE(files[i], nullptr);
+		ASSERT_EQ(pmemfile_write(pfp, files[i], "x", 1), 1);
+		pmemfile_close(pfp, files[i]);
+
+		pmemfile_stat_t st;
+		ASSERT_EQ(pmemfile_fstatat(pfp, dir, names[i], &st, 0), 0);
+		EXPECT_EQ(st.st_size, 1);
+		EXPECT_EQ(st.st_nlink, 1u);
+		EXPECT_EQ(st.st_mode & PMEMFILE_ALLPERMS, 0644u);
+	}
+
+	/* files are not opened */
+	ASSERT_EQ(pmemfile_create_batch(pfp, dir, bad, bad_modes, NULL, 1), 0);
+
+	/* directories can't be removed, so nothing is removed */
+	ASSERT_EQ(pmemfile_mkdirat(pfp, dir, "subdir", 0755), 0);
+	const char *with_dir[] = {"a", "subdir"};
+	ASSERT_EQ(pmemfile_unlink_batch(pfp, dir, with_dir, 2), -1);
+	EXPECT_EQ(errno, EISDIR);
+	ASSERT_EQ(pmemfile_unlinkat(pfp, dir, "subdir", PMEMFILE_AT_REMOVEDIR),
+		  0);
+
+	/* repeated name fails */
+	const char *twice[] = {"a", "a"};
+	ASSERT_EQ(pmemfile_unlink_batch(pfp, dir, twice, 2), -1);
+	EXPECT_EQ(errno, ENOENT);
+
+	/* hard links to one file are removed together */
+	ASSERT_EQ(pmemfile_linkat(pfp, dir, "a", dir, "b", 0), 0);
+	const char *links[] = {"a", "b"};
+	ASSERT_EQ(pmemfile_unlink_batch(pfp, dir, links, 2), 0);
+
+	ASSERT_EQ(pmemfile_unlink_batch(pfp, dir, names.data(), ops), 0);
+	ASSERT_EQ(pmemfile_unlink_batch(pfp, dir, names.data(), 1), -1);
+	EXPECT_EQ(errno, ENOENT);
+
+	ASSERT_TRUE(test_empty_dir(pfp, "/dir1"));
+
+	pmemfile_close(pfp, dir);
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir1"), 0);
+}
+
+TEST_F(dirs, lookup_cache)
+{
+	struct pmemfile_stats before, after;
+	pmemfile_stat_t st;
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir1", 0755), 0);
+	ASSERT_TRUE(test_pmemfile_create(pfp, "/dir1/file1", 0, 0644));
+
+	pmemfile_stats(pfp, &before);
+
+	for (int i = 0; i < 2; ++i) {
+		ASSERT_EQ(pmemfile_stat(pfp, "/dir1/file1", &st), 0);
+
+		errno = 0;
+		ASSERT_EQ(pmemfile_stat(pfp, "/dir1/file2", &st), -1);
+		ASSERT_EQ(errno, ENOENT);
+	}
+
+	pmemfile_stats(pfp, &after);
+
+	if (!is_pmemfile_pop) {
+		EXPECT_GT(after.dcache_hits, before.dcache_hits);
+		EXPECT_GT(after.dcache_negative_hits,
+			  before.dcache_negative_hits);
+	}
+
+	/* cached results must not survive modifications of the directory */
+	ASSERT_TRUE(test_pmemfile_create(pfp, "/dir1/file2", 0, 0644));
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1/file2", &st), 0);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dir1/file1"), 0);
+	errno = 0;
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1/file1", &st), -1);
+	ASSERT_EQ(errno, ENOENT);
+
+	ASSERT_EQ(pmemfile_rename(pfp, "/dir1/file2", "/dir1/file1"), 0);
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1/file1", &st), 0);
+	errno = 0;
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1/file2", &st), -1);
+	ASSERT_EQ(errno, ENOENT);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/dir1/file1"), 0);
+
+	/* unlinked files are not kept alive by the cache */
+	ASSERT_TRUE(test_pmemfile_stats_match(pfp, 1, 0, 0, 0));
+
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir1"), 0);
+	errno = 0;
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir1", &st), -1);
+	ASSERT_EQ(errno, ENOENT);
+}
+
 TEST_F(dirs, chdir_getcwd)
 {
 	char buf[PMEMFILE_PATH_MAX];
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * inline_data.cpp -- unit test for data of small files stored in the inode
+ */
+
+#include "pmemfile_test.hpp"
+
+#include <vector>
+
+/* set by inline_data.cmake */
+#define INLINE_DATA_SIZE 3072
+
+class inline_data : public pmemfile_test {
+public:
+	inline_data() : pmemfile_test()
+	{
+	}
+
+protected:
+	PMEMfile *
+	create_file(const char *path)
+	{
+		return pmemfile_open(pfp, path, PMEMFILE_O_CREAT |
+					 PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				     0644);
+	}
+
+	/* number of allocated data blocks, 0 when running on top of pop */
+	unsigned
+	data_blocks()
+	{
+		if (is_pmemfile_pop)
+			return 0;
+
+		struct pmemfile_stats stats;
+		pmemfile_stats(pfp, &stats);
+
+		return stats.blocks;
+	}
+
+	bool
+	file_is(PMEMfile *f, const std::vector<char> &expected)
+	{
+		std::vector<char> buf(expected.size() + 1);
+
+		pmemfile_ssize_t r =
+			pmemfile_pread(pfp, f, buf.data(), buf.size(), 0);
+		if (r != (pmemfile_ssize_t)expected.size())
+			return false;
+
+		return memcmp(buf.data(), expected.data(), expected.size()) ==
+			0;
+	}
+};
+
+TEST_F(inline_data, small_file)
+{
+	std::vector<char> data(100);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = (char)(i + 1);
+
+	PMEMfile *f = create_file("/file");
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	pmemfile_ssize_t w = pmemfile_write(pfp, f, data.data(), data.size());
+	ASSERT_EQ(w, (pmemfile_ssize_t)data.size()) << COND_ERROR(w);
+
+	EXPECT_EQ(data_blocks(), 0u);
+	if (!is_pmemfile_pop) {
+		pmemfile_stat_t st;
+		ASSERT_EQ(pmemfile_fstat(pfp, f, &st), 0);
+		EXPECT_EQ(st.st_size, (pmemfile_off_t)data.size());
+		EXPECT_EQ(st.st_blocks, 0);
+	}
+
+	/* overwrite in the middle */
+	memset(&data[10], 0x55, 20);
+	w = pmemfile_pwrite(pfp, f, &data[10], 20, 10);
+	ASSERT_EQ(w, 20) << COND_ERROR(w);
+
+	EXPECT_TRUE(file_is(f, data));
+
+	pmemfile_close(pfp, f);
+
+	f = pmemfile_open(pfp, "/file", PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	EXPECT_TRUE(file_is(f, data));
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(inline_data, holes)
+{
+	std::vector<char> data(1000, 0);
+	memset(&data[0], 'a', 10);
+	memset(&data[990], 'b', 10);
+
+	PMEMfile *f = create_file("/file");
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_write(pfp, f, &data[0], 10), 10);
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, &data[990], 10, 990), 10);
+
+	EXPECT_EQ(data_blocks(), 0u);
+	EXPECT_TRUE(file_is(f, data));
+
+	/* bytes cut off by truncate must not come back */
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 5), 0);
+	data.resize(5);
+	EXPECT_TRUE(file_is(f, data));
+
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 2000), 0);
+	data.resize(2000, 0);
+	EXPECT_TRUE(file_is(f, data));
+
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 3), 0);
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, "c", 1, 1500), 1);
+	data.resize(3);
+	data.resize(1501, 0);
+	data[1500] = 'c';
+	EXPECT_TRUE(file_is(f, data));
+
+	EXPECT_EQ(data_blocks(), 0u);
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(inline_data, grow)
+{
+	std::vector<char> data(INLINE_DATA_SIZE + 1000);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = (char)(i % 251);
+
+	PMEMfile *f = create_file("/file");
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_write(pfp, f, data.data(), INLINE_DATA_SIZE),
+		  INLINE_DATA_SIZE);
+	EXPECT_EQ(data_blocks(), 0u);
+
+	/* data moves to blocks */
+	ASSERT_EQ(pmemfile_write(pfp, f, &data[INLINE_DATA_SIZE], 1000),
+		  1000);
+	if (!is_pmemfile_pop)
+		EXPECT_GT(data_blocks(), 0u);
+
+	EXPECT_TRUE(file_is(f, data));
+
+	/* and stays there when the file shrinks */
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 100), 0);
+	data.resize(100);
+	EXPECT_TRUE(file_is(f, data));
+
+	/* empty file can store its data inline again */
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 0), 0);
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, data.data(), 100, 0), 100);
+	EXPECT_EQ(data_blocks(), 0u);
+	EXPECT_TRUE(file_is(f, data));
+
+	/* truncate past inline data size moves data to blocks too */
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, INLINE_DATA_SIZE * 2), 0);
+	data.resize(INLINE_DATA_SIZE * 2, 0);
+	EXPECT_TRUE(file_is(f, data));
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(inline_data, fallocate)
+{
+	std::vector<char> data(200, 'x');
+
+	PMEMfile *f = create_file("/file");
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_write(pfp, f, data.data(), data.size()), 200);
+	EXPECT_EQ(data_blocks(), 0u);
+
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_KEEP_SIZE, 0,
+				     4096),
+		  0);
+	if (!is_pmemfile_pop)
+		EXPECT_GT(data_blocks(), 0u);
+
+	EXPECT_TRUE(file_is(f, data));
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(inline_data, seek_and_fiemap)
+{
+	std::vector<char> data(300, 'y');
+
+	PMEMfile *f = create_file("/file");
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, data.data(), data.size(), 100),
+		  300);
+
+	/* the gap before written data is not a hole */
+	EXPECT_EQ(pmemfile_lseek(pfp, f, 0, PMEMFILE_SEEK_DATA), 0);
+	EXPECT_EQ(pmemfile_lseek(pfp, f, 50, PMEMFILE_SEEK_HOLE), 400);
+
+	if (!is_pmemfile_pop) {
+		struct pmemfile_extent ext[2];
+
+		ASSERT_EQ(pmemfile_fiemap(pfp, f, 0, 400, ext, 2), 1);
+		EXPECT_EQ(ext[0].offset, 0u);
+		EXPECT_EQ(ext[0].length, 400u);
+		EXPECT_TRUE(ext[0].flags & PMEMFILE_FIEMAP_EXTENT_DATA_INLINE);
+		EXPECT_TRUE(ext[0].flags & PMEMFILE_FIEMAP_EXTENT_LAST);
+	}
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START();
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s global_path", argv[0]);
+		exit(1);
+	}
+
+	global_path = argv[1];
+
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
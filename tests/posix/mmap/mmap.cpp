@@ -0,0 +1,416 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * mmap.cpp -- unit test for pmemfile_mmap and friends
+ */
+
+#include "pmemfile_test.hpp"
+
+#include <unistd.h>
+
+static size_t page_size;
+
+class mmap : public pmemfile_test {
+public:
+	mmap() : pmemfile_test(64 * 1024 * 1024)
+	{
+	}
+
+protected:
+	PMEMfile *
+	create_file(const char *path, size_t size, char pattern)
+	{
+		PMEMfile *f = pmemfile_open(pfp, path, PMEMFILE_O_CREAT |
+						       PMEMFILE_O_EXCL |
+						       PMEMFILE_O_RDWR,
+					    0644);
+		if (!f)
+			return nullptr;
+
+		std::vector<char> buf(size, pattern);
+		if (pmemfile_write(pfp, f, buf.data(), size) !=
+		    (pmemfile_ssize_t)size) {
+			pmemfile_close(pfp, f);
+			return nullptr;
+		}
+
+		return f;
+	}
+
+	bool
+	file_equals(PMEMfile *f, pmemfile_off_t offset, const char *data,
+		    size_t len)
+	{
+		std::vector<char> buf(len);
+
+		if (pmemfile_pread(pfp, f, buf.data(), len, offset) !=
+		    (pmemfile_ssize_t)len)
+			return false;
+
+		return memcmp(buf.data(), data, len) == 0;
+	}
+};
+
+TEST_F(mmap, errors)
+{
+	PMEMfile *f = create_file("/file", page_size, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_mmap(pfp, NULL, 0, PMEMFILE_PROT_READ,
+				PMEMFILE_MAP_SHARED, f, 0),
+		  PMEMFILE_MAP_FAILED);
+	EXPECT_EQ(errno, EINVAL);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_mmap(pfp, NULL, page_size, PMEMFILE_PROT_READ,
+				PMEMFILE_MAP_SHARED, f, 1),
+		  PMEMFILE_MAP_FAILED);
+	EXPECT_EQ(errno, EINVAL);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_mmap(pfp, NULL, page_size, PMEMFILE_PROT_READ, 0, f,
+				0),
+		  PMEMFILE_MAP_FAILED);
+	EXPECT_EQ(errno, EINVAL);
+
+	pmemfile_close(pfp, f);
+
+	f = pmemfile_open(pfp, "/file", PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_mmap(pfp, NULL, page_size,
+				PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+				PMEMFILE_MAP_SHARED, f, 0),
+		  PMEMFILE_MAP_FAILED);
+	EXPECT_EQ(errno, EACCES);
+
+	/* private writable mapping of read-only file is fine */
+	void *addr = pmemfile_mmap(pfp, NULL, page_size,
+				   PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+				   PMEMFILE_MAP_PRIVATE, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, page_size), 0);
+
+	pmemfile_close(pfp, f);
+
+	f = pmemfile_open(pfp, "/", PMEMFILE_O_DIRECTORY | PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_mmap(pfp, NULL, page_size, PMEMFILE_PROT_READ,
+				PMEMFILE_MAP_SHARED, f, 0),
+		  PMEMFILE_MAP_FAILED);
+	EXPECT_EQ(errno, ENODEV);
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+
+	if (_pmemfile_fault_injection_enabled()) {
+		/* block tree of a new, empty file is built by mmap */
+		f = pmemfile_open(pfp, "/file", PMEMFILE_O_CREAT |
+					  PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				  0644);
+		ASSERT_NE(f, nullptr) << strerror(errno);
+
+		_pmemfile_inject_fault_at(PF_CALLOC, 1, "offset_map_new");
+
+		errno = 0;
+		ASSERT_EQ(pmemfile_mmap(pfp, NULL, page_size,
+					PMEMFILE_PROT_READ, PMEMFILE_MAP_SHARED,
+					f, 0),
+			  PMEMFILE_MAP_FAILED);
+		EXPECT_EQ(errno, ENOMEM);
+
+		pmemfile_close(pfp, f);
+
+		ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+	}
+}
+
+TEST_F(mmap, shared)
+{
+	const size_t len = 16 * page_size;
+	PMEMfile *f = create_file("/file", len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, len, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	std::vector<char> expected(len, 'a');
+	ASSERT_EQ(memcmp(addr, expected.data(), len), 0);
+
+	/* stores through the mapping reach the file after msync */
+	memset(addr + 100, 'b', 2 * page_size);
+	memset(expected.data() + 100, 'b', 2 * page_size);
+	ASSERT_EQ(pmemfile_msync(pfp, addr, len, PMEMFILE_MS_SYNC), 0);
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), len));
+
+	/* and after munmap */
+	memset(addr + len - 10, 'c', 10);
+	memset(expected.data() + len - 10, 'c', 10);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, len), 0);
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), len));
+
+	/* offset mapping sees writes done before mapping */
+	addr = (char *)pmemfile_mmap(pfp, NULL, page_size, PMEMFILE_PROT_READ,
+				     PMEMFILE_MAP_SHARED, f,
+				     (pmemfile_off_t)page_size);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+	EXPECT_EQ(memcmp(addr, expected.data() + page_size, page_size), 0);
+
+	/* read-only mappings don't need writing back */
+	ASSERT_EQ(pmemfile_msync(pfp, addr, page_size, PMEMFILE_MS_SYNC), 0);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, page_size), 0);
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(mmap, private)
+{
+	const size_t len = 4 * page_size;
+	PMEMfile *f = create_file("/file", len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, len, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_PRIVATE, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	std::vector<char> expected(len, 'a');
+	ASSERT_EQ(memcmp(addr, expected.data(), len), 0);
+
+	memset(addr, 'b', len);
+	ASSERT_EQ(pmemfile_msync(pfp, addr, len, PMEMFILE_MS_SYNC), 0);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, len), 0);
+
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), len));
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(mmap, past_eof)
+{
+	PMEMfile *f = create_file("/file", 100, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, page_size, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	for (size_t i = 0; i < page_size; ++i)
+		ASSERT_EQ(addr[i], i < 100 ? 'a' : 0) << i;
+
+	/* mapping doesn't change file size */
+	memset(addr, 'b', page_size);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, page_size), 0);
+
+	pmemfile_stat_t st;
+	ASSERT_EQ(pmemfile_fstat(pfp, f, &st), 0);
+	EXPECT_EQ(st.st_size, 100);
+
+	std::vector<char> expected(100, 'b');
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), 100));
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(mmap, partial_unmap)
+{
+	const size_t len = 4 * page_size;
+	PMEMfile *f = create_file("/file", len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, len, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	std::vector<char> expected(len, 'a');
+
+	ASSERT_EQ(pmemfile_munmap(pfp, addr + page_size, page_size), 0);
+
+	memset(addr, 'b', page_size);
+	memset(expected.data(), 'b', page_size);
+	memset(addr + 3 * page_size, 'c', page_size);
+	memset(expected.data() + 3 * page_size, 'c', page_size);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_msync(pfp, addr, len, PMEMFILE_MS_SYNC), -1);
+	EXPECT_EQ(errno, ENOMEM);
+
+	ASSERT_EQ(pmemfile_msync(pfp, addr, page_size, PMEMFILE_MS_SYNC), 0);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, len), 0);
+
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), len));
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(mmap, mremap)
+{
+	const size_t len = 2 * page_size;
+	PMEMfile *f = create_file("/file", 2 * len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, len, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	memset(addr, 'b', len);
+
+	char *naddr = (char *)pmemfile_mremap(pfp, addr, len, 2 * len,
+					      PMEMFILE_MREMAP_MAYMOVE, NULL);
+	ASSERT_NE(naddr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	std::vector<char> expected(2 * len, 'a');
+	memset(expected.data(), 'b', len);
+	EXPECT_EQ(memcmp(naddr, expected.data(), 2 * len), 0);
+
+	/* shrink in place */
+	ASSERT_EQ(pmemfile_mremap(pfp, naddr, 2 * len, len, 0, NULL),
+		  (void *)naddr);
+	ASSERT_EQ(pmemfile_munmap(pfp, naddr, len), 0);
+
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), 2 * len));
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(mmap, mprotect)
+{
+	const size_t len = 2 * page_size;
+	PMEMfile *f = create_file("/file", len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, len, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	memset(addr, 'b', len);
+
+	/* data written before making pages inaccessible is not lost */
+	ASSERT_EQ(pmemfile_mprotect(pfp, addr, len, PMEMFILE_PROT_NONE), 0);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, len), 0);
+
+	std::vector<char> expected(len, 'b');
+	EXPECT_TRUE(file_equals(f, 0, expected.data(), len));
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+TEST_F(mmap, truncate)
+{
+	/* kernel raises SIGBUS on access past the end of file */
+	if (is_pmemfile_pop)
+		return;
+
+	const size_t len = 4 * page_size;
+	PMEMfile *f = create_file("/file", len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(
+		pfp, NULL, len, PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+		PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, (pmemfile_off_t)page_size + 10),
+		  0);
+
+	/* reuse freed space */
+	PMEMfile *g = create_file("/file2", len, 'x');
+	ASSERT_NE(g, nullptr) << strerror(errno);
+
+	for (size_t i = 0; i < len; ++i)
+		ASSERT_EQ(addr[i], i < page_size + 10 ? 'a' : 0) << i;
+
+	memset(addr, 'b', len);
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, len), 0);
+
+	std::vector<char> expected(len, 'x');
+	EXPECT_TRUE(file_equals(g, 0, expected.data(), len));
+
+	pmemfile_close(pfp, g);
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file2"), 0);
+}
+
+TEST_F(mmap, unlink_while_mapped)
+{
+	const size_t len = 2 * page_size;
+	PMEMfile *f = create_file("/file", len, 'a');
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char *addr = (char *)pmemfile_mmap(pfp, NULL, len, PMEMFILE_PROT_READ,
+					   PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(addr, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+
+	std::vector<char> expected(len, 'a');
+	EXPECT_EQ(memcmp(addr, expected.data(), len), 0);
+
+	ASSERT_EQ(pmemfile_munmap(pfp, addr, len), 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START();
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s global_path", argv[0]);
+		exit(1);
+	}
+
+	global_path = argv[1];
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -33,6 +33,10 @@ include(${SRC_DIR}/../posix-helpers.cmake)
 
 setup()
 
+if(DEFINED group_commit)
+	set(ENV{PMEMFILE_GROUP_COMMIT} ${group_commit})
+endif()
+
 execute(${TEST_EXECUTABLE} ${ops} ${filter})
 
 cleanup()
@@ -33,9 +33,12 @@
 /*
  * mt.cpp -- multithreaded test for pmemfile_*
  */
+#include <chrono>
 #include <cstdlib>
 #include <list>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "pmemfile_test.hpp"
 
@@ -183,6 +186,135 @@ TEST_F(mt, pread)
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
 }
 
+static void
+pwrite_worker(PMEMfile *file, unsigned idx)
+{
+	char buf[1024];
+
+	for (int i = 0; i < ops * 10; ++i) {
+		pmemfile_off_t off = (pmemfile_off_t)(idx << 12) +
+			(rand() % 4) * 1024;
+		memset(buf, (char)(idx + (unsigned)i), sizeof(buf));
+		pmemfile_ssize_t ret =
+			pmemfile_pwrite(global_pfp, file, buf, sizeof(buf), off);
+		if (ret != (pmemfile_ssize_t)sizeof(buf))
+			abort();
+	}
+
+	/* leave a recognizable pattern in the whole region of this thread */
+	memset(buf, (char)idx, sizeof(buf));
+	for (pmemfile_off_t off = 0; off < 4096; off += 1024) {
+		if (pmemfile_pwrite(global_pfp, file, buf, sizeof(buf),
+				(pmemfile_off_t)(idx << 12) + off) !=
+				(pmemfile_ssize_t)sizeof(buf))
+			abort();
+	}
+}
+
+TEST_F(mt, pwrite_disjoint)
+{
+	PMEMfile *file =
+		pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT | PMEMFILE_O_RDWR,
+			      PMEMFILE_S_IRWXU);
+	ASSERT_NE(file, nullptr);
+
+	unsigned randomness = 1;
+	unsigned nthreads = ncpus + randomness;
+
+	/* allocate and initialize all space, so writers can go in parallel */
+	char buf[4096];
+	memset(buf, 0xff, sizeof(buf));
+	for (unsigned j = 0; j < nthreads; ++j)
+		ASSERT_EQ(pmemfile_write(pfp, file, buf, sizeof(buf)),
+			  (pmemfile_ssize_t)sizeof(buf))
+			<< strerror(errno);
+
+	for (unsigned j = 0; j < nthreads; ++j)
+		threads.emplace_back(pwrite_worker, file, j);
+
+	for (auto &t : threads)
+		t.join();
+
+	char pat[4096];
+	for (unsigned j = 0; j < nthreads; ++j) {
+		ASSERT_EQ(pmemfile_pread(pfp, file, buf, sizeof(buf),
+					 (pmemfile_off_t)(j << 12)),
+			  (pmemfile_ssize_t)sizeof(buf));
+		memset(pat, (char)j, sizeof(pat));
+		ASSERT_EQ(memcmp(buf, pat, sizeof(buf)), 0);
+	}
+
+	pmemfile_stat_t st;
+	ASSERT_EQ(pmemfile_fstat(pfp, file, &st), 0);
+	ASSERT_EQ(st.st_size, (pmemfile_off_t)(nthreads << 12));
+
+	pmemfile_close(pfp, file);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+}
+
+static void
+borrow_pread_worker(PMEMfile *file)
+{
+	char buf[4096];
+
+	for (int i = 0; i < ops; ++i) {
+		pmemfile_iovec_t iov[16];
+		int iovcnt = 16;
+		PMEMfilelease *lease;
+
+		if (pmemfile_pread_borrow(global_pfp, file, 64 << 10, 0, iov,
+				&iovcnt, &lease) < 0)
+			abort();
+
+		/* give truncate a chance to start waiting for the lease */
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+		/* needs the vinode lock while the lease is held */
+		if (pmemfile_pread(global_pfp, file, buf, sizeof(buf), 0) < 0)
+			abort();
+
+		pmemfile_pread_release(global_pfp, lease);
+	}
+}
+
+static void
+truncate_worker(PMEMfile *file)
+{
+	char buf[4096];
+	memset(buf, 0xaa, sizeof(buf));
+
+	for (int i = 0; i < ops; ++i) {
+		if (pmemfile_ftruncate(global_pfp, file, 0))
+			abort();
+		if (pmemfile_pwrite(global_pfp, file, buf, sizeof(buf),
+				(i % 16) << 12) != (pmemfile_ssize_t)sizeof(buf))
+			abort();
+		if (pmemfile_ftruncate(global_pfp, file, 64 << 10))
+			abort();
+	}
+}
+
+TEST_F(mt, pread_borrow_truncate)
+{
+	PMEMfile *file =
+		pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT | PMEMFILE_O_RDWR,
+			      PMEMFILE_S_IRWXU);
+	ASSERT_NE(file, nullptr);
+
+	ASSERT_EQ(pmemfile_ftruncate(pfp, file, 64 << 10), 0);
+
+	threads.emplace_back(borrow_pread_worker, file);
+	threads.emplace_back(truncate_worker, file);
+
+	for (auto &t : threads)
+		t.join();
+
+	pmemfile_close(pfp, file);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+}
+
 static void
 test_rename(const char *path1, const char *path2)
 {
@@ -390,6 +522,248 @@ TEST_F(mt, exchange_random_paths)
 	}
 }
 
+static const char deep_dir[] = "/d1/d2/d3/d4/d5/d6/d7/d8";
+static const char deep_file[] = "/d1/d2/d3/d4/d5/d6/d7/d8/file";
+static const char deep_file2[] = "/d1/d2/d3/d4/d5/d6/d7/d8/file2";
+
+static void
+stat_worker(const char *path, unsigned count)
+{
+	pmemfile_stat_t st;
+
+	for (unsigned i = 0; i < count; ++i) {
+		if (pmemfile_stat(global_pfp, path, &st) == 0)
+			continue;
+
+		if (errno != ENOENT) {
+			ADD_FAILURE() << errno;
+			abort();
+		}
+	}
+}
+
+static void
+rename_back_and_forth_worker(unsigned count)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		if (pmemfile_rename(global_pfp, deep_file, deep_file2) ||
+		    pmemfile_rename(global_pfp, deep_file2, deep_file)) {
+			ADD_FAILURE() << errno;
+			abort();
+		}
+	}
+}
+
+TEST_F(mt, stat_same_deep_path)
+{
+	std::string dir;
+	for (const char *p = deep_dir; *p; ++p) {
+		if (*p == '/' && !dir.empty())
+			ASSERT_EQ(pmemfile_mkdir(pfp, dir.c_str(), 0755), 0);
+		dir += *p;
+	}
+	ASSERT_EQ(pmemfile_mkdir(pfp, dir.c_str(), 0755), 0);
+	ASSERT_TRUE(test_pmemfile_create(pfp, deep_file, 0, 0644));
+
+	const unsigned count = (unsigned)ops * 10;
+
+	/* scaling of lookups of the same path */
+	for (unsigned n = 1; n <= ncpus; n *= 2) {
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned j = 0; j < n; ++j)
+			threads.emplace_back(stat_worker, deep_file, count);
+
+		for (auto &t : threads)
+			t.join();
+		threads.clear();
+
+		auto end = std::chrono::steady_clock::now();
+		double sec = std::chrono::duration<double>(end - start).count();
+
+		T_OUT("%u threads: %.0f stats/s\n", n, n * count / sec);
+	}
+
+	/* lookups racing with modifications of the last directory */
+	for (unsigned j = 0; j < ncpus; ++j)
+		threads.emplace_back(stat_worker, deep_file, count);
+	threads.emplace_back(rename_back_and_forth_worker, (unsigned)ops);
+
+	for (auto &t : threads)
+		t.join();
+	threads.clear();
+
+	ASSERT_EQ(pmemfile_unlink(pfp, deep_file), 0);
+
+	while (dir.size() > 1) {
+		ASSERT_EQ(pmemfile_rmdir(pfp, dir.c_str()), 0);
+		dir.erase(dir.rfind('/'));
+	}
+}
+
+static void
+open_close_count_worker(std::string path, unsigned count)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		PMEMfile *f = pmemfile_open(global_pfp, path.c_str(),
+				PMEMFILE_O_RDONLY);
+		if (!f) {
+			ADD_FAILURE() << errno;
+			abort();
+		}
+		pmemfile_close(global_pfp, f);
+	}
+}
+
+TEST_F(mt, open_close_scaling)
+{
+	/*
+	 * Open and close don't allocate anything, so unlike other tests this
+	 * one can go beyond the ncpus limit.
+	 */
+	const unsigned max_threads = 64;
+	const unsigned count = (unsigned)ops;
+
+	for (unsigned j = 0; j < max_threads; ++j) {
+		std::string path = "/file" + std::to_string(j);
+		ASSERT_TRUE(test_pmemfile_create(pfp, path.c_str(), 0, 0644));
+	}
+
+	for (int same = 1; same >= 0; --same) {
+		for (unsigned n = 1; n <= max_threads; n *= 2) {
+			auto start = std::chrono::steady_clock::now();
+
+			for (unsigned j = 0; j < n; ++j)
+				threads.emplace_back(open_close_count_worker,
+						"/file" +
+						std::to_string(same ? 0 : j),
+						count);
+
+			for (auto &t : threads)
+				t.join();
+			threads.clear();
+
+			auto end = std::chrono::steady_clock::now();
+			double sec = std::chrono::duration<double>(end - start)
+					.count();
+
+			T_OUT("%s file, %u threads: %.0f open+close/s\n",
+					same ? "same" : "different", n,
+					n * count / sec);
+		}
+	}
+
+	for (unsigned j = 0; j < max_threads; ++j) {
+		std::string path = "/file" + std::to_string(j);
+		ASSERT_EQ(pmemfile_unlink(pfp, path.c_str()), 0);
+	}
+}
+
+static void
+create_mkdir_worker(unsigned id, unsigned count, double *sec, double *max_lat)
+{
+	std::string dir = "/dir" + std::to_string(id) + "/";
+	*max_lat = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < count; ++i) {
+		std::string path = dir + std::to_string(i);
+
+		auto op_start = std::chrono::steady_clock::now();
+
+		/* every 4th entry is a directory */
+		PMEMfile *f = nullptr;
+		int ret;
+		if (i % 4 == 3) {
+			ret = pmemfile_mkdir(global_pfp, path.c_str(), 0755);
+		} else {
+			f = pmemfile_create(global_pfp, path.c_str(), 0644);
+			ret = f ? 0 : -1;
+		}
+
+		auto op_end = std::chrono::steady_clock::now();
+
+		if (ret) {
+			ADD_FAILURE() << errno;
+			abort();
+		}
+		if (f)
+			pmemfile_close(global_pfp, f);
+
+		double lat =
+			std::chrono::duration<double>(op_end - op_start).count();
+		if (lat > *max_lat)
+			*max_lat = lat;
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	*sec = std::chrono::duration<double>(end - start).count();
+}
+
+/*
+ * Creates files and directories in separate directories (one per thread).
+ * With PMEMFILE_GROUP_COMMIT set creations of different threads share
+ * transactions.
+ */
+TEST_F(mt, create_mkdir)
+{
+	unsigned count = (unsigned)ops / 10;
+	if (count == 0)
+		count = 1;
+
+	for (unsigned n = 1; n <= ncpus; n *= 2) {
+		std::vector<double> sec(n), max_lat(n);
+
+		for (unsigned j = 0; j < n; ++j) {
+			std::string dir = "/dir" + std::to_string(j);
+			ASSERT_EQ(pmemfile_mkdir(pfp, dir.c_str(), 0755), 0);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (unsigned j = 0; j < n; ++j)
+			threads.emplace_back(create_mkdir_worker, j, count,
+					     &sec[j], &max_lat[j]);
+
+		for (auto &t : threads)
+			t.join();
+		threads.clear();
+
+		auto end = std::chrono::steady_clock::now();
+		double total = std::chrono::duration<double>(end - start)
+				       .count();
+
+		double sum = 0, max = 0;
+		for (unsigned j = 0; j < n; ++j) {
+			sum += sec[j];
+			if (max_lat[j] > max)
+				max = max_lat[j];
+		}
+
+		T_OUT("%u threads: %.0f creates/s, latency avg %.1f us, "
+		      "max %.1f us\n",
+		      n, n * count / total, sum / (n * count) * 1e6,
+		      max * 1e6);
+
+		for (unsigned j = 0; j < n; ++j) {
+			std::string dir = "/dir" + std::to_string(j) + "/";
+			for (unsigned i = 0; i < count; ++i) {
+				std::string path = dir + std::to_string(i);
+				if (i % 4 == 3)
+					ASSERT_EQ(pmemfile_rmdir(pfp,
+								 path.c_str()),
+						  0);
+				else
+					ASSERT_EQ(pmemfile_unlink(pfp,
+								  path.c_str()),
+						  0);
+			}
+			ASSERT_EQ(pmemfile_rmdir(pfp, dir.c_str()), 0);
+		}
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
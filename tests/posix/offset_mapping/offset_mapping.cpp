@@ -36,6 +36,10 @@
 #include "offset_mapping_wrapper.h"
 #include "pmemfile_test.hpp"
 
+#include <chrono>
+#include <memory>
+#include <random>
+
 class offset_mapping : public pmemfile_test {
 protected:
 	struct offset_map *map;
@@ -219,6 +223,139 @@ TEST_F(offset_mapping, find_block)
 	ASSERT_EQ(nullptr, block_find_closest_wrapper(map, block3.offset));
 }
 
+/*
+ * build_file -- creates a list of adjacent blocks of mixed sizes, the way
+ * a file written with a growing block size would look like
+ */
+static std::vector<std::unique_ptr<block_desc>>
+build_file(size_t count, std::mt19937_64 &rng)
+{
+	static const uint32_t sizes[] = {block_size, 16 * block_size,
+					 128 * block_size};
+	std::vector<std::unique_ptr<block_desc>> blocks;
+	uint64_t offset = 0;
+	struct pmemfile_block_desc *prev = nullptr;
+
+	blocks.reserve(count);
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t size = sizes[rng() % 3];
+		blocks.emplace_back(new block_desc(offset, size, prev));
+		prev = blocks.back()->ptr;
+		offset += size;
+	}
+
+	return blocks;
+}
+
+TEST_F(offset_mapping, random_insert_remove)
+{
+	std::mt19937_64 rng(7);
+	auto blocks = build_file(4096, rng);
+	std::vector<bool> present(blocks.size(), false);
+	uint64_t file_size = blocks.back()->offset + blocks.back()->size;
+
+	for (unsigned round = 0; round < 50000; ++round) {
+		size_t i = rng() % blocks.size();
+
+		if (!present[i]) {
+			ASSERT_EQ(insert_block_wrapper(map, blocks[i]->ptr), 0);
+			present[i] = true;
+		} else if (rng() % 2) {
+			ASSERT_EQ(remove_block_wrapper(map, blocks[i]->ptr), 0);
+			present[i] = false;
+		}
+
+		if (round % 1000 != 0)
+			continue;
+
+		for (unsigned k = 0; k < 100; ++k) {
+			uint64_t offset = rng() % file_size;
+			struct pmemfile_block_desc *expected = nullptr;
+			size_t first = blocks.size();
+
+			for (size_t j = 0; j < blocks.size(); ++j) {
+				if (!present[j])
+					continue;
+				if (first == blocks.size())
+					first = j;
+				if (blocks[j]->offset <= offset)
+					expected = blocks[j]->ptr;
+			}
+
+			/* below the first block the map returns its prev */
+			if (expected == nullptr && first > 0 &&
+			    first < blocks.size())
+				expected = blocks[first - 1]->ptr;
+
+			ASSERT_EQ(expected,
+				  block_find_closest_wrapper(map, offset));
+		}
+	}
+
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		if (present[i]) {
+			ASSERT_EQ(remove_block_wrapper(map, blocks[i]->ptr), 0);
+		}
+	}
+
+	ASSERT_EQ(nullptr, block_find_closest_wrapper(map, UINT64_MAX));
+}
+
+TEST_F(offset_mapping, lookup_benchmark)
+{
+	constexpr size_t nblocks = 16384;
+	constexpr size_t nlookups = 1 << 20;
+
+	std::mt19937_64 rng(1);
+	auto blocks = build_file(nblocks, rng);
+	uint64_t file_size = blocks.back()->offset + blocks.back()->size;
+
+	std::vector<uint64_t> offsets(nlookups);
+	for (auto &o : offsets)
+		o = rng() % file_size;
+
+	struct radix_map *radix = radix_map_new(pfp);
+	ASSERT_NE(radix, nullptr);
+
+	auto start = std::chrono::steady_clock::now();
+	for (auto &b : blocks)
+		ASSERT_EQ(insert_block_wrapper(map, b->ptr), 0);
+	auto tree_build = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (auto &b : blocks)
+		ASSERT_EQ(radix_insert_block(radix, b->ptr), 0);
+	auto radix_build = std::chrono::steady_clock::now() - start;
+
+	uintptr_t tree_sum = 0, radix_sum = 0;
+
+	start = std::chrono::steady_clock::now();
+	for (uint64_t o : offsets)
+		tree_sum += (uintptr_t)block_find_closest_wrapper(map, o);
+	auto tree_lookup = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (uint64_t o : offsets)
+		radix_sum += (uintptr_t)radix_find_closest(radix, o);
+	auto radix_lookup = std::chrono::steady_clock::now() - start;
+
+	EXPECT_EQ(tree_sum, radix_sum);
+	for (size_t i = 0; i < 1024; ++i)
+		ASSERT_EQ(block_find_closest_wrapper(map, offsets[i]),
+			  radix_find_closest(radix, offsets[i]));
+
+	using ms = std::chrono::duration<double, std::milli>;
+	T_OUT("%zu blocks, %zu lookups\n", nblocks, nlookups);
+	T_OUT("extent tree: build %.2f ms, lookup %.2f ms\n",
+	      ms(tree_build).count(), ms(tree_lookup).count());
+	T_OUT("radix tree:  build %.2f ms, lookup %.2f ms\n",
+	      ms(radix_build).count(), ms(radix_lookup).count());
+
+	for (auto &b : blocks)
+		ASSERT_EQ(radix_remove_block(radix, b->ptr), 0);
+	radix_map_delete(radix);
+}
+
 int
 main(int argc, char *argv[])
 {
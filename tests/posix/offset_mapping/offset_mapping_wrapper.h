@@ -44,6 +44,7 @@ extern "C" {
 
 struct pmemfile_block_desc;
 struct offset_map;
+struct radix_map;
 
 struct pmemfile_block_desc *create_block(uint64_t offset, uint32_t size,
 	struct pmemfile_block_desc *prev);
@@ -61,6 +62,18 @@ int insert_block_wrapper(struct offset_map *map,
 int remove_block_wrapper(struct offset_map *map,
 	struct pmemfile_block_desc *block);
 
+/* previous radix tree implementation, used as a benchmark reference */
+struct radix_map *radix_map_new(PMEMfilepool *pfp);
+
+void radix_map_delete(struct radix_map *m);
+
+struct pmemfile_block_desc *radix_find_closest(struct radix_map *m,
+	uint64_t offset);
+
+int radix_insert_block(struct radix_map *m, struct pmemfile_block_desc *block);
+
+int radix_remove_block(struct radix_map *m, struct pmemfile_block_desc *block);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,485 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * radix_map.c -- radix tree mapping offsets directly to a block
+ *
+ * This is the offset mapping used by libpmemfile-posix before it switched
+ * to an extent B+tree. It is kept here only as a reference point for the
+ * lookup benchmark in offset_mapping.cpp.
+ *
+ * Every entry in tree maps certain range to blocks, if there is more than
+ * one block at this range, radix_map_entry holds a pointer to an array of
+ * next level radix_map_entries (with smaller range) - size of this array
+ * is const and equal to N_CHILDREN
+ *
+ * Below examples assumes that N_CHILDREN = 16
+ *  * - means that node is internal
+ *
+ * Example - insert block (1) with offset 256k, size 256k to empty tree:
+ * ---------------------------------------------------------------------------
+ *                                | 0 - 4M |
+ *                                |   *    |
+ * ---------------------------------------------------------------------------
+ *             |0 - 256k|    |256k - 512k|    |512k - 768k|     ...
+ *             |  NULL  |    |    (1)    |    |    NULL   |   NULLs ...
+ * ---------------------------------------------------------------------------
+ *
+ * Example - insert block (2) with offset 240k, size 256k to empty tree:
+ * ---------------------------------------------------------------------------
+ *                                | 0 - 4M |
+ *                                |   *    |
+ * ---------------------------------------------------------------------------
+ *         |0 - 256k|                           |256k - 512k|           ...
+ *         |    *   |                           |     *     |        NULLs ...
+ * ---------------------------------------------------------------------------
+ * |0-16k |  ...  |240k-256k|    |256k-272k|   ...   |480k-496k| |496k-512k|
+ * | NULL | NULLs |    (2)  |    |   (2)   | ..(2).. |   (2)   | |   NULL  |
+ * ---------------------------------------------------------------------------
+ * 16 entries will be updated (blocks covering offsets 240k - 496k)
+ */
+
+#include "alloc.h"
+#include "blocks.h"
+#include "out.h"
+#include "utils.h"
+#include "offset_mapping_wrapper.h"
+
+/* branching factor is 2^N_CHILDREN_POW */
+#define N_CHILDREN_POW 4
+
+#define N_CHILDREN (1 << N_CHILDREN_POW)
+
+struct radix_map_entry {
+
+	/*
+	 * data holds pointer to pmemfile_block_desc when internal == false
+	 * or to radix_map_entry array otherwise
+	 */
+
+	union {
+		struct pmemfile_block_desc *block;
+
+		struct radix_map_entry *children;
+	} data;
+
+	bool internal;
+};
+
+struct radix_map {
+
+	struct radix_map_entry entry;
+
+	PMEMfilepool *pfp;
+
+	/*
+	 * specifies range covered by radix_map:
+	 * range starts at 0 and has length of 2^range_length_bits
+	 */
+	int range_length_bits;
+};
+
+static uint64_t
+max_map_offset(struct radix_map *m)
+{
+	if (m->range_length_bits < 64)
+		return (1ULL << m->range_length_bits)
+				- ((uint64_t) MIN_BLOCK_SIZE);
+	else
+		return UINT64_MAX - ((uint64_t) MIN_BLOCK_SIZE) + 1;
+}
+
+/*
+ * create new radix_map
+ */
+struct radix_map *
+radix_map_new(PMEMfilepool *pfp)
+{
+	struct radix_map *m = pf_calloc(1, sizeof(*m));
+	m->range_length_bits = __builtin_ctzll(MIN_BLOCK_SIZE);
+	m->pfp = pfp;
+
+	return m;
+}
+
+/*
+ * recursively remove entry in radix_map
+ */
+static void
+offset_entry_delete(struct radix_map_entry *e)
+{
+	if (e->internal) {
+		struct radix_map_entry *children = e->data.children;
+		for (unsigned i = 0; i < N_CHILDREN; ++i)
+			offset_entry_delete(children + i);
+
+		pf_free(children);
+	}
+}
+
+/*
+ * remove entire radix_map
+ */
+void
+radix_map_delete(struct radix_map *m)
+{
+	offset_entry_delete(&m->entry);
+
+	pf_free(m);
+}
+
+/*
+ * adds new level to the tree, doesn't allocate memory if there
+ * are noe entries
+ */
+static int
+add_new_level(struct radix_map *m)
+{
+	if (m->range_length_bits > 64)
+		return 1;
+
+	m->range_length_bits += N_CHILDREN_POW;
+
+	if (m->entry.data.children != NULL) {
+		/*
+		 * if current root had any children we must allocate
+		 * new array(level) and move child to first entry
+		 * in the array
+		 */
+		struct radix_map_entry *new_entries =
+			pf_calloc(N_CHILDREN,
+				sizeof(struct radix_map_entry));
+
+		if (new_entries == NULL)
+			return 1;
+
+		new_entries[0] = m->entry;
+		m->entry.internal = true;
+		m->entry.data.children = new_entries;
+	} else {
+		m->entry.internal = false;
+	}
+
+	return 0;
+}
+
+/*
+ * finds closest block with offset equal or smaller than
+ * requested
+ */
+struct pmemfile_block_desc *
+radix_find_closest(struct radix_map *m, uint64_t offset)
+{
+	int range_bits = m->range_length_bits;
+	struct radix_map_entry *entry = &m->entry, *children;
+
+	uint64_t max_offset = max_map_offset(m);
+
+	/* make sure we don't go beyond allocated range */
+	if (offset > max_offset)
+		offset = max_offset;
+
+	while (entry->internal) {
+		children = entry->data.children;
+		range_bits -= N_CHILDREN_POW;
+		entry = children + ((offset >> range_bits) &
+						((1 << N_CHILDREN_POW) - 1));
+	}
+
+	/* if found entry is not NULL it is the requested block */
+	if (entry->data.block != NULL)
+		return entry->data.block;
+
+	/*
+	 * if entry at requested offset was NULL
+	 * find first not NULL entry at this level with smaller offset
+	 */
+
+	/* if 'entry' is the top level entry, there are no blocks in the tree */
+	if (entry == &m->entry)
+		return NULL;
+
+	struct radix_map_entry *e;
+
+	/*
+	 * look for block in entries with lower offset
+	 *
+	 * Example: offset = 48k
+	 * -------------------------------------------------------------------
+	 *                           | 0 - 256k |
+	 *                           |    *     |
+	 * -------------------------------------------------------------------
+	 * |0  - 16k| |16k - 32k| |32k - 48k| |48k - 64k| |64k - 80k|   ...
+	 * |  NULL  | |   AAA   | |   NULL  | |   NULL  | |  BBB    |   ...
+	 * -------------------------------------------------------------------
+	 *
+	 * entry mapping offset 48k to block is NULL, so in this case
+	 * AAA will be returned
+	 */
+	e = entry - 1;
+	while (e >= children) {
+		if (e->data.block == NULL)
+			e--;
+		else if (!e->internal)
+			return e->data.block;
+		else {
+			children = e->data.children;
+			e = children + N_CHILDREN - 1;
+		}
+	}
+
+	/*
+	 * look for block in entries with higher offset,
+	 * if found, then return previous block
+	 *
+	 * Example: offset = 48k
+	 * -------------------------------------------------------------------
+	 *                           | 0 - 256k |
+	 *                           |     *    |
+	 * -------------------------------------------------------------------
+	 * |0  - 16k| |16k - 32k| |32k - 48k| |48k - 64k| |64k - 80k|   ...
+	 * |  NULL  | |   NULL  | |   NULL  | |   NULL  | |  BBB    |   ...
+	 * -------------------------------------------------------------------
+	 *
+	 * entry mapping offset 48k to block is NULL, and there is
+	 * no non-NULL entry to the left, so in this case BBB->prev
+	 * will be returned
+	 */
+	e = entry + 1;
+	while (e < children + N_CHILDREN) {
+		if (e->data.block == NULL)
+			e++;
+		else if (!e->internal) {
+			return PF_RW(m->pfp, e->data.block->prev);
+		} else {
+			children = e->data.children;
+			e = children;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * frees memory used by 'child' if  all child entries are NULL
+ */
+static void
+check_and_free_range(struct radix_map_entry *entry)
+{
+	for (unsigned i = 0; i < N_CHILDREN; ++i) {
+		struct radix_map_entry *e = entry->data.children;
+		if (e[i].data.children != NULL)
+			return;
+	}
+
+	pf_free(entry->data.children);
+	entry->data.children = NULL;
+	entry->internal = false;
+}
+
+static int
+check_and_allocate_range(struct radix_map_entry *entry)
+{
+	if (entry->data.children == NULL) {
+		entry->data.children = pf_calloc(N_CHILDREN,
+			sizeof(struct radix_map_entry));
+
+		if (entry->data.children == NULL)
+			return 1;
+
+		entry->internal = true;
+	}
+
+	return 0;
+}
+
+/*
+ * put (or delete) block to radix_map
+ * block can occupy one or more entries in map
+ */
+static int
+set_range(struct radix_map_entry *entry, void *block, size_t offset,
+	size_t remaining, uint64_t range)
+{
+	int ret = 0;
+	entry += offset / range;
+
+	while (remaining > 0) {
+		if (offset % range == 0 && remaining >= range) {
+			/* case when block covers whole range */
+			entry->internal = false;
+			entry->data.block = block;
+
+			offset += range;
+			remaining -= range;
+		} else {
+			/* case when block covers only part of range */
+			ret = check_and_allocate_range(entry);
+			if (ret)
+				return ret;
+
+			size_t sub_offset = offset % range;
+			size_t sub_remaining = range - sub_offset;
+
+			if (remaining < sub_remaining)
+				sub_remaining = remaining;
+
+			ret = set_range(entry->data.children, block,
+				sub_offset, sub_remaining,
+				range >> N_CHILDREN_POW);
+
+			if (ret)
+				return ret;
+
+			offset += sub_remaining;
+			remaining -= sub_remaining;
+
+			if (block == NULL) /* removing block */
+				check_and_free_range(entry);
+		}
+
+		entry++;
+	}
+
+	return 0;
+}
+
+/*
+ * insert block to radix_map
+ */
+int
+radix_insert_block(struct radix_map *m, struct pmemfile_block_desc *block)
+{
+	ASSERT(UINT64_MAX - block->offset >= block->size - 1);
+
+	int ret = 0;
+
+	/*
+	 * add as many levels as necessary to cover range from 0 to end
+	 * of the block
+	 */
+	while (m->range_length_bits < 64 &&
+			max_map_offset(m) + MIN_BLOCK_SIZE <=
+				block->offset + block->size) {
+
+		ret = add_new_level(m);
+		if (ret)
+			return ret;
+	}
+
+	if (m->range_length_bits >= 64)
+		ASSERT(max_map_offset(m) > block->offset + block->size);
+
+	check_and_allocate_range(&m->entry);
+	uint64_t range = 1ULL << (m->range_length_bits - N_CHILDREN_POW);
+
+	return set_range(m->entry.data.children, block, block->offset,
+		block->size, range);
+}
+
+/*
+ * remove block from radix_map
+ */
+int
+radix_remove_block(struct radix_map *m, struct pmemfile_block_desc *block)
+{
+	uint64_t range = 1ULL << (m->range_length_bits - N_CHILDREN_POW);
+
+	int ret = set_range(m->entry.data.children, NULL, block->offset,
+						block->size, range);
+
+	if (ret)
+		return ret;
+
+	check_and_free_range(&m->entry);
+
+	/*
+	 * cleans up radix_map tree
+	 * if at the top level only first entry is internal and not null
+	 * its children can be transferred one level up and height of
+	 * the tree can be decreased
+	 *
+	 * Example:
+	 *
+	 * Before cleanup:
+	 * -------------------------------------------------------------------
+	 *                           | 0 - 4M |
+	 *                           |   *    |
+	 * -------------------------------------------------------------------
+	 *               |0 - 256k|               ...
+	 *               |   *    |  rest of the entries are NULL
+	 * -------------------------------------------------------------------
+	 * |0  - 16k| |16k - 32k| |32k - 48k|           ...
+	 * |   YYY  | |   YYY   | |   YYY   |
+	 * -------------------------------------------------------------------
+	 * there is at least one non-null entry at the last level (16k range)
+	 * this is because set_range(..., NULL, ...) removes levels where all
+	 * entries are NULL
+	 *
+	 * After cleanup:
+	 * -------------------------------------------------------------------
+	 *                           | 0 - 256k |
+	 *                           |    *     |
+	 * -------------------------------------------------------------------
+	 * |0  - 16k| |16k - 32k| |32k - 48k|           ...
+	 * |   YYY  | |   YYY   | |   YYY   |
+	 * -------------------------------------------------------------------
+	 */
+	while (m->range_length_bits > __builtin_ctzll(MIN_BLOCK_SIZE)) {
+		if (!m->entry.internal) {
+			m->range_length_bits = __builtin_ctzll(MIN_BLOCK_SIZE);
+		} else {
+			struct radix_map_entry *child = m->entry.data.children;
+
+			/* if first entry is leaf, no cleanup is needed */
+			if (!child[0].internal)
+				return 0;
+
+			/* check if all entries except first are NULL */
+			for (unsigned i = 1; i < N_CHILDREN; ++i) {
+				if (child[i].data.children != NULL)
+					return 0;
+			}
+
+			struct radix_map_entry *grandchild =
+				child[0].data.children;
+			ASSERT(grandchild != NULL);
+
+			pf_free(m->entry.data.children);
+			m->entry.data.children = grandchild;
+
+			m->range_length_bits -= N_CHILDREN_POW;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * perf.cpp -- microbenchmarks for pmemfile-posix
+ *
+ * Each test prints its results to stderr. Besides time, some of them count
+ * persistence fences issued by the library, by interposing libpmemobj
+ * functions which end with a fence. This doesn't count fences issued
+ * internally by libpmemobj (e.g. on transaction commit).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include <libpmemobj.h>
+
+#include "pmemfile_test.hpp"
+
+static std::atomic<unsigned long> fences;
+
+template <typename F>
+static F
+real_func(const char *name)
+{
+	void *f = dlsym(RTLD_NEXT, name);
+	if (!f) {
+		fprintf(stderr, "can't find %s\n", name);
+		abort();
+	}
+
+	return reinterpret_cast<F>(f);
+}
+
+extern "C" {
+
+void
+pmemobj_drain(PMEMobjpool *pop)
+{
+	static auto real = real_func<void (*)(PMEMobjpool *)>("pmemobj_drain");
+	fences++;
+	real(pop);
+}
+
+void
+pmemobj_persist(PMEMobjpool *pop, const void *addr, size_t len)
+{
+	static auto real =
+		real_func<void (*)(PMEMobjpool *, const void *, size_t)>(
+			"pmemobj_persist");
+	fences++;
+	real(pop, addr, len);
+}
+
+void *
+pmemobj_memcpy_persist(PMEMobjpool *pop, void *dest, const void *src,
+		       size_t len)
+{
+	static auto real = real_func<void *(*)(PMEMobjpool *, void *,
+					       const void *, size_t)>(
+		"pmemobj_memcpy_persist");
+	fences++;
+	return real(pop, dest, src, len);
+}
+
+void *
+pmemobj_memset_persist(PMEMobjpool *pop, void *dest, int c, size_t len)
+{
+	static auto real =
+		real_func<void *(*)(PMEMobjpool *, void *, int, size_t)>(
+			"pmemobj_memset_persist");
+	fences++;
+	return real(pop, dest, c, len);
+}
+
+#ifdef PMEMOBJ_F_MEM_NODRAIN
+void *
+pmemobj_memcpy(PMEMobjpool *pop, void *dest, const void *src, size_t len,
+	       unsigned flags)
+{
+	static auto real = real_func<void *(*)(PMEMobjpool *, void *,
+					       const void *, size_t, unsigned)>(
+		"pmemobj_memcpy");
+	if (!(flags & PMEMOBJ_F_MEM_NODRAIN))
+		fences++;
+	return real(pop, dest, src, len, flags);
+}
+
+void *
+pmemobj_memset(PMEMobjpool *pop, void *dest, int c, size_t len,
+	       unsigned flags)
+{
+	static auto real = real_func<void *(*)(PMEMobjpool *, void *, int,
+					       size_t, unsigned)>(
+		"pmemobj_memset");
+	if (!(flags & PMEMOBJ_F_MEM_NODRAIN))
+		fences++;
+	return real(pop, dest, c, len, flags);
+}
+#endif
+}
+
+class perf : public pmemfile_test {
+public:
+	perf() : pmemfile_test(256 << 20)
+	{
+	}
+};
+
+/*
+ * Runs "count" calls of "fn" and prints number of fences per call, calls per
+ * second and throughput, assuming each call processes "bytes" bytes.
+ * Returns average number of fences per call.
+ */
+template <typename F>
+static double
+measure(const char *name, unsigned count, size_t bytes, F fn)
+{
+	unsigned long start_fences = fences;
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned i = 0; i < count; ++i)
+		fn(i);
+
+	auto end = std::chrono::steady_clock::now();
+	double sec = std::chrono::duration<double>(end - start).count();
+	double fpc = (double)(fences - start_fences) / count;
+
+	T_OUT("%s: %u ops, %.2f fences/op, %.0f ops/s, %.1f MiB/s\n", name,
+	      count, fpc, count / sec,
+	      (double)bytes * count / sec / (1 << 20));
+
+	return fpc;
+}
+
+TEST_F(perf, pwrite_fences)
+{
+	const size_t len = 1 << 20;
+	const unsigned count = 32;
+
+	PMEMfile *f = pmemfile_open(pfp, "/file", PMEMFILE_O_CREAT |
+					     PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	std::vector<char> buf(len, 0x5a);
+
+	double fpc = measure("1MiB append", count, len, [&](unsigned) {
+		ASSERT_EQ(pmemfile_write(pfp, f, buf.data(), len),
+			  (pmemfile_ssize_t)len);
+	});
+	/*
+	 * mtime before the write (2), data before marking blocks as
+	 * initialized (1), data and metadata before updating slots (1),
+	 * slots (1)
+	 */
+	EXPECT_LE(fpc, 5.0);
+
+	fpc = measure("1MiB overwrite", count, len, [&](unsigned i) {
+		ASSERT_EQ(pmemfile_pwrite(pfp, f, buf.data(), len,
+					  (pmemfile_off_t)(i * len)),
+			  (pmemfile_ssize_t)len);
+	});
+	/* mtime before the write (2), data (1), slots (1) */
+	EXPECT_LE(fpc, 4.0);
+
+	fpc = measure("4KiB overwrite", count * 64, 4096, [&](unsigned i) {
+		ASSERT_EQ(pmemfile_pwrite(pfp, f, buf.data(), 4096,
+					  (pmemfile_off_t)(i * 4096)),
+			  4096);
+	});
+	EXPECT_LE(fpc, 4.0);
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
+/*
+ * Compares access to a file mapped by pmemfile with pread and with a kernel
+ * mapping of a tmpfs file of the same size.
+ */
+TEST_F(perf, mmap)
+{
+	const size_t len = 16 << 20;
+	const unsigned count = 16;
+
+	PMEMfile *f = pmemfile_open(pfp, "/file", PMEMFILE_O_CREAT |
+					     PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	std::vector<char> buf(len, 0x5a);
+	ASSERT_EQ(pmemfile_write(pfp, f, buf.data(), len),
+		  (pmemfile_ssize_t)len);
+
+	char *p = (char *)pmemfile_mmap(pfp, nullptr, len,
+					PMEMFILE_PROT_READ | PMEMFILE_PROT_WRITE,
+					PMEMFILE_MAP_SHARED, f, 0);
+	ASSERT_NE(p, PMEMFILE_MAP_FAILED) << strerror(errno);
+
+	measure("pmemfile pread", count, len, [&](unsigned) {
+		ASSERT_EQ(pmemfile_pread(pfp, f, buf.data(), len, 0),
+			  (pmemfile_ssize_t)len);
+	});
+
+	measure("pmemfile mmap read", count, len, [&](unsigned) {
+		memcpy(buf.data(), p, len);
+	});
+
+	measure("pmemfile mmap write+msync", count, len, [&](unsigned i) {
+		memset(p, (int)i, len);
+		ASSERT_EQ(pmemfile_msync(pfp, p, len, PMEMFILE_MS_SYNC), 0);
+	});
+
+	ASSERT_EQ(pmemfile_munmap(pfp, p, len), 0);
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+
+	char path[] = "/dev/shm/pmemfile_perf_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		T_OUT("can't create a file on tmpfs, skipping comparison\n");
+		return;
+	}
+	unlink(path);
+
+	ASSERT_EQ(ftruncate(fd, (off_t)len), 0);
+	p = (char *)mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			 0);
+	ASSERT_NE(p, MAP_FAILED) << strerror(errno);
+	memset(p, 0x5a, len);
+
+	measure("tmpfs mmap read", count, len, [&](unsigned) {
+		memcpy(buf.data(), p, len);
+	});
+
+	measure("tmpfs mmap write+msync", count, len, [&](unsigned i) {
+		memset(p, (int)i, len);
+		ASSERT_EQ(msync(p, len, MS_SYNC), 0);
+	});
+
+	ASSERT_EQ(munmap(p, len), 0);
+	close(fd);
+}
+
+/*
+ * Lists and looks up entries of a big directory and prints how much space
+ * its entries take.
+ */
+TEST_F(perf, getdents)
+{
+	const unsigned files = 10000;
+	const unsigned count = 16;
+	char path[64];
+
+	ASSERT_EQ(pmemfile_mkdir(pfp, "/dir", 0755), 0);
+
+	for (unsigned i = 0; i < files; ++i) {
+		sprintf(path, "/dir/file_with_name_%06u", i);
+		PMEMfile *f = pmemfile_open(pfp, path, PMEMFILE_O_CREAT |
+						     PMEMFILE_O_EXCL |
+						     PMEMFILE_O_WRONLY,
+					    0644);
+		ASSERT_NE(f, nullptr) << strerror(errno);
+		pmemfile_close(pfp, f);
+	}
+
+	pmemfile_stat_t st;
+	ASSERT_EQ(pmemfile_stat(pfp, "/dir", &st), 0);
+	T_OUT("directory with %u entries: %ld bytes, %.1f bytes/entry\n", files,
+	      (long)st.st_size, (double)st.st_size / files);
+
+	PMEMfile *dir = pmemfile_open(pfp, "/dir", PMEMFILE_O_DIRECTORY |
+					      PMEMFILE_O_RDONLY);
+	ASSERT_NE(dir, nullptr) << strerror(errno);
+
+	std::vector<char> buf(32 << 10);
+	size_t bytes = 0;
+
+	auto list = [&]() {
+		ASSERT_EQ(pmemfile_lseek(pfp, dir, 0, PMEMFILE_SEEK_SET), 0);
+
+		unsigned entries = 0;
+		int r;
+		bytes = 0;
+		while ((r = pmemfile_getdents64(
+				pfp, dir, (struct linux_dirent64 *)buf.data(),
+				(unsigned)buf.size())) > 0) {
+			bytes += (size_t)r;
+			for (int pos = 0; pos < r; ++entries)
+				pos += *(unsigned short *)&buf[(size_t)pos +
+							       16];
+		}
+		ASSERT_EQ(r, 0);
+		ASSERT_EQ(entries, files + 2);
+	};
+
+	list();
+	measure("getdents64 of whole directory", count, bytes,
+		[&](unsigned) { list(); });
+
+	pmemfile_close(pfp, dir);
+
+	measure("stat of directory entry", files, 0, [&](unsigned i) {
+		sprintf(path, "/dir/file_with_name_%06u", i);
+		ASSERT_EQ(pmemfile_stat(pfp, path, &st), 0);
+	});
+
+	for (unsigned i = 0; i < files; ++i) {
+		sprintf(path, "/dir/file_with_name_%06u", i);
+		ASSERT_EQ(pmemfile_unlink(pfp, path), 0);
+	}
+	ASSERT_EQ(pmemfile_rmdir(pfp, "/dir"), 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START();
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s global_path", argv[0]);
+		exit(1);
+	}
+
+	global_path = argv[1];
+
+	::testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -34,9 +34,15 @@ include(${SRC_DIR}/../../helpers.cmake)
 function(setup)
 	common_setup()
 	set(ENV{PMEMFILE_POSIX_LOG_LEVEL} 1)
+	# most tests verify allocation of blocks, inline_data enables it back,
+	# rw and crash run once more with default_inline_data
+	set(ENV{PMEMFILE_INLINE_DATA_SIZE} 0)
 endfunction()
 
 function(cleanup)
+	unset(ENV{PMEMFILE_INLINE_DATA_SIZE})
+	unset(ENV{PMEMFILE_GROUP_COMMIT})
+	unset(ENV{PMEMFILE_BACKGROUND_RECLAIM})
 	unset(ENV{PMEMFILE_POSIX_LOG_LEVEL})
 	common_cleanup()
 endfunction()
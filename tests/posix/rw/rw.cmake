@@ -33,6 +33,10 @@ include(${SRC_DIR}/../posix-helpers.cmake)
 
 setup()
 
+if(DEFINED default_inline_data)
+	unset(ENV{PMEMFILE_INLINE_DATA_SIZE})
+endif()
+
 if(LONG_TESTS OR NOT (TRACER STREQUAL "pmemcheck"))
 	execute(${TEST_EXECUTABLE})
 else()
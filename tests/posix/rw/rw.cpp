@@ -40,6 +40,8 @@
 #include <sstream>
 
 static unsigned env_block_size;
+/* small files keep their data in the inode, without blocks */
+static bool env_inline_data;
 
 class rw : public pmemfile_test {
 public:
@@ -103,7 +105,8 @@ TEST_F(rw, basic)
 						    {0100644, 1, 9, "file1"},
 					    }));
 
-	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 1, 1, 0, 1));
+	EXPECT_TRUE(test_pmemfile_stats_match(
+		pfp, 1, 1, 0, env_inline_data ? 0 : 1));
 
 	errno = 0;
 	ASSERT_EQ(pmemfile_read(pfp, NULL, data2, len), -1);
@@ -140,7 +143,8 @@ TEST_F(rw, basic)
 	ASSERT_EQ(r, 0);
 	pmemfile_close(pfp, f);
 
-	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 1, 1, 0, 1));
+	EXPECT_TRUE(test_pmemfile_stats_match(
+		pfp, 1, 1, 0, env_inline_data ? 0 : 1));
 
 	f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDONLY);
 	ASSERT_NE(f, nullptr) << strerror(errno);
@@ -195,7 +199,8 @@ TEST_F(rw, basic)
 						    {0100644, 1, 9, "file1"},
 					    }));
 
-	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 1, 1, 0, 1));
+	EXPECT_TRUE(test_pmemfile_stats_match(
+		pfp, 1, 1, 0, env_inline_data ? 0 : 1));
 
 	f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDWR);
 	ASSERT_NE(f, nullptr) << strerror(errno);
@@ -283,7 +288,8 @@ TEST_F(rw, basic)
 	ASSERT_EQ(pmemfile_lseek(pfp, f, 0, PMEMFILE_SEEK_CUR), 9 + 100 + 4);
 	ASSERT_EQ(pmemfile_lseek(pfp, f, 0, PMEMFILE_SEEK_SET), 0);
 
-	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 1, 1, 0, 1));
+	EXPECT_TRUE(test_pmemfile_stats_match(
+		pfp, 1, 1, 0, env_inline_data ? 0 : 1));
 
 	/* validate the whole file contents */
 	memset(data2, 0xff, sizeof(data2));
@@ -428,6 +434,202 @@ TEST_F(rw, huge_file)
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
 }
 
+TEST_F(rw, block_index)
+{
+	/*
+	 * Fill holes of a sparse file backwards, so every new block goes
+	 * before all the others, with enough blocks to need a few index pages.
+	 */
+	const size_t nblocks = 600;
+	const pmemfile_off_t stride = 1024 * 1024;
+	char buf[128], expected[128];
+
+	PMEMfile *f = pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT |
+					    PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	for (size_t i = nblocks; i > 0; --i) {
+		memset(buf, (int)(i % 255) + 1, sizeof(buf));
+		pmemfile_ssize_t w = pmemfile_pwrite(
+			pfp, f, buf, sizeof(buf),
+			(pmemfile_off_t)(i - 1) * stride);
+		ASSERT_EQ(w, (pmemfile_ssize_t)sizeof(buf)) << COND_ERROR(w);
+	}
+
+	/* remove every third block */
+	for (size_t i = 0; i < nblocks; i += 3)
+		ASSERT_EQ(pmemfile_fallocate(
+				  pfp, f, PMEMFILE_FALLOC_FL_PUNCH_HOLE |
+					  PMEMFILE_FALLOC_FL_KEEP_SIZE,
+				  (pmemfile_off_t)i * stride, stride),
+			  0)
+			<< strerror(errno);
+
+	pmemfile_close(pfp, f);
+
+	if (!is_pmemfile_pop) {
+		struct pmemfile_stats stats;
+		pmemfile_stats(pfp, &stats);
+		EXPECT_GT(stats.block_index, 1u);
+	}
+
+	/* blocks of the reopened file are found through the index */
+	f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_lseek(pfp, f, 0, PMEMFILE_SEEK_DATA), stride);
+
+	for (size_t i = nblocks; i > 0; --i) {
+		size_t b = i - 1;
+
+		if (b % 3 == 0)
+			memset(expected, 0, sizeof(expected));
+		else
+			memset(expected, (int)(i % 255) + 1, sizeof(expected));
+
+		pmemfile_ssize_t r =
+			pmemfile_pread(pfp, f, buf, sizeof(buf),
+				       (pmemfile_off_t)b * stride);
+		ASSERT_EQ(r, (pmemfile_ssize_t)sizeof(buf)) << COND_ERROR(r);
+		ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0) << b;
+	}
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+
+	if (!is_pmemfile_pop) {
+		struct pmemfile_stats stats;
+		pmemfile_stats(pfp, &stats);
+		EXPECT_EQ(stats.block_index, 0u);
+	}
+}
+
+TEST_F(rw, reopen_cached)
+{
+	const size_t nblocks = 64;
+	const pmemfile_off_t stride = 64 * 1024;
+	char buf[128], expected[128];
+
+	PMEMfile *f = pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT |
+					    PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	for (size_t i = 0; i < nblocks; ++i) {
+		memset(buf, (int)i + 1, sizeof(buf));
+		pmemfile_ssize_t w =
+			pmemfile_pwrite(pfp, f, buf, sizeof(buf),
+					(pmemfile_off_t)i * stride);
+		ASSERT_EQ(w, (pmemfile_ssize_t)sizeof(buf)) << COND_ERROR(w);
+	}
+
+	pmemfile_close(pfp, f);
+
+	/* closed file is still in memory - reopen reuses its block tree */
+	for (int j = 0; j < 3; ++j) {
+		f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDONLY);
+		ASSERT_NE(f, nullptr) << strerror(errno);
+
+		for (size_t i = 0; i < nblocks; ++i) {
+			memset(expected, (int)i + 1, sizeof(expected));
+			pmemfile_ssize_t r =
+				pmemfile_pread(pfp, f, buf, sizeof(buf),
+					       (pmemfile_off_t)i * stride);
+			ASSERT_EQ(r, (pmemfile_ssize_t)sizeof(buf))
+				<< COND_ERROR(r);
+			ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0) << i;
+		}
+
+		pmemfile_close(pfp, f);
+	}
+
+	/* modifications of a closed file must be visible after reopen */
+	ASSERT_EQ(pmemfile_truncate(pfp, "/file1", stride), 0);
+
+	f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	memset(expected, 1, sizeof(expected));
+	ASSERT_EQ(pmemfile_pread(pfp, f, buf, sizeof(buf), 0),
+		  (pmemfile_ssize_t)sizeof(buf));
+	ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0);
+	ASSERT_EQ(pmemfile_pread(pfp, f, buf, sizeof(buf), stride), 0);
+
+	pmemfile_close(pfp, f);
+
+	/* unlinked file is not kept alive */
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 0, 0, 0, 0));
+}
+
+TEST_F(rw, defrag)
+{
+	/*
+	 * Fill a 2MB file with 16KB writes backwards, so every write
+	 * allocates a separate block.
+	 */
+	const size_t chunk = 16 * 1024;
+	const size_t nchunks = 128;
+	std::vector<char> buf(chunk), expected(chunk);
+
+	PMEMfile *f = pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT |
+					    PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f,
+				     (pmemfile_off_t)(chunk * nchunks)),
+		  0);
+
+	for (size_t i = nchunks; i > 0; --i) {
+		memset(buf.data(), (int)i, chunk);
+		pmemfile_ssize_t w =
+			pmemfile_pwrite(pfp, f, buf.data(), chunk,
+					(pmemfile_off_t)((i - 1) * chunk));
+		ASSERT_EQ(w, (pmemfile_ssize_t)chunk) << COND_ERROR(w);
+	}
+
+	struct pmemfile_stats before, after;
+	pmemfile_stats(pfp, &before);
+
+	ASSERT_EQ(pmemfile_defrag(pfp, f, 0, INT64_MAX), 0) << strerror(errno);
+
+	pmemfile_stats(pfp, &after);
+
+	if (!is_pmemfile_pop) {
+		if (env_block_size == 0) {
+			EXPECT_EQ(before.blocks, nchunks);
+			EXPECT_EQ(after.blocks, 1u);
+		} else {
+			EXPECT_EQ(after.blocks, before.blocks);
+		}
+	}
+
+	for (size_t i = nchunks; i > 0; --i) {
+		memset(expected.data(), (int)i, chunk);
+		pmemfile_ssize_t r =
+			pmemfile_pread(pfp, f, buf.data(), chunk,
+				       (pmemfile_off_t)((i - 1) * chunk));
+		ASSERT_EQ(r, (pmemfile_ssize_t)chunk) << COND_ERROR(r);
+		ASSERT_EQ(memcmp(buf.data(), expected.data(), chunk), 0) << i;
+	}
+
+	pmemfile_close(pfp, f);
+
+	f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDONLY);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_defrag(pfp, f, 0, INT64_MAX), -1);
+	EXPECT_EQ(errno, EBADF);
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+}
+
 TEST_F(rw, trunc)
 {
 	/* check that O_TRUNC works */
@@ -490,7 +692,8 @@ TEST_F(rw, trunc)
 						    {0100644, 1, 128, "file2"},
 					    }));
 
-	EXPECT_TRUE(test_pmemfile_stats_match(pfp, 2, 1, 0, 1));
+	EXPECT_TRUE(test_pmemfile_stats_match(
+		pfp, 2, 1, 0, env_inline_data ? 0 : 1));
 
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file2"), 0);
@@ -1102,20 +1305,22 @@ TEST_F(rw, fallocate_errors)
 					     PMEMFILE_FALLOC_FL_INSERT_RANGE, 0,
 					     1),
 			  -1);
-		EXPECT_EQ(errno, EOPNOTSUPP);
+		EXPECT_EQ(errno, EINVAL);
 
 		errno = 0;
 		ASSERT_EQ(pmemfile_fallocate(pfp, f,
 					     PMEMFILE_FALLOC_FL_COLLAPSE_RANGE,
 					     0, 1),
 			  -1);
-		EXPECT_EQ(errno, EOPNOTSUPP);
+		EXPECT_EQ(errno, EINVAL);
 
 		errno = 0;
 		ASSERT_EQ(pmemfile_fallocate(
-				  pfp, f, PMEMFILE_FALLOC_FL_ZERO_RANGE, 0, 1),
+				  pfp, f, PMEMFILE_FALLOC_FL_ZERO_RANGE |
+					  PMEMFILE_FALLOC_FL_PUNCH_HOLE,
+				  0, 1),
 			  -1);
-		EXPECT_EQ(errno, EOPNOTSUPP);
+		EXPECT_EQ(errno, EINVAL);
 
 		errno = 0;
 		ASSERT_EQ(pmemfile_fallocate(pfp, f, 0x1000, 0, 1), -1);
@@ -1131,6 +1336,112 @@ TEST_F(rw, fallocate_errors)
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
 }
 
+static void
+expect_file_content(PMEMfilepool *pfp, PMEMfile *f,
+		    const std::vector<char> &expected)
+{
+	ASSERT_EQ(test_pmemfile_file_size(pfp, f),
+		  (pmemfile_ssize_t)expected.size());
+
+	std::vector<char> buf(expected.size());
+	pmemfile_ssize_t r = pmemfile_pread(pfp, f, buf.data(), buf.size(), 0);
+	ASSERT_EQ(r, (pmemfile_ssize_t)buf.size()) << COND_ERROR(r);
+	EXPECT_TRUE(buf == expected);
+}
+
+TEST_F(rw, fallocate_ranges)
+{
+	/* tmpfs doesn't support collapsing and inserting ranges */
+	if (is_pmemfile_pop)
+		return;
+
+	const size_t chunk = 16 * 1024;
+	std::vector<char> expected(64 * chunk);
+
+	for (size_t i = 0; i < expected.size(); ++i)
+		expected[i] = (char)(i / chunk + 1);
+
+	PMEMfile *f = pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT |
+					    PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	pmemfile_ssize_t w =
+		pmemfile_write(pfp, f, expected.data(), expected.size());
+	ASSERT_EQ(w, (pmemfile_ssize_t)expected.size()) << COND_ERROR(w);
+
+	/* collapse range in the middle of a block */
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_COLLAPSE_RANGE,
+				     (pmemfile_off_t)(4 * chunk),
+				     (pmemfile_off_t)(8 * chunk)),
+		  0)
+		<< strerror(errno);
+	expected.erase(expected.begin() + 4 * chunk,
+		       expected.begin() + 12 * chunk);
+	expect_file_content(pfp, f, expected);
+
+	/* insert a hole */
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_INSERT_RANGE,
+				     (pmemfile_off_t)(2 * chunk),
+				     (pmemfile_off_t)(3 * chunk)),
+		  0)
+		<< strerror(errno);
+	expected.insert(expected.begin() + 2 * chunk, 3 * chunk, 0);
+	expect_file_content(pfp, f, expected);
+
+	/* zero unaligned range, crossing blocks */
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_ZERO_RANGE |
+					     PMEMFILE_FALLOC_FL_KEEP_SIZE,
+				     (pmemfile_off_t)(chunk + 100),
+				     (pmemfile_off_t)(10 * chunk)),
+		  0)
+		<< strerror(errno);
+	std::fill(expected.begin() + chunk + 100,
+		  expected.begin() + 11 * chunk + 100, 0);
+	expect_file_content(pfp, f, expected);
+
+	/* zero range past the end of file extends it */
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_ZERO_RANGE,
+				     (pmemfile_off_t)(expected.size() - 10),
+				     100),
+		  0)
+		<< strerror(errno);
+	std::fill(expected.end() - 10, expected.end(), 0);
+	expected.resize(expected.size() + 90);
+	expect_file_content(pfp, f, expected);
+
+	/* the layout survives reopening the file */
+	pmemfile_close(pfp, f);
+	f = pmemfile_open(pfp, "/file1", PMEMFILE_O_RDWR);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+	expect_file_content(pfp, f, expected);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_COLLAPSE_RANGE,
+				     0, (pmemfile_off_t)(64 * chunk)),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_INSERT_RANGE,
+				     (pmemfile_off_t)(64 * chunk),
+				     (pmemfile_off_t)chunk),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_fallocate(pfp, f,
+				     PMEMFILE_FALLOC_FL_INSERT_RANGE |
+					     PMEMFILE_FALLOC_FL_KEEP_SIZE,
+				     0, (pmemfile_off_t)chunk),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+}
+
 TEST_F(rw, o_append)
 {
 	/* check that O_APPEND works */
@@ -1524,6 +1835,80 @@ end:
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
 }
 
+TEST_F(rw, fiemap)
+{
+	/* FS_IOC_FIEMAP is not supported by tmpfs */
+	if (is_pmemfile_pop)
+		return;
+
+	const pmemfile_off_t mb = 1024 * 1024;
+	char buf[4096];
+	memset(buf, 0xff, sizeof(buf));
+
+	PMEMfile *f = pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT |
+					    PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, 0, INT64_MAX, nullptr, 0), 0);
+
+	/* no write below is an append, so nothing is overallocated */
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 16 * mb), 0);
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, buf, sizeof(buf), 0),
+		  (pmemfile_ssize_t)sizeof(buf));
+	ASSERT_EQ(pmemfile_fallocate(pfp, f, PMEMFILE_FALLOC_FL_KEEP_SIZE, mb,
+				     64 * 1024),
+		  0);
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, buf, sizeof(buf), 8 * mb),
+		  (pmemfile_ssize_t)sizeof(buf));
+
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, 0, INT64_MAX, nullptr, 0), 3);
+
+	struct pmemfile_extent ext[8];
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, 0, INT64_MAX, ext, 8), 3);
+
+	EXPECT_EQ(ext[0].offset, 0u);
+	EXPECT_GE(ext[0].length, sizeof(buf));
+	EXPECT_LE(ext[0].length, (uint64_t)mb);
+	EXPECT_EQ(ext[0].flags, 0u);
+
+	EXPECT_EQ(ext[1].offset, (uint64_t)mb);
+	EXPECT_GE(ext[1].length, 64u * 1024);
+	EXPECT_EQ(ext[1].flags, (uint32_t)PMEMFILE_FIEMAP_EXTENT_UNWRITTEN);
+
+	EXPECT_EQ(ext[2].offset, (uint64_t)(8 * mb));
+	EXPECT_GE(ext[2].length, sizeof(buf));
+	EXPECT_EQ(ext[2].flags, (uint32_t)PMEMFILE_FIEMAP_EXTENT_LAST);
+
+	/* the array is filled up to its size */
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, 0, INT64_MAX, ext, 1), 1);
+	EXPECT_EQ(ext[0].offset, 0u);
+
+	/* only extents starting in the range are reported */
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, mb, mb, ext, 8), 1);
+	EXPECT_EQ(ext[0].offset, (uint64_t)mb);
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, 9 * mb, mb, ext, 8), 0);
+
+	/* writing to the unwritten extent initializes its first block */
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, buf, sizeof(buf), mb),
+		  (pmemfile_ssize_t)sizeof(buf));
+	ASSERT_GE(pmemfile_fiemap(pfp, f, mb, mb, ext, 8), 1);
+	EXPECT_EQ(ext[0].offset, (uint64_t)mb);
+	EXPECT_EQ(ext[0].flags, 0u);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, -1, mb, ext, 8), -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_fiemap(pfp, f, 0, mb, nullptr, 8), -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+}
+
 TEST_F(rw, failed_write)
 {
 	char buf[256];
@@ -1808,6 +2193,94 @@ TEST_F(rw, preadv)
 	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
 }
 
+static size_t
+compare_borrowed(const pmemfile_iovec_t *vec, int cnt, const char *expected)
+{
+	size_t off = 0;
+
+	for (int i = 0; i < cnt; ++i) {
+		if (memcmp(vec[i].iov_base, expected + off, vec[i].iov_len))
+			return SIZE_MAX;
+		off += vec[i].iov_len;
+	}
+
+	return off;
+}
+
+TEST_F(rw, pread_borrow)
+{
+	PMEMfile *f = pmemfile_open(pfp, "/file1", PMEMFILE_O_CREAT |
+					    PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+				    0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	constexpr size_t hole = 1 << 20;
+	constexpr size_t size = hole + 4096;
+	std::vector<char> expected(size, 0);
+	memset(expected.data(), 'A', 4096);
+	memset(expected.data() + hole, 'B', 4096);
+
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, expected.data(), 4096, 0), 4096);
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, expected.data() + hole, 4096, hole),
+		  4096);
+
+	pmemfile_iovec_t vec[64];
+	PMEMfilelease *lease;
+	int cnt = 64;
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_pread_borrow(NULL, f, size, 0, vec, &cnt, &lease),
+		  -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_pread_borrow(pfp, NULL, size, 0, vec, &cnt, &lease),
+		  -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	errno = 0;
+	ASSERT_EQ(pmemfile_pread_borrow(pfp, f, size, 0, vec, &cnt, NULL), -1);
+	EXPECT_EQ(errno, EFAULT);
+
+	cnt = 0;
+	errno = 0;
+	ASSERT_EQ(pmemfile_pread_borrow(pfp, f, size, 0, vec, &cnt, &lease),
+		  -1);
+	EXPECT_EQ(errno, EINVAL);
+
+	/* whole file, including the hole */
+	cnt = 64;
+	ASSERT_EQ(pmemfile_pread_borrow(pfp, f, 2 * size, 0, vec, &cnt, &lease),
+		  (ssize_t)size);
+	ASSERT_GT(cnt, 0);
+	EXPECT_EQ(compare_borrowed(vec, cnt, expected.data()), size);
+	pmemfile_pread_release(pfp, lease);
+
+	/* only as much as fits in one iovec */
+	cnt = 1;
+	ssize_t ret =
+		pmemfile_pread_borrow(pfp, f, size, 100, vec, &cnt, &lease);
+	ASSERT_GT(ret, 0);
+	ASSERT_LE((size_t)ret, size - 100);
+	ASSERT_EQ(cnt, 1);
+	EXPECT_EQ(compare_borrowed(vec, cnt, expected.data() + 100),
+		  (size_t)ret);
+	pmemfile_pread_release(pfp, lease);
+
+	/* at the end of file */
+	cnt = 64;
+	ASSERT_EQ(pmemfile_pread_borrow(pfp, f, 10, size, vec, &cnt, &lease),
+		  0);
+	EXPECT_EQ(cnt, 0);
+	pmemfile_pread_release(pfp, lease);
+
+	/* released leases don't block truncation */
+	ASSERT_EQ(pmemfile_ftruncate(pfp, f, 0), 0);
+
+	pmemfile_close(pfp, f);
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file1"), 0);
+}
+
 static bool
 test_writev(PMEMfilepool *pfp, const size_t vec_size, const size_t arr_len)
 {
@@ -1986,6 +2459,17 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	e = getenv("PMEMFILE_INLINE_DATA_SIZE");
+
+	if (e == NULL)
+		env_inline_data = true;
+	else if (strcmp(e, "0") == 0)
+		env_inline_data = false;
+	else {
+		fprintf(stderr, "unexpected PMEMFILE_INLINE_DATA_SIZE\n");
+		exit(1);
+	}
+
 	global_path = argv[1];
 
 	::testing::InitGoogleTest(&argc, argv);
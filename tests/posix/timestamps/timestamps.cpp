@@ -754,6 +754,39 @@ TEST_F(timestamps, utimensat)
 	ASSERT_EQ(pmemfile_rmdir(pfp, "/d"), 0);
 }
 
+TEST_F(timestamps, write_after_future_mtime)
+{
+	PMEMfile *f = pmemfile_open(pfp, "/file",
+			PMEMFILE_O_CREAT | PMEMFILE_O_EXCL | PMEMFILE_O_RDWR,
+			0644);
+	ASSERT_NE(f, nullptr) << strerror(errno);
+
+	char buf[4096];
+	memset(buf, 0xaa, sizeof(buf));
+	ASSERT_EQ(pmemfile_write(pfp, f, buf, sizeof(buf)),
+			(pmemfile_ssize_t)sizeof(buf));
+
+	pmemfile_stat_t st;
+	ASSERT_EQ(pmemfile_fstat(pfp, f, &st), 0);
+
+	/* clock stepped back, or mtime was set by hand */
+	pmemfile_timespec_t tm[2] = {st.st_atim, st.st_mtim};
+	tm[1].tv_sec += 24 * 60 * 60;
+	ASSERT_EQ(pmemfile_utimensat(pfp, NULL, "/file", tm, 0), 0);
+
+	/* write which doesn't change the size of the file */
+	ASSERT_EQ(pmemfile_pwrite(pfp, f, buf, 1, 0), 1);
+
+	pmemfile_stat_t st2;
+	ASSERT_EQ(pmemfile_fstat(pfp, f, &st2), 0);
+	EXPECT_LT(st2.st_mtim.tv_sec, tm[1].tv_sec);
+	EXPECT_GE(st2.st_mtim.tv_sec, st.st_mtim.tv_sec);
+
+	pmemfile_close(pfp, f);
+
+	ASSERT_EQ(pmemfile_unlink(pfp, "/file"), 0);
+}
+
 TEST_F(timestamps, futimesat)
 {
 	ASSERT_EQ(pmemfile_mkdir(pfp, "/d", 0755), 0);
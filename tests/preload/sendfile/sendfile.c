@@ -0,0 +1,336 @@
+/*
+ * Copyright 2017, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * sendfile.c - sendfile and splice between pmemfile and kernel files,
+ * compared with read + write loops
+ */
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FILE_SIZE ((size_t)8 << 20)
+#define BUF_SIZE ((size_t)64 << 10)
+#define ROUNDS 8
+
+static char *pattern;
+
+static int
+xopen(const char *path, int flags)
+{
+	int fd = open(path, flags, 0600);
+	if (fd < 0)
+		err(1, "open(\"%s\")", path);
+
+	return fd;
+}
+
+static void
+xclose(int fd)
+{
+	if (close(fd) != 0)
+		err(1, "close");
+}
+
+static void
+xsendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	size_t done = 0;
+
+	while (done < count) {
+		ssize_t r = sendfile(out_fd, in_fd, offset, count - done);
+		if (r <= 0)
+			err(1, "sendfile");
+
+		done += (size_t)r;
+	}
+}
+
+static void
+create_file(const char *path)
+{
+	int fd = xopen(path, O_CREAT | O_TRUNC | O_WRONLY);
+
+	if (write(fd, pattern, FILE_SIZE) != (ssize_t)FILE_SIZE)
+		err(1, "write");
+
+	xclose(fd);
+}
+
+static void
+check_file(const char *path)
+{
+	int fd = xopen(path, O_RDONLY);
+	char *buf = malloc(FILE_SIZE + 1);
+	if (!buf)
+		err(1, "malloc");
+
+	assert(read(fd, buf, FILE_SIZE + 1) == (ssize_t)FILE_SIZE);
+	assert(memcmp(buf, pattern, FILE_SIZE) == 0);
+
+	free(buf);
+	xclose(fd);
+}
+
+static void
+read_write(int out_fd, int in_fd)
+{
+	static char buf[BUF_SIZE];
+	size_t done = 0;
+
+	while (done < FILE_SIZE) {
+		ssize_t r = read(in_fd, buf, sizeof(buf));
+		if (r <= 0)
+			err(1, "read");
+
+		if (write(out_fd, buf, (size_t)r) != r)
+			err(1, "write");
+
+		done += (size_t)r;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+/*
+ * measure -- copies src to dst ROUNDS times with sendfile and with a read +
+ * write loop, prints throughput of both
+ */
+static void
+measure(const char *name, const char *src, const char *dst)
+{
+	double t_sendfile = 0, t_rw = 0;
+
+	for (int i = 0; i < ROUNDS; ++i) {
+		int in = xopen(src, O_RDONLY);
+		int out = xopen(dst, O_CREAT | O_TRUNC | O_WRONLY);
+
+		double start = now();
+		xsendfile(out, in, NULL, FILE_SIZE);
+		t_sendfile += now() - start;
+
+		xclose(out);
+		xclose(in);
+
+		in = xopen(src, O_RDONLY);
+		out = xopen(dst, O_CREAT | O_TRUNC | O_WRONLY);
+
+		start = now();
+		read_write(out, in);
+		t_rw += now() - start;
+
+		xclose(out);
+		xclose(in);
+	}
+
+	double mb = (double)(FILE_SIZE * ROUNDS) / (1 << 20);
+	fprintf(stderr, "%s: sendfile %.1f MB/s, read + write %.1f MB/s\n",
+			name, mb / t_sendfile, mb / t_rw);
+}
+
+static void
+test_sendfile(const char *src, const char *dst)
+{
+	int in = xopen(src, O_RDONLY);
+	int out = xopen(dst, O_CREAT | O_TRUNC | O_WRONLY);
+
+	/* explicit offset doesn't move the file offset */
+	off_t offset = 1;
+	assert(sendfile(out, in, &offset, 2) == 2);
+	assert(offset == 3);
+	assert(lseek(in, 0, SEEK_CUR) == 0);
+	assert(lseek(out, 0, SEEK_CUR) == 2);
+
+	assert(lseek(out, 0, SEEK_SET) == 0);
+	xsendfile(out, in, NULL, FILE_SIZE);
+	assert(lseek(in, 0, SEEK_CUR) == (off_t)FILE_SIZE);
+	assert(lseek(out, 0, SEEK_CUR) == (off_t)FILE_SIZE);
+
+	/* end of file */
+	assert(sendfile(out, in, NULL, 1) == 0);
+
+	xclose(out);
+	xclose(in);
+
+	check_file(dst);
+}
+
+/*
+ * test_sendfile_append -- sendfile to a file opened with O_APPEND
+ */
+static void
+test_sendfile_append(const char *src, const char *dst)
+{
+	int in = xopen(src, O_RDONLY);
+	int out = xopen(dst, O_CREAT | O_TRUNC | O_WRONLY);
+
+	/* data written with sendfile lands at the end of out */
+	assert(write(out, pattern, 1) == 1);
+	xclose(out);
+	out = xopen(dst, O_WRONLY | O_APPEND);
+
+	off_t offset = 1;
+	xsendfile(out, in, &offset, FILE_SIZE - 1);
+	assert(offset == (off_t)FILE_SIZE);
+	assert(lseek(in, 0, SEEK_CUR) == 0);
+
+	xclose(out);
+	xclose(in);
+
+	check_file(dst);
+}
+
+static void
+test_splice(const char *src, const char *dst)
+{
+	int in = xopen(src, O_RDONLY);
+	int out = xopen(dst, O_CREAT | O_TRUNC | O_WRONLY);
+	int p[2];
+
+	if (pipe(p))
+		err(1, "pipe");
+
+	loff_t off_in = 0;
+	size_t done = 0;
+
+	while (done < FILE_SIZE) {
+		ssize_t r = splice(in, &off_in, p[1], NULL, FILE_SIZE - done,
+				0);
+		if (r <= 0)
+			err(1, "splice from file");
+
+		ssize_t left = r;
+		while (left > 0) {
+			ssize_t w = splice(p[0], NULL, out, NULL,
+					(size_t)left, 0);
+			if (w <= 0)
+				err(1, "splice to file");
+
+			left -= w;
+		}
+
+		done += (size_t)r;
+	}
+
+	assert(off_in == (loff_t)FILE_SIZE);
+	assert(lseek(in, 0, SEEK_CUR) == 0);
+
+	/* offset of a pipe */
+	loff_t off = 0;
+	assert(splice(in, NULL, p[1], &off, 1, 0) == -1);
+	assert(errno == ESPIPE);
+
+	/* neither is a pipe */
+	assert(splice(in, NULL, out, NULL, 1, 0) == -1);
+	assert(errno == EINVAL);
+
+	xclose(p[0]);
+	xclose(p[1]);
+	xclose(out);
+	xclose(in);
+
+	check_file(dst);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 3)
+		errx(1, "two path arguments required");
+
+	char kernel_src[PATH_MAX], kernel_dst[PATH_MAX];
+	char pmem_src[PATH_MAX], pmem_dst[PATH_MAX];
+
+	snprintf(kernel_src, sizeof(kernel_src), "%s/src", argv[1]);
+	snprintf(kernel_dst, sizeof(kernel_dst), "%s/dst", argv[1]);
+	snprintf(pmem_src, sizeof(pmem_src), "%s/src", argv[2]);
+	snprintf(pmem_dst, sizeof(pmem_dst), "%s/dst", argv[2]);
+
+	pattern = malloc(FILE_SIZE);
+	if (!pattern)
+		err(1, "malloc");
+
+	for (size_t i = 0; i < FILE_SIZE; ++i)
+		pattern[i] = (char)(i * 7 + i / 4096);
+
+	create_file(kernel_src);
+	create_file(pmem_src);
+
+	fputs("sendfile pmemfile -> kernel\n", stderr);
+	test_sendfile(pmem_src, kernel_dst);
+
+	fputs("sendfile kernel -> pmemfile\n", stderr);
+	test_sendfile(kernel_src, pmem_dst);
+
+	fputs("sendfile pmemfile -> pmemfile\n", stderr);
+	test_sendfile(pmem_src, pmem_dst);
+
+	fputs("sendfile pmemfile -> pmemfile, O_APPEND\n", stderr);
+	test_sendfile_append(pmem_src, pmem_dst);
+
+	fputs("splice pmemfile -> pipe -> kernel\n", stderr);
+	test_splice(pmem_src, kernel_dst);
+
+	fputs("splice kernel -> pipe -> pmemfile\n", stderr);
+	test_splice(kernel_src, pmem_dst);
+
+	measure("pmemfile -> kernel", pmem_src, kernel_dst);
+	measure("kernel -> pmemfile", kernel_src, pmem_dst);
+	measure("pmemfile -> pmemfile", pmem_src, pmem_dst);
+
+	free(pattern);
+
+	return 0;
+}